@@ -53,6 +53,7 @@
 #include "options.h"
 #include "prompter.h"
 #include "stash.h"
+#include "timing.h"
 #include "tokens.h"
 #include "userinfo.h"
 #include "v5.h"
@@ -66,33 +67,44 @@ pam_sm_acct_mgmt(pam_handle_t *pamh, int flags,
 	struct _pam_krb5_options *options;
 	struct _pam_krb5_user_info *userinfo;
 	struct _pam_krb5_stash *stash;
+	struct _pam_krb5_timing timing;
 	int i, retval;
 
 	/* Initialize Kerberos. */
-	if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+	_pam_krb5_timing_init(&timing);
+	_pam_krb5_timing_start(&timing, _pam_krb5_timing_init_ctx);
+	if (_pam_krb5_init_ctx_for_handle(pamh, &ctx, argc, argv) != 0) {
 		warn("error initializing Kerberos");
 		return PAM_SERVICE_ERR;
 	}
+	_pam_krb5_timing_stop(&timing, _pam_krb5_timing_init_ctx);
 
 	/* Get the user's name. */
 	i = pam_get_user(pamh, &user, NULL);
 	if ((i != PAM_SUCCESS) || (user == NULL)) {
 		warn("could not identify user name");
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return i;
 	}
 
 	/* Read our options. */
+	_pam_krb5_timing_start(&timing, _pam_krb5_timing_options_init);
 	options = _pam_krb5_options_init(pamh, argc, argv, ctx,
 					 _pam_krb5_option_role_general);
 	if (options == NULL) {
 		warn("error parsing options (shouldn't happen)");
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
+	_pam_krb5_timing_stop(&timing, _pam_krb5_timing_options_init);
+	options->timings = options->timing ? &timing : NULL;
 
 	/* Get information about the user and the user's principal name. */
-	userinfo = _pam_krb5_user_info_init(ctx, user, options);
+	_pam_krb5_timing_start(options->timings,
+			       _pam_krb5_timing_user_info_init);
+	userinfo = _pam_krb5_user_info_init(pamh, ctx, user, options);
+	_pam_krb5_timing_stop(options->timings,
+			      _pam_krb5_timing_user_info_init);
 	if (userinfo == NULL) {
 		if (options->ignore_unknown_principals == 0) {
 			retval = PAM_IGNORE;
@@ -100,8 +112,10 @@ pam_sm_acct_mgmt(pam_handle_t *pamh, int flags,
 			warn("error getting information about '%s'", user);
 			retval = PAM_USER_UNKNOWN;
 		}
+		_pam_krb5_timing_report(options->timings, "pam_acct_mgmt",
+					user, retval);
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return retval;
 	}
 
@@ -115,16 +129,18 @@ pam_sm_acct_mgmt(pam_handle_t *pamh, int flags,
 		}
 		_pam_krb5_user_info_free(ctx, userinfo);
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_IGNORE;
 	}
 
 	/* Get the stash for this user. */
+	_pam_krb5_timing_start(options->timings, _pam_krb5_timing_stash_get);
 	stash = _pam_krb5_stash_get(pamh, user, userinfo, options);
+	_pam_krb5_timing_stop(options->timings, _pam_krb5_timing_stash_get);
 	if (stash == NULL) {
 		_pam_krb5_user_info_free(ctx, userinfo);
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
@@ -215,8 +231,13 @@ pam_sm_acct_mgmt(pam_handle_t *pamh, int flags,
 	/* If we got this far, check the target user's .k5login file. */
 	if ((retval == PAM_SUCCESS) && options->user_check &&
 	    (options->ignore_k5login == 0)) {
-		if (_pam_krb5_kuserok(ctx, stash, options, userinfo, user,
-				      userinfo->uid, userinfo->gid) != TRUE) {
+		_pam_krb5_timing_start(options->timings,
+				       _pam_krb5_timing_kuserok);
+		i = _pam_krb5_kuserok(ctx, stash, options, userinfo, user,
+				      userinfo->uid, userinfo->gid);
+		_pam_krb5_timing_stop(options->timings,
+				      _pam_krb5_timing_kuserok);
+		if (i != TRUE) {
 			notice("account checks fail for '%s': user disallowed "
 			       "by .k5login file for '%s'",
 			       userinfo->unparsed_name, user);
@@ -240,9 +261,11 @@ pam_sm_acct_mgmt(pam_handle_t *pamh, int flags,
 		debug("pam_acct_mgmt returning %d (%s)", retval,
 		      pam_strerror(pamh, retval));
 	}
+	_pam_krb5_timing_report(options->timings, "pam_acct_mgmt",
+				user, retval);
 	_pam_krb5_options_free(pamh, ctx, options);
 	_pam_krb5_user_info_free(ctx, userinfo);
-	_pam_krb5_free_ctx(ctx);
+	_pam_krb5_free_ctx_for_handle(pamh, ctx);
 
 	return retval;
 }
@@ -61,6 +61,7 @@
 #include "session.h"
 #include "sly.h"
 #include "stash.h"
+#include "timing.h"
 #include "tokens.h"
 #include "userinfo.h"
 #include "v5.h"
@@ -76,20 +77,24 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 	struct _pam_krb5_user_info *userinfo;
 	struct _pam_krb5_stash *stash;
 	krb5_get_init_creds_opt *gic_options;
+	struct _pam_krb5_timing timing;
 	int i, retval, use_third_pass, prompted, prompt_result;
 	char *first_pass, *second_pass;
 
 	/* Initialize Kerberos. */
-	if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+	_pam_krb5_timing_init(&timing);
+	_pam_krb5_timing_start(&timing, _pam_krb5_timing_init_ctx);
+	if (_pam_krb5_init_ctx_for_handle(pamh, &ctx, argc, argv) != 0) {
 		warn("error initializing Kerberos");
 		return PAM_SERVICE_ERR;
 	}
+	_pam_krb5_timing_stop(&timing, _pam_krb5_timing_init_ctx);
 
 	/* Get the user's name. */
 	i = pam_get_user(pamh, &user, NULL);
 	if ((i != PAM_SUCCESS) || (user == NULL)) {
 		warn("could not identify user name");
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return i;
 	}
 
@@ -97,17 +102,20 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 	i = v5_alloc_get_init_creds_opt(ctx, &gic_options);
 	if (i != 0) {
 		warn("error initializing options (shouldn't happen)");
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
+	_pam_krb5_timing_start(&timing, _pam_krb5_timing_options_init);
 	options = _pam_krb5_options_init(pamh, argc, argv, ctx,
 					 _pam_krb5_option_role_general);
 	if (options == NULL) {
 		warn("error parsing options (shouldn't happen)");
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
+	_pam_krb5_timing_stop(&timing, _pam_krb5_timing_options_init);
+	options->timings = options->timing ? &timing : NULL;
 	if (options->debug) {
 		debug("called to authenticate '%s', configured realm '%s'",
 		      user, options->realm);
@@ -131,7 +139,11 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 	}
 
 	/* Get information about the user and the user's principal name. */
-	userinfo = _pam_krb5_user_info_init(ctx, user, options);
+	_pam_krb5_timing_start(options->timings,
+			       _pam_krb5_timing_user_info_init);
+	userinfo = _pam_krb5_user_info_init(pamh, ctx, user, options);
+	_pam_krb5_timing_stop(options->timings,
+			      _pam_krb5_timing_user_info_init);
 	if (userinfo == NULL) {
 		if (options->ignore_unknown_principals) {
 			retval = PAM_IGNORE;
@@ -139,6 +151,8 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 			warn("error getting information about '%s'", user);
 			retval = PAM_USER_UNKNOWN;
 		}
+		_pam_krb5_timing_report(options->timings, "pam_authenticate",
+					user, retval);
 		if (prompted && (prompt_result == 0) && (second_pass != NULL)) {
 			if (options->debug) {
 				debug("saving newly-entered "
@@ -150,7 +164,7 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 		/* Clean up and return. */
 		_pam_krb5_options_free(pamh, ctx, options);
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return retval;
 	}
 	if (options->debug) {
@@ -176,12 +190,14 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 		}
 		_pam_krb5_options_free(pamh, ctx, options);
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_IGNORE;
 	}
 
 	/* Get the stash for this user. */
+	_pam_krb5_timing_start(options->timings, _pam_krb5_timing_stash_get);
 	stash = _pam_krb5_stash_get(pamh, user, userinfo, options);
+	_pam_krb5_timing_stop(options->timings, _pam_krb5_timing_stash_get);
 	if (stash == NULL) {
 		warn("error retrieving stash for '%s' (shouldn't happen)",
 		     user);
@@ -196,7 +212,7 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 		}
 		_pam_krb5_options_free(pamh, ctx, options);
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
@@ -263,7 +279,11 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 		    (options->ignore_afs == 0) &&
 		    (options->tokens == 1) &&
 		    tokens_useful()) {
+			_pam_krb5_timing_start(options->timings,
+					       _pam_krb5_timing_tokens_obtain);
 			tokens_obtain(ctx, stash, options, userinfo, 1);
+			_pam_krb5_timing_stop(options->timings,
+					      _pam_krb5_timing_tokens_obtain);
 		}
 	}
 
@@ -335,7 +355,11 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 		    (options->ignore_afs == 0) &&
 		    (options->tokens == 1) &&
 		    tokens_useful()) {
+			_pam_krb5_timing_start(options->timings,
+					       _pam_krb5_timing_tokens_obtain);
 			tokens_obtain(ctx, stash, options, userinfo, 1);
+			_pam_krb5_timing_stop(options->timings,
+					      _pam_krb5_timing_tokens_obtain);
 		}
 	}
 
@@ -373,15 +397,24 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 		    (options->ignore_afs == 0) &&
 		    (options->tokens == 1) &&
 		    tokens_useful()) {
+			_pam_krb5_timing_start(options->timings,
+					       _pam_krb5_timing_tokens_obtain);
 			tokens_obtain(ctx, stash, options, userinfo, 1);
+			_pam_krb5_timing_stop(options->timings,
+					      _pam_krb5_timing_tokens_obtain);
 		}
 	}
 
 	/* If we got this far, check the target user's .k5login file. */
 	if ((retval == PAM_SUCCESS) && options->user_check &&
 	    (options->ignore_k5login == 0)) {
-		if (_pam_krb5_kuserok(ctx, stash, options, userinfo, user,
-				      userinfo->uid, userinfo->gid) != TRUE) {
+		_pam_krb5_timing_start(options->timings,
+				       _pam_krb5_timing_kuserok);
+		i = _pam_krb5_kuserok(ctx, stash, options, userinfo, user,
+				      userinfo->uid, userinfo->gid);
+		_pam_krb5_timing_stop(options->timings,
+				      _pam_krb5_timing_kuserok);
+		if (i != TRUE) {
 			notice("account checks fail for '%s': user disallowed "
 			       "by .k5login file for '%s'",
 			       userinfo->unparsed_name, user);
@@ -421,10 +454,12 @@ pam_sm_authenticate(pam_handle_t *pamh, int flags,
 		debug("pam_authenticate returning %d (%s)", retval,
 		      pam_strerror(pamh, retval));
 	}
+	_pam_krb5_timing_report(options->timings, "pam_authenticate",
+				user, retval);
 	v5_free_get_init_creds_opt(ctx, gic_options);
 	_pam_krb5_options_free(pamh, ctx, options);
 	_pam_krb5_user_info_free(ctx, userinfo);
-	_pam_krb5_free_ctx(ctx);
+	_pam_krb5_free_ctx_for_handle(pamh, ctx);
 
 	return retval;
 }
@@ -0,0 +1,523 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include KRB5_H
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#ifdef HAVE_SECURITY_PAM_MODULES_H
+#include <security/pam_modules.h>
+#endif
+
+#include "ccfile.h"
+#include "options.h"
+#include "stash.h"
+#include "userinfo.h"
+#include "v5.h"
+
+/* Produce the contents of a version 4 FILE: ccache, which is what the helper
+ * expects to read, directly from another ccache, without writing one out to
+ * disk and reading it back.  We only know how to do this with MIT-style
+ * structures, since Heimdal stores its ticket flags differently. */
+#if defined(HAVE_KRB5_CREDS_KEYBLOCK) && defined(HAVE_KRB5_CREDS_TICKET_FLAGS) && defined(HAVE_KRB5_PRINCIPAL_DATA_LENGTH)
+#define CCFILE_SERIALIZE 1
+#endif
+
+#define CCFILE_VERSION 0x0504
+#define CCFILE_TAG_KDC_OFFSET 1
+
+/* The most components, addresses, or authdata items which we'll decode in
+ * place for a single credential. */
+#define CCFILE_VIEW_MAX 16
+
+struct ccfile_buffer {
+	unsigned char *data;
+	size_t length, allocated;
+	int error;
+};
+
+static void
+ccfile_append(struct ccfile_buffer *buffer, const void *data, size_t length)
+{
+	unsigned char *tmp;
+	size_t size;
+
+	if (buffer->error) {
+		return;
+	}
+	if (buffer->length + length > buffer->allocated) {
+		size = buffer->allocated ? buffer->allocated * 2 : 4096;
+		while (size < buffer->length + length) {
+			size *= 2;
+		}
+		tmp = malloc(size);
+		if (tmp == NULL) {
+			buffer->error = ENOMEM;
+			return;
+		}
+		/* Don't leave copies of keys lying around. */
+		if (buffer->data != NULL) {
+			memcpy(tmp, buffer->data, buffer->length);
+			memset(buffer->data, '\0', buffer->allocated);
+			free(buffer->data);
+		}
+		buffer->data = tmp;
+		buffer->allocated = size;
+	}
+	memcpy(buffer->data + buffer->length, data, length);
+	buffer->length += length;
+}
+
+static void
+ccfile_append_16(struct ccfile_buffer *buffer, unsigned int value)
+{
+	unsigned char bytes[2];
+
+	bytes[0] = (value >> 8) & 0xff;
+	bytes[1] = value & 0xff;
+	ccfile_append(buffer, bytes, sizeof(bytes));
+}
+
+static void
+ccfile_append_32(struct ccfile_buffer *buffer, unsigned long value)
+{
+	unsigned char bytes[4];
+
+	bytes[0] = (value >> 24) & 0xff;
+	bytes[1] = (value >> 16) & 0xff;
+	bytes[2] = (value >> 8) & 0xff;
+	bytes[3] = value & 0xff;
+	ccfile_append(buffer, bytes, sizeof(bytes));
+}
+
+static void
+ccfile_append_data(struct ccfile_buffer *buffer, const void *data,
+		   size_t length)
+{
+	ccfile_append_32(buffer, length);
+	if (length > 0) {
+		ccfile_append(buffer, data, length);
+	}
+}
+
+#ifdef CCFILE_SERIALIZE
+static void
+ccfile_append_principal(struct ccfile_buffer *buffer, krb5_principal princ)
+{
+	int i;
+
+	ccfile_append_32(buffer, princ->type);
+	ccfile_append_32(buffer, v5_princ_component_count(princ));
+	ccfile_append_data(buffer, v5_princ_realm_contents(princ),
+			   v5_princ_realm_length(princ));
+	for (i = 0; i < v5_princ_component_count(princ); i++) {
+		ccfile_append_data(buffer,
+				   v5_princ_component_contents(princ, i),
+				   v5_princ_component_length(princ, i));
+	}
+}
+
+static void
+ccfile_append_creds(struct ccfile_buffer *buffer, krb5_creds *creds)
+{
+	int i;
+
+	ccfile_append_principal(buffer, creds->client);
+	ccfile_append_principal(buffer, creds->server);
+	ccfile_append_16(buffer, v5_creds_key_type(creds));
+	ccfile_append_data(buffer, v5_creds_key_contents(creds),
+			   v5_creds_key_length(creds));
+	ccfile_append_32(buffer, creds->times.authtime);
+	ccfile_append_32(buffer, creds->times.starttime);
+	ccfile_append_32(buffer, creds->times.endtime);
+	ccfile_append_32(buffer, creds->times.renew_till);
+	ccfile_append(buffer, v5_creds_get_is_skey(creds) ? "\001" : "\000", 1);
+	ccfile_append_32(buffer, v5_creds_get_flags(creds));
+	ccfile_append_32(buffer, v5_creds_address_count(creds));
+	for (i = 0; i < v5_creds_address_count(creds); i++) {
+		ccfile_append_16(buffer, v5_creds_address_type(creds, i));
+		ccfile_append_data(buffer, v5_creds_address_contents(creds, i),
+				   v5_creds_address_length(creds, i));
+	}
+	ccfile_append_32(buffer, v5_creds_authdata_count(creds));
+	for (i = 0; i < v5_creds_authdata_count(creds); i++) {
+		ccfile_append_16(buffer, v5_creds_authdata_type(creds, i));
+		ccfile_append_data(buffer, v5_creds_authdata_contents(creds, i),
+				   v5_creds_authdata_length(creds, i));
+	}
+	ccfile_append_data(buffer, creds->ticket.data, creds->ticket.length);
+	ccfile_append_data(buffer, creds->second_ticket.data,
+			   creds->second_ticket.length);
+}
+#endif
+
+struct ccfile_reader {
+	const unsigned char *data;
+	size_t length, offset;
+	int error;
+};
+
+static const unsigned char *
+ccfile_take(struct ccfile_reader *reader, size_t length)
+{
+	const unsigned char *p;
+
+	if (reader->error || (length > reader->length - reader->offset)) {
+		reader->error = KRB5_CC_FORMAT;
+		return NULL;
+	}
+	p = reader->data + reader->offset;
+	reader->offset += length;
+	return p;
+}
+
+static unsigned int
+ccfile_take_16(struct ccfile_reader *reader)
+{
+	const unsigned char *p;
+
+	p = ccfile_take(reader, 2);
+	return p ? ((p[0] << 8) | p[1]) : 0;
+}
+
+static unsigned long
+ccfile_take_32(struct ccfile_reader *reader)
+{
+	const unsigned char *p;
+
+	p = ccfile_take(reader, 4);
+	return p ? (((unsigned long) p[0] << 24) | (p[1] << 16) |
+		    (p[2] << 8) | p[3]) : 0;
+}
+
+#ifdef CCFILE_SERIALIZE
+/* A credential whose contents point in to the buffer it was read from. */
+struct ccfile_view {
+	krb5_creds creds;
+	krb5_principal_data client, server;
+	krb5_data components[2][CCFILE_VIEW_MAX];
+	krb5_address addresses[CCFILE_VIEW_MAX];
+	krb5_address *address_list[CCFILE_VIEW_MAX + 1];
+	krb5_authdata authdata[CCFILE_VIEW_MAX];
+	krb5_authdata *authdata_list[CCFILE_VIEW_MAX + 1];
+};
+
+static void
+ccfile_view_data(struct ccfile_reader *reader, krb5_data *data)
+{
+	unsigned long n;
+
+	n = ccfile_take_32(reader);
+	data->magic = KV5M_DATA;
+	data->data = (char *) ccfile_take(reader, n);
+	data->length = data->data ? n : 0;
+}
+
+static void
+ccfile_view_principal(struct ccfile_reader *reader,
+		      krb5_principal_data *princ, krb5_data *components)
+{
+	unsigned long i, n;
+
+	princ->magic = KV5M_PRINCIPAL;
+	princ->type = ccfile_take_32(reader);
+	n = ccfile_take_32(reader);
+	if (n > CCFILE_VIEW_MAX) {
+		reader->error = KRB5_CC_FORMAT;
+		return;
+	}
+	ccfile_view_data(reader, &princ->realm);
+	for (i = 0; i < n; i++) {
+		ccfile_view_data(reader, &components[i]);
+	}
+	princ->data = components;
+	princ->length = n;
+}
+
+static void
+ccfile_view_creds(struct ccfile_reader *reader, struct ccfile_view *view)
+{
+	krb5_creds *creds;
+	krb5_data data;
+	const unsigned char *p;
+	unsigned long i, n;
+
+	creds = &view->creds;
+	creds->magic = KV5M_CREDS;
+	ccfile_view_principal(reader, &view->client, view->components[0]);
+	creds->client = &view->client;
+	ccfile_view_principal(reader, &view->server, view->components[1]);
+	creds->server = &view->server;
+	creds->keyblock.magic = KV5M_KEYBLOCK;
+	creds->keyblock.enctype = ccfile_take_16(reader);
+	ccfile_view_data(reader, &data);
+	creds->keyblock.contents = (krb5_octet *) data.data;
+	creds->keyblock.length = data.length;
+	creds->times.authtime = ccfile_take_32(reader);
+	creds->times.starttime = ccfile_take_32(reader);
+	creds->times.endtime = ccfile_take_32(reader);
+	creds->times.renew_till = ccfile_take_32(reader);
+	p = ccfile_take(reader, 1);
+	creds->is_skey = p ? (*p != 0) : 0;
+	creds->ticket_flags = ccfile_take_32(reader);
+	n = ccfile_take_32(reader);
+	if (n > CCFILE_VIEW_MAX) {
+		reader->error = KRB5_CC_FORMAT;
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		view->addresses[i].magic = KV5M_ADDRESS;
+		view->addresses[i].addrtype = ccfile_take_16(reader);
+		ccfile_view_data(reader, &data);
+		view->addresses[i].contents = (krb5_octet *) data.data;
+		view->addresses[i].length = data.length;
+		view->address_list[i] = &view->addresses[i];
+	}
+	view->address_list[n] = NULL;
+	creds->addresses = n ? view->address_list : NULL;
+	n = ccfile_take_32(reader);
+	if (n > CCFILE_VIEW_MAX) {
+		reader->error = KRB5_CC_FORMAT;
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		view->authdata[i].magic = KV5M_AUTHDATA;
+		view->authdata[i].ad_type = ccfile_take_16(reader);
+		ccfile_view_data(reader, &data);
+		view->authdata[i].contents = (krb5_octet *) data.data;
+		view->authdata[i].length = data.length;
+		view->authdata_list[i] = &view->authdata[i];
+	}
+	view->authdata_list[n] = NULL;
+	creds->authdata = n ? view->authdata_list : NULL;
+	ccfile_view_data(reader, &creds->ticket);
+	ccfile_view_data(reader, &creds->second_ticket);
+}
+#endif
+
+/* Whether or not _pam_krb5_ccfile_serialize() can do anything for us. */
+int
+_pam_krb5_ccfile_available(void)
+{
+#ifdef CCFILE_SERIALIZE
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Serialize the contents of "ccache", as a ccache for "client", in to a newly
+ * allocated buffer, which the caller should clear and free. */
+krb5_error_code
+_pam_krb5_ccfile_serialize(krb5_context ctx, krb5_ccache ccache,
+			   krb5_principal client,
+			   unsigned char **blob, size_t *blob_size)
+{
+#ifdef CCFILE_SERIALIZE
+	struct ccfile_buffer buffer;
+	krb5_cc_cursor cursor;
+	krb5_creds creds;
+	krb5_error_code err;
+
+	*blob = NULL;
+	*blob_size = 0;
+	memset(&buffer, 0, sizeof(buffer));
+	ccfile_append_16(&buffer, CCFILE_VERSION);
+	/* A header holding a zero KDC time offset, as libkrb5 writes. */
+	ccfile_append_16(&buffer, 12);
+	ccfile_append_16(&buffer, CCFILE_TAG_KDC_OFFSET);
+	ccfile_append_16(&buffer, 8);
+	ccfile_append_32(&buffer, 0);
+	ccfile_append_32(&buffer, 0);
+	ccfile_append_principal(&buffer, client);
+
+	err = krb5_cc_start_seq_get(ctx, ccache, &cursor);
+	if (err != 0) {
+		free(buffer.data);
+		return err;
+	}
+	memset(&creds, 0, sizeof(creds));
+	while ((err = krb5_cc_next_cred(ctx, ccache, &cursor, &creds)) == 0) {
+		ccfile_append_creds(&buffer, &creds);
+		krb5_free_cred_contents(ctx, &creds);
+		memset(&creds, 0, sizeof(creds));
+	}
+	krb5_cc_end_seq_get(ctx, ccache, &cursor);
+
+	/* Anything other than reaching the end would leave us with a copy
+	 * which is missing some of the creds. */
+	if ((err != KRB5_CC_END) && (buffer.error == 0)) {
+		buffer.error = err;
+	}
+	if (buffer.error != 0) {
+		if (buffer.data != NULL) {
+			memset(buffer.data, '\0', buffer.allocated);
+			free(buffer.data);
+		}
+		return buffer.error;
+	}
+	*blob = buffer.data;
+	*blob_size = buffer.length;
+	return 0;
+#else
+	*blob = NULL;
+	*blob_size = 0;
+	return KRB5_CC_NOSUPP;
+#endif
+}
+
+/* Load the contents of a FILE: ccache, as produced by
+ * _pam_krb5_ccfile_serialize(), in to "ccache", which is (re)initialized.
+ * Like _pam_krb5_ccfile_store_cred(), this decodes the credentials in place. */
+krb5_error_code
+_pam_krb5_ccfile_deserialize(krb5_context ctx,
+			     const unsigned char *blob, size_t blob_size,
+			     krb5_ccache ccache)
+{
+#ifdef CCFILE_SERIALIZE
+	struct ccfile_reader reader;
+	struct ccfile_view view;
+	krb5_principal_data client;
+	krb5_data components[CCFILE_VIEW_MAX];
+	krb5_error_code err;
+
+	memset(&reader, 0, sizeof(reader));
+	reader.data = blob;
+	reader.length = blob_size;
+	if (ccfile_take_16(&reader) != CCFILE_VERSION) {
+		return KRB5_CCACHE_BADVNO;
+	}
+	/* Skip over the header. */
+	ccfile_take(&reader, ccfile_take_16(&reader));
+	memset(&client, 0, sizeof(client));
+	ccfile_view_principal(&reader, &client, components);
+	if (reader.error) {
+		return reader.error;
+	}
+	err = krb5_cc_initialize(ctx, ccache, &client);
+	while ((err == 0) && (reader.offset < reader.length)) {
+		memset(&view, 0, sizeof(view));
+		ccfile_view_creds(&reader, &view);
+		if (reader.error) {
+			err = reader.error;
+		} else {
+			err = krb5_cc_store_cred(ctx, ccache, &view.creds);
+		}
+	}
+	return err;
+#else
+	return KRB5_CC_NOSUPP;
+#endif
+}
+
+/* Serialize a single credential, as it would appear in a FILE: ccache, in to
+ * a newly allocated buffer, which the caller should clear and free.  Fails if
+ * _pam_krb5_ccfile_store_cred() wouldn't be able to read it back. */
+krb5_error_code
+_pam_krb5_ccfile_serialize_cred(krb5_context ctx, krb5_creds *creds,
+				unsigned char **blob, size_t *blob_size)
+{
+#ifdef CCFILE_SERIALIZE
+	struct ccfile_buffer buffer;
+
+	*blob = NULL;
+	*blob_size = 0;
+	if ((v5_princ_component_count(creds->client) > CCFILE_VIEW_MAX) ||
+	    (v5_princ_component_count(creds->server) > CCFILE_VIEW_MAX) ||
+	    (v5_creds_address_count(creds) > CCFILE_VIEW_MAX) ||
+	    (v5_creds_authdata_count(creds) > CCFILE_VIEW_MAX)) {
+		return KRB5_CC_FORMAT;
+	}
+	memset(&buffer, 0, sizeof(buffer));
+	ccfile_append_creds(&buffer, creds);
+	if (buffer.error != 0) {
+		if (buffer.data != NULL) {
+			memset(buffer.data, '\0', buffer.allocated);
+			free(buffer.data);
+		}
+		return buffer.error;
+	}
+	*blob = buffer.data;
+	*blob_size = buffer.length;
+	return 0;
+#else
+	*blob = NULL;
+	*blob_size = 0;
+	return KRB5_CC_NOSUPP;
+#endif
+}
+
+/* Store a single credential, as produced by _pam_krb5_ccfile_serialize_cred(),
+ * in "ccache", first (re)initializing it for the credential's client if
+ * "initialize" is set.  The credential we hand to libkrb5 points in to
+ * "record", so nothing is allocated or copied until the ccache copies it. */
+krb5_error_code
+_pam_krb5_ccfile_store_cred(krb5_context ctx,
+			    const unsigned char *record, size_t record_size,
+			    krb5_ccache ccache, int initialize)
+{
+#ifdef CCFILE_SERIALIZE
+	struct ccfile_reader reader;
+	struct ccfile_view view;
+	krb5_error_code err;
+
+	memset(&reader, 0, sizeof(reader));
+	reader.data = record;
+	reader.length = record_size;
+	memset(&view, 0, sizeof(view));
+	ccfile_view_creds(&reader, &view);
+	if (!reader.error && (reader.offset != reader.length)) {
+		reader.error = KRB5_CC_FORMAT;
+	}
+	if (reader.error) {
+		return reader.error;
+	}
+	if (initialize) {
+		err = krb5_cc_initialize(ctx, ccache, view.creds.client);
+		if (err != 0) {
+			return err;
+		}
+	}
+	return krb5_cc_store_cred(ctx, ccache, &view.creds);
+#else
+	return KRB5_CC_NOSUPP;
+#endif
+}
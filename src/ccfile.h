@@ -0,0 +1,56 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef pam_krb5_ccfile_h
+#define pam_krb5_ccfile_h
+
+int _pam_krb5_ccfile_available(void);
+krb5_error_code _pam_krb5_ccfile_serialize(krb5_context ctx,
+					   krb5_ccache ccache,
+					   krb5_principal client,
+					   unsigned char **blob,
+					   size_t *blob_size);
+krb5_error_code _pam_krb5_ccfile_deserialize(krb5_context ctx,
+					     const unsigned char *blob,
+					     size_t blob_size,
+					     krb5_ccache ccache);
+krb5_error_code _pam_krb5_ccfile_serialize_cred(krb5_context ctx,
+						krb5_creds *creds,
+						unsigned char **blob,
+						size_t *blob_size);
+krb5_error_code _pam_krb5_ccfile_store_cred(krb5_context ctx,
+					    const unsigned char *record,
+					    size_t record_size,
+					    krb5_ccache ccache,
+					    int initialize);
+
+#endif
@@ -34,8 +34,12 @@
 
 #include <sys/types.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
@@ -55,11 +59,20 @@
 #include <security/pam_modules.h>
 #endif
 
+#ifdef USE_SELINUX
+#include <selinux/selinux.h>
+#endif
+
+#include "ccfile.h"
 #include "cchelper.h"
+#include "ccinit.h"
+#include "child.h"
 #include "log.h"
 #include "mkdir.h"
 #include "options.h"
+#include "perms.h"
 #include "stash.h"
+#include "timing.h"
 #include "userinfo.h"
 #include "v5.h"
 #include "xstr.h"
@@ -132,21 +145,222 @@ _pam_krb5_read_with_retry(int fd, unsigned char *buffer, ssize_t len)
 	return length;
 }
 
+#ifdef SO_PEERCRED
+/* Whether or not a running helper can handle a request for this ccache
+ * exactly as a helper which we ran would have.  It can't for KEYRING caches,
+ * which would end up in its keyring instead of ours, or if SELinux would have
+ * labeled files differently on its way in to a helper that we ran. */
+static int
+_pam_krb5_cchelper_socket_ok(const char *ccname)
+{
+#ifdef USE_SELINUX
+	if (is_selinux_enabled()) {
+		return 0;
+	}
+#endif
+	if (strncmp(ccname, "FILE:", 5) == 0) {
+		return 1;
+	}
+	if ((strncmp(ccname, "DIR:", 4) == 0) && (ccname[4] != ':')) {
+		return 1;
+	}
+	if ((strchr(ccname, ':') == NULL) && (ccname[0] == '/')) {
+		return 1;
+	}
+	return 0;
+}
+
+/* Like _pam_krb5_write_with_retry() and _pam_krb5_read_with_retry(), but give
+ * up when the socket's timeout expires instead of waiting for it to become
+ * ready again.  A helper which hangs up on us mustn't raise SIGPIPE in the
+ * calling application, and changing its handler would affect every thread. */
+static ssize_t
+_pam_krb5_cchelper_send(int s, const unsigned char *buffer, ssize_t len)
+{
+	ssize_t length, ret;
+
+	length = 0;
+	while (len > length) {
+		ret = send(s, buffer + length, len - length, MSG_NOSIGNAL);
+		if ((ret == -1) && (errno == EINTR)) {
+			continue;
+		}
+		if (ret <= 0) {
+			break;
+		}
+		length += ret;
+	}
+	return length;
+}
+
+static ssize_t
+_pam_krb5_cchelper_recv(int s, unsigned char *buffer, ssize_t len)
+{
+	ssize_t length, ret;
+
+	length = 0;
+	while (len > length) {
+		ret = read(s, buffer + length, len - length);
+		if ((ret == -1) && (errno == EINTR)) {
+			continue;
+		}
+		if (ret <= 0) {
+			break;
+		}
+		length += ret;
+	}
+	return length;
+}
+#endif
+
+/* Send the request to a helper which is already running in "--serve" mode,
+ * if we can find one, and read back its result and output.  Returns -2 if
+ * there's no running helper, if it never saw the request, or if it can't
+ * handle this kind of ccache, so that the caller can run the helper itself. */
+static int
+_pam_krb5_cchelper_call(const char *socket_path, const char *flag,
+			const char *ccname, uid_t uid, gid_t gid,
+			const unsigned char *stdin_data, ssize_t stdin_data_len,
+			unsigned char *stdout_data, size_t stdout_data_max_len,
+			ssize_t *stdout_data_len)
+{
+#ifdef SO_PEERCRED
+	struct _pam_krb5_cchelper_request request;
+	struct _pam_krb5_cchelper_reply reply;
+	struct sockaddr_un address;
+	struct ucred peer;
+	struct timeval timeout;
+	socklen_t len;
+	int s, ret;
+
+	if ((socket_path == NULL) || (strlen(socket_path) == 0) ||
+	    !_pam_krb5_cchelper_socket_ok(ccname)) {
+		return -2;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		return -2;
+	}
+	strcpy(address.sun_path, socket_path);
+	s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s == -1) {
+		return -2;
+	}
+	fcntl(s, F_SETFD, FD_CLOEXEC);
+	/* Don't wait forever for a helper which has stopped answering. */
+	memset(&timeout, 0, sizeof(timeout));
+	timeout.tv_sec = PAM_KRB5_CCHELPER_TIMEOUT;
+	if ((setsockopt(s, SOL_SOCKET, SO_RCVTIMEO,
+			&timeout, sizeof(timeout)) != 0) ||
+	    (setsockopt(s, SOL_SOCKET, SO_SNDTIMEO,
+			&timeout, sizeof(timeout)) != 0)) {
+		close(s);
+		return -2;
+	}
+	if (connect(s, (struct sockaddr *) &address, sizeof(address)) != 0) {
+		close(s);
+		return -2;
+	}
+	/* Don't hand credentials to anyone other than root. */
+	len = sizeof(peer);
+	if ((getsockopt(s, SOL_SOCKET, SO_PEERCRED, &peer, &len) != 0) ||
+	    (peer.uid != 0)) {
+		close(s);
+		return -2;
+	}
+
+	memset(&request, 0, sizeof(request));
+	request.magic = PAM_KRB5_CCHELPER_MAGIC;
+	request.flag = flag[1];
+	request.uid = uid;
+	request.gid = gid;
+	request.ccname_len = strlen(ccname);
+	request.data_len = stdin_data_len;
+	if ((_pam_krb5_cchelper_send(s, (const unsigned char *) &request,
+				     sizeof(request)) != sizeof(request)) ||
+	    (_pam_krb5_cchelper_send(s, (const unsigned char *) ccname,
+				     request.ccname_len) !=
+	     request.ccname_len) ||
+	    (_pam_krb5_cchelper_send(s, stdin_data, stdin_data_len) !=
+	     stdin_data_len)) {
+		/* The helper won't act on an incomplete request. */
+		close(s);
+		return -2;
+	}
+
+	if (stdout_data != NULL) {
+		memset(stdout_data, '\0', stdout_data_max_len);
+		*stdout_data_len = 0;
+	}
+	ret = -1;
+	if ((_pam_krb5_cchelper_recv(s, (unsigned char *) &reply,
+				     sizeof(reply)) == sizeof(reply)) &&
+	    (reply.magic == PAM_KRB5_CCHELPER_MAGIC)) {
+		ret = reply.status;
+		if ((stdout_data != NULL) && (reply.output_len > 0)) {
+			if ((reply.output_len > stdout_data_max_len) ||
+			    (_pam_krb5_cchelper_recv(s, stdout_data,
+						     reply.output_len) !=
+			     reply.output_len)) {
+				memset(stdout_data, '\0', stdout_data_max_len);
+				ret = -1;
+			} else {
+				*stdout_data_len = reply.output_len;
+			}
+		}
+	}
+	close(s);
+	return ret;
+#else
+	return -2;
+#endif
+}
+
 /* Pipe the specified data in to the specified helper and capture its exit
- * status and output. */
+ * status and output.  If a copy of the helper is already listening on
+ * "socket_path", just send the request there. */
 static int
-_pam_krb5_cchelper_run(const char *helper, const char *flag, const char *ccname,
+_pam_krb5_cchelper_run(const char *helper, const char *socket_path,
+		       const char *flag, const char *ccname,
 		       uid_t uid, gid_t gid,
 		       const unsigned char *stdin_data, ssize_t stdin_data_len,
 		       unsigned char *stdout_data, size_t stdout_data_max_len,
 		       ssize_t *stdout_data_len)
 {
 	int i;
-	int inpipe[2], outpipe[2], dummy[3], status;
+	int inpipe[2], outpipe[2], dummy[3];
 	char uidstr[100], gidstr[100];
-	pid_t child;
-	struct sigaction saved_sigchld_handler, saved_sigpipe_handler;
-	struct sigaction ignore_handler, default_handler;
+	char *argv[6];
+	struct _pam_krb5_child child;
+
+	i = _pam_krb5_cchelper_call(socket_path, flag, ccname, uid, gid,
+				    stdin_data, stdin_data_len,
+				    stdout_data, stdout_data_max_len,
+				    stdout_data_len);
+	if (i != -2) {
+		return i;
+	}
+
+#ifdef HAVE_LONG_LONG
+	snprintf(uidstr, sizeof(uidstr), "%llu", (unsigned long long) uid);
+	snprintf(gidstr, sizeof(gidstr), "%llu", (unsigned long long) gid);
+#else
+	snprintf(uidstr, sizeof(uidstr), "%lu", (unsigned long) uid);
+	snprintf(gidstr, sizeof(gidstr), "%lu", (unsigned long) gid);
+#endif
+	if ((strlen(uidstr) > sizeof(uidstr) - 2) ||
+	    (strlen(gidstr) > sizeof(gidstr) - 2)) {
+		return -1;
+	}
+	argv[0] = (char *) helper;
+	argv[1] = (char *) flag;
+	argv[2] = (char *) ccname;
+	argv[3] = uidstr;
+	argv[4] = gidstr;
+	argv[5] = NULL;
+
+	/* Make sure that the pipes don't end up as descriptors 0 through 2. */
 	for (i = 0; i < 3; i++) {
 		dummy[i] = open("/dev/null", O_RDONLY);
 	}
@@ -164,136 +378,327 @@ _pam_krb5_cchelper_run(const char *helper, const char *flag, const char *ccname,
 		close(inpipe[1]);
 		return -1;
 	}
-	/* Set signal handlers here.  We used to do it later, but that turns
-	 * out to be a race if the child decides to exit immediately. */
-	memset(&default_handler, 0, sizeof(default_handler));
-	default_handler.sa_handler = SIG_DFL;
-	if (sigaction(SIGCHLD, &default_handler, &saved_sigchld_handler) != 0) {
-		close(inpipe[0]);
-		close(inpipe[1]);
-		close(outpipe[0]);
-		close(outpipe[1]);
-		return -1;
+	/* The helper switches to the given user and group itself, unless
+	 * we're set-user-ID, in which case the child does that first. */
+	if (_pam_krb5_child_exec(&child, helper, argv, uid, gid,
+				 inpipe[0], outpipe[1]) == -1) {
+		warn("error running helper \"%s\": %s", helper,
+		     strerror(errno));
 	}
-	memset(&ignore_handler, 0, sizeof(ignore_handler));
-	ignore_handler.sa_handler = SIG_IGN;
-	if (sigaction(SIGPIPE, &ignore_handler, &saved_sigpipe_handler) != 0) {
-		sigaction(SIGCHLD, &saved_sigchld_handler, NULL);
-		close(inpipe[0]);
+	for (i = 0; i < 3; i++) {
+		close(dummy[i]);
+	}
+	close(inpipe[0]);
+	close(outpipe[1]);
+	if (child.pid == -1) {
 		close(inpipe[1]);
 		close(outpipe[0]);
-		close(outpipe[1]);
 		return -1;
 	}
-	switch (child = fork()) {
-	case -1:
-		sigaction(SIGCHLD, &saved_sigchld_handler, NULL);
-		sigaction(SIGPIPE, &saved_sigpipe_handler, NULL);
-		for (i = 0; i < 3; i++) {
-			close(dummy[i]);
-		}
-		close(inpipe[0]);
+	if (_pam_krb5_write_with_retry(inpipe[1],
+				       stdin_data,
+				       stdin_data_len) == stdin_data_len) {
 		close(inpipe[1]);
-		close(outpipe[0]);
-		close(outpipe[1]);
-		return -1;
-		break;
-	case 0:
-		/* We're the child. */
+		if (stdout_data != NULL) {
+			memset(stdout_data, '\0', stdout_data_max_len);
+			i = _pam_krb5_read_with_retry(outpipe[0],
+						      stdout_data,
+						      stdout_data_max_len);
+			*stdout_data_len = i;
+		}
+	} else {
 		close(inpipe[1]);
-		close(outpipe[0]);
-		for (i = 0; i < sysconf(_SC_OPEN_MAX); i++) {
-			if ((i != inpipe[0]) && (i != outpipe[1]) &&
-			    (i != STDERR_FILENO)) {
-				close(i);
-			}
+		if (stdout_data != NULL) {
+			memset(stdout_data, '\0', stdout_data_max_len);
+			*stdout_data_len = 0;
 		}
-		dup2(outpipe[1], STDOUT_FILENO);
-		dup2(inpipe[0], STDIN_FILENO);
-#ifdef HAVE_LONG_LONG
-		snprintf(uidstr, sizeof(uidstr), "%llu",
-			 (unsigned long long) uid);
-		snprintf(gidstr, sizeof(gidstr), "%llu",
-			 (unsigned long long) gid);
-#else
-		snprintf(uidstr, sizeof(uidstr), "%lu", (unsigned long) uid);
-		snprintf(gidstr, sizeof(gidstr), "%lu", (unsigned long) gid);
+	}
+	i = _pam_krb5_child_wait(&child);
+	close(outpipe[0]);
+	return i;
+}
+
+#ifdef PAM_KRB5_FS_PERMS
+#define CCHELPER_IN_PROCESS 1
 #endif
-		if ((strlen(uidstr) > sizeof(uidstr) - 2) ||
-		    (strlen(gidstr) > sizeof(gidstr) - 2)) {
-			_exit(-1);
-		}
-		if (uid == 0) {
-			setgroups(0, NULL);
-		}
-		/* Now, attempt to assume the desired uid/gid pair.  Note that
-		 * if we're not root, this is allowed to fail. */
-		if ((gid != getgid()) || (gid != getegid())) {
-			i = setregid(gid, gid);
+
+/* Which kind of ccache we can write without the helper, if any. */
+enum _pam_krb5_cchelper_in_process_type {
+	_pam_krb5_cchelper_in_process_none,
+	_pam_krb5_cchelper_in_process_file,
+	_pam_krb5_cchelper_in_process_dir,
+};
+
+static enum _pam_krb5_cchelper_in_process_type
+_pam_krb5_cchelper_in_process_type(struct _pam_krb5_options *options,
+				   const char *ccname)
+{
+	if (!options->cchelper_in_process) {
+		return _pam_krb5_cchelper_in_process_none;
+	}
+#ifdef CCHELPER_IN_PROCESS
+#ifdef USE_SELINUX
+	/* The helper exists so that files get the right labels. */
+	if (is_selinux_enabled()) {
+		if (options->debug) {
+			debug("SELinux is enabled, using helper");
 		}
-		if ((uid != getuid()) || (uid != geteuid())) {
-			i = setreuid(uid, uid);
+		return _pam_krb5_cchelper_in_process_none;
+	}
+#endif
+	if (strncmp(ccname, "FILE:", 5) == 0) {
+		return _pam_krb5_cchelper_in_process_file;
+	}
+	if ((strncmp(ccname, "DIR:", 4) == 0) && (ccname[4] != ':')) {
+		return _pam_krb5_cchelper_in_process_dir;
+	}
+	if ((strchr(ccname, ':') == NULL) && (ccname[0] == '/')) {
+		return _pam_krb5_cchelper_in_process_file;
+	}
+#endif
+	return _pam_krb5_cchelper_in_process_none;
+}
+
+#ifdef CCHELPER_IN_PROCESS
+/* Write a FILE: ccache's contents as the user, performing the same checks
+ * on an existing file that the helper does. */
+static int
+_pam_krb5_cchelper_write_file(const char *flag, const char *ccname,
+			      uid_t uid, gid_t gid,
+			      const unsigned char *data, ssize_t data_len,
+			      char **created)
+{
+	struct _pam_krb5_fs_perms saved;
+	struct stat st, st2;
+	char *name, *path;
+	int fd, i;
+
+	if (strchr(ccname, ':') == NULL) {
+		name = malloc(strlen(ccname) + 6);
+		if (name != NULL) {
+			sprintf(name, "FILE:%s", ccname);
 		}
-		execl(helper, helper, flag, ccname, uidstr, gidstr, NULL);
-		warn("error running helper \"%s\": %s", helper,
-		     strerror(errno));
-		_exit(-1);
-		break;
-	default:
-		/* parent */
-		for (i = 0; i < 3; i++) {
-			close(dummy[i]);
+	} else {
+		name = xstrdup(ccname);
+	}
+	if (name == NULL) {
+		return 4;
+	}
+	path = name + 5;
+	if (_pam_krb5_switch_fs_perms(uid, gid, &saved) != 0) {
+		_pam_krb5_restore_fs_perms(&saved);
+		free(name);
+		return 6;
+	}
+	if (strstr(path, "XXXXXX") != NULL) {
+		if (strcmp(flag, "-c") != 0) {
+			_pam_krb5_restore_fs_perms(&saved);
+			free(name);
+			return 9;
 		}
-		close(inpipe[0]);
-		close(outpipe[1]);
-		if (_pam_krb5_write_with_retry(inpipe[1],
-					       stdin_data,
-					       stdin_data_len) == stdin_data_len) {
-			close(inpipe[1]);
-			if (stdout_data != NULL) {
-				memset(stdout_data, '\0', stdout_data_max_len);
-				i = _pam_krb5_read_with_retry(outpipe[0],
-							      stdout_data,
-							      stdout_data_max_len);
-				*stdout_data_len = i;
+		fd = mkstemp(path);
+	} else {
+		/* Try to create the file, in case it doesn't exist. */
+		fd = open(path, O_CREAT | O_EXCL | O_WRONLY, S_IRUSR | S_IWUSR);
+		if ((fd == -1) && (errno == EEXIST)) {
+			/* Verify that the user owns the existing file, and
+			 * nothing funny's going on. */
+			if ((lstat(path, &st) != 0) ||
+			    (st.st_uid != uid) ||
+			    (st.st_gid != gid) ||
+			    (st.st_nlink != 1) ||
+			    ((st.st_mode & (S_IRWXG | S_IRWXO)) != 0) ||
+			    !S_ISREG(st.st_mode)) {
+				_pam_krb5_restore_fs_perms(&saved);
+				free(name);
+				return 9;
 			}
-		} else {
-			close(inpipe[1]);
-			if (stdout_data != NULL) {
-				memset(stdout_data, '\0', stdout_data_max_len);
-				*stdout_data_len = 0;
+			fd = open(path, O_WRONLY);
+			if ((fd == -1) ||
+			    (fstat(fd, &st2) != 0) ||
+			    (st2.st_dev != st.st_dev) ||
+			    (st2.st_ino != st.st_ino)) {
+				if (fd != -1) {
+					close(fd);
+				}
+				_pam_krb5_restore_fs_perms(&saved);
+				free(name);
+				return 9;
 			}
 		}
-		waitpid(child, &status, 0);
-		close(outpipe[0]);
-		sigaction(SIGCHLD, &saved_sigchld_handler, NULL);
-		sigaction(SIGPIPE, &saved_sigpipe_handler, NULL);
-		return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
-		break;
 	}
-	abort(); /* not reached */
+	if (fd == -1) {
+		i = errno;
+		_pam_krb5_restore_fs_perms(&saved);
+		free(name);
+		return i;
+	}
+	/* Keep the user's permissions until we're done, so that if we have to
+	 * remove the file, we do it as the user, and not as root in a
+	 * directory which the user controls. */
+	if ((ftruncate(fd, 0) != 0) ||
+	    (lseek(fd, 0, SEEK_SET) != 0)) {
+		close(fd);
+		_pam_krb5_restore_fs_perms(&saved);
+		free(name);
+		return 9;
+	}
+	if (_pam_krb5_write_with_retry(fd, data, data_len) != data_len) {
+		close(fd);
+		unlink(path);
+		_pam_krb5_restore_fs_perms(&saved);
+		free(name);
+		return 10;
+	}
+	close(fd);
+	_pam_krb5_restore_fs_perms(&saved);
+	*created = name;
+	return 0;
 }
 
+/* Store the stashed credentials in a DIR: ccache as the user, creating the
+ * directory if need be. */
 static int
-_pam_krb5_cchelper_cred_blob(krb5_context ctx, struct _pam_krb5_stash *stash,
-			     struct _pam_krb5_options *options,
-			     const char *realm,
-			     unsigned char **blob, ssize_t *blob_size)
+_pam_krb5_cchelper_write_dir(struct _pam_krb5_stash *stash,
+			     const char *realm, const char *flag,
+			     const char *ccname, uid_t uid, gid_t gid,
+			     char **created)
 {
-	krb5_ccache fccache, mccache;
-	char ccname[PATH_MAX];
+	struct _pam_krb5_fs_perms saved;
+	krb5_principal client;
+	krb5_ccache ccache;
 	struct stat st;
-	int fd;
+	char *name;
+	int i;
 
-	*blob = NULL;
-	*blob_size = 0;
-	/* Check that we have creds. */
 	if ((stash->v5ccache == NULL) ||
-	    (v5_ccache_has_tgt(ctx, stash->v5ccache,
+	    (v5_ccache_has_tgt(stash->v5ctx, stash->v5ccache,
 			       realm, NULL) != 0)) {
 		warn("no creds to save");
 		return -1;
 	}
+	client = NULL;
+	if (krb5_cc_get_principal(stash->v5ctx, stash->v5ccache,
+				  &client) != 0) {
+		return -1;
+	}
+	name = xstrdup(ccname);
+	if (name == NULL) {
+		krb5_free_principal(stash->v5ctx, client);
+		return 4;
+	}
+	if (_pam_krb5_switch_fs_perms(uid, gid, &saved) != 0) {
+		_pam_krb5_restore_fs_perms(&saved);
+		krb5_free_principal(stash->v5ctx, client);
+		free(name);
+		return 6;
+	}
+	if (strstr(name + 4, "XXXXXX") != NULL) {
+		/* Check that we're in create mode, and create a directory. */
+		if (strcmp(flag, "-c") != 0) {
+			i = 9;
+		} else {
+			i = (mkdtemp(name + 4) != NULL) ? 0 : errno;
+		}
+	} else {
+		/* See if we can create the directory.  If it exists,
+		 * check that it's the user's. */
+		i = 0;
+		if ((mkdir(name + 4, S_IRWXU) != 0) &&
+		    ((errno != EEXIST) ||
+		     (lstat(name + 4, &st) != 0) ||
+		     !S_ISDIR(st.st_mode) ||
+		     (st.st_uid != uid) ||
+		     (st.st_gid != gid) ||
+		     ((st.st_mode & (S_IRWXG | S_IRWXO)) != 0))) {
+			i = 9;
+		}
+	}
+	if (i == 0) {
+		ccache = NULL;
+		i = _pam_krb5_cc_resolve_and_initialize(stash->v5ctx, name,
+							client, &ccache);
+		if (i == 0) {
+			i = v5_cc_copy(stash->v5ctx, realm,
+				       stash->v5ccache, &ccache);
+			if (i == 0) {
+				krb5_cc_close(stash->v5ctx, ccache);
+			} else {
+				krb5_cc_destroy(stash->v5ctx, ccache);
+			}
+		}
+	}
+	_pam_krb5_restore_fs_perms(&saved);
+	krb5_free_principal(stash->v5ctx, client);
+	if (i != 0) {
+		free(name);
+		return i;
+	}
+	*created = name;
+	return 0;
+}
+
+/* Destroy a FILE: or DIR: ccache the way the helper would. */
+static int
+_pam_krb5_cchelper_remove(krb5_context ctx, const char *ccname)
+{
+	krb5_ccache ccache;
+	struct dirent **dents;
+	char path[PATH_MAX];
+	int i, j;
+
+	if (strstr(ccname, "XXXXXX") != NULL) {
+		return 9;
+	}
+	if (strchr(ccname, ':') == NULL) {
+		snprintf(path, sizeof(path), "FILE:%s", ccname);
+		ccname = path;
+	}
+	i = krb5_cc_resolve(ctx, ccname, &ccache);
+	if (i != 0) {
+		return i;
+	}
+	i = krb5_cc_destroy(ctx, ccache);
+	if ((i == 0) && (strncmp(ccname, "DIR:", 4) == 0)) {
+		dents = NULL;
+		if ((j = scandir(ccname + 4, &dents, NULL, &alphasort)) > 0) {
+			while (j > 0) {
+				if (((strcmp(dents[j - 1]->d_name,
+					     "primary") == 0) ||
+				     (strncmp(dents[j - 1]->d_name,
+					      "tkt", 3) == 0)) &&
+				    (snprintf(path, sizeof(path), "%s/%s",
+					      ccname + 4,
+					      dents[j - 1]->d_name) <
+				     (int) sizeof(path))) {
+					unlink(path);
+				}
+				free(dents[j - 1]);
+				j--;
+			}
+			free(dents);
+		}
+		rmdir(ccname + 4);
+		/* Nothing we can do if this fails. */
+	}
+	return i;
+}
+#endif
+
+/* Serialize the stashed credentials by writing them to a temporary FILE:
+ * ccache and reading its contents back, for when we can't do it directly. */
+static int
+_pam_krb5_cchelper_cred_blob_file(krb5_context ctx,
+				  struct _pam_krb5_stash *stash,
+				  struct _pam_krb5_options *options,
+				  const char *realm,
+				  unsigned char **blob, ssize_t *blob_size)
+{
+	krb5_ccache fccache, mccache;
+	char ccname[PATH_MAX];
+	struct stat st;
+	int fd;
+
 	/* Create a temporary memory cache. */
 	snprintf(ccname, sizeof(ccname), "MEMORY:%p", &mccache);
 	if (krb5_cc_resolve(stash->v5ctx, ccname, &mccache) != 0) {
@@ -386,10 +791,53 @@ _pam_krb5_cchelper_cred_blob(krb5_context ctx, struct _pam_krb5_stash *stash,
 	return 0;
 }
 
+/* Serialize the stashed credentials in the format of a FILE: ccache, which is
+ * what the helper expects to read. */
+static int
+_pam_krb5_cchelper_cred_blob(krb5_context ctx, struct _pam_krb5_stash *stash,
+			     struct _pam_krb5_options *options,
+			     const char *realm,
+			     unsigned char **blob, ssize_t *blob_size)
+{
+	krb5_creds tgt;
+	krb5_principal client;
+	krb5_error_code err;
+	size_t size;
+
+	*blob = NULL;
+	*blob_size = 0;
+	/* Check that we have creds. */
+	memset(&tgt, 0, sizeof(tgt));
+	if ((stash->v5ccache == NULL) ||
+	    (v5_ccache_has_tgt(ctx, stash->v5ccache,
+			       realm, &tgt) != 0)) {
+		warn("no creds to save");
+		return -1;
+	}
+	if (!_pam_krb5_ccfile_available()) {
+		krb5_free_cred_contents(ctx, &tgt);
+		return _pam_krb5_cchelper_cred_blob_file(ctx, stash, options,
+							 realm, blob,
+							 blob_size);
+	}
+	/* Write them straight from the stash to memory. */
+	client = tgt.client;
+	err = _pam_krb5_ccfile_serialize(stash->v5ctx, stash->v5ccache,
+					 client, blob, &size);
+	krb5_free_cred_contents(ctx, &tgt);
+	if (err != 0) {
+		warn("error serializing credentials: %s",
+		     v5_error_message(err));
+		return -1;
+	}
+	*blob_size = size;
+	return 0;
+}
+
 int
 _pam_krb5_cchelper_create(krb5_context ctx, struct _pam_krb5_stash *stash,
 			  struct _pam_krb5_options *options,
-			  const char *ccname_template,
+			  const struct _pam_krb5_template *ccname_template,
 			  const char *user,
 			  struct _pam_krb5_user_info *userinfo,
 			  uid_t uid, gid_t gid,
@@ -398,18 +846,21 @@ _pam_krb5_cchelper_create(krb5_context ctx, struct _pam_krb5_stash *stash,
 	unsigned char *cred_blob, output[PATH_MAX];
 	char *ccpattern;
 	const char *residual;
+	enum _pam_krb5_cchelper_in_process_type type;
 	int i;
 	ssize_t cred_blob_size, osize;
 
-	ccpattern = v5_user_info_subst(ctx, user, userinfo, options,
-				       ccname_template);
+	ccpattern = v5_user_info_template_subst(ctx, user, userinfo, options,
+						ccname_template);
 	if (ccpattern == NULL) {
 		return -1;
 	}
 
+	type = _pam_krb5_cchelper_in_process_type(options, ccpattern);
 	cred_blob = NULL;
-	if (_pam_krb5_cchelper_cred_blob(ctx, stash, options, userinfo->realm,
-					 &cred_blob, &cred_blob_size) != 0) {
+	if ((type != _pam_krb5_cchelper_in_process_dir) &&
+	    (_pam_krb5_cchelper_cred_blob(ctx, stash, options, userinfo->realm,
+					  &cred_blob, &cred_blob_size) != 0)) {
 		free(ccpattern);
 		return -1;
 	}
@@ -417,7 +868,8 @@ _pam_krb5_cchelper_create(krb5_context ctx, struct _pam_krb5_stash *stash,
 	residual = strchr(ccpattern, ':');
 	if (residual != NULL) {
 		residual++;
-		if (_pam_krb5_leading_mkdir(residual, options) != 0) {
+		if (_pam_krb5_leading_mkdir(residual, user, userinfo,
+					    options) != 0) {
 			if (options->debug) {
 				debug("error ensuring directory for \"%s\"",
 				      residual);
@@ -425,12 +877,34 @@ _pam_krb5_cchelper_create(krb5_context ctx, struct _pam_krb5_stash *stash,
 		}
 	}
 
-	i = _pam_krb5_cchelper_run(options->cchelper_path, "-c", ccpattern,
-				   uid, gid, cred_blob, cred_blob_size,
-				   output, sizeof(output), &osize);
+	_pam_krb5_timing_start(options->timings, _pam_krb5_timing_cchelper);
+	*ccname = NULL;
+	switch (type) {
+#ifdef CCHELPER_IN_PROCESS
+	case _pam_krb5_cchelper_in_process_file:
+		i = _pam_krb5_cchelper_write_file("-c", ccpattern, uid, gid,
+						  cred_blob, cred_blob_size,
+						  ccname);
+		break;
+	case _pam_krb5_cchelper_in_process_dir:
+		i = _pam_krb5_cchelper_write_dir(stash, userinfo->realm, "-c",
+						 ccpattern, uid, gid, ccname);
+		break;
+#endif
+	default:
+		i = _pam_krb5_cchelper_run(options->cchelper_path,
+					   options->cchelper_socket, "-c",
+					   ccpattern, uid, gid,
+					   cred_blob, cred_blob_size,
+					   output, sizeof(output), &osize);
+		if (i == 0) {
+			*ccname = xstrndup((const char *) output, osize);
+		}
+		break;
+	}
+	_pam_krb5_timing_stop(options->timings, _pam_krb5_timing_cchelper);
 	free(cred_blob);
 	if (i == 0) {
-		*ccname = xstrndup((const char *) output, osize);
 		if (*ccname == NULL) {
 			free(ccpattern);
 			return -1;
@@ -456,17 +930,42 @@ _pam_krb5_cchelper_update(krb5_context ctx, struct _pam_krb5_stash *stash,
 			  const char *ccname)
 {
 	unsigned char *cred_blob, output[PATH_MAX];
+	char *updated;
+	enum _pam_krb5_cchelper_in_process_type type;
 	int i;
 	ssize_t cred_blob_size, osize;
 
+	type = _pam_krb5_cchelper_in_process_type(options, ccname);
 	cred_blob = NULL;
-	if (_pam_krb5_cchelper_cred_blob(ctx, stash, options, userinfo->realm,
-					 &cred_blob, &cred_blob_size) != 0) {
+	if ((type != _pam_krb5_cchelper_in_process_dir) &&
+	    (_pam_krb5_cchelper_cred_blob(ctx, stash, options, userinfo->realm,
+					  &cred_blob, &cred_blob_size) != 0)) {
 		return -1;
 	}
-	i = _pam_krb5_cchelper_run(options->cchelper_path, "-u", ccname,
-				   uid, gid, cred_blob, cred_blob_size,
-				   output, sizeof(output), &osize);
+	_pam_krb5_timing_start(options->timings, _pam_krb5_timing_cchelper);
+	updated = NULL;
+	switch (type) {
+#ifdef CCHELPER_IN_PROCESS
+	case _pam_krb5_cchelper_in_process_file:
+		i = _pam_krb5_cchelper_write_file("-u", ccname, uid, gid,
+						  cred_blob, cred_blob_size,
+						  &updated);
+		break;
+	case _pam_krb5_cchelper_in_process_dir:
+		i = _pam_krb5_cchelper_write_dir(stash, userinfo->realm, "-u",
+						 ccname, uid, gid, &updated);
+		break;
+#endif
+	default:
+		i = _pam_krb5_cchelper_run(options->cchelper_path,
+					   options->cchelper_socket, "-u",
+					   ccname, uid, gid,
+					   cred_blob, cred_blob_size,
+					   output, sizeof(output), &osize);
+		break;
+	}
+	_pam_krb5_timing_stop(options->timings, _pam_krb5_timing_cchelper);
+	free(updated);
 	if (i == 0) {
 		if (options->debug) {
 			debug("updated ccache \"%s\"", ccname);
@@ -487,9 +986,22 @@ _pam_krb5_cchelper_destroy(krb5_context ctx, struct _pam_krb5_stash *stash,
 	ssize_t osize;
 	int i;
 
-	i = _pam_krb5_cchelper_run(options->cchelper_path, "-d", ccname,
-				   -1, -1, NULL, 0,
-				   output, sizeof(output), &osize);
+	_pam_krb5_timing_start(options->timings, _pam_krb5_timing_cchelper);
+	switch (_pam_krb5_cchelper_in_process_type(options, ccname)) {
+#ifdef CCHELPER_IN_PROCESS
+	case _pam_krb5_cchelper_in_process_file:
+	case _pam_krb5_cchelper_in_process_dir:
+		i = _pam_krb5_cchelper_remove(ctx, ccname);
+		break;
+#endif
+	default:
+		i = _pam_krb5_cchelper_run(options->cchelper_path,
+					   options->cchelper_socket, "-d",
+					   ccname, -1, -1, NULL, 0,
+					   output, sizeof(output), &osize);
+		break;
+	}
+	_pam_krb5_timing_stop(options->timings, _pam_krb5_timing_cchelper);
 	if (i == 0) {
 		if (options->debug) {
 			debug("destroyed ccache \"%s\"", ccname);
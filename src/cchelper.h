@@ -33,8 +33,31 @@
 #ifndef pam_krb5_cchelper_h
 #define pam_krb5_cchelper_h
 
+/* A request sent to "pam_krb5_cchelper --serve", which is followed by the
+ * ccname and the credentials, and the reply, which is followed by whatever the
+ * helper would have printed. */
+#define PAM_KRB5_CCHELPER_MAGIC 0x706b6331
+/* How many seconds either side waits for the other to read or write. */
+#define PAM_KRB5_CCHELPER_TIMEOUT 10
+struct _pam_krb5_cchelper_request {
+	unsigned int magic;
+	unsigned int flag;
+	long long uid, gid;
+	unsigned int ccname_len, data_len;
+};
+struct _pam_krb5_cchelper_reply {
+	unsigned int magic;
+	int status;
+	unsigned int output_len;
+};
+
+/* The descriptor at which "pam_krb5_cchelper --keep-memfd" holds the memfd
+ * which it was given as its standard input. */
+#define PAM_KRB5_CCHELPER_MEMFD_FD 3
+
 struct _pam_krb5_stash;
 struct _pam_krb5_options;
+struct _pam_krb5_template;
 struct _pam_krb5_user_info;
 
 ssize_t _pam_krb5_write_with_retry(int fd, const unsigned char *buffer,
@@ -43,7 +66,8 @@ ssize_t _pam_krb5_read_with_retry(int fd, unsigned char *buffer, ssize_t len);
 
 int _pam_krb5_cchelper_create(krb5_context ctx, struct _pam_krb5_stash *stash,
 			      struct _pam_krb5_options *options,
-			      const char *ccname_template, const char *user,
+			      const struct _pam_krb5_template *ccname_template,
+			      const char *user,
 			      struct _pam_krb5_user_info *userinfo,
 			      uid_t uid, gid_t gid,
 			      char **ccname);
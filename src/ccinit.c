@@ -0,0 +1,127 @@
+/*
+ * Copyright 2012,2013,2014 Red Hat, Inc.
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include KRB5_H
+
+#include "ccinit.h"
+
+/* Resolve a ccache name and initialize the ccache for the client.  If the
+ * ccache type supports collections, reuse the client's existing ccache in the
+ * collection, if it has one, or create a new one, making it the primary if
+ * it's the first. */
+krb5_error_code
+_pam_krb5_cc_resolve_and_initialize(krb5_context ctx, const char *ccname,
+				    krb5_principal client,
+				    krb5_ccache *ccout)
+{
+	krb5_ccache ccache;
+	krb5_error_code err;
+#if defined(HAVE_KRB5_CC_SUPPORT_SWITCH) && \
+    defined(HAVE_KRB5_CC_CACHE_MATCH) && \
+    defined(HAVE_KRB5_CC_NEW_UNIQUE)
+	krb5_cccol_cursor cursor;
+	krb5_boolean make_primary;
+	char *cctype, *hint, *defcc;
+	const char *cdefcc;
+
+	/* Set the default name to the already-not-a-template location that
+	 * we're planning to use, in case we end up calling
+	 * krb5_cc_new_unique() below. */
+	cdefcc = krb5_cc_default_name(ctx);
+	defcc = (cdefcc != NULL) ? strdup(cdefcc) : NULL;
+	err = krb5_cc_set_default_name(ctx, ccname);
+
+	/* Isolate the cctype. */
+	cctype = strdup(ccname);
+	hint = strchr(cctype, ':');
+	if (hint != NULL) {
+		*hint++ = '\0';
+	}
+
+	/* If the type supports switching... */
+	if (krb5_cc_support_switch(ctx, cctype)) {
+		/* check if there are any ccaches in there yet */
+		make_primary = FALSE;
+		if (krb5_cccol_cursor_new(ctx, &cursor) == 0) {
+			ccache = NULL;
+			if ((krb5_cccol_cursor_next(ctx, cursor,
+						    &ccache) == 0) &&
+			    (ccache != NULL)) {
+				make_primary = FALSE;
+			} else {
+				make_primary = TRUE;
+			}
+			krb5_cccol_cursor_free(ctx, &cursor);
+		}
+		/* check if we already have a ccache for this client. */
+		ccache = NULL;
+		err = krb5_cc_cache_match(ctx, client, &ccache);
+		if (err != 0) {
+			if (err == KRB5_CC_NOTFOUND) {
+				/* We don't have one -> create a new one. */
+				err = krb5_cc_new_unique(ctx, cctype, hint,
+							 &ccache);
+			} else {
+				/* Some other error -> just start over. */
+				err = krb5_cc_resolve(ctx, ccname, &ccache);
+			}
+		}
+		/* make this the primary ccache if there wasn't already one */
+		if ((ccache != NULL) && make_primary) {
+			krb5_cc_switch(ctx, ccache);
+		}
+	} else {
+		/* Just resolve the name for overwriting later. */
+		err = krb5_cc_resolve(ctx, ccname, &ccache);
+	}
+	krb5_cc_set_default_name(ctx, defcc);
+#else
+	err = krb5_cc_resolve(ctx, ccname, &ccache);
+#endif
+	*ccout = NULL;
+	if (err == 0) {
+		err = krb5_cc_initialize(ctx, ccache, client);
+		if (err == 0) {
+			*ccout = ccache;
+			return 0;
+		}
+		krb5_cc_close(ctx, ccache);
+	}
+	return err;
+}
@@ -0,0 +1,313 @@
+/*
+ * Copyright 2012,2013 Red Hat, Inc.
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#ifdef HAVE_SYS_PIDFD_H
+#include <sys/pidfd.h>
+#endif
+#include <sys/wait.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <signal.h>
+#ifdef HAVE_SPAWN_H
+#include <spawn.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "child.h"
+
+#if defined(HAVE_PIDFD_SPAWN) && defined(HAVE_PIDFD_GETPID) && defined(P_PIDFD)
+#define USE_PIDFD 1
+#endif
+
+extern char **environ;
+
+/* Set the signal dispositions we want while a child is running: SIGCHLD needs
+ * to be at its default so that we can reap the child ourselves, and we don't
+ * want to be killed if it exits before reading everything we send it. */
+static int
+_pam_krb5_child_prepare(struct _pam_krb5_child *child)
+{
+	struct sigaction ignore_handler, default_handler;
+
+	child->pid = -1;
+	child->pidfd = -1;
+	memset(&default_handler, 0, sizeof(default_handler));
+	default_handler.sa_handler = SIG_DFL;
+	if (sigaction(SIGCHLD, &default_handler,
+		      &child->saved_sigchld_handler) != 0) {
+		return -1;
+	}
+	memset(&ignore_handler, 0, sizeof(ignore_handler));
+	ignore_handler.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &ignore_handler,
+		      &child->saved_sigpipe_handler) != 0) {
+		sigaction(SIGCHLD, &child->saved_sigchld_handler, NULL);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+_pam_krb5_child_restore(struct _pam_krb5_child *child)
+{
+	sigaction(SIGCHLD, &child->saved_sigchld_handler, NULL);
+	sigaction(SIGPIPE, &child->saved_sigpipe_handler, NULL);
+}
+
+/* Close every descriptor numbered "first" or higher, or at least arrange for
+ * them to be closed when we exec(), without looping over every possible
+ * descriptor number if we can help it, as that can take a while when the
+ * descriptor limit is raised. */
+void
+_pam_krb5_child_close_fds(int first)
+{
+	DIR *dir;
+	struct dirent *dent;
+	char *p;
+	long fd, max;
+
+#ifdef HAVE_CLOSE_RANGE
+#ifdef CLOSE_RANGE_CLOEXEC
+	if (close_range(first, ~0U, CLOSE_RANGE_CLOEXEC) == 0) {
+		return;
+	}
+#endif
+	if (close_range(first, ~0U, 0) == 0) {
+		return;
+	}
+#endif
+	/* Only look at the descriptors which are actually open.  We mark
+	 * them instead of closing them, so that we don't close the one we're
+	 * using to read the directory. */
+	dir = opendir("/proc/self/fd");
+	if (dir != NULL) {
+		while ((dent = readdir(dir)) != NULL) {
+			fd = strtol(dent->d_name, &p, 10);
+			if ((p == dent->d_name) || (*p != '\0') ||
+			    (fd < first) || (fd == dirfd(dir))) {
+				continue;
+			}
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+		closedir(dir);
+		return;
+	}
+	/* Fall back to trying them all. */
+	max = sysconf(_SC_OPEN_MAX);
+	for (fd = first; fd < max; fd++) {
+		close(fd);
+	}
+}
+
+/* In a child process, attempt to make the given user and group both our real
+ * and effective IDs.  Note that if we're not root, this is allowed to fail. */
+static void
+_pam_krb5_child_become(uid_t uid, gid_t gid)
+{
+	int i;
+
+	setgroups(0, NULL);
+	if ((gid != getgid()) || (gid != getegid())) {
+		i = setregid(gid, gid);
+	}
+	if ((uid != getuid()) || (uid != geteuid())) {
+		i = setreuid(uid, uid);
+	}
+}
+
+/* Start a child process, which will attempt to become the given user and
+ * group and then return 0.  In the parent, returns the child's PID, which
+ * should be passed to _pam_krb5_child_wait() later, or -1 on error. */
+int
+_pam_krb5_child_fork(struct _pam_krb5_child *child, uid_t uid, gid_t gid)
+{
+	if (_pam_krb5_child_prepare(child) != 0) {
+		return -1;
+	}
+	switch (child->pid = fork()) {
+	case -1:
+		_pam_krb5_child_restore(child);
+		return -1;
+		break;
+	case 0:
+		/* We're the child. */
+		_pam_krb5_child_become(uid, gid);
+		return 0;
+		break;
+	default:
+		break;
+	}
+	return child->pid;
+}
+
+#if defined(HAVE_POSIX_SPAWN) && \
+    defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP)
+#define USE_SPAWN 1
+#endif
+
+#ifdef USE_SPAWN
+/* Start the program using posix_spawn(), which closes the other descriptors
+ * for us.  Returns the child's PID, or -1 on error. */
+static int
+_pam_krb5_child_spawn(struct _pam_krb5_child *child, const char *path,
+		      char * const *argv, int stdin_fd, int stdout_fd)
+{
+	posix_spawn_file_actions_t actions;
+	pid_t pid;
+	int i;
+
+	if (_pam_krb5_child_prepare(child) != 0) {
+		return -1;
+	}
+	if (posix_spawn_file_actions_init(&actions) != 0) {
+		_pam_krb5_child_restore(child);
+		return -1;
+	}
+	if ((posix_spawn_file_actions_adddup2(&actions, stdin_fd,
+					      STDIN_FILENO) != 0) ||
+	    (posix_spawn_file_actions_adddup2(&actions, stdout_fd,
+					      STDOUT_FILENO) != 0) ||
+	    (posix_spawn_file_actions_addclosefrom_np(&actions,
+						      STDERR_FILENO + 1) != 0)) {
+		posix_spawn_file_actions_destroy(&actions);
+		_pam_krb5_child_restore(child);
+		return -1;
+	}
+#ifdef USE_PIDFD
+	/* Keep a descriptor for the child, so that we wait for it and only
+	 * it, even if something else reaps it and its PID gets reused. */
+	i = pidfd_spawn(&child->pidfd, path, &actions, NULL, argv, environ);
+	if (i == 0) {
+		pid = pidfd_getpid(child->pidfd);
+		if (pid == -1) {
+			/* We'll wait for it using the descriptor. */
+			pid = 0;
+		}
+	}
+#else
+	i = posix_spawn(&pid, path, &actions, NULL, argv, environ);
+#endif
+	posix_spawn_file_actions_destroy(&actions);
+	if (i != 0) {
+		child->pidfd = -1;
+		_pam_krb5_child_restore(child);
+		errno = i;
+		return -1;
+	}
+	child->pid = pid;
+	return child->pid;
+}
+#endif
+
+/* Run the specified program with "stdin_fd" and "stdout_fd" as its standard
+ * input and output, leaving standard error as it is and closing everything
+ * else.  The programs we run switch to the user and group they're given
+ * themselves, but refuse to start with mismatched real and effective IDs, so
+ * if we're set-user-ID, we fork(), switch to "uid" and "gid", and exec().
+ * Otherwise, we use posix_spawn() if it can close the other descriptors for
+ * us.  Returns the child's PID, or -1 on error. */
+int
+_pam_krb5_child_exec(struct _pam_krb5_child *child, const char *path,
+		     char * const *argv, uid_t uid, gid_t gid,
+		     int stdin_fd, int stdout_fd)
+{
+#ifdef USE_SPAWN
+	if ((getuid() == geteuid()) && (getgid() == getegid())) {
+		return _pam_krb5_child_spawn(child, path, argv,
+					     stdin_fd, stdout_fd);
+	}
+#endif
+	if (_pam_krb5_child_prepare(child) != 0) {
+		return -1;
+	}
+	switch (child->pid = fork()) {
+	case -1:
+		_pam_krb5_child_restore(child);
+		return -1;
+		break;
+	case 0:
+		/* We're the child. */
+		dup2(stdin_fd, STDIN_FILENO);
+		dup2(stdout_fd, STDOUT_FILENO);
+		_pam_krb5_child_close_fds(STDERR_FILENO + 1);
+		_pam_krb5_child_become(uid, gid);
+		execv(path, argv);
+		_exit(-1);
+		break;
+	default:
+		break;
+	}
+	return child->pid;
+}
+
+/* Wait for the child to exit, put back the signal handlers which were in
+ * place before it was started, and return its exit status, or -1 if it didn't
+ * exit normally. */
+int
+_pam_krb5_child_wait(struct _pam_krb5_child *child)
+{
+	int status, ret;
+#ifdef USE_PIDFD
+	siginfo_t info;
+
+	if (child->pidfd != -1) {
+		memset(&info, 0, sizeof(info));
+		do {
+			ret = waitid(P_PIDFD, child->pidfd, &info, WEXITED);
+		} while ((ret == -1) && (errno == EINTR));
+		close(child->pidfd);
+		child->pidfd = -1;
+		_pam_krb5_child_restore(child);
+		if ((ret == 0) && (info.si_code == CLD_EXITED)) {
+			return info.si_status;
+		}
+		return -1;
+	}
+#endif
+	do {
+		ret = waitpid(child->pid, &status, 0);
+	} while ((ret == -1) && (errno == EINTR));
+	_pam_krb5_child_restore(child);
+	if ((ret == child->pid) && WIFEXITED(status)) {
+		return WEXITSTATUS(status);
+	}
+	return -1;
+}
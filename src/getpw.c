@@ -41,27 +41,45 @@
 #include <string.h>
 #include <unistd.h>
 
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#ifdef HAVE_SECURITY_PAM_MODULES_H
+#include <security/pam_modules.h>
+#endif
+
 #include "getpw.h"
 #include "xstr.h"
 
+#define PASSWD_CACHE_DATA "pam_krb5_passwd_cache"
+
 #if defined(HAVE_GETPWNAM_R) || defined(HAVE___POSIX_GETPWNAM_R)
-#define CHUNK_SIZE 128
+#define DEFAULT_BUFFER_SIZE 1024
 /* Convert a name to a UID/GID pair. */
 static int
 _get_pw_nam(const char *name, long id, uid_t *uid, gid_t *gid, char **homedir)
 {
 	struct passwd passwd, *pwd;
 	char *buffer;
-	int size, i;
+	long size;
+	int i;
 
-	size = CHUNK_SIZE;
+	/* Start with the size which the system suggests, and double it each
+	 * time it turns out to be too small. */
+	size = -1;
+#ifdef _SC_GETPW_R_SIZE_MAX
+	size = sysconf(_SC_GETPW_R_SIZE_MAX);
+#endif
+	if (size <= 0) {
+		size = DEFAULT_BUFFER_SIZE;
+	}
 	do {
 		/* Allocate a temporary buffer to hold the string data. */
 		buffer = malloc(size);
 		if (buffer == NULL) {
 			return 1;
 		}
-		memset(buffer, '\0', size);
 
 		/* Give it a shot. */
 		pwd = NULL;
@@ -87,8 +105,11 @@ _get_pw_nam(const char *name, long id, uid_t *uid, gid_t *gid, char **homedir)
 			break;
 		}
 
-		/* Free the buffer -- we'll reallocate it later. */
-		xstrfree(buffer);
+		/* Free the buffer -- we'll reallocate it later.  We didn't
+		 * clear it when we allocated it, so wipe all of it rather than
+		 * looking for a terminating NUL. */
+		memset(buffer, '\0', size);
+		free(buffer);
 		buffer = NULL;
 
 		/* We need to use more space if we got ERANGE back, so bail on
@@ -98,7 +119,7 @@ _get_pw_nam(const char *name, long id, uid_t *uid, gid_t *gid, char **homedir)
 		}
 
 		/* Increase the size of the buffer. */
-		size += CHUNK_SIZE;
+		size = (size <= LONG_MAX / 2) ? size * 2 : -1;
 	} while (size > 0);
 
 	/* If we exited successfully, then pull out the UID/GID. */
@@ -152,3 +173,108 @@ _pam_krb5_get_pw_info(const char *name, long id, uid_t *uid, gid_t *gid,
 {
 	return _get_pw_nam(name, id, uid, gid, homedir);
 }
+
+/* Users whose information we've already looked up using this PAM handle, so
+ * that each of our entry points doesn't have to ask NSS again. */
+struct _pam_krb5_passwd_cache_entry {
+	char *name;
+	uid_t uid;
+	gid_t gid;
+	char *homedir;
+	struct _pam_krb5_passwd_cache_entry *next;
+};
+
+struct _pam_krb5_passwd_cache {
+	struct _pam_krb5_passwd_cache_entry *head;
+};
+
+static void
+passwd_cache_entry_free(struct _pam_krb5_passwd_cache_entry *entry)
+{
+	xstrfree(entry->name);
+	xstrfree(entry->homedir);
+	free(entry);
+}
+
+static void
+passwd_cache_cleanup(pam_handle_t *pamh, void *data, int error)
+{
+	struct _pam_krb5_passwd_cache *cache = data;
+	struct _pam_krb5_passwd_cache_entry *next;
+	while (cache->head != NULL) {
+		next = cache->head->next;
+		passwd_cache_entry_free(cache->head);
+		cache->head = next;
+	}
+	free(cache);
+}
+
+static struct _pam_krb5_passwd_cache *
+passwd_cache_get(pam_handle_t *pamh)
+{
+	struct _pam_krb5_passwd_cache *cache;
+	cache = NULL;
+	if ((pam_get_data(pamh, PASSWD_CACHE_DATA,
+			  (PAM_KRB5_MAYBE_CONST void **) &cache) == PAM_SUCCESS) &&
+	    (cache != NULL)) {
+		return cache;
+	}
+	cache = malloc(sizeof(*cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+	cache->head = NULL;
+	if (pam_set_data(pamh, PASSWD_CACHE_DATA, cache,
+			 passwd_cache_cleanup) != PAM_SUCCESS) {
+		free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+/* Look up a user's UID, GID, and home directory, reusing the results of an
+ * earlier lookup made using the same PAM handle. */
+int
+_pam_krb5_get_pw_info_for_handle(pam_handle_t *pamh, const char *name,
+				 uid_t *uid, gid_t *gid, char **homedir)
+{
+	struct _pam_krb5_passwd_cache *cache;
+	struct _pam_krb5_passwd_cache_entry *entry;
+
+	cache = passwd_cache_get(pamh);
+	for (entry = (cache != NULL) ? cache->head : NULL;
+	     entry != NULL;
+	     entry = entry->next) {
+		if (strcmp(entry->name, name) == 0) {
+			*uid = entry->uid;
+			*gid = entry->gid;
+			*homedir = xstrdup(entry->homedir);
+			return (*homedir != NULL) ? 0 : 1;
+		}
+	}
+
+	if (_get_pw_nam(name, -1, uid, gid, homedir) != 0) {
+		return 1;
+	}
+
+	/* Remember what we found.  If we can't, that's okay. */
+	if (cache == NULL) {
+		return 0;
+	}
+	entry = malloc(sizeof(*entry));
+	if (entry == NULL) {
+		return 0;
+	}
+	memset(entry, 0, sizeof(*entry));
+	entry->name = xstrdup(name);
+	entry->homedir = xstrdup(*homedir);
+	if ((entry->name == NULL) || (entry->homedir == NULL)) {
+		passwd_cache_entry_free(entry);
+		return 0;
+	}
+	entry->uid = *uid;
+	entry->gid = *gid;
+	entry->next = cache->head;
+	cache->head = entry;
+	return 0;
+}
@@ -36,5 +36,7 @@
 int _pam_krb5_get_pw_ids(const char *name, long id, uid_t *uid, gid_t *gid);
 int _pam_krb5_get_pw_info(const char *name, long id, uid_t *uid, gid_t *gid,
 			  char **homedir);
+int _pam_krb5_get_pw_info_for_handle(pam_handle_t *pamh, const char *name,
+				     uid_t *uid, gid_t *gid, char **homedir);
 
 #endif
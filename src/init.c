@@ -33,6 +33,10 @@
 #include "../config.h"
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -50,6 +54,50 @@
 #include "log.h"
 #include "v5.h"
 
+#define PAM_KRB5_SHARED_CTX_DATA	"_pam_krb5_shared_ctx"
+#define PAM_KRB5_PROFILE_MAX_DEPTH	8
+
+/* What a configuration file looked like when we read it. */
+struct _pam_krb5_profile_stamp {
+	char *path;
+	int exists;
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	off_t size;
+	struct _pam_krb5_profile_stamp *next;
+};
+
+/* A library context which is shared by the calls made using a PAM handle,
+ * along with enough information to tell if its configuration has changed
+ * since it was read. */
+struct _pam_krb5_shared_ctx {
+	krb5_context ctx;
+	int secure, refs;
+	unsigned long generation;
+	struct _pam_krb5_profile_stamp *stamps;
+	struct _pam_krb5_shared_ctx *next;
+};
+
+/* The contexts for a PAM handle: the current one first, followed by any
+ * which have been superseded but which are still in use. */
+struct _pam_krb5_shared_ctx_list {
+	struct _pam_krb5_shared_ctx *head;
+	unsigned long generations;
+};
+
+static int
+want_secure(int argc, PAM_KRB5_MAYBE_CONST char **argv)
+{
+	int i;
+	for (i = 0; i < argc; i++) {
+		if (strcmp(argv[i], "unsecure_for_debugging_only") == 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
 static int
 set_realm(krb5_context ctx, int argc, PAM_KRB5_MAYBE_CONST char **argv)
 {
@@ -66,12 +114,8 @@ int
 _pam_krb5_init_ctx(krb5_context *ctx,
 		   int argc, PAM_KRB5_MAYBE_CONST char **argv)
 {
-	int try_secure = 1, i;
-	for (i = 0; i < argc; i++) {
-		if (strcmp(argv[i], "unsecure_for_debugging_only") == 0) {
-			try_secure = 0;
-		}
-	}
+	int try_secure, i;
+	try_secure = want_secure(argc, argv);
 	*ctx = NULL;
 #ifdef HAVE_KRB5_INIT_SECURE_CONTEXT
 	if (try_secure) {
@@ -113,3 +157,366 @@ _pam_krb5_free_ctx(krb5_context ctx)
 #endif
 	krb5_free_context(ctx);
 }
+
+/* Record the state of a file or directory, returning 1 if it's one which we
+ * hadn't already seen and it exists, 0 if not, and -1 on error. */
+static int
+stamp_add(struct _pam_krb5_profile_stamp **stamps, const char *path)
+{
+	struct _pam_krb5_profile_stamp *stamp;
+	struct stat st;
+	for (stamp = *stamps; stamp != NULL; stamp = stamp->next) {
+		if (strcmp(stamp->path, path) == 0) {
+			return 0;
+		}
+	}
+	stamp = malloc(sizeof(*stamp));
+	if (stamp == NULL) {
+		return -1;
+	}
+	memset(stamp, 0, sizeof(*stamp));
+	stamp->path = strdup(path);
+	if (stamp->path == NULL) {
+		free(stamp);
+		return -1;
+	}
+	if (stat(path, &st) == 0) {
+		stamp->exists = 1;
+		stamp->dev = st.st_dev;
+		stamp->ino = st.st_ino;
+		stamp->mtime = st.st_mtime;
+		stamp->size = st.st_size;
+	}
+	stamp->next = *stamps;
+	*stamps = stamp;
+	return stamp->exists;
+}
+
+/* Record the state of a configuration file and of the files and directories
+ * which it pulls in using "include" and "includedir" directives. */
+static void
+stamp_file(struct _pam_krb5_profile_stamp **stamps, const char *path,
+	   int depth)
+{
+	FILE *fp;
+	DIR *dir;
+	struct dirent *ent;
+	char buf[LINE_MAX], *p, *q, *sub;
+	int includedir;
+
+	if ((stamp_add(stamps, path) != 1) ||
+	    (depth >= PAM_KRB5_PROFILE_MAX_DEPTH)) {
+		return;
+	}
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return;
+	}
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		p = buf + strspn(buf, " \t");
+		p[strcspn(p, "\r\n")] = '\0';
+		if (strncmp(p, "include", 7) != 0) {
+			continue;
+		}
+		includedir = (strncmp(p, "includedir", 10) == 0);
+		q = p + (includedir ? 10 : 7);
+		if ((*q != ' ') && (*q != '\t')) {
+			continue;
+		}
+		q += strspn(q, " \t");
+		p = q + strlen(q);
+		while ((p > q) && ((p[-1] == ' ') || (p[-1] == '\t'))) {
+			*--p = '\0';
+		}
+		if (*q != '/') {
+			continue;
+		}
+		if (!includedir) {
+			stamp_file(stamps, q, depth + 1);
+			continue;
+		}
+		/* The directory's own timestamp changes when files are added
+		 * to or removed from it, but not when they're edited. */
+		if (stamp_add(stamps, q) != 1) {
+			continue;
+		}
+		dir = opendir(q);
+		if (dir == NULL) {
+			continue;
+		}
+		while ((ent = readdir(dir)) != NULL) {
+			if (ent->d_name[0] == '.') {
+				continue;
+			}
+			sub = malloc(strlen(q) + 1 + strlen(ent->d_name) + 1);
+			if (sub == NULL) {
+				break;
+			}
+			sprintf(sub, "%s/%s", q, ent->d_name);
+			stamp_file(stamps, sub, depth + 1);
+			free(sub);
+		}
+		closedir(dir);
+	}
+	fclose(fp);
+}
+
+static void
+stamps_free(struct _pam_krb5_profile_stamp *stamps)
+{
+	struct _pam_krb5_profile_stamp *next;
+	while (stamps != NULL) {
+		next = stamps->next;
+		free(stamps->path);
+		free(stamps);
+		stamps = next;
+	}
+}
+
+/* Record the state of the files which the library will read its
+ * configuration from. */
+static struct _pam_krb5_profile_stamp *
+stamps_record(void)
+{
+	struct _pam_krb5_profile_stamp *stamps;
+	char *files, *p, *q;
+#if defined(HAVE_KRB5_GET_DEFAULT_CONFIG_FILES) && \
+    defined(HAVE_KRB5_FREE_CONFIG_FILES)
+	char **list;
+	int i;
+#endif
+
+	stamps = NULL;
+#if defined(HAVE_KRB5_GET_DEFAULT_CONFIG_FILES) && \
+    defined(HAVE_KRB5_FREE_CONFIG_FILES)
+	if (krb5_get_default_config_files(&list) == 0) {
+		for (i = 0; (list != NULL) && (list[i] != NULL); i++) {
+			stamp_file(&stamps, list[i], 0);
+		}
+		krb5_free_config_files(list);
+		return stamps;
+	}
+#endif
+	p = getenv("KRB5_CONFIG");
+	files = strdup(((p != NULL) && (strlen(p) > 0)) ?
+		       p : "/etc/krb5.conf");
+	if (files == NULL) {
+		return NULL;
+	}
+	for (p = files; p != NULL; p = q) {
+		q = strchr(p, ':');
+		if (q != NULL) {
+			*q++ = '\0';
+		}
+		if (strlen(p) > 0) {
+			stamp_file(&stamps, p, 0);
+		}
+	}
+	free(files);
+	return stamps;
+}
+
+/* Check if any of the files we recorded have been changed, created, or
+ * removed since we recorded them. */
+static int
+stamps_changed(struct _pam_krb5_profile_stamp *stamps)
+{
+	struct stat st;
+	for (; stamps != NULL; stamps = stamps->next) {
+		if (stat(stamps->path, &st) != 0) {
+			if (stamps->exists) {
+				return 1;
+			}
+			continue;
+		}
+		if (!stamps->exists ||
+		    (st.st_dev != stamps->dev) ||
+		    (st.st_ino != stamps->ino) ||
+		    (st.st_mtime != stamps->mtime) ||
+		    (st.st_size != stamps->size)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void
+_pam_krb5_shared_ctx_unref(struct _pam_krb5_shared_ctx *shared)
+{
+	if ((shared == NULL) || (--shared->refs > 0)) {
+		return;
+	}
+	_pam_krb5_free_ctx(shared->ctx);
+	stamps_free(shared->stamps);
+	free(shared);
+}
+
+/* Drop superseded contexts which are no longer being used by anything other
+ * than the list. */
+static void
+shared_ctx_list_sweep(struct _pam_krb5_shared_ctx_list *list)
+{
+	struct _pam_krb5_shared_ctx **prev, *shared;
+	if (list->head == NULL) {
+		return;
+	}
+	prev = &list->head->next;
+	while (*prev != NULL) {
+		shared = *prev;
+		if (shared->refs == 1) {
+			*prev = shared->next;
+			_pam_krb5_shared_ctx_unref(shared);
+		} else {
+			prev = &shared->next;
+		}
+	}
+}
+
+static void
+shared_ctx_list_cleanup(pam_handle_t *pamh, void *data, int error)
+{
+	struct _pam_krb5_shared_ctx_list *list = data;
+	struct _pam_krb5_shared_ctx *next;
+	while (list->head != NULL) {
+		next = list->head->next;
+		_pam_krb5_shared_ctx_unref(list->head);
+		list->head = next;
+	}
+	free(list);
+}
+
+static struct _pam_krb5_shared_ctx_list *
+shared_ctx_list_get(pam_handle_t *pamh, int create)
+{
+	struct _pam_krb5_shared_ctx_list *list;
+	list = NULL;
+	if ((pam_get_data(pamh, PAM_KRB5_SHARED_CTX_DATA,
+			  (PAM_KRB5_MAYBE_CONST void **) &list) == PAM_SUCCESS) &&
+	    (list != NULL)) {
+		return list;
+	}
+	if (!create) {
+		return NULL;
+	}
+	list = malloc(sizeof(*list));
+	if (list == NULL) {
+		return NULL;
+	}
+	list->head = NULL;
+	list->generations = 0;
+	if (pam_set_data(pamh, PAM_KRB5_SHARED_CTX_DATA, list,
+			 shared_ctx_list_cleanup) != PAM_SUCCESS) {
+		free(list);
+		return NULL;
+	}
+	return list;
+}
+
+/* Find the shared context which "ctx" belongs to, if it is one. */
+struct _pam_krb5_shared_ctx *
+_pam_krb5_shared_ctx_find(pam_handle_t *pamh, krb5_context ctx)
+{
+	struct _pam_krb5_shared_ctx_list *list;
+	struct _pam_krb5_shared_ctx *shared;
+	list = shared_ctx_list_get(pamh, 0);
+	if (list == NULL) {
+		return NULL;
+	}
+	for (shared = list->head; shared != NULL; shared = shared->next) {
+		if (shared->ctx == ctx) {
+			return shared;
+		}
+	}
+	return NULL;
+}
+
+/* Identify the shared context which "ctx" belongs to, so that anything
+ * derived from its configuration can be tied to it.  Private contexts are
+ * always 0. */
+unsigned long
+_pam_krb5_shared_ctx_generation(pam_handle_t *pamh, krb5_context ctx)
+{
+	struct _pam_krb5_shared_ctx *shared;
+	shared = _pam_krb5_shared_ctx_find(pamh, ctx);
+	return (shared != NULL) ? shared->generation : 0;
+}
+
+/* Get a context for use during a call using this PAM handle.  We hand back
+ * the one which an earlier call used if the configuration files haven't
+ * changed since it read them, so that we only parse them once per handle. */
+int
+_pam_krb5_init_ctx_for_handle(pam_handle_t *pamh, krb5_context *ctx,
+			      int argc, PAM_KRB5_MAYBE_CONST char **argv)
+{
+	struct _pam_krb5_shared_ctx_list *list;
+	struct _pam_krb5_shared_ctx *shared;
+	int i;
+
+	*ctx = NULL;
+	list = shared_ctx_list_get(pamh, 1);
+	if (list == NULL) {
+		return _pam_krb5_init_ctx(ctx, argc, argv);
+	}
+	shared = list->head;
+	if ((shared != NULL) &&
+	    (shared->secure == want_secure(argc, argv)) &&
+	    !stamps_changed(shared->stamps)) {
+		/* Forget about any default realm which an earlier call's
+		 * arguments set before applying this call's. */
+		i = krb5_set_default_realm(shared->ctx, NULL);
+		if (i == 0) {
+			i = set_realm(shared->ctx, argc, argv);
+		}
+		if (i != 0) {
+			return i;
+		}
+		shared->refs++;
+		*ctx = shared->ctx;
+		return 0;
+	}
+	if (shared != NULL) {
+		debug("configuration changed, reinitializing kerberos");
+	}
+	shared = malloc(sizeof(*shared));
+	if (shared == NULL) {
+		return _pam_krb5_init_ctx(ctx, argc, argv);
+	}
+	memset(shared, 0, sizeof(*shared));
+	/* Record the files' states before the library reads them, so that a
+	 * change made while it's reading them is noticed next time. */
+	shared->stamps = stamps_record();
+	i = _pam_krb5_init_ctx(&shared->ctx, argc, argv);
+	if (i != 0) {
+		stamps_free(shared->stamps);
+		free(shared);
+		return i;
+	}
+	shared->secure = want_secure(argc, argv);
+	shared->generation = ++list->generations;
+	/* One reference for the list, one for the caller. */
+	shared->refs = 2;
+	shared->next = list->head;
+	list->head = shared;
+	shared_ctx_list_sweep(list);
+	*ctx = shared->ctx;
+	return 0;
+}
+
+/* Release a context obtained using _pam_krb5_init_ctx_for_handle().  A shared
+ * context stays around for use by later calls. */
+void
+_pam_krb5_free_ctx_for_handle(pam_handle_t *pamh, krb5_context ctx)
+{
+	struct _pam_krb5_shared_ctx_list *list;
+	struct _pam_krb5_shared_ctx *shared;
+	shared = _pam_krb5_shared_ctx_find(pamh, ctx);
+	if (shared == NULL) {
+		_pam_krb5_free_ctx(ctx);
+		return;
+	}
+	_pam_krb5_shared_ctx_unref(shared);
+	list = shared_ctx_list_get(pamh, 0);
+	if (list != NULL) {
+		shared_ctx_list_sweep(list);
+	}
+}
@@ -37,4 +37,14 @@ int _pam_krb5_init_ctx(krb5_context *ctx,
 		       int argc, PAM_KRB5_MAYBE_CONST char **argv);
 void _pam_krb5_free_ctx(krb5_context ctx);
 
+struct _pam_krb5_shared_ctx;
+int _pam_krb5_init_ctx_for_handle(pam_handle_t *pamh, krb5_context *ctx,
+				  int argc, PAM_KRB5_MAYBE_CONST char **argv);
+void _pam_krb5_free_ctx_for_handle(pam_handle_t *pamh, krb5_context ctx);
+struct _pam_krb5_shared_ctx *_pam_krb5_shared_ctx_find(pam_handle_t *pamh,
+						       krb5_context ctx);
+unsigned long _pam_krb5_shared_ctx_generation(pam_handle_t *pamh,
+					      krb5_context ctx);
+void _pam_krb5_shared_ctx_unref(struct _pam_krb5_shared_ctx *shared);
+
 #endif
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kdchealth.h"
+#include "mapfile.h"
+
+/* How many times in a row a KDC can fail to answer before we stop trying it
+ * for a while, and how long "a while" is: it doubles with each further
+ * failure, up to a limit. */
+#define KDC_HEALTH_FAILURES 3
+#define KDC_HEALTH_OPEN_MIN 30
+#define KDC_HEALTH_OPEN_MAX 300
+
+/* Map the calling user's table, creating it if need be. */
+struct _pam_krb5_kdc_health *
+_pam_krb5_kdc_health_open(const char *dir)
+{
+	struct _pam_krb5_kdc_health *health;
+
+	health = malloc(sizeof(*health));
+	if (health == NULL) {
+		return NULL;
+	}
+	health->file = _pam_krb5_mapfile_open(dir, PAM_KRB5_KDC_HEALTH_FILE,
+					      sizeof(*health->table),
+					      PAM_KRB5_KDC_HEALTH_MAGIC,
+					      PAM_KRB5_KDC_HEALTH_VERSION);
+	if (health->file == NULL) {
+		free(health);
+		return NULL;
+	}
+	health->table = health->file->data;
+	return health;
+}
+
+void
+_pam_krb5_kdc_health_close(struct _pam_krb5_kdc_health *health)
+{
+	if (health == NULL) {
+		return;
+	}
+	_pam_krb5_mapfile_close(health->file);
+	free(health);
+}
+
+static struct _pam_krb5_kdc_health_entry *
+_pam_krb5_kdc_health_find(struct _pam_krb5_kdc_health *health,
+			  const struct sockaddr *address,
+			  socklen_t address_length)
+{
+	struct _pam_krb5_kdc_health_entry *entry;
+	unsigned int i;
+
+	if ((address_length == 0) ||
+	    (address_length > sizeof(entry->address))) {
+		return NULL;
+	}
+	for (i = 0; i < PAM_KRB5_KDC_HEALTH_ENTRIES; i++) {
+		entry = &health->table->entries[i];
+		if ((entry->address_length == address_length) &&
+		    (memcmp(&entry->address, address, address_length) == 0)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/* Look up what we know about a KDC: whether or not we should try it right
+ * now, how many times in a row it has failed to answer, and how long it
+ * usually takes to answer.  Returns 0 if we know anything at all about it. */
+int
+_pam_krb5_kdc_health_get(struct _pam_krb5_kdc_health *health,
+			 const struct sockaddr *address,
+			 socklen_t address_length,
+			 int *usable, unsigned int *failures,
+			 unsigned int *rtt)
+{
+	struct _pam_krb5_kdc_health_entry *entry;
+	int ret;
+
+	*usable = 1;
+	*failures = 0;
+	*rtt = 0;
+	if ((health == NULL) ||
+	    (_pam_krb5_mapfile_lock(health->file, F_RDLCK) != 0)) {
+		return -1;
+	}
+	entry = _pam_krb5_kdc_health_find(health, address, address_length);
+	if (entry != NULL) {
+		*usable = (entry->open_until <= (int64_t) time(NULL));
+		*failures = entry->failures;
+		*rtt = entry->rtt;
+		ret = 0;
+	} else {
+		ret = -1;
+	}
+	_pam_krb5_mapfile_unlock(health->file);
+	return ret;
+}
+
+/* Note that a KDC either answered, after "rtt" milliseconds, or didn't.  If
+ * it's new to us, take over the slot which has gone unused the longest. */
+void
+_pam_krb5_kdc_health_record(struct _pam_krb5_kdc_health *health,
+			    const struct sockaddr *address,
+			    socklen_t address_length,
+			    int answered, unsigned int rtt)
+{
+	struct _pam_krb5_kdc_health_entry *entry, *oldest;
+	unsigned int i, failures;
+	int64_t now, wait;
+
+	if ((health == NULL) ||
+	    (address_length == 0) ||
+	    (address_length > sizeof(entry->address)) ||
+	    (_pam_krb5_mapfile_lock(health->file, F_WRLCK) != 0)) {
+		return;
+	}
+	now = time(NULL);
+	entry = _pam_krb5_kdc_health_find(health, address, address_length);
+	if (entry == NULL) {
+		oldest = &health->table->entries[0];
+		for (i = 0; i < PAM_KRB5_KDC_HEALTH_ENTRIES; i++) {
+			entry = &health->table->entries[i];
+			if (entry->address_length == 0) {
+				oldest = entry;
+				break;
+			}
+			if (entry->last_used < oldest->last_used) {
+				oldest = entry;
+			}
+		}
+		entry = oldest;
+		memset(entry, 0, sizeof(*entry));
+		memcpy(&entry->address, address, address_length);
+		entry->address_length = address_length;
+	}
+	entry->last_used = now;
+	if (answered) {
+		/* Weight the new measurement at 1/4. */
+		if (rtt == 0) {
+			rtt = 1;
+		}
+		if (entry->rtt == 0) {
+			entry->rtt = rtt;
+		} else {
+			entry->rtt = (entry->rtt * 3 + rtt + 3) / 4;
+		}
+		entry->failures = 0;
+		entry->open_until = 0;
+	} else {
+		failures = ++entry->failures;
+		if (failures >= KDC_HEALTH_FAILURES) {
+			wait = KDC_HEALTH_OPEN_MIN;
+			while ((--failures >= KDC_HEALTH_FAILURES) &&
+			       (wait < KDC_HEALTH_OPEN_MAX)) {
+				wait *= 2;
+			}
+			if (wait > KDC_HEALTH_OPEN_MAX) {
+				wait = KDC_HEALTH_OPEN_MAX;
+			}
+			entry->open_until = now + wait;
+		}
+	}
+	_pam_krb5_mapfile_unlock(health->file);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef pam_krb5_kdchealth_h
+#define pam_krb5_kdchealth_h
+
+struct _pam_krb5_mapfile;
+
+#define PAM_KRB5_KDC_HEALTH_FILE "pam_krb5_kdc_health"
+#define PAM_KRB5_KDC_HEALTH_MAGIC 0x6b646368
+#define PAM_KRB5_KDC_HEALTH_VERSION 2
+#define PAM_KRB5_KDC_HEALTH_ENTRIES 64
+
+/* What we've seen of one KDC address lately.  A slot with a zero
+ * address_length is unused. */
+struct _pam_krb5_kdc_health_entry {
+	struct sockaddr_storage address;
+	socklen_t address_length;
+	/* Smoothed round-trip time in milliseconds, or 0 if we've never
+	 * heard back from it. */
+	uint32_t rtt;
+	/* How many times in a row it has failed to answer. */
+	uint32_t failures;
+	/* When we'll next be willing to try it, if it's been failing. */
+	int64_t open_until;
+	int64_t last_used;
+};
+
+/* The layout of the file which we map, and which all of a user's processes
+ * share.  Only the kdc_race code reads and updates it, since when the library
+ * contacts KDCs for us, it doesn't tell us which ones it tried. */
+struct _pam_krb5_kdc_health_table {
+	uint32_t magic, version;
+	struct _pam_krb5_kdc_health_entry entries[PAM_KRB5_KDC_HEALTH_ENTRIES];
+};
+
+struct _pam_krb5_kdc_health {
+	struct _pam_krb5_mapfile *file;
+	struct _pam_krb5_kdc_health_table *table;
+};
+
+struct _pam_krb5_kdc_health *_pam_krb5_kdc_health_open(const char *dir);
+void _pam_krb5_kdc_health_close(struct _pam_krb5_kdc_health *health);
+int _pam_krb5_kdc_health_get(struct _pam_krb5_kdc_health *health,
+			     const struct sockaddr *address,
+			     socklen_t address_length,
+			     int *usable, unsigned int *failures,
+			     unsigned int *rtt);
+void _pam_krb5_kdc_health_record(struct _pam_krb5_kdc_health *health,
+				 const struct sockaddr *address,
+				 socklen_t address_length,
+				 int answered, unsigned int rtt);
+
+#endif
@@ -0,0 +1,767 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#ifdef HAVE_SECURITY_PAM_MODULES_H
+#include <security/pam_modules.h>
+#endif
+
+#include KRB5_H
+#ifdef HAVE_PROFILE_H
+#include <profile.h>
+#endif
+
+#include "kdchealth.h"
+#include "kdcrace.h"
+#include "log.h"
+#include "options.h"
+
+#ifdef PAM_KRB5_KDC_RACE
+
+#define KDC_RACE_MAX_KDCS 8
+#define KDC_RACE_MAX_REPLY 65536
+#define KDC_RACE_ROUNDS 3
+#define KDC_RACE_FIRST_WAIT 1000
+#define KDC_RACE_MAX_ANSWERS 16
+
+struct _pam_krb5_kdc_race_kdc {
+	struct sockaddr_storage address;
+	socklen_t address_length;
+	char name[NI_MAXHOST + NI_MAXSERV + 2];
+	/* Filled in from the health table. */
+	int usable;
+	unsigned int failures, rtt;
+};
+
+/* Answers which the user has already given to the prompter, so that we don't
+ * ask for them again if we have to start the exchange over. */
+struct _pam_krb5_kdc_race_answer {
+	char *prompt;
+	krb5_data reply;
+	int used;
+};
+
+struct _pam_krb5_kdc_race_answers {
+	krb5_prompter_fct prompter;
+	void *data;
+	struct _pam_krb5_kdc_race_answer list[KDC_RACE_MAX_ANSWERS];
+	int n_answers;
+};
+
+/* Break a "kdc" setting into host and port, dropping a "udp/" prefix.  We
+ * can't race over TCP or HTTPS, so we skip KDCs which need them. */
+static int
+_pam_krb5_kdc_race_split(char *value, char **host, char **port)
+{
+	char *p;
+
+	value += strspn(value, " \t");
+	value[strcspn(value, " \t")] = '\0';
+	if (strncmp(value, "udp/", 4) == 0) {
+		value += 4;
+	}
+	if ((strncmp(value, "tcp/", 4) == 0) ||
+	    (strstr(value, "://") != NULL) ||
+	    (*value == '\0')) {
+		return -1;
+	}
+	*port = NULL;
+	if (*value == '[') {
+		*host = value + 1;
+		p = strchr(value, ']');
+		if (p == NULL) {
+			return -1;
+		}
+		*p++ = '\0';
+		if (*p == ':') {
+			*port = p + 1;
+		} else
+		if (*p != '\0') {
+			return -1;
+		}
+	} else {
+		*host = value;
+		p = strchr(value, ':');
+		if ((p != NULL) && (strchr(p + 1, ':') == NULL)) {
+			*p++ = '\0';
+			*port = p;
+		}
+	}
+	if ((*port == NULL) || (**port == '\0')) {
+		*port = "88";
+	}
+	return 0;
+}
+
+/* Read the list of KDCs for "realm" from the configuration, using "key" to
+ * choose between the "kdc" and "master_kdc" lists, and resolve up to "max"
+ * addresses for them, in the order in which they're listed.  We don't go
+ * looking for KDCs in DNS. */
+static int
+_pam_krb5_kdc_race_lookup(krb5_context ctx, const char *realm,
+			  const char *key, int max,
+			  struct _pam_krb5_kdc_race_kdc *kdcs)
+{
+	profile_t profile;
+	const char *names[4];
+	char **values, *value, *host, *port;
+	struct addrinfo hints, *res, *ai;
+	int i, n;
+
+	if (krb5_get_profile(ctx, &profile) != 0) {
+		return 0;
+	}
+	names[0] = "realms";
+	names[1] = realm;
+	names[2] = key;
+	names[3] = NULL;
+	values = NULL;
+	if (profile_get_values(profile, names, &values) != 0) {
+		profile_release(profile);
+		return 0;
+	}
+	n = 0;
+	for (i = 0; (values[i] != NULL) && (n < max); i++) {
+		value = strdup(values[i]);
+		if (value == NULL) {
+			break;
+		}
+		if (_pam_krb5_kdc_race_split(value, &host, &port) != 0) {
+			free(value);
+			continue;
+		}
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = AI_ADDRCONFIG;
+		res = NULL;
+		if (getaddrinfo(host, port, &hints, &res) == 0) {
+			for (ai = res;
+			     (ai != NULL) && (n < max);
+			     ai = ai->ai_next) {
+				if (ai->ai_addrlen > sizeof(kdcs[n].address)) {
+					continue;
+				}
+				memcpy(&kdcs[n].address, ai->ai_addr,
+				       ai->ai_addrlen);
+				kdcs[n].address_length = ai->ai_addrlen;
+				snprintf(kdcs[n].name, sizeof(kdcs[n].name),
+					 "%s:%s", host, port);
+				n++;
+			}
+			freeaddrinfo(res);
+		}
+		free(value);
+	}
+	profile_free_list(values);
+	profile_release(profile);
+	return n;
+}
+
+/* Sort the KDCs so that the ones which have been answering, quickest first,
+ * come before the ones which have been failing, keeping the configured order
+ * where we can't tell them apart.  We haven't timed KDCs which we've never heard
+ * from, so they sort first, and get tried.  Then trim the list to "max"
+ * entries, leaving out the ones which we're giving a rest, unless that
+ * leaves us with nothing. */
+static int
+_pam_krb5_kdc_race_order(struct _pam_krb5_kdc_health *health,
+			 struct _pam_krb5_kdc_race_kdc *kdcs, int n_kdcs,
+			 int max)
+{
+	struct _pam_krb5_kdc_race_kdc tmp;
+	int i, j, usable;
+
+	usable = 0;
+	for (i = 0; i < n_kdcs; i++) {
+		_pam_krb5_kdc_health_get(health,
+					 (const struct sockaddr *)
+					 &kdcs[i].address,
+					 kdcs[i].address_length,
+					 &kdcs[i].usable, &kdcs[i].failures,
+					 &kdcs[i].rtt);
+		if (kdcs[i].usable) {
+			usable++;
+		}
+	}
+	if (usable == 0) {
+		return (n_kdcs < max) ? n_kdcs : max;
+	}
+	for (i = 1; i < n_kdcs; i++) {
+		tmp = kdcs[i];
+		for (j = i;
+		     (j > 0) &&
+		     ((tmp.usable > kdcs[j - 1].usable) ||
+		      ((tmp.usable == kdcs[j - 1].usable) &&
+		       (tmp.failures < kdcs[j - 1].failures)) ||
+		      ((tmp.usable == kdcs[j - 1].usable) &&
+		       (tmp.failures == kdcs[j - 1].failures) &&
+		       (tmp.rtt < kdcs[j - 1].rtt)));
+		     j--) {
+			kdcs[j] = kdcs[j - 1];
+		}
+		kdcs[j] = tmp;
+	}
+	if (usable < max) {
+		max = usable;
+	}
+	return (n_kdcs < max) ? n_kdcs : max;
+}
+
+static long
+_pam_krb5_kdc_race_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+static void
+_pam_krb5_kdc_race_note(struct _pam_krb5_kdc_health *health,
+			const struct _pam_krb5_kdc_race_kdc *kdc,
+			int answered, long rtt)
+{
+	_pam_krb5_kdc_health_record(health,
+				    (const struct sockaddr *) &kdc->address,
+				    kdc->address_length,
+				    answered, rtt);
+}
+
+/* Send "request" to every KDC in the list, and wait for the first of them to
+ * answer with something which looks like an AS-REP or a KRB-ERROR.  Each call
+ * uses new sockets, so that late answers to an earlier request in the same
+ * exchange are never mistaken for answers to this one.  Note which KDCs
+ * answered and which ones couldn't be reached in the health table. */
+static int
+_pam_krb5_kdc_race_send(struct _pam_krb5_kdc_health *health,
+			const struct _pam_krb5_kdc_race_kdc *kdcs,
+			int n_kdcs, const krb5_data *request,
+			krb5_data *reply, int *winner)
+{
+	struct pollfd fds[KDC_RACE_MAX_KDCS];
+	unsigned char *buffer, discard;
+	long started, deadline, timeout, wait;
+	ssize_t length;
+	int i, k, live, round, ret;
+
+	buffer = malloc(KDC_RACE_MAX_REPLY);
+	if (buffer == NULL) {
+		return -1;
+	}
+	live = 0;
+	for (i = 0; i < n_kdcs; i++) {
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+		fds[i].fd = socket(kdcs[i].address.ss_family, SOCK_DGRAM, 0);
+		if (fds[i].fd == -1) {
+			continue;
+		}
+		if ((fcntl(fds[i].fd, F_SETFD, FD_CLOEXEC) != 0) ||
+		    (fcntl(fds[i].fd, F_SETFL, O_NONBLOCK) != 0) ||
+		    (connect(fds[i].fd,
+			     (const struct sockaddr *) &kdcs[i].address,
+			     kdcs[i].address_length) != 0)) {
+			close(fds[i].fd);
+			fds[i].fd = -1;
+			continue;
+		}
+		live++;
+	}
+	ret = -1;
+	started = _pam_krb5_kdc_race_now();
+	timeout = KDC_RACE_FIRST_WAIT;
+	for (round = 0;
+	     (round < KDC_RACE_ROUNDS) && (live > 0) && (ret != 0);
+	     round++, timeout *= 2) {
+		for (i = 0; i < n_kdcs; i++) {
+			if (fds[i].fd == -1) {
+				continue;
+			}
+			if (send(fds[i].fd, request->data, request->length,
+				 0) != (ssize_t) request->length) {
+				_pam_krb5_kdc_race_note(health, &kdcs[i], 0, 0);
+				close(fds[i].fd);
+				fds[i].fd = -1;
+				live--;
+			}
+		}
+		deadline = _pam_krb5_kdc_race_now() + timeout;
+		while ((live > 0) && (ret != 0)) {
+			wait = deadline - _pam_krb5_kdc_race_now();
+			if (wait <= 0) {
+				break;
+			}
+			k = poll(fds, n_kdcs, wait);
+			if ((k == -1) && (errno == EINTR)) {
+				continue;
+			}
+			if (k <= 0) {
+				break;
+			}
+			/* Once we have a winner, we only look at the others to
+			 * notice any which turned out to be unreachable. */
+			for (i = 0; i < n_kdcs; i++) {
+				if ((fds[i].fd == -1) ||
+				    (fds[i].revents == 0)) {
+					continue;
+				}
+				length = recv(fds[i].fd,
+					      (ret != 0) ? buffer : &discard,
+					      (ret != 0) ?
+					      KDC_RACE_MAX_REPLY : 1, 0);
+				if (length == -1) {
+					if ((errno == EAGAIN) ||
+					    (errno == EINTR)) {
+						continue;
+					}
+					/* Most likely nothing's listening
+					 * there. */
+					_pam_krb5_kdc_race_note(health,
+								&kdcs[i],
+								0, 0);
+					close(fds[i].fd);
+					fds[i].fd = -1;
+					live--;
+					continue;
+				}
+				/* [APPLICATION 11] is an AS-REP, and
+				 * [APPLICATION 30] is a KRB-ERROR. */
+				if ((ret != 0) &&
+				    (length > 0) &&
+				    ((buffer[0] == 0x6b) ||
+				     (buffer[0] == 0x7e))) {
+					reply->data = (char *) buffer;
+					reply->length = length;
+					*winner = i;
+					ret = 0;
+					_pam_krb5_kdc_race_note(health,
+								&kdcs[i], 1,
+								_pam_krb5_kdc_race_now() -
+								started);
+				}
+			}
+		}
+	}
+	for (i = 0; i < n_kdcs; i++) {
+		if (fds[i].fd != -1) {
+			/* If nobody answered, this one didn't either. */
+			if (ret != 0) {
+				_pam_krb5_kdc_race_note(health, &kdcs[i], 0, 0);
+			}
+			close(fds[i].fd);
+		}
+	}
+	if (ret != 0) {
+		free(buffer);
+	}
+	return ret;
+}
+
+/* Hand back answers which the user gave to the same questions earlier, if we
+ * have them for every one of these prompts.  Otherwise, ask, and remember
+ * the answers.  Each answer is only handed back once per exchange. */
+static krb5_error_code
+_pam_krb5_kdc_race_prompter(krb5_context ctx, void *data,
+			    const char *name, const char *banner,
+			    int num_prompts, krb5_prompt prompts[])
+{
+	struct _pam_krb5_kdc_race_answers *answers = data;
+	struct _pam_krb5_kdc_race_answer *answer;
+	int found[KDC_RACE_MAX_ANSWERS];
+	int i, j;
+	krb5_error_code ret;
+
+	for (i = 0; (i < num_prompts) && (i < KDC_RACE_MAX_ANSWERS); i++) {
+		found[i] = -1;
+		for (j = 0; j < answers->n_answers; j++) {
+			answer = &answers->list[j];
+			if (!answer->used &&
+			    (prompts[i].prompt != NULL) &&
+			    (strcmp(answer->prompt, prompts[i].prompt) == 0) &&
+			    (answer->reply.length <= prompts[i].reply->length)) {
+				answer->used = 1;
+				found[i] = j;
+				break;
+			}
+		}
+		if (found[i] == -1) {
+			break;
+		}
+	}
+	if ((num_prompts > 0) && (i == num_prompts)) {
+		for (i = 0; i < num_prompts; i++) {
+			answer = &answers->list[found[i]];
+			memcpy(prompts[i].reply->data, answer->reply.data,
+			       answer->reply.length);
+			prompts[i].reply->length = answer->reply.length;
+		}
+		return 0;
+	}
+	while (--i >= 0) {
+		if (found[i] != -1) {
+			answers->list[found[i]].used = 0;
+		}
+	}
+	ret = answers->prompter(ctx, answers->data, name, banner,
+				num_prompts, prompts);
+	if (ret != 0) {
+		return ret;
+	}
+	for (i = 0;
+	     (i < num_prompts) && (answers->n_answers < KDC_RACE_MAX_ANSWERS);
+	     i++) {
+		if (prompts[i].prompt == NULL) {
+			continue;
+		}
+		answer = &answers->list[answers->n_answers];
+		answer->prompt = strdup(prompts[i].prompt);
+		answer->reply.data = malloc(prompts[i].reply->length + 1);
+		if ((answer->prompt == NULL) || (answer->reply.data == NULL)) {
+			free(answer->prompt);
+			free(answer->reply.data);
+			answer->prompt = NULL;
+			answer->reply.data = NULL;
+			break;
+		}
+		memcpy(answer->reply.data, prompts[i].reply->data,
+		       prompts[i].reply->length);
+		answer->reply.length = prompts[i].reply->length;
+		answer->used = 1;
+		answers->n_answers++;
+	}
+	return 0;
+}
+
+/* Let every answer be handed out again, for a new exchange. */
+static void
+_pam_krb5_kdc_race_answers_reset(struct _pam_krb5_kdc_race_answers *answers)
+{
+	int i;
+
+	for (i = 0; i < answers->n_answers; i++) {
+		answers->list[i].used = 0;
+	}
+}
+
+static void
+_pam_krb5_kdc_race_answers_free(struct _pam_krb5_kdc_race_answers *answers)
+{
+	int i;
+
+	for (i = 0; i < answers->n_answers; i++) {
+		free(answers->list[i].prompt);
+		memset(answers->list[i].reply.data, '\0',
+		       answers->list[i].reply.length);
+		free(answers->list[i].reply.data);
+	}
+	answers->n_answers = 0;
+}
+
+/* Results which asking the master wouldn't change: success, not reaching any
+ * KDC at all, and the user not answering the prompter. */
+static int
+_pam_krb5_kdc_race_final(krb5_error_code error)
+{
+	switch (error) {
+	case 0:
+	case KRB5_KDC_UNREACH:
+	case KRB5_REALM_CANT_RESOLVE:
+	case KRB5_LIBOS_PWDINTR:
+	case KRB5_LIBOS_CANTREADPWD:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Check if "kdc" is one of the KDCs in the list. */
+static int
+_pam_krb5_kdc_race_listed(const struct _pam_krb5_kdc_race_kdc *kdc,
+			  const struct _pam_krb5_kdc_race_kdc *kdcs,
+			  int n_kdcs)
+{
+	int i;
+
+	for (i = 0; i < n_kdcs; i++) {
+		if ((kdc->address_length == kdcs[i].address_length) &&
+		    (memcmp(&kdc->address, &kdcs[i].address,
+			    kdc->address_length) == 0)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Carry out one exchange, racing up to "max" of the KDCs in each realm's
+ * "key" list.  Returns 0 and sets "result" if it finished, or non-zero if it
+ * couldn't.  Either way, "last_realm" and "last_kdc" are set to the realm
+ * which we last talked to, and to the KDC which answered, if one did. */
+static int
+_pam_krb5_kdc_race_exchange(krb5_context ctx,
+			    krb5_creds *creds,
+			    krb5_principal client,
+			    const char *password,
+			    krb5_prompter_fct prompter,
+			    void *data,
+			    const char *service,
+			    krb5_get_init_creds_opt *gic_options,
+			    const struct _pam_krb5_options *options,
+			    struct _pam_krb5_kdc_health *health,
+			    const char *key, int max,
+			    char **last_realm,
+			    struct _pam_krb5_kdc_race_kdc *last_kdc,
+			    int *result)
+{
+	struct _pam_krb5_kdc_race_kdc kdcs[KDC_RACE_MAX_KDCS];
+	krb5_init_creds_context icc;
+	krb5_data in, out, realm;
+	char *realm_name, *lookup_realm;
+	unsigned int flags;
+	long started;
+	int n_kdcs, winner, ret;
+	krb5_error_code i;
+
+	*last_realm = NULL;
+	memset(last_kdc, 0, sizeof(*last_kdc));
+	if (krb5_init_creds_init(ctx, client, prompter, data, 0, gic_options,
+				 &icc) != 0) {
+		return -1;
+	}
+	if (((service != NULL) &&
+	     (krb5_init_creds_set_service(ctx, icc, service) != 0)) ||
+	    ((password != NULL) &&
+	     (krb5_init_creds_set_password(ctx, icc, password) != 0))) {
+		krb5_init_creds_free(ctx, icc);
+		return -1;
+	}
+	memset(&in, 0, sizeof(in));
+	lookup_realm = NULL;
+	n_kdcs = 0;
+	ret = -1;
+	for (;;) {
+		memset(&out, 0, sizeof(out));
+		memset(&realm, 0, sizeof(realm));
+		flags = 0;
+		i = krb5_init_creds_step(ctx, icc, &in, &out, &realm, &flags);
+		free(in.data);
+		memset(&in, 0, sizeof(in));
+		if (i == KRB5KRB_ERR_RESPONSE_TOO_BIG) {
+			/* The reply won't fit in a datagram, so leave it to
+			 * the library to ask again using TCP. */
+			if (options->debug) {
+				debug("KDC reply too big to race, "
+				      "trying again normally");
+			}
+			break;
+		}
+		if ((i != 0) ||
+		    ((flags & KRB5_INIT_CREDS_STEP_FLAG_CONTINUE) == 0)) {
+			if (i == 0) {
+				i = krb5_init_creds_get_creds(ctx, icc, creds);
+			}
+			*result = i;
+			ret = 0;
+			break;
+		}
+		/* Find the KDCs for the realm we're being asked to talk to,
+		 * unless they're the ones we used last time. */
+		realm_name = malloc(realm.length + 1);
+		if (realm_name == NULL) {
+			break;
+		}
+		memcpy(realm_name, realm.data, realm.length);
+		realm_name[realm.length] = '\0';
+		if ((lookup_realm == NULL) ||
+		    (strcmp(lookup_realm, realm_name) != 0)) {
+			free(lookup_realm);
+			lookup_realm = realm_name;
+			n_kdcs = _pam_krb5_kdc_race_lookup(ctx, lookup_realm,
+							   key,
+							   KDC_RACE_MAX_KDCS,
+							   kdcs);
+			n_kdcs = _pam_krb5_kdc_race_order(health, kdcs,
+							  n_kdcs, max);
+		} else {
+			free(realm_name);
+		}
+		if (n_kdcs == 0) {
+			if (options->debug) {
+				debug("no KDCs to race for \"%s\"",
+				      lookup_realm);
+			}
+			break;
+		}
+		started = _pam_krb5_kdc_race_now();
+		if (_pam_krb5_kdc_race_send(health, kdcs, n_kdcs, &out, &in,
+					    &winner) != 0) {
+			if (options->debug) {
+				debug("no answer from any of %d KDCs for "
+				      "\"%s\", trying again normally",
+				      n_kdcs, lookup_realm);
+			}
+			break;
+		}
+		if (options->debug) {
+			debug("KDC %s answered first, after %ldms",
+			      kdcs[winner].name,
+			      _pam_krb5_kdc_race_now() - started);
+		}
+		*last_kdc = kdcs[winner];
+		krb5_free_data_contents(ctx, &out);
+		krb5_free_data_contents(ctx, &realm);
+	}
+	krb5_free_data_contents(ctx, &out);
+	krb5_free_data_contents(ctx, &realm);
+	free(in.data);
+	*last_realm = lookup_realm;
+	krb5_init_creds_free(ctx, icc);
+	return ret;
+}
+
+int
+_pam_krb5_kdc_race(krb5_context ctx,
+		   krb5_creds *creds,
+		   krb5_principal client,
+		   const char *password,
+		   krb5_prompter_fct prompter,
+		   void *data,
+		   const char *service,
+		   krb5_get_init_creds_opt *gic_options,
+		   const struct _pam_krb5_options *options,
+		   int *result)
+{
+	struct _pam_krb5_kdc_race_kdc masters[KDC_RACE_MAX_KDCS], last;
+	struct _pam_krb5_kdc_race_answers answers;
+	struct _pam_krb5_kdc_health *health;
+	krb5_prompter_fct race_prompter;
+	char *realm;
+	int n_masters, max, ret;
+
+	max = options->kdc_race;
+	if (max > KDC_RACE_MAX_KDCS) {
+		max = KDC_RACE_MAX_KDCS;
+	}
+	/* Keep track of what the user tells the prompter, in case we have to
+	 * start over. */
+	memset(&answers, 0, sizeof(answers));
+	answers.prompter = prompter;
+	answers.data = data;
+	race_prompter = (prompter != NULL) ? _pam_krb5_kdc_race_prompter : NULL;
+	health = _pam_krb5_kdc_health_open(options->ccache_dir);
+	ret = _pam_krb5_kdc_race_exchange(ctx, creds, client, password,
+					  race_prompter, &answers, service,
+					  gic_options, options, health,
+					  "kdc", max, &realm, &last, result);
+	/* A replica which hasn't caught up with the master yet can turn down
+	 * a new password or a new principal, so do as the library would, and
+	 * ask the master before taking its word for it. */
+	if ((ret == 0) && !_pam_krb5_kdc_race_final(*result) &&
+	    (realm != NULL)) {
+		n_masters = _pam_krb5_kdc_race_lookup(ctx, realm, "master_kdc",
+						      KDC_RACE_MAX_KDCS,
+						      masters);
+		if (n_masters == 0) {
+			if (options->debug) {
+				debug("no master KDC listed for \"%s\", "
+				      "trying again normally", realm);
+			}
+			ret = -1;
+		} else
+		if (!_pam_krb5_kdc_race_listed(&last, masters, n_masters)) {
+			if (options->debug) {
+				debug("error %d from a KDC which isn't the "
+				      "master, trying the master", *result);
+			}
+			free(realm);
+			_pam_krb5_kdc_race_answers_reset(&answers);
+			ret = _pam_krb5_kdc_race_exchange(ctx, creds, client,
+							  password,
+							  race_prompter,
+							  &answers, service,
+							  gic_options, options,
+							  health, "master_kdc",
+							  KDC_RACE_MAX_KDCS,
+							  &realm, &last,
+							  result);
+		}
+	}
+	/* If we couldn't finish, let the library go through the KDCs one by
+	 * one, handing it anything we've already been told. */
+	if (ret != 0) {
+		_pam_krb5_kdc_race_answers_reset(&answers);
+		*result = krb5_get_init_creds_password(ctx, creds, client,
+						       password, race_prompter,
+						       &answers, 0, service,
+						       gic_options);
+	}
+	free(realm);
+	_pam_krb5_kdc_health_close(health);
+	_pam_krb5_kdc_race_answers_free(&answers);
+	return 0;
+}
+
+#else
+
+int
+_pam_krb5_kdc_race(krb5_context ctx,
+		   krb5_creds *creds,
+		   krb5_principal client,
+		   const char *password,
+		   krb5_prompter_fct prompter,
+		   void *data,
+		   const char *service,
+		   krb5_get_init_creds_opt *gic_options,
+		   const struct _pam_krb5_options *options,
+		   int *result)
+{
+	return -1;
+}
+
+#endif
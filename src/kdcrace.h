@@ -0,0 +1,71 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef pam_krb5_kdcrace_h
+#define pam_krb5_kdcrace_h
+
+struct _pam_krb5_options;
+
+#if defined(HAVE_KRB5_INIT_CREDS_INIT) && \
+    defined(HAVE_KRB5_INIT_CREDS_STEP) && \
+    defined(KRB5_INIT_CREDS_STEP_TAKES_REALM) && \
+    defined(HAVE_KRB5_INIT_CREDS_SET_PASSWORD) && \
+    defined(HAVE_KRB5_INIT_CREDS_SET_SERVICE) && \
+    defined(HAVE_KRB5_INIT_CREDS_GET_CREDS) && \
+    defined(HAVE_KRB5_INIT_CREDS_FREE) && \
+    defined(HAVE_PROFILE_H) && \
+    defined(HAVE_KRB5_GET_PROFILE) && \
+    defined(HAVE_PROFILE_GET_VALUES) && \
+    defined(HAVE_PROFILE_FREE_LIST) && \
+    defined(HAVE_PROFILE_RELEASE)
+#define PAM_KRB5_KDC_RACE 1
+#endif
+
+/* Get initial creds the way krb5_get_init_creds_password() would, but send
+ * each request to several of the realm's KDCs at once and carry on with
+ * whichever answers first.  If that fails, ask the master KDC, and if we
+ * can't finish, call krb5_get_init_creds_password(), handing it any answers
+ * which the prompter has already been given.  Returns 0 and sets "result",
+ * or non-zero if we can't race at all, and the caller should do it the usual
+ * way instead. */
+int _pam_krb5_kdc_race(krb5_context ctx,
+		       krb5_creds *creds,
+		       krb5_principal client,
+		       const char *password,
+		       krb5_prompter_fct prompter,
+		       void *data,
+		       const char *service,
+		       krb5_get_init_creds_opt *gic_options,
+		       const struct _pam_krb5_options *options,
+		       int *result);
+
+#endif
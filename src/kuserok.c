@@ -35,11 +35,17 @@
 #include <sys/types.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_VFS_H
+#include <sys/vfs.h>
+#endif
 #include <sys/wait.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
 #include <limits.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -55,10 +61,16 @@
 
 #include KRB5_H
 
+#ifdef HAVE_PROFILE_H
+#include <profile.h>
+#endif
+
 #include "cchelper.h"
+#include "child.h"
 #include "init.h"
 #include "log.h"
 #include "options.h"
+#include "perms.h"
 #include "stash.h"
 #include "tokens.h"
 #include "userinfo.h"
@@ -66,9 +78,368 @@
 
 #include "kuserok.h"
 
+#if defined(HAVE_PROFILE_H) && defined(HAVE_KRB5_GET_PROFILE) && \
+    defined(HAVE_PROFILE_GET_STRING) && \
+    defined(HAVE_PROFILE_RELEASE_STRING) && \
+    defined(HAVE_PROFILE_RELEASE) && \
+    defined(HAVE_SYS_VFS_H) && defined(HAVE_FSTATFS) && \
+    defined(PAM_KRB5_FS_PERMS)
+#define KUSEROK_IN_PROCESS 1
+#endif
+
+/* Ask libkrb5 if the principal is allowed to log in as the user, and
+ * optionally let in a principal which maps to the user's name. */
+static krb5_boolean
+_pam_krb5_kuserok_check(krb5_context ctx,
+			struct _pam_krb5_options *options,
+			struct _pam_krb5_user_info *userinfo,
+			const char *user)
+{
+	krb5_boolean allowed;
+#ifdef HAVE_KRB5_ANAME_TO_LOCALNAME
+	krb5_error_code err;
+	char localname[PATH_MAX];
+#endif
+
+	allowed = krb5_kuserok(ctx, userinfo->principal_name, user);
+	if (options->debug) {
+		debug("krb5_kuserok() says \"%s\" for (\"%s\",\"%s\")",
+		      allowed ? "true" : "false",
+		      userinfo->unparsed_name, user);
+	}
+#ifdef HAVE_KRB5_ANAME_TO_LOCALNAME
+	if (!allowed && options->always_allow_localname) {
+		memset(&localname, '\0', sizeof(localname));
+		err = krb5_aname_to_localname(ctx,
+					      userinfo->principal_name,
+					      sizeof(localname),
+					      localname);
+		if (err != 0) {
+			if (options->debug) {
+				debug("krb5_aname_to_localname "
+				      "failed: %s",
+				      v5_error_message(err));
+			}
+		} else {
+			if (strcmp(localname, user) == 0) {
+				if (options->debug) {
+					debug("krb5_aname_to_localname "
+					      "returned '%s' for '%s', "
+					      "allowing access",
+					      localname,
+					      userinfo->unparsed_name);
+				}
+				allowed = 1;
+			}
+		}
+	}
+#endif
+	return allowed;
+}
+
+#ifdef KUSEROK_IN_PROCESS
+#define KUSEROK_CACHE_SIZE 8
+#define KUSEROK_MAX_FILE_SIZE (1024 * 1024)
+
+/* The contents of .k5login files we've read recently, one principal name per
+ * line, with the newlines replaced by NULs, and which version of which file
+ * they came from. */
+static struct _pam_krb5_kuserok_cache_entry {
+	dev_t dev;
+	ino_t ino;
+	time_t mtime, ctime;
+	long mtime_nsec;
+	off_t size;
+	char *lines;
+	size_t length;
+} kuserok_cache[KUSEROK_CACHE_SIZE];
+static int kuserok_cache_next;
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t kuserok_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Filesystems which may be serving different contents to the user than they
+ * would to us, or which may need the user's credentials. */
+static const unsigned long kuserok_network_fs_types[] = {
+	0x6969,		/* NFS */
+	0x517b,		/* SMB */
+	0xff534d42,	/* CIFS */
+	0xfe534d42,	/* SMB2 */
+	0x5346414f,	/* AFS */
+	0x73757245,	/* Coda */
+	0x564c,		/* NCP */
+	0x00c36400,	/* Ceph */
+	0x01021997,	/* 9P */
+	0x65735546,	/* FUSE */
+	0x01161970,	/* GFS2 */
+	0x7461636f,	/* OCFS2 */
+	0x0bd00bd0,	/* Lustre */
+	0x47504653,	/* GPFS */
+};
+
+static int
+_pam_krb5_kuserok_network_fs(int fd)
+{
+	struct statfs sfs;
+	unsigned int i;
+
+	if (fstatfs(fd, &sfs) != 0) {
+		return 1;
+	}
+	for (i = 0;
+	     i < sizeof(kuserok_network_fs_types) /
+		 sizeof(kuserok_network_fs_types[0]);
+	     i++) {
+		if (((unsigned long) sfs.f_type & 0xffffffff) ==
+		    kuserok_network_fs_types[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Check for libkrb5 settings which change where it looks for the file, or
+ * how it treats one. */
+static int
+_pam_krb5_kuserok_configured(krb5_context ctx)
+{
+	const char *settings[][3] = {
+		{"libdefaults", "k5login_directory", NULL},
+		{"plugins", "localauth", "disable"},
+		{"plugins", "localauth", "enable_only"},
+		{"plugins", "localauth", "module"},
+	};
+	profile_t profile;
+	char *value;
+	unsigned int i;
+	int ret;
+
+	if (krb5_get_profile(ctx, &profile) != 0) {
+		return 1;
+	}
+	ret = 0;
+	for (i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+		value = NULL;
+		if ((profile_get_string(profile,
+					settings[i][0],
+					settings[i][1],
+					settings[i][2],
+					NULL,
+					&value) == 0) &&
+		    (value != NULL)) {
+			profile_release_string(value);
+			ret = 1;
+			break;
+		}
+	}
+	profile_release(profile);
+	return ret;
+}
+
+static int
+_pam_krb5_kuserok_cache_matches(struct _pam_krb5_kuserok_cache_entry *entry,
+				struct stat *st)
+{
+	return (entry->lines != NULL) &&
+	       (entry->dev == st->st_dev) &&
+	       (entry->ino == st->st_ino) &&
+	       (entry->mtime == st->st_mtime) &&
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	       (entry->mtime_nsec == st->st_mtim.tv_nsec) &&
+#endif
+	       (entry->ctime == st->st_ctime) &&
+	       (entry->size == st->st_size);
+}
+
+static int
+_pam_krb5_kuserok_listed(const char *lines, size_t length,
+			 const char *principal)
+{
+	size_t i;
+
+	for (i = 0; i < length; i += strlen(lines + i) + 1) {
+		if (strcmp(lines + i, principal) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Check if the principal is listed in the opened file, reading and
+ * remembering its contents if we haven't already. */
+static int
+_pam_krb5_kuserok_file_lists(int fd, struct stat *st, const char *principal,
+			     int debug_flag)
+{
+	struct _pam_krb5_kuserok_cache_entry *entry;
+	char *lines;
+	size_t length, i;
+	ssize_t n;
+	int ret;
+
+	ret = -1;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_lock(&kuserok_cache_lock);
+#endif
+	for (i = 0; i < KUSEROK_CACHE_SIZE; i++) {
+		entry = &kuserok_cache[i];
+		if (_pam_krb5_kuserok_cache_matches(entry, st)) {
+			if (debug_flag) {
+				debug("using cached copy of .k5login");
+			}
+			ret = _pam_krb5_kuserok_listed(entry->lines,
+						       entry->length,
+						       principal);
+			break;
+		}
+	}
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_unlock(&kuserok_cache_lock);
+#endif
+	if (ret != -1) {
+		return ret;
+	}
+
+	/* Read the whole file. */
+	lines = malloc(st->st_size + 1);
+	if (lines == NULL) {
+		return -1;
+	}
+	length = 0;
+	while (length < (size_t) st->st_size) {
+		n = read(fd, lines + length, st->st_size - length);
+		if ((n < 0) && (errno == EINTR)) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		length += n;
+	}
+	if (length != (size_t) st->st_size) {
+		free(lines);
+		return -1;
+	}
+	for (i = 0; i < length; i++) {
+		if (lines[i] == '\n') {
+			lines[i] = '\0';
+		}
+	}
+	lines[length] = '\0';
+	ret = _pam_krb5_kuserok_listed(lines, length, principal);
+
+	/* Remember it, replacing the oldest entry. */
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_lock(&kuserok_cache_lock);
+#endif
+	entry = &kuserok_cache[kuserok_cache_next];
+	kuserok_cache_next = (kuserok_cache_next + 1) % KUSEROK_CACHE_SIZE;
+	free(entry->lines);
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->mtime = st->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	entry->mtime_nsec = st->st_mtim.tv_nsec;
+#endif
+	entry->ctime = st->st_ctime;
+	entry->size = st->st_size;
+	entry->lines = lines;
+	entry->length = length;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_unlock(&kuserok_cache_lock);
+#endif
+	return ret;
+}
+
+/* Try to answer the question without starting a helper process: open the
+ * user's .k5login as the user, and if it's on a local filesystem, either find
+ * the principal in it or let libkrb5 take a look from here.  Returns -1 if
+ * we need to ask the helper.  Switching our filesystem IDs and groups affects
+ * every thread in the process, so this is only done when the
+ * "kuserok_in_process" option asks for it. */
+static int
+_pam_krb5_kuserok_local(krb5_context ctx,
+			struct _pam_krb5_options *options,
+			struct _pam_krb5_user_info *userinfo,
+			const char *user,
+			uid_t uid, gid_t gid)
+{
+	struct _pam_krb5_fs_perms saved;
+	struct stat st;
+	int dfd, fd, i;
+
+	if ((userinfo->homedir == NULL) ||
+	    _pam_krb5_kuserok_configured(ctx)) {
+		return -1;
+	}
+
+	/* Open the directory and the file as the user. */
+	dfd = -1;
+	fd = -1;
+	if (_pam_krb5_switch_fs_perms(uid, gid, &saved) == 0) {
+		dfd = open(userinfo->homedir, O_RDONLY | O_DIRECTORY);
+		if (dfd != -1) {
+			fd = openat(dfd, ".k5login",
+				    O_RDONLY | O_NOCTTY | O_NONBLOCK);
+			if (fd == -1) {
+				fd = (errno == ENOENT) ? -2 : -1;
+			}
+		}
+	}
+	_pam_krb5_restore_fs_perms(&saved);
+	if ((dfd == -1) || (fd == -1) ||
+	    _pam_krb5_kuserok_network_fs(dfd)) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		if (dfd != -1) {
+			close(dfd);
+		}
+		return -1;
+	}
+	close(dfd);
+
+	/* If there's no file, libkrb5 has nothing to read. */
+	if (fd == -2) {
+		return _pam_krb5_kuserok_check(ctx, options, userinfo, user);
+	}
+
+	/* Leave anything unusual about the file to libkrb5 and a helper. */
+	if ((fstat(fd, &st) != 0) ||
+	    !S_ISREG(st.st_mode) ||
+	    ((st.st_uid != uid) && (st.st_uid != 0)) ||
+	    (st.st_size > KUSEROK_MAX_FILE_SIZE) ||
+	    _pam_krb5_kuserok_network_fs(fd)) {
+		close(fd);
+		return -1;
+	}
+	i = _pam_krb5_kuserok_file_lists(fd, &st, userinfo->unparsed_name,
+					 options->debug);
+	close(fd);
+	switch (i) {
+	case 1:
+		if (options->debug) {
+			debug("found \"%s\" in .k5login for \"%s\"",
+			      userinfo->unparsed_name, user);
+		}
+		return TRUE;
+		break;
+	case 0:
+		/* Let libkrb5 apply its rules about names which aren't
+		 * listed, which we know it can read. */
+		return _pam_krb5_kuserok_check(ctx, options, userinfo, user);
+		break;
+	default:
+		return -1;
+		break;
+	}
+}
+#endif
+
 /* Use a helper to perform the kuserok check using the user's credentials,
  * in case we're in a root-squashed or needs-authentication situation with
- * a remotely-stored file. */
+ * a remotely-stored file.  If we're allowed to look for ourselves, and the
+ * file is stored locally, we don't need one. */
 krb5_boolean
 _pam_krb5_kuserok(krb5_context ctx,
                   struct _pam_krb5_stash *stash,
@@ -80,54 +451,37 @@ _pam_krb5_kuserok(krb5_context ctx,
 	int outpipe[2];
 	int i;
 	krb5_boolean allowed;
-	krb5_error_code err;
 	unsigned char result;
-	pid_t child;
-	struct sigaction saved_sigchld_handler, saved_sigpipe_handler;
-	struct sigaction ignore_handler, default_handler;
-	char envstr[PATH_MAX + 20], localname[PATH_MAX];
+	struct _pam_krb5_child child;
+	char envstr[PATH_MAX + 20];
 	const char *ccname;
 
-	if (pipe(outpipe) == -1) {
-		return -1;
-	}
-	/* Set signal handlers here.  We used to do it later, but that turns
-	 * out to be a race if the child decides to exit immediately. */
-	memset(&default_handler, 0, sizeof(default_handler));
-	default_handler.sa_handler = SIG_DFL;
-	if (sigaction(SIGCHLD, &default_handler, &saved_sigchld_handler) != 0) {
-		close(outpipe[0]);
-		close(outpipe[1]);
-		return -1;
+#ifdef KUSEROK_IN_PROCESS
+	if (options->kuserok_in_process) {
+		i = _pam_krb5_kuserok_local(ctx, options, userinfo, user,
+					    uid, gid);
+		if (i != -1) {
+			return i;
+		}
+		if (options->debug) {
+			debug("checking .k5login for \"%s\" using a helper",
+			      user);
+		}
 	}
-	memset(&ignore_handler, 0, sizeof(ignore_handler));
-	ignore_handler.sa_handler = SIG_IGN;
-	if (sigaction(SIGPIPE, &ignore_handler, &saved_sigpipe_handler) != 0) {
-		sigaction(SIGCHLD, &saved_sigchld_handler, NULL);
-		close(outpipe[0]);
-		close(outpipe[1]);
+#endif
+
+	if (pipe(outpipe) == -1) {
 		return -1;
 	}
-	switch (child = fork()) {
+	switch (_pam_krb5_child_fork(&child, uid, gid)) {
 	case -1:
-		sigaction(SIGCHLD, &saved_sigchld_handler, NULL);
-		sigaction(SIGPIPE, &saved_sigpipe_handler, NULL);
 		close(outpipe[0]);
 		close(outpipe[1]);
 		return -1;
 		break;
 	case 0:
-		/* We're the child. */
+		/* We're the child, running as the user. */
 		close(outpipe[0]);
-		setgroups(0, NULL);
-		/* Now, attempt to assume the desired uid/gid pair.  Note that
-		 * if we're not root, this is allowed to fail. */
-		if ((gid != getgid()) || (gid != getegid())) {
-			i = setregid(gid, gid);
-		}
-		if ((uid != getuid()) || (uid != geteuid())) {
-			i = setreuid(uid, uid);
-		}
 		/* Try to get tokens. */
 		if ((options->ignore_afs == 0) && tokens_useful()) {
 			tokens_obtain(ctx, stash, options, userinfo, 1);
@@ -149,39 +503,7 @@ _pam_krb5_kuserok(krb5_context ctx,
 		}
 		/* Actually check, now that we have a shot at being able to
 		 * read the user's .k5login file. */
-		allowed = krb5_kuserok(ctx, userinfo->principal_name, user);
-		if (options->debug) {
-			debug("krb5_kuserok() says \"%s\" for (\"%s\",\"%s\")",
-			      allowed ? "true" : "false",
-			      userinfo->unparsed_name, user);
-		}
-#ifdef HAVE_KRB5_ANAME_TO_LOCALNAME
-		if (!allowed && options->always_allow_localname) {
-			memset(&localname, '\0', sizeof(localname));
-			err = krb5_aname_to_localname(ctx,
-						      userinfo->principal_name,
-						      sizeof(localname),
-						      localname);
-			if (err != 0) {
-				if (options->debug) {
-					debug("krb5_aname_to_localname "
-					      "failed: %s",
-					      v5_error_message(err));
-				}
-			} else {
-				if (strcmp(localname, user) == 0) {
-					if (options->debug) {
-						debug("krb5_aname_to_localname "
-						      "returned '%s' for '%s', "
-						      "allowing access",
-						      localname,
-						      userinfo->unparsed_name);
-					}
-					allowed = 1;
-				}
-			}
-		}
-#endif
+		allowed = _pam_krb5_kuserok_check(ctx, options, userinfo, user);
 		/* Clean up. */
 		if (ccname != NULL) {
 			v5_destroy(ctx, stash, options);
@@ -198,9 +520,7 @@ _pam_krb5_kuserok(krb5_context ctx,
 		} else {
 			allowed = FALSE;
 		}
-		waitpid(child, NULL, 0);
-		sigaction(SIGCHLD, &saved_sigchld_handler, NULL);
-		sigaction(SIGPIPE, &saved_sigpipe_handler, NULL);
+		_pam_krb5_child_wait(&child);
 		close(outpipe[0]);
 		return allowed;
 		break;
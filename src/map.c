@@ -54,93 +54,261 @@
 #include "options.h"
 
 #define SEPARATOR '$'
+#define MAX_GROUPS 10
 
+/* How we match a pattern: with the regex library, or, for patterns which are
+ * just a literal prefix or suffix and a group which captures everything
+ * else, by comparing strings. */
+enum map_type {
+	map_type_invalid,
+	map_type_regex,
+	map_type_prefix,
+	map_type_suffix,
+};
+
+/* A piece of a replacement: either literal text, or a matched group. */
+struct map_piece {
+	const char *text;
+	size_t length;
+	int group;
+};
+
+struct name_mapping_compiled {
+	enum map_type type;
+	regex_t re;
+	char *literal;
+	size_t literal_length;
+	struct map_piece *pieces;
+	int n_pieces;
+};
+
+/* Check if "pattern", between "start" and "end", is only literal characters,
+ * possibly escaped, and if so, store them without the escapes in "literal". */
 static int
-map_single(const char *pattern, const char *replacement,
-	   const char *input, char *output, size_t output_len)
+map_parse_literal(const char *start, const char *end, char *literal,
+		  size_t *literal_length)
+{
+	const char *specials = ".[]()*+?{}|^$\\";
+	size_t n;
+
+	for (n = 0; start < end; start++) {
+		if (*start == '\\') {
+			start++;
+			if ((start == end) || (strchr(specials, *start) == NULL)) {
+				return -1;
+			}
+		} else if (strchr(specials, *start) != NULL) {
+			return -1;
+		}
+		literal[n++] = *start;
+	}
+	literal[n] = '\0';
+	*literal_length = n;
+	return 0;
+}
+
+/* Recognize "^literal(.*)$" and "^(.*)literal$". */
+static enum map_type
+map_parse_pattern(const char *pattern, char *literal, size_t *literal_length)
+{
+	const char *any = "(.*)";
+	size_t length;
+
+	length = strlen(pattern);
+	if ((length < strlen(any) + 2) ||
+	    (pattern[0] != '^') || (pattern[length - 1] != '$') ||
+	    ((length >= 2) && (pattern[length - 2] == '\\'))) {
+		return map_type_regex;
+	}
+	if ((strncmp(pattern + length - 1 - strlen(any), any,
+		     strlen(any)) == 0) &&
+	    (map_parse_literal(pattern + 1, pattern + length - 1 - strlen(any),
+			       literal, literal_length) == 0)) {
+		return map_type_prefix;
+	}
+	if ((strncmp(pattern + 1, any, strlen(any)) == 0) &&
+	    (map_parse_literal(pattern + 1 + strlen(any), pattern + length - 1,
+			       literal, literal_length) == 0)) {
+		return map_type_suffix;
+	}
+	return map_type_regex;
+}
+
+/* Split a replacement into literal text and references to groups. */
+static int
+map_parse_replacement(const char *replacement,
+		      struct map_piece **pieces, int *n_pieces)
 {
-	regex_t re;
-	regmatch_t *matches;
 	const char *specifiers = "0123456789", *p;
-	size_t n_matches;
-	unsigned int i, j;
-	int k, match;
+	struct map_piece *list;
+	int n;
 
-	/* Limit the length of the match array. */
-	n_matches = strlen(input) * 2;
-	if (n_matches > 100) {
+	*pieces = NULL;
+	*n_pieces = 0;
+	list = malloc(sizeof(*list) * (strlen(replacement) + 1));
+	if (list == NULL) {
 		return -1;
 	}
-	if (n_matches < strlen(specifiers)) {
-		n_matches = strlen(specifiers) * 2;
+	n = 0;
+	while (*replacement != '\0') {
+		if (*replacement != SEPARATOR) {
+			/* Run of literal text. */
+			list[n].text = replacement;
+			list[n].length = strcspn(replacement, "$");
+			list[n].group = -1;
+			replacement += list[n++].length;
+			continue;
+		}
+		replacement++;
+		if (*replacement == SEPARATOR) {
+			list[n].text = replacement;
+			list[n].length = 1;
+			list[n++].group = -1;
+		} else if ((*replacement != '\0') &&
+			   ((p = strchr(specifiers, *replacement)) != NULL)) {
+			list[n].text = NULL;
+			list[n].length = 0;
+			list[n++].group = p - specifiers;
+		}
+		/* Anything else after a separator is dropped. */
+		if (*replacement != '\0') {
+			replacement++;
+		}
 	}
-	matches = malloc(n_matches * sizeof(regmatch_t));
-	if (matches == NULL) {
+	*pieces = list;
+	*n_pieces = n;
+	return 0;
+}
+
+/* Compile a mapping's pattern and replacement for use by map_lname_aname().
+ * A mapping which fails to compile never matches. */
+int
+map_compile(struct name_mapping *mapping)
+{
+	struct name_mapping_compiled *compiled;
+
+	compiled = malloc(sizeof(*compiled));
+	if (compiled == NULL) {
 		return -1;
 	}
+	memset(compiled, 0, sizeof(*compiled));
+	mapping->compiled = compiled;
+	compiled->type = map_type_invalid;
+	compiled->literal = malloc(strlen(mapping->pattern) + 1);
+	if (compiled->literal == NULL) {
+		return -1;
+	}
+	if (map_parse_replacement(mapping->replacement, &compiled->pieces,
+				  &compiled->n_pieces) != 0) {
+		return -1;
+	}
+	compiled->type = map_parse_pattern(mapping->pattern, compiled->literal,
+					   &compiled->literal_length);
+	if (compiled->type == map_type_regex) {
+		if (regcomp(&compiled->re, mapping->pattern,
+			    REG_EXTENDED) != 0) {
+			compiled->type = map_type_invalid;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void
+map_free(struct name_mapping *mapping)
+{
+	struct name_mapping_compiled *compiled;
+
+	compiled = mapping->compiled;
+	if (compiled == NULL) {
+		return;
+	}
+	if (compiled->type == map_type_regex) {
+		regfree(&compiled->re);
+	}
+	free(compiled->literal);
+	free(compiled->pieces);
+	free(compiled);
+	mapping->compiled = NULL;
+}
 
-	for (i = 0; i < n_matches; i++) {
+static int
+map_single(const struct name_mapping_compiled *compiled,
+	   const char *input, char *output, size_t output_len)
+{
+	regmatch_t matches[MAX_GROUPS];
+	const struct map_piece *piece;
+	size_t length, j;
+	int i;
+
+	for (i = 0; i < MAX_GROUPS; i++) {
 		matches[i].rm_so = -1;
 		matches[i].rm_eo = -1;
 	}
 
-	/* Build the pattern and check for a match. */
-	i = regcomp(&re, pattern, REG_EXTENDED);
-	if (i != 0) {
-		free(matches);
-		return -1;
-	}
-	i = regexec(&re, input, n_matches, matches, 0);
-	if (i != 0) {
-		free(matches);
-		regfree(&re);
-		return -1;
-	}
-	if ((matches[0].rm_so == -1) && (matches[0].rm_eo != -1)) {
-		free(matches);
-		regfree(&re);
+	/* Check for a match. */
+	length = strlen(input);
+	switch (compiled->type) {
+	case map_type_prefix:
+		if ((length < compiled->literal_length) ||
+		    (memcmp(input, compiled->literal,
+			    compiled->literal_length) != 0)) {
+			return -1;
+		}
+		matches[0].rm_so = 0;
+		matches[0].rm_eo = length;
+		matches[1].rm_so = compiled->literal_length;
+		matches[1].rm_eo = length;
+		break;
+	case map_type_suffix:
+		if ((length < compiled->literal_length) ||
+		    (memcmp(input + length - compiled->literal_length,
+			    compiled->literal,
+			    compiled->literal_length) != 0)) {
+			return -1;
+		}
+		matches[0].rm_so = 0;
+		matches[0].rm_eo = length;
+		matches[1].rm_so = 0;
+		matches[1].rm_eo = length - compiled->literal_length;
+		break;
+	case map_type_regex:
+		if (regexec(&compiled->re, input, MAX_GROUPS, matches, 0) != 0) {
+			return -1;
+		}
+		if ((matches[0].rm_so == -1) && (matches[0].rm_eo != -1)) {
+			return -1;
+		}
+		break;
+	default:
 		return -1;
 	}
-	regfree(&re);
 
 	/* Build the output string. */
-	for (i = j = 0; (replacement[i] != '\0') && (j < output_len - 1); i++) {
-		switch (replacement[i]) {
-		case SEPARATOR:
-			i++;
-			if (replacement[i] == SEPARATOR) {
-				output[j++] = replacement[i];
-			} else {
-				/* Decide which match to insert here. */
-				p = strchr(specifiers, replacement[i]);
-				if (p != NULL) {
-					match = p - specifiers;
-				} else {
-					match = -1;
-				}
-				/* Only bother if we have a match. */
-				if ((match != -1) &&
-				    (matches[match].rm_so != -1) &&
-				    (matches[match].rm_eo != -1)) {
-					k = matches[match].rm_so;
-					while ((k < matches[match].rm_eo) &&
-					       (j < output_len - 1)) {
-						output[j++] = input[k++];
-					}
-				}
+	for (i = 0, j = 0; i < compiled->n_pieces; i++) {
+		piece = &compiled->pieces[i];
+		if (piece->group == -1) {
+			if (j + piece->length >= output_len) {
+				return -1;
 			}
-			break;
-		default:
-			output[j++] = replacement[i];
-			break;
+			memcpy(output + j, piece->text, piece->length);
+			j += piece->length;
+			continue;
+		}
+		/* Only bother if we have a match. */
+		if ((matches[piece->group].rm_so == -1) ||
+		    (matches[piece->group].rm_eo == -1)) {
+			continue;
+		}
+		length = matches[piece->group].rm_eo -
+			 matches[piece->group].rm_so;
+		if (j + length >= output_len) {
+			return -1;
 		}
+		memcpy(output + j, input + matches[piece->group].rm_so, length);
+		j += length;
 	}
-	free(matches);
 	output[j] = '\0';
-	/* Check for unexpected truncation. */
-	if (replacement[i] != '\0') {
-		return -1;
-	}
 	return 0;
 }
 
@@ -151,10 +319,15 @@ map_lname_aname(const struct name_mapping *mappings, int n_mappings,
 {
 	int i, status;
 
+	if (principal_len == 0) {
+		return -1;
+	}
 	/* Iterate through the maps. */
 	for (i = 0; i < n_mappings; i++) {
-		status = map_single(mappings[i].pattern,
-				    mappings[i].replacement,
+		if (mappings[i].compiled == NULL) {
+			continue;
+		}
+		status = map_single(mappings[i].compiled,
 				    lname,
 				    principal,
 				    principal_len);
@@ -164,25 +337,3 @@ map_lname_aname(const struct name_mapping *mappings, int n_mappings,
 	}
 	return -1;
 }
-
-#if 0
-int
-main(int argc, char **argv)
-{
-	char output[LINE_MAX];
-	int i;
-
-	if (argc < 4) {
-		printf("Usage: %s pattern replacment data\n", argv[0]);
-		return 1;
-	}
-	i = map_single(argv[1], argv[2], argv[3],
-		       output, sizeof(output));
-	if (i == 0) {
-		printf("Match: \"%s\" -> \"%s\"\n", argv[3], output);
-	} else {
-		printf("No match: \"%s\"\n", argv[3]);
-	}
-	return 0;
-}
-#endif
@@ -35,6 +35,8 @@
 
 #include "options.h"
 
+int map_compile(struct name_mapping *mapping);
+void map_free(struct name_mapping *mapping);
 int map_lname_aname(const struct name_mapping *mappings, int n_mappings,
 		    const char *lname, char *principal, size_t principal_len);
 
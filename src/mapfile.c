@@ -0,0 +1,149 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mapfile.h"
+
+int
+_pam_krb5_mapfile_lock(struct _pam_krb5_mapfile *mapfile, int type)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	while (fcntl(mapfile->fd, F_SETLKW, &fl) != 0) {
+		if (errno != EINTR) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void
+_pam_krb5_mapfile_unlock(struct _pam_krb5_mapfile *mapfile)
+{
+	_pam_krb5_mapfile_lock(mapfile, F_UNLCK);
+}
+
+/* Map the calling user's copy of the named file, creating it if need be.  We
+ * only trust a file which is a plain file that belongs to us and which nobody
+ * else can write.  The caller's table has to start with a
+ * _pam_krb5_mapfile_header. */
+struct _pam_krb5_mapfile *
+_pam_krb5_mapfile_open(const char *dir, const char *name, size_t size,
+		       uint32_t magic, uint32_t version)
+{
+	struct _pam_krb5_mapfile *mapfile;
+	struct _pam_krb5_mapfile_header *header;
+	char path[PATH_MAX];
+	struct stat st;
+	void *p;
+	int fd;
+
+	if ((dir == NULL) ||
+	    (size < sizeof(*header)) ||
+	    (snprintf(path, sizeof(path), "%s/%s_%lu", dir, name,
+		      (unsigned long) geteuid()) >= (int) sizeof(path))) {
+		return NULL;
+	}
+	fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_NONBLOCK,
+		  S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		return NULL;
+	}
+	if ((fstat(fd, &st) != 0) ||
+	    !S_ISREG(st.st_mode) ||
+	    (st.st_uid != geteuid()) ||
+	    ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0)) {
+		close(fd);
+		return NULL;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	mapfile = malloc(sizeof(*mapfile));
+	if (mapfile == NULL) {
+		close(fd);
+		return NULL;
+	}
+	mapfile->fd = fd;
+	mapfile->size = size;
+	/* Check the size again now that nobody else can be changing it. */
+	if ((_pam_krb5_mapfile_lock(mapfile, F_WRLCK) != 0) ||
+	    (fstat(fd, &st) != 0) ||
+	    (ftruncate(fd, size) != 0)) {
+		close(fd);
+		free(mapfile);
+		return NULL;
+	}
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		free(mapfile);
+		return NULL;
+	}
+	mapfile->data = p;
+	/* A new file, or one written by an incompatible version, gets
+	 * reset. */
+	header = p;
+	if ((st.st_size != (off_t) size) ||
+	    (header->magic != magic) || (header->version != version)) {
+		memset(p, 0, size);
+		header->magic = magic;
+		header->version = version;
+	}
+	_pam_krb5_mapfile_unlock(mapfile);
+	return mapfile;
+}
+
+void
+_pam_krb5_mapfile_close(struct _pam_krb5_mapfile *mapfile)
+{
+	if (mapfile == NULL) {
+		return;
+	}
+	munmap(mapfile->data, mapfile->size);
+	close(mapfile->fd);
+	free(mapfile);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef pam_krb5_mapfile_h
+#define pam_krb5_mapfile_h
+
+/* A small file in ccache_dir, mapped into memory and shared by all of a
+ * user's processes.  Its contents start with a magic number and a version,
+ * and are reset whenever either of them isn't what we expect. */
+struct _pam_krb5_mapfile {
+	int fd;
+	size_t size;
+	void *data;
+};
+
+struct _pam_krb5_mapfile_header {
+	uint32_t magic, version;
+};
+
+struct _pam_krb5_mapfile *_pam_krb5_mapfile_open(const char *dir,
+						 const char *name,
+						 size_t size,
+						 uint32_t magic,
+						 uint32_t version);
+int _pam_krb5_mapfile_lock(struct _pam_krb5_mapfile *mapfile, int type);
+void _pam_krb5_mapfile_unlock(struct _pam_krb5_mapfile *mapfile);
+void _pam_krb5_mapfile_close(struct _pam_krb5_mapfile *mapfile);
+
+#endif
@@ -46,7 +46,9 @@
 
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
+#include <sys/time.h>
 #ifdef HAVE_SYS_IOCCOM_H
 #include <sys/ioccom.h>
 #endif
@@ -58,6 +60,7 @@
 #endif
 #include <limits.h>
 #include <netdb.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #ifdef HAVE_STDINT_H
@@ -65,6 +68,7 @@
 #endif
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_SECURITY_PAM_APPL_H
@@ -77,8 +81,11 @@
  
 #include KRB5_H
 
+#include "ccfile.h"
+#include "child.h"
 #include "init.h"
 #include "log.h"
+#include "mapfile.h"
 #include "minikafs.h"
 #include "v5.h"
 #include "xstr.h"
@@ -107,6 +114,46 @@
  * thread-safe, we'll have to lock around accesses to this. */
 static const char *minikafs_procpath = NULL;
 
+/* A descriptor for minikafs_procpath, which we keep open for as long as we're
+ * loaded instead of opening it for every call.  Children which we or our
+ * caller fork can keep using it, because AFS looks at the credentials and PAG
+ * of the process which makes the call, and not those of the process which
+ * opened the file, but it's close-on-exec so that it won't leak into anything
+ * they run.  The application may close it, and then open something else which
+ * gets the same number, so we remember which file it was, and check before
+ * using it.  We also remember if we've found AFS to be running, and count the
+ * system calls which doing these things has saved us. */
+static int minikafs_procfd = -1;
+static dev_t minikafs_procfd_dev;
+static ino_t minikafs_procfd_ino;
+static int minikafs_afs_running = 0;
+static unsigned long minikafs_saved_syscalls = 0;
+
+/* Realms which we've found AFS cells to be in, so that we don't have to go
+ * through minikafs_realm_of_cell_lookup() for each of them every time.  We
+ * keep a few in memory, and if we're root, a longer list in a file in
+ * ccache_dir which any of our callers can use. */
+#define MINIKAFS_REALM_FILE "pam_krb5_afs_realms"
+#define MINIKAFS_REALM_MAGIC 0x6b616672
+#define MINIKAFS_REALM_VERSION 1
+#define MINIKAFS_REALM_ENTRIES 64
+#define MINIKAFS_REALM_MEMORY 8
+struct minikafs_realm_entry {
+	int64_t expires;
+	char cell[256];
+	char realm[256];
+};
+struct minikafs_realm_table {
+	uint32_t magic, version;
+	struct minikafs_realm_entry entries[MINIKAFS_REALM_ENTRIES];
+};
+static struct minikafs_realm_entry minikafs_realm_memory[MINIKAFS_REALM_MEMORY];
+static unsigned int minikafs_realm_memory_next = 0;
+
+/* Set in a child process started by minikafs_prefetch(): instead of setting
+ * tokens using the credentials we get, send them to our parent here. */
+static int minikafs_prefetch_fd = -1;
+
 #define VIOCTL_SYSCALL ((unsigned int) _IOW('C', 1, void *))
 #define VIOCTL_FN(id)  ((unsigned int) _IOW('V', (id), struct minikafs_ioblock))
 #define CIOCTL_FN(id)  ((unsigned int) _IOW('C', (id), struct minikafs_ioblock))
@@ -164,26 +211,123 @@ enum minikafs_pioctl_fn {
 /* Forward declarations. */
 static int minikafs_5settoken2(const char *cell, krb5_creds *creds, int32_t id);
 
+/* Check that the descriptor we kept is still the one we opened. */
+static int
+minikafs_procfd_ours(void)
+{
+	struct stat st;
+
+	return (minikafs_procfd != -1) &&
+	       (fstat(minikafs_procfd, &st) == 0) &&
+	       (st.st_dev == minikafs_procfd_dev) &&
+	       (st.st_ino == minikafs_procfd_ino);
+}
+
+/* Stop using the descriptor we kept, closing it only if it's still ours. */
+static void
+minikafs_procfd_forget(void)
+{
+	if (minikafs_procfd_ours()) {
+		close(minikafs_procfd);
+	}
+	minikafs_procfd = -1;
+}
+
+/* Open the file in /proc which we use to call AFS, and keep it for later.
+ * Returns the descriptor, or -1 on failure. */
+static int
+minikafs_procfd_open(const char *path)
+{
+	struct stat st;
+	int fd;
+
+	minikafs_procfd_forget();
+#ifdef O_CLOEXEC
+	fd = open(path, O_RDWR | O_CLOEXEC);
+#else
+	fd = open(path, O_RDWR);
+	if (fd != -1) {
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+#endif
+	if ((fd != -1) && (fstat(fd, &st) != 0)) {
+		close(fd);
+		fd = -1;
+	}
+	if (fd != -1) {
+		minikafs_procfd = fd;
+		minikafs_procfd_dev = st.st_dev;
+		minikafs_procfd_ino = st.st_ino;
+		minikafs_procpath = path;
+	}
+	return fd;
+}
+
+/* Close the file in /proc when we're unloaded, so that a long-running process
+ * which loads and unloads us for each of its users doesn't run out of
+ * descriptors. */
+#ifdef __GNUC__
+static void minikafs_procfd_close(void) __attribute__((destructor));
+#endif
+static void
+minikafs_procfd_close(void)
+{
+	minikafs_procfd_forget();
+}
+
+/* Return the number of system calls which we've avoided making since the last
+ * time we were asked. */
+unsigned long
+minikafs_syscalls_saved(void)
+{
+	unsigned long ret;
+
+	ret = minikafs_saved_syscalls;
+	minikafs_saved_syscalls = 0;
+	return ret;
+}
+
 /* Call AFS using an ioctl. Might not port to your system. */
 static int
 minikafs_ioctlcall(long function, long arg1, long arg2, long arg3, long arg4)
 {
-	int fd, ret, saved_errno;
+	int ret, tries;
 	struct minikafs_procdata data;
-	fd = open(minikafs_procpath, O_RDWR);
-	if (fd == -1) {
-		errno = EINVAL;
-		return -1;
-	}
+
 	data.function = function;
 	data.param1 = arg1;
 	data.param2 = arg2;
 	data.param3 = arg3;
 	data.param4 = arg4;
-	ret = ioctl(fd, VIOCTL_SYSCALL, &data);
-	saved_errno = errno;
-	close(fd);
-	errno = saved_errno;
+	for (tries = 0; tries < 2; tries++) {
+		/* If someone closed our descriptor out from under us, and
+		 * maybe reused its number, leave it alone and open the file
+		 * again. */
+		if ((minikafs_procfd != -1) && !minikafs_procfd_ours()) {
+			minikafs_procfd = -1;
+		}
+		if (minikafs_procfd == -1) {
+			if (minikafs_procfd_open(minikafs_procpath) == -1) {
+				errno = EINVAL;
+				return -1;
+			}
+		} else {
+			/* Saved an open() and a close(), at the cost of an
+			 * fstat(). */
+			minikafs_saved_syscalls += 1;
+		}
+		ret = ioctl(minikafs_procfd, VIOCTL_SYSCALL, &data);
+		/* If it was closed between our check and the call, retry. */
+		if ((ret == -1) && (errno == EBADF)) {
+			minikafs_procfd = -1;
+			continue;
+		}
+		break;
+	}
+#ifndef __GNUC__
+	/* Without a way to close it when we're unloaded, don't keep it. */
+	minikafs_procfd_close();
+#endif
 	return ret;
 }
 
@@ -273,24 +417,30 @@ minikafs_has_afs(void)
 	int fd, i, ret;
 	struct sigaction news, olds;
 
+	/* Once we've found AFS, it isn't going anywhere, so don't look for
+	 * it again. */
+	if (minikafs_afs_running) {
+		/* Saved an open() and a close(). */
+		minikafs_saved_syscalls += 2;
+		return 1;
+	}
+
 	fd = -1;
 
 #ifdef OPENAFS_AFS_IOCTL_FILE
 	if (fd == -1) {
-		fd = open(OPENAFS_AFS_IOCTL_FILE, O_RDWR);
+		fd = minikafs_procfd_open(OPENAFS_AFS_IOCTL_FILE);
 		if (fd != -1) {
-			minikafs_procpath = OPENAFS_AFS_IOCTL_FILE;
-			close(fd);
+			minikafs_afs_running = 1;
 			return 1;
 		}
 	}
 #endif
 #ifdef ARLA_AFS_IOCTL_FILE
 	if (fd == -1) {
-		fd = open(ARLA_AFS_IOCTL_FILE, O_RDWR);
+		fd = minikafs_procfd_open(ARLA_AFS_IOCTL_FILE);
 		if (fd != -1) {
-			minikafs_procpath = ARLA_AFS_IOCTL_FILE;
-			close(fd);
+			minikafs_afs_running = 1;
 			return 1;
 		}
 	}
@@ -322,10 +472,10 @@ minikafs_has_afs(void)
  * volume from the cell is mounted there), converting the address to a host
  * name, and then asking libkrb5 to tell us to which realm the host belongs. */
 static int
-minikafs_realm_of_cell_with_ctx(krb5_context ctx,
-				struct _pam_krb5_options *options,
-				const char *cell,
-				char *realm, size_t length)
+minikafs_realm_of_cell_lookup(krb5_context ctx,
+			      struct _pam_krb5_options *options,
+			      const char *cell,
+			      char *realm, size_t length)
 {
 	struct minikafs_ioblock iob;
 	struct sockaddr_in sin;
@@ -460,6 +610,154 @@ minikafs_realm_of_cell_with_ctx(krb5_context ctx,
 	return i;
 }
 
+/* Look up the realm of a cell in the list of ones we've found before, first in
+ * the copy we keep in memory, and then in the one which root keeps in
+ * ccache_dir. */
+static int
+minikafs_realm_of_cell_cached(struct _pam_krb5_options *options,
+			      const char *cell, char *realm, size_t length)
+{
+	struct _pam_krb5_mapfile *file;
+	struct minikafs_realm_table *table;
+	struct minikafs_realm_entry *entry;
+	int64_t now;
+	unsigned int i;
+
+	now = time(NULL);
+	for (i = 0; i < MINIKAFS_REALM_MEMORY; i++) {
+		entry = &minikafs_realm_memory[i];
+		if ((entry->expires > now) &&
+		    (strcmp(entry->cell, cell) == 0) &&
+		    (strlen(entry->realm) < length)) {
+			strcpy(realm, entry->realm);
+			return 0;
+		}
+	}
+	if (geteuid() != 0) {
+		return -1;
+	}
+	file = _pam_krb5_mapfile_open(options->ccache_dir,
+				      MINIKAFS_REALM_FILE,
+				      sizeof(*table),
+				      MINIKAFS_REALM_MAGIC,
+				      MINIKAFS_REALM_VERSION);
+	if (file == NULL) {
+		return -1;
+	}
+	if (_pam_krb5_mapfile_lock(file, F_RDLCK) != 0) {
+		_pam_krb5_mapfile_close(file);
+		return -1;
+	}
+	table = file->data;
+	entry = NULL;
+	for (i = 0; i < MINIKAFS_REALM_ENTRIES; i++) {
+		if ((table->entries[i].expires > now) &&
+		    (strncmp(table->entries[i].cell, cell,
+			     sizeof(table->entries[i].cell)) == 0) &&
+		    (memchr(table->entries[i].realm, '\0',
+			    sizeof(table->entries[i].realm)) != NULL) &&
+		    (strlen(table->entries[i].realm) < length)) {
+			entry = &table->entries[i];
+			break;
+		}
+	}
+	if (entry != NULL) {
+		memcpy(&minikafs_realm_memory[minikafs_realm_memory_next],
+		       entry, sizeof(*entry));
+		minikafs_realm_memory_next = (minikafs_realm_memory_next + 1) %
+					     MINIKAFS_REALM_MEMORY;
+		strcpy(realm, entry->realm);
+	}
+	_pam_krb5_mapfile_unlock(file);
+	_pam_krb5_mapfile_close(file);
+	return (entry != NULL) ? 0 : -1;
+}
+
+/* Remember the realm of a cell, both in memory and, if we're root, in the
+ * shared list, where it takes over the slot which will expire soonest if
+ * there isn't one for the cell already. */
+static void
+minikafs_realm_of_cell_remember(struct _pam_krb5_options *options,
+				const char *cell, const char *realm)
+{
+	struct _pam_krb5_mapfile *file;
+	struct minikafs_realm_table *table;
+	struct minikafs_realm_entry *entry, new_entry;
+	unsigned int i;
+
+	memset(&new_entry, 0, sizeof(new_entry));
+	if ((strlen(cell) >= sizeof(new_entry.cell)) ||
+	    (strlen(realm) >= sizeof(new_entry.realm))) {
+		return;
+	}
+	strcpy(new_entry.cell, cell);
+	strcpy(new_entry.realm, realm);
+	new_entry.expires = (int64_t) time(NULL) + options->afs_realm_ttl;
+	memcpy(&minikafs_realm_memory[minikafs_realm_memory_next],
+	       &new_entry, sizeof(new_entry));
+	minikafs_realm_memory_next = (minikafs_realm_memory_next + 1) %
+				     MINIKAFS_REALM_MEMORY;
+	if (geteuid() != 0) {
+		return;
+	}
+	file = _pam_krb5_mapfile_open(options->ccache_dir,
+				      MINIKAFS_REALM_FILE,
+				      sizeof(*table),
+				      MINIKAFS_REALM_MAGIC,
+				      MINIKAFS_REALM_VERSION);
+	if (file == NULL) {
+		return;
+	}
+	if (_pam_krb5_mapfile_lock(file, F_WRLCK) != 0) {
+		_pam_krb5_mapfile_close(file);
+		return;
+	}
+	table = file->data;
+	entry = &table->entries[0];
+	for (i = 0; i < MINIKAFS_REALM_ENTRIES; i++) {
+		if (strncmp(table->entries[i].cell, cell,
+			    sizeof(table->entries[i].cell)) == 0) {
+			entry = &table->entries[i];
+			break;
+		}
+		if (table->entries[i].expires < entry->expires) {
+			entry = &table->entries[i];
+		}
+	}
+	memcpy(entry, &new_entry, sizeof(new_entry));
+	_pam_krb5_mapfile_unlock(file);
+	_pam_krb5_mapfile_close(file);
+}
+
+/* Determine in which realm a cell exists, if we don't already know. */
+static int
+minikafs_realm_of_cell_with_ctx(krb5_context ctx,
+				struct _pam_krb5_options *options,
+				const char *cell,
+				char *realm, size_t length)
+{
+	if ((cell == NULL) || (options->afs_realm_ttl <= 0)) {
+		return minikafs_realm_of_cell_lookup(ctx, options, cell,
+						     realm, length);
+	}
+	if (minikafs_realm_of_cell_cached(options, cell, realm, length) == 0) {
+		if (options->debug) {
+			debug("remembered that \"%s\" is in realm \"%s\"",
+			      cell, realm);
+		}
+		return 0;
+	}
+	/* Only remember an answer we actually got from libkrb5. */
+	memset(realm, '\0', length);
+	if ((minikafs_realm_of_cell_lookup(ctx, options, cell,
+					   realm, length) != 0) ||
+	    (strlen(realm) == 0)) {
+		return -1;
+	}
+	minikafs_realm_of_cell_remember(options, cell, realm);
+	return 0;
+}
+
 /* Create a new PAG. */
 int
 minikafs_setpag(void)
@@ -981,6 +1279,32 @@ minikafs_get_rxk5_enctypes(krb5_enctype *etypes, int n_etypes)
 	return n;
 }
 
+/* Pass a credential to the process which started us, as a length followed by
+ * the credential as it would appear in a FILE: ccache. */
+static int
+minikafs_prefetch_send(krb5_context ctx, krb5_creds *creds)
+{
+	unsigned char *blob, length[4];
+	size_t blob_size, sent;
+	ssize_t n;
+
+	if (_pam_krb5_ccfile_serialize_cred(ctx, creds,
+					    &blob, &blob_size) != 0) {
+		return -1;
+	}
+	length[0] = (blob_size >> 24) & 0xff;
+	length[1] = (blob_size >> 16) & 0xff;
+	length[2] = (blob_size >>  8) & 0xff;
+	length[3] = (blob_size >>  0) & 0xff;
+	n = write(minikafs_prefetch_fd, length, sizeof(length));
+	for (sent = 0; (n > 0) && (sent < blob_size); sent += n) {
+		n = write(minikafs_prefetch_fd, blob + sent, blob_size - sent);
+	}
+	memset(blob, '\0', blob_size);
+	free(blob);
+	return (sent == blob_size) ? 0 : -1;
+}
+
 /* Try to set a token for the given cell using creds for the named principal. */
 static int
 minikafs_5log_with_principal(krb5_context ctx,
@@ -1079,6 +1403,14 @@ minikafs_5log_with_principal(krb5_context ctx,
 		}
 		if (krb5_cc_retrieve_cred(ctx, ccache, v5_cc_retrieve_match(),
 					  &mcreds, &creds) == 0) {
+			if (minikafs_prefetch_fd != -1) {
+				/* Our parent already has this one. */
+				krb5_free_cred_contents(ctx, &creds);
+				v5_free_unparsed_name(ctx, unparsed_client);
+				krb5_free_principal(ctx, client);
+				krb5_free_principal(ctx, server);
+				return 0;
+			} else
 			if (use_rxk5 &&
 			    (minikafs_5settoken2(cell, &creds, uid) == 0)) {
 				krb5_free_cred_contents(ctx, &creds);
@@ -1111,6 +1443,16 @@ minikafs_5log_with_principal(krb5_context ctx,
 		tmp = krb5_get_credentials(ctx, 0, ccache,
 					   &mcreds, &new_creds);
 		if (tmp == 0) {
+			if (minikafs_prefetch_fd != -1) {
+				/* Our parent sets the token, so whether or
+				 * not it gets this, we never do. */
+				tmp = minikafs_prefetch_send(ctx, new_creds);
+				krb5_free_creds(ctx, new_creds);
+				v5_free_unparsed_name(ctx, unparsed_client);
+				krb5_free_principal(ctx, client);
+				krb5_free_principal(ctx, server);
+				return (tmp == 0) ? 0 : -1;
+			} else
 			if (use_rxk5 &&
 			    (minikafs_5settoken2(cell, new_creds, uid) == 0)) {
 				krb5_free_creds(ctx, new_creds);
@@ -1451,6 +1793,189 @@ minikafs_log(krb5_context ctx, krb5_ccache ccache,
 	}
 }
 
+/* Start a child process for each of the listed cells, which goes through the
+ * same steps minikafs_log() would, but which sends us the service tickets it
+ * gets instead of setting tokens with them, and add the tickets to "ccache".
+ * That way the KDCs for all of the cells are asked at the same time, and when
+ * minikafs_log() is called for each cell in turn, it finds what it needs
+ * already there.  How long each cell took is stored in "usec".  Cells which
+ * are NULL are skipped. */
+int
+minikafs_prefetch(krb5_context ctx, krb5_ccache ccache,
+		  struct _pam_krb5_options *options,
+		  const char **cells, const char **hint_principals,
+		  int n_cells, uid_t uid,
+		  const int *methods, int n_methods, long *usec)
+{
+	struct minikafs_prefetch {
+		struct _pam_krb5_child child;
+		int fd;
+		struct timeval start;
+		unsigned char *data;
+		size_t length, allocated;
+		int started;
+	} *prefetch;
+	struct pollfd *pfds;
+	struct timeval now;
+	krb5_ccache child_ccache;
+	unsigned char *p;
+	size_t length;
+	ssize_t n;
+	int i, fds[2], n_children, n_open, started_all;
+
+	if ((ccache == NULL) || (n_cells < 1) ||
+	    !_pam_krb5_ccfile_available()) {
+		return -1;
+	}
+	prefetch = calloc(n_cells, sizeof(*prefetch));
+	pfds = calloc(n_cells, sizeof(*pfds));
+	if ((prefetch == NULL) || (pfds == NULL)) {
+		free(prefetch);
+		free(pfds);
+		return -1;
+	}
+
+	/* Start the children. */
+	for (i = 0; i < n_cells; i++) {
+		usec[i] = -1;
+		prefetch[i].fd = -1;
+	}
+	n_children = 0;
+	for (i = 0; i < n_cells; i++) {
+		if (cells[i] == NULL) {
+			continue;
+		}
+		if (pipe(fds) != 0) {
+			break;
+		}
+		gettimeofday(&prefetch[i].start, NULL);
+		switch (_pam_krb5_child_fork(&prefetch[i].child,
+					     getuid(), getgid())) {
+		case -1:
+			close(fds[0]);
+			close(fds[1]);
+			break;
+		case 0:
+			close(fds[0]);
+			minikafs_prefetch_fd = fds[1];
+			child_ccache = NULL;
+			if (v5_cc_copy(ctx, options->realm, ccache,
+				       &child_ccache) == 0) {
+				minikafs_log(ctx, child_ccache, options,
+					     cells[i], hint_principals[i], uid,
+					     methods, n_methods);
+			}
+			_exit(0);
+			break;
+		default:
+			close(fds[1]);
+			prefetch[i].fd = fds[0];
+			prefetch[i].started = 1;
+			n_children++;
+			continue;
+		}
+		break;
+	}
+	started_all = (i == n_cells);
+	if (options->debug) {
+		debug("fetching tickets for %d AFS cells at once",
+		      n_children);
+	}
+
+	/* Read what they send us until they're all done. */
+	n_open = n_children;
+	while (n_open > 0) {
+		for (i = 0; i < n_cells; i++) {
+			pfds[i].fd = prefetch[i].fd;
+			pfds[i].events = POLLIN;
+			pfds[i].revents = 0;
+		}
+		if (poll(pfds, n_cells, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		for (i = 0; i < n_cells; i++) {
+			if ((prefetch[i].fd == -1) ||
+			    ((pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) ==
+			     0)) {
+				continue;
+			}
+			if (prefetch[i].length == prefetch[i].allocated) {
+				p = realloc(prefetch[i].data,
+					    prefetch[i].allocated + 4096);
+				if (p != NULL) {
+					prefetch[i].data = p;
+					prefetch[i].allocated += 4096;
+				}
+			}
+			if (prefetch[i].length < prefetch[i].allocated) {
+				n = read(prefetch[i].fd,
+					 prefetch[i].data + prefetch[i].length,
+					 prefetch[i].allocated -
+					 prefetch[i].length);
+				if ((n == -1) && (errno == EINTR)) {
+					continue;
+				}
+			} else {
+				n = -1;
+			}
+			if (n > 0) {
+				prefetch[i].length += n;
+				continue;
+			}
+			close(prefetch[i].fd);
+			prefetch[i].fd = -1;
+			gettimeofday(&now, NULL);
+			usec[i] = (now.tv_sec - prefetch[i].start.tv_sec) *
+				  1000000L +
+				  (now.tv_usec - prefetch[i].start.tv_usec);
+			n_open--;
+		}
+	}
+
+	/* Reap them, most recent first, so that the signal handlers which
+	 * were in place before we started are the ones which end up being
+	 * restored, and store what they sent us, in the order in which the
+	 * cells were listed. */
+	for (i = n_cells - 1; i >= 0; i--) {
+		if (!prefetch[i].started) {
+			continue;
+		}
+		if (prefetch[i].fd != -1) {
+			close(prefetch[i].fd);
+		}
+		_pam_krb5_child_wait(&prefetch[i].child);
+	}
+	for (i = 0; i < n_cells; i++) {
+		p = prefetch[i].data;
+		while ((p != NULL) &&
+		       (p + 4 <= prefetch[i].data + prefetch[i].length)) {
+			length = ((size_t) p[0] << 24) | (p[1] << 16) |
+				 (p[2] << 8) | p[3];
+			p += 4;
+			if (length > (size_t) (prefetch[i].data +
+					       prefetch[i].length - p)) {
+				break;
+			}
+			if (_pam_krb5_ccfile_store_cred(ctx, p, length,
+							ccache, 0) != 0) {
+				warn("error storing ticket for cell \"%s\"",
+				     cells[i]);
+			}
+			p += length;
+		}
+		if (prefetch[i].data != NULL) {
+			memset(prefetch[i].data, '\0', prefetch[i].allocated);
+			free(prefetch[i].data);
+		}
+	}
+	free(pfds);
+	free(prefetch);
+	return started_all ? 0 : -1;
+}
+
 /* We do the XDR here to avoid deps on what might not be a standard part of
  * glibc, and we don't need the decode or free functionality. */
 static int
@@ -1694,3 +2219,199 @@ minikafs_5settoken2(const char *cell, krb5_creds *creds, int32_t uid)
 	}
 	return i;
 }
+
+/* Read back the sort of data which the encode_*() functions write. */
+struct decoder {
+	const unsigned char *data;
+	size_t length, offset;
+	int error;
+};
+static const unsigned char *
+decode_take(struct decoder *decoder, size_t length)
+{
+	const unsigned char *p;
+	if (decoder->error ||
+	    (length > decoder->length - decoder->offset)) {
+		decoder->error = 1;
+		return NULL;
+	}
+	p = decoder->data + decoder->offset;
+	decoder->offset += length;
+	return p;
+}
+static uint32_t
+decode_uint32(struct decoder *decoder)
+{
+	const unsigned char *p;
+	p = decode_take(decoder, 4);
+	if (p == NULL) {
+		return 0;
+	}
+	return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+static uint64_t
+decode_uint64(struct decoder *decoder)
+{
+	uint64_t num;
+	num = decode_uint32(decoder);
+	return (num << 32) | decode_uint32(decoder);
+}
+static const unsigned char *
+decode_opaque(struct decoder *decoder, size_t *length)
+{
+	const unsigned char *p;
+	*length = decode_uint32(decoder);
+	p = decode_take(decoder, *length);
+	decode_take(decoder, (*length % 4) ? (4 - (*length % 4)) : 0);
+	return p;
+}
+static int
+decode_principal_matches(struct decoder *decoder, krb5_principal princ)
+{
+	const unsigned char *p;
+	size_t length;
+	uint32_t i, n;
+	int match;
+
+	n = decode_uint32(decoder);
+	match = (n == (uint32_t) v5_princ_component_count(princ));
+	for (i = 0; (i < n) && !decoder->error; i++) {
+		p = decode_opaque(decoder, &length);
+		if (match &&
+		    ((p == NULL) ||
+		     (length != (size_t) v5_princ_component_length(princ, i)) ||
+		     (memcmp(p, v5_princ_component_contents(princ, i),
+			     length) != 0))) {
+			match = 0;
+		}
+	}
+	p = decode_opaque(decoder, &length);
+	if ((p == NULL) ||
+	    (length != (size_t) v5_princ_realm_length(princ)) ||
+	    (memcmp(p, v5_princ_realm_contents(princ), length) != 0)) {
+		match = 0;
+	}
+	return match && !decoder->error;
+}
+
+/* Find out when the tokens we already hold for the cell expire, looking only
+ * at ones which were set for this user: rxkad tokens which carry the UID we
+ * would have used, and rxk5 tokens for the client principal.  Returns 0 and
+ * sets "endtime" to the latest of them if there are any. */
+static int
+minikafs_5gettoken2(const char *cell, krb5_principal client, uid_t uid,
+		    int64_t *endtime)
+{
+	struct minikafs_ioblock iob;
+	struct decoder decoder, token;
+	const unsigned char *p;
+	char *wcell, *buffer;
+	size_t length;
+	uint32_t i, n;
+	int64_t end;
+	int found;
+
+	buffer = malloc(16384);
+	wcell = xstrdup(cell);
+	if ((buffer == NULL) || (wcell == NULL)) {
+		free(buffer);
+		xstrfree(wcell);
+		return -1;
+	}
+	memset(buffer, '\0', 16384);
+	memset(&iob, 0, sizeof(iob));
+	iob.in = wcell;
+	iob.insize = strlen(wcell) + 1;
+	iob.out = buffer;
+	iob.outsize = 16384;
+	if (minikafs_pioctl(NULL, minikafs_pioctl_gettoken2, &iob) != 0) {
+		memset(buffer, '\0', 16384);
+		free(buffer);
+		xstrfree(wcell);
+		return -1;
+	}
+	xstrfree(wcell);
+
+	memset(&decoder, 0, sizeof(decoder));
+	decoder.data = (const unsigned char *) buffer;
+	decoder.length = 16384;
+	found = 0;
+	decode_uint32(&decoder); /* flags */
+	decode_opaque(&decoder, &length); /* cell */
+	n = decode_uint32(&decoder);
+	for (i = 0; (i < n) && !decoder.error; i++) {
+		p = decode_opaque(&decoder, &length);
+		if (p == NULL) {
+			break;
+		}
+		memset(&token, 0, sizeof(token));
+		token.data = p;
+		token.length = length;
+		end = -1;
+		switch (decode_uint32(&token)) {
+		case AFSTOKEN_UNION_RXKAD:
+			if (decode_uint32(&token) != (uint32_t) uid) {
+				break;
+			}
+			decode_uint32(&token); /* kvno */
+			decode_take(&token, 8); /* key */
+			decode_uint32(&token); /* start time */
+			end = decode_uint32(&token);
+			break;
+		case AFSTOKEN_UNION_RXK5:
+			if (!decode_principal_matches(&token, client)) {
+				break;
+			}
+			decode_principal_matches(&token, client); /* server */
+			decode_uint32(&token); /* key type */
+			decode_opaque(&token, &length); /* key */
+			decode_uint64(&token); /* auth time */
+			decode_uint64(&token); /* start time */
+			end = decode_uint64(&token);
+			break;
+		default:
+			break;
+		}
+		if (!token.error && (end != -1)) {
+			if (!found || (end > *endtime)) {
+				*endtime = end;
+			}
+			found = 1;
+		}
+	}
+	/* The tokens include their session keys. */
+	memset(buffer, '\0', 16384);
+	free(buffer);
+	return found ? 0 : -1;
+}
+
+/* Check if we already hold a token for the cell, set for this user, which
+ * won't expire for at least "margin" seconds, so that there's no need to get
+ * a new one. */
+int
+minikafs_has_token(krb5_context ctx, krb5_ccache ccache,
+		   struct _pam_krb5_options *options,
+		   const char *cell, uid_t uid, int margin)
+{
+	krb5_principal client;
+	int64_t endtime;
+	int ret;
+
+	if ((ccache == NULL) ||
+	    (krb5_cc_get_principal(ctx, ccache, &client) != 0)) {
+		return 0;
+	}
+	ret = 0;
+	if (minikafs_5gettoken2(cell, client, uid, &endtime) == 0) {
+		if (endtime > (int64_t) time(NULL) + margin) {
+			ret = 1;
+		}
+		if (options->debug) {
+			debug("token for \"%s\" expires in %ld seconds%s", cell,
+			      (long) (endtime - time(NULL)),
+			      ret ? ", keeping it" : "");
+		}
+	}
+	krb5_free_principal(ctx, client);
+	return ret;
+}
@@ -65,6 +65,26 @@ int minikafs_log(krb5_context ctx, krb5_ccache ccache,
 		 const char *cell, const char *hint_principal,
 		 uid_t uid, const int *methods, int n_methods);
 
+/* Check if we already have a token for the cell which will be good for at
+ * least "margin" more seconds. */
+int minikafs_has_token(krb5_context ctx, krb5_ccache ccache,
+		       struct _pam_krb5_options *options,
+		       const char *cell, uid_t uid, int margin);
+
+/* Get the service tickets needed to get tokens for several cells, all at
+ * once, and add them to the ccache.  Returns 0 if all of the cells were
+ * tried. */
+int minikafs_prefetch(krb5_context ctx, krb5_ccache ccache,
+		      struct _pam_krb5_options *options,
+		      const char **cells, const char **hint_principals,
+		      int n_cells, uid_t uid,
+		      const int *methods, int n_methods, long *usec);
+
+/* Return the number of system calls which we've saved by keeping the file we
+ * use to call AFS open and remembering that AFS is running, since the last time
+ * we were asked. */
+unsigned long minikafs_syscalls_saved(void);
+
 /* Not really for external use, but exported so that we can unit test them. */
 krb5_boolean minikafs_key_is_weak(const unsigned char *key);
 krb5_boolean minikafs_r2k_is_identity(krb5_context ctx, krb5_enctype etype);
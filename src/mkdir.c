@@ -171,7 +171,9 @@ labeled_mkdir(const char *path, mode_t perms, uid_t uid, gid_t gid,
 #endif
 
 int
-_pam_krb5_leading_mkdir(const char *path, struct _pam_krb5_options *options)
+_pam_krb5_leading_mkdir(const char *path, const char *user,
+			struct _pam_krb5_user_info *userinfo,
+			struct _pam_krb5_options *options)
 {
 	char target[PATH_MAX], *p, *component;
 	struct stat st;
@@ -207,6 +209,12 @@ _pam_krb5_leading_mkdir(const char *path, struct _pam_krb5_options *options)
 				      "owned by UID %ld",
 				      target, id);
 			}
+			if ((userinfo != NULL) && options->user_check &&
+			    (id == (long) userinfo->uid)) {
+				/* We already looked this user up. */
+				uid = userinfo->uid;
+				gid = userinfo->gid;
+			} else
 			if (_pam_krb5_get_pw_ids(NULL, id, &uid, &gid) != 0) {
 				/* Fail. */
 				warn("error looking up primary GID for account "
@@ -221,6 +229,13 @@ _pam_krb5_leading_mkdir(const char *path, struct _pam_krb5_options *options)
 					      "owned by user \"%s\"",
 					      target, component);
 				}
+				if ((userinfo != NULL) && (user != NULL) &&
+				    options->user_check &&
+				    (strcmp(component, user) == 0)) {
+					/* We already looked this user up. */
+					uid = userinfo->uid;
+					gid = userinfo->gid;
+				} else
 				if (_pam_krb5_get_pw_ids(component, -1,
 							 &uid, &gid) != 0) {
 					/* Fail. */
@@ -34,8 +34,10 @@
 #define pam_krb5_mkdir_h
 
 struct _pam_krb5_options;
+struct _pam_krb5_user_info;
 
-int _pam_krb5_leading_mkdir(const char *path,
+int _pam_krb5_leading_mkdir(const char *path, const char *user,
+			    struct _pam_krb5_user_info *userinfo,
 			    struct _pam_krb5_options *options);
 
 #endif
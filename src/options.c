@@ -55,24 +55,267 @@
 #include <profile.h>
 #endif
 
+#include "init.h"
 #include "items.h"
 #include "log.h"
+#include "map.h"
 #include "options.h"
 #include "userinfo.h"
 #include "v5.h"
 #include "xstr.h"
 
 #define LIST_SEPARATORS " \t,"
+#define OPTIONS_CACHE_DATA "_pam_krb5_options_cache"
+
+/* Options which we've already parsed for a PAM handle, along with the
+ * arguments, service, role, and library context they were parsed using. */
+struct _pam_krb5_options_cache_entry {
+	int argc;
+	char **argv;
+	char *service;
+	enum _pam_krb5_option_role role;
+	unsigned long generation;
+	struct _pam_krb5_options *options;
+	struct _pam_krb5_options_cache_entry *next;
+};
+
+struct _pam_krb5_options_cache {
+	struct _pam_krb5_options_cache_entry *head;
+};
+
+#if defined(HAVE_PROFILE_H) && defined(HAVE_KRB5_GET_PROFILE) && \
+    defined(HAVE_PROFILE_RELEASE) && defined(HAVE_PROFILE_RELEASE_STRING) && \
+    defined(HAVE_PROFILE_ITERATOR_CREATE) && defined(HAVE_PROFILE_ITERATOR) && \
+    defined(HAVE_PROFILE_ITERATOR_FREE)
+#define APPDEFAULTS_TABLE 1
+#endif
+
+/* The [appdefaults] settings which apply to us in a realm.  If we were able
+ * to read them all in one go, "loaded" is set and lookups are answered from
+ * the sorted table, otherwise we ask the library about each one. */
+struct appdefaults {
+	const char *realm;
+	int loaded;
+	int n_entries;
+	struct appdefault {
+		char *name, *value;
+		int order;
+	} *entries;
+};
 
 static char **option_l(int argc, PAM_KRB5_MAYBE_CONST char **argv,
-		       krb5_context ctx, const char *realm,
+		       krb5_context ctx, struct appdefaults *defaults,
 		       const char *s, const char *def);
 static char ** option_l_from_s(const char *o);
 static void free_l(char **l);
 
+#ifdef APPDEFAULTS_TABLE
+static int
+appdefaults_compare(const void *a, const void *b)
+{
+	const struct appdefault *l = a, *r = b;
+	int i;
+	i = strcmp(l->name, r->name);
+	if (i != 0) {
+		return i;
+	}
+	return l->order - r->order;
+}
+
+/* Add every relation directly under the named section to the table.  We'll
+ * sort out which one takes precedence later. */
+static int
+appdefaults_walk(profile_t profile, const char **names,
+		 struct appdefaults *defaults, int *allocated)
+{
+	void *iter;
+	char *name, *value;
+	struct appdefault *entries, *entry;
+	long ret;
+
+	iter = NULL;
+	ret = profile_iterator_create(profile, names,
+				      PROFILE_ITER_RELATIONS_ONLY, &iter);
+	if (ret != 0) {
+		return -1;
+	}
+	for (;;) {
+		name = value = NULL;
+		ret = profile_iterator(&iter, &name, &value);
+		if ((ret != 0) || (name == NULL)) {
+			break;
+		}
+		if (value == NULL) {
+			profile_release_string(name);
+			continue;
+		}
+		if (defaults->n_entries >= *allocated) {
+			entries = realloc(defaults->entries,
+					  sizeof(struct appdefault) *
+					  (*allocated * 2 + 16));
+			if (entries == NULL) {
+				ret = ENOMEM;
+			} else {
+				defaults->entries = entries;
+				*allocated = *allocated * 2 + 16;
+			}
+		}
+		if (ret == 0) {
+			entry = &defaults->entries[defaults->n_entries];
+			entry->name = xstrdup(name);
+			entry->value = xstrdup(value);
+			entry->order = defaults->n_entries;
+			if ((entry->name == NULL) ||
+			    (entry->value == NULL)) {
+				xstrfree(entry->name);
+				xstrfree(entry->value);
+				ret = ENOMEM;
+			} else {
+				defaults->n_entries++;
+			}
+		}
+		profile_release_string(name);
+		profile_release_string(value);
+		if (ret != 0) {
+			break;
+		}
+	}
+	profile_iterator_free(&iter);
+	return (ret == 0) ? 0 : -1;
+}
+#endif
+
+static void
+appdefaults_free(struct appdefaults *defaults)
+{
+	int i;
+	for (i = 0; i < defaults->n_entries; i++) {
+		xstrfree(defaults->entries[i].name);
+		xstrfree(defaults->entries[i].value);
+	}
+	free(defaults->entries);
+	defaults->entries = NULL;
+	defaults->n_entries = 0;
+	defaults->loaded = 0;
+}
+
+/* Read all of the [appdefaults] settings which could apply to us in this
+ * realm, in the same order of precedence that krb5_appdefault_string() uses,
+ * and keep only the first value for each.  If anything goes wrong, we fall
+ * back to asking the library about each setting as we need it. */
+static void
+appdefaults_load(struct appdefaults *defaults, krb5_context ctx,
+		 const char *realm)
+{
+#ifdef APPDEFAULTS_TABLE
+	profile_t profile;
+	const char *pam_realm[] = {"appdefaults", PAM_KRB5_APPNAME, realm, NULL};
+	const char *pam[] = {"appdefaults", PAM_KRB5_APPNAME, NULL};
+	const char *any_realm[] = {"appdefaults", realm, NULL};
+	const char *any[] = {"appdefaults", NULL};
+	int allocated, i, j;
+#endif
+
+	memset(defaults, 0, sizeof(*defaults));
+	defaults->realm = realm;
+#ifdef APPDEFAULTS_TABLE
+	if ((realm == NULL) || (strlen(realm) == 0) ||
+	    (krb5_get_profile(ctx, &profile) != 0)) {
+		return;
+	}
+	allocated = 0;
+	if ((appdefaults_walk(profile, pam_realm, defaults, &allocated) != 0) ||
+	    (appdefaults_walk(profile, pam, defaults, &allocated) != 0) ||
+	    (appdefaults_walk(profile, any_realm, defaults, &allocated) != 0) ||
+	    (appdefaults_walk(profile, any, defaults, &allocated) != 0)) {
+		profile_release(profile);
+		appdefaults_free(defaults);
+		return;
+	}
+	profile_release(profile);
+	if (defaults->n_entries > 0) {
+		qsort(defaults->entries, defaults->n_entries,
+		      sizeof(struct appdefault), appdefaults_compare);
+		for (i = 0, j = 0; i < defaults->n_entries; i++) {
+			if ((j > 0) &&
+			    (strcmp(defaults->entries[j - 1].name,
+				    defaults->entries[i].name) == 0)) {
+				xstrfree(defaults->entries[i].name);
+				xstrfree(defaults->entries[i].value);
+				continue;
+			}
+			defaults->entries[j++] = defaults->entries[i];
+		}
+		defaults->n_entries = j;
+	}
+	defaults->loaded = 1;
+#endif
+}
+
+static int
+appdefaults_compare_name(const void *key, const void *entry)
+{
+	const struct appdefault *e = entry;
+	return strcmp(key, e->name);
+}
+
+static const char *
+appdefaults_find(struct appdefaults *defaults, const char *name)
+{
+	struct appdefault *entry;
+	if (defaults->n_entries == 0) {
+		return NULL;
+	}
+	entry = bsearch(name, defaults->entries, defaults->n_entries,
+			sizeof(struct appdefault), appdefaults_compare_name);
+	return (entry != NULL) ? entry->value : NULL;
+}
+
+static void
+appdefault_string(krb5_context ctx, struct appdefaults *defaults,
+		  const char *option, const char *default_value,
+		  char **ret_value)
+{
+	const char *value;
+	if (!defaults->loaded) {
+		v5_appdefault_string(ctx, defaults->realm, option,
+				     default_value, ret_value);
+		return;
+	}
+	value = appdefaults_find(defaults, option);
+	*ret_value = xstrdup(value ? value : default_value);
+}
+
+static void
+appdefault_boolean(krb5_context ctx, struct appdefaults *defaults,
+		   const char *option, krb5_boolean default_value,
+		   krb5_boolean *ret_value)
+{
+	const char *value;
+	const char *yes[] = {"y", "yes", "true", "t", "1", "on"};
+	unsigned int i;
+	if (!defaults->loaded) {
+		v5_appdefault_boolean(ctx, defaults->realm, option,
+				      default_value, ret_value);
+		return;
+	}
+	value = appdefaults_find(defaults, option);
+	if (value == NULL) {
+		*ret_value = default_value;
+		return;
+	}
+	*ret_value = 0;
+	for (i = 0; i < sizeof(yes) / sizeof(yes[0]); i++) {
+		if (strcasecmp(value, yes[i]) == 0) {
+			*ret_value = 1;
+			break;
+		}
+	}
+}
+
 static int
 option_b(int argc, PAM_KRB5_MAYBE_CONST char **argv,
-	 krb5_context ctx, const char *realm,
+	 krb5_context ctx, struct appdefaults *defaults,
 	 const char *service,
 	 const char *default_services, const char *default_notservices,
 	 const char *s, int default_value)
@@ -101,9 +344,9 @@ option_b(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 	ret = -1;
 
 	/* configured service yes */
-	if ((ret == -1) && (realm != NULL) &&
+	if ((ret == -1) && (defaults != NULL) &&
 	    (service != NULL) && (strlen(service) > 0)) {
-		list = option_l(argc, argv, ctx, realm, s, "");
+		list = option_l(argc, argv, ctx, defaults, s, "");
 		if (list != NULL) {
 			for (i = 0;
 			     ((list != NULL) && (list[i] != NULL));
@@ -118,13 +361,13 @@ option_b(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 	}
 
 	/* configured service no */
-	if ((ret == -1) && (realm != NULL) &&
+	if ((ret == -1) && (defaults != NULL) &&
 	    (service != NULL) && (strlen(service) > 0)) {
 		for (n = 0; n < (sizeof(prefix) / sizeof(prefix[0])); n++) {
 			nots = malloc(strlen(prefix[n]) + strlen(s) + 1);
 			if (nots != NULL) {
 				sprintf(nots, "%s%s", prefix[n], s);
-				list = option_l(argc, argv, ctx, realm,
+				list = option_l(argc, argv, ctx, defaults,
 						nots, "");
 				if (list != NULL) {
 					for (j = 0; list[j] != NULL; j++) {
@@ -145,8 +388,8 @@ option_b(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 	}
 
 	/* configured boolean */
-	if ((ret == -1) && (realm != NULL)) {
-		v5_appdefault_boolean(ctx, realm, s, -1, &retbool);
+	if ((ret == -1) && (defaults != NULL)) {
+		appdefault_boolean(ctx, defaults, s, -1, &retbool);
 		ret = retbool;
 	}
 
@@ -188,7 +431,7 @@ option_b(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 
 static char *
 option_s(int argc, PAM_KRB5_MAYBE_CONST char **argv,
-	 krb5_context ctx, const char *realm, const char *s,
+	 krb5_context ctx, struct appdefaults *defaults, const char *s,
 	 const char *default_value)
 {
 	int i;
@@ -201,7 +444,7 @@ option_s(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 		}
 	}
 
-	v5_appdefault_string(ctx, realm, s, default_value, &o);
+	appdefault_string(ctx, defaults, s, default_value, &o);
 
 	return o;
 }
@@ -216,7 +459,7 @@ static long long
 static long
 #endif
 option_i(int argc, PAM_KRB5_MAYBE_CONST char **argv,
-	 krb5_context ctx, const char *realm, const char *s)
+	 krb5_context ctx, struct appdefaults *defaults, const char *s)
 {
 	char *tmp, *p;
 #ifdef HAVE_LONG_LONG
@@ -225,7 +468,7 @@ option_i(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 	long i;
 #endif
 
-	tmp = option_s(argc, argv, ctx, realm, s, "");
+	tmp = option_s(argc, argv, ctx, defaults, s, "");
 
 #ifdef HAVE_STRTOLL
 	i = strtoll(tmp, &p, 10);
@@ -242,13 +485,13 @@ option_i(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 #if 0
 static krb5_deltat
 option_t(int argc, PAM_KRB5_MAYBE_CONST char **argv,
-	 krb5_context ctx, const char *realm, const char *s)
+	 krb5_context ctx, struct appdefaults *defaults, const char *s)
 {
 	char *tmp, *p;
 	krb5_deltat d;
 	long i;
 
-	tmp = option_s(argc, argv, ctx, realm, s, "");
+	tmp = option_s(argc, argv, ctx, defaults, s, "");
 
 	i = strtol(tmp, &p, 10);
 	if ((p == NULL) || (p == tmp) || (*p != '\0')) {
@@ -265,11 +508,12 @@ option_t(int argc, PAM_KRB5_MAYBE_CONST char **argv,
 #endif
 static char **
 option_l(int argc, PAM_KRB5_MAYBE_CONST char **argv,
-	 krb5_context ctx, const char *realm, const char *s, const char *def)
+	 krb5_context ctx, struct appdefaults *defaults,
+	 const char *s, const char *def)
 {
 	char *o, **list;
 
-	o = option_s(argc, argv, ctx, realm, s, def ? def : "");
+	o = option_s(argc, argv, ctx, defaults, s, def ? def : "");
 	list = option_l_from_s(o);
 	free_s(o);
 	return list;
@@ -318,17 +562,18 @@ free_l(char **l)
 	}
 }
 
-struct _pam_krb5_options *
-_pam_krb5_options_init(pam_handle_t *pamh, int argc,
-		       PAM_KRB5_MAYBE_CONST char **argv,
-		       krb5_context ctx,
-		       enum _pam_krb5_option_role role)
+static struct _pam_krb5_options *
+options_parse(pam_handle_t *pamh, int argc,
+	      PAM_KRB5_MAYBE_CONST char **argv,
+	      krb5_context ctx,
+	      enum _pam_krb5_option_role role)
 {
 	struct _pam_krb5_options *options;
 	int try_first_pass, use_first_pass, initial_prompt, subsequent_prompt;
 	int i;
 	char *default_realm, *default_ccname, **list;
 	char *service;
+	struct appdefaults defaults;
 
 	options = malloc(sizeof(struct _pam_krb5_options));
 	if (options == NULL) {
@@ -375,39 +620,52 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 		}
 	}
 
+	/* Read the settings for this realm all at once, unless we've been told
+	 * not to (undocumented command-line option, for benchmarking). */
+	if (option_b(argc, argv, ctx, NULL, service, NULL, NULL,
+		     "appdefaults_table", 1)) {
+		appdefaults_load(&defaults, ctx, options->realm);
+	} else {
+		memset(&defaults, 0, sizeof(defaults));
+		defaults.realm = options->realm;
+	}
+	if (options->debug && defaults.loaded) {
+		debug("read %d appdefaults settings", defaults.n_entries);
+	}
+
 	/* parsing debugging */
 	for (i = 0; i < argc; i++) {
 		if (strcmp(argv[i], "debug_parser") == 0) {
 			char *s, **l;
-			i = option_b(argc, argv, ctx, options->realm,
+			i = option_b(argc, argv, ctx, &defaults,
 				     service, NULL, NULL,
 				     "boolean_parameter_1", -1);
 			debug("boolean_parameter_1 = %d", i);
-			i = option_b(argc, argv, ctx, options->realm,
+			i = option_b(argc, argv, ctx, &defaults,
 				     service, NULL, NULL,
 				     "boolean_parameter_2", 0);
 			debug("boolean_parameter_2 = %d", i);
-			i = option_b(argc, argv, ctx, options->realm,
+			i = option_b(argc, argv, ctx, &defaults,
 				     service, NULL, NULL,
 				     "boolean_parameter_3", 1);
 			debug("boolean_parameter_3 = %d", i);
 			s = option_s(argc, argv,
-				     ctx, options->realm, "string_parameter_1",
+				     ctx, &defaults, "string_parameter_1",
 				     "default_string_value");
 			debug("string_parameter_1 = '%s'", s ? s : "(null)");
 			free_s(s);
 			s = option_s(argc, argv,
-				     ctx, options->realm, "string_parameter_2",
+				     ctx, &defaults, "string_parameter_2",
 				     "default_string_value");
 			debug("string_parameter_2 = '%s'", s ? s : "(null)");
 			free_s(s);
 			s = option_s(argc, argv,
-				     ctx, options->realm, "string_parameter_3",
+				     ctx, &defaults, "string_parameter_3",
 				     "default_string_value");
 			debug("string_parameter_3 = '%s'", s ? s : "(null)");
 			free_s(s);
 			l = option_l(argc, argv,
-				     ctx, options->realm, "list_parameter_1",
+				     ctx, &defaults, "list_parameter_1",
 				     "");
 			for (i = 0; (l != NULL) && (l[i] != NULL); i++) {
 				debug("list_parameter_1[%d] = '%s'", i, l[i]);
@@ -418,7 +676,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	}
 
 	/* private option */
-	options->debug = option_b(argc, argv, ctx, options->realm,
+	options->debug = option_b(argc, argv, ctx, &defaults,
 				  service, NULL, NULL,
 				  "debug", 0);
 	if (options->debug) {
@@ -426,7 +684,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	}
 
 #ifdef HAVE_KRB5_SET_TRACE_CALLBACK
-	options->trace = option_b(argc, argv, ctx, options->realm,
+	options->trace = option_b(argc, argv, ctx, &defaults,
 				  service, NULL, NULL,
 				  "trace", 0);
 	if (options->trace) {
@@ -435,30 +693,54 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	}
 #endif
 
+	/* private option */
+	options->timing = option_b(argc, argv, ctx, &defaults,
+				   service, NULL, NULL,
+				   "timing", 0);
+	if (options->debug && options->timing) {
+		debug("flag: timing");
+	}
+
 	/* undocumented private option */
-	options->test_environment = option_b(argc, argv, ctx, options->realm,
+	options->test_environment = option_b(argc, argv, ctx, &defaults,
 					     service, NULL, NULL,
 					     "test_environment", 0);
 	if (options->test_environment) {
 		debug("flag: test_environment");
 	}
 
+	options->kdc_race = option_i(argc, argv, ctx, &defaults, "kdc_race");
+	if (options->kdc_race < 0) {
+		options->kdc_race = 0;
+	}
+	if (options->debug && options->kdc_race) {
+		debug("kdc_race: %d", options->kdc_race);
+	}
+
 #if defined(HAVE_KRB5_GET_INIT_CREDS_OPT_SET_FAST_CCACHE) && \
     defined(HAVE_KRB5_GET_INIT_CREDS_OPT_SET_FAST_FLAGS)
 	/* private options */
-	options->armor = option_b(argc, argv, ctx, options->realm,
+	options->armor = option_b(argc, argv, ctx, &defaults,
 				  service, NULL, NULL,
 				  "armor", 0);
 	if (options->armor) {
 		debug("flag: armor");
 	}
 	options->armor_strategy = option_s(argc, argv,
-					   ctx, options->realm, "armor_strategy",
+					   ctx, &defaults, "armor_strategy",
 					   DEFAULT_ARMOR_STRATEGY);
+	options->armor_refresh = option_i(argc, argv,
+					  ctx, &defaults, "armor_refresh");
+	if (options->armor_refresh < 0) {
+		options->armor_refresh = DEFAULT_ARMOR_REFRESH;
+	}
+	if (options->debug && options->armor) {
+		debug("armor_refresh: %d", options->armor_refresh);
+	}
 #endif
 
 	/* private option */
-	options->debug_sensitive = option_b(argc, argv, ctx, options->realm,
+	options->debug_sensitive = option_b(argc, argv, ctx, &defaults,
 					    service, NULL, NULL,
 					    "debug_sensitive", 0);
 	if (options->debug && options->debug_sensitive) {
@@ -467,12 +749,30 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 
 	/* undocumented private option */
 	options->cchelper_path = option_s(argc, argv,
-					  ctx, options->realm, "cchelper_path",
+					  ctx, &defaults, "cchelper_path",
 					  PKGSECURITYDIR "/pam_krb5_cchelper");
 
+	/* private option */
+	options->cchelper_socket = option_s(argc, argv,
+					    ctx, &defaults, "cchelper_socket",
+					    DEFAULT_CCHELPER_SOCKET);
+	if (options->debug && (options->cchelper_socket != NULL) &&
+	    (strlen(options->cchelper_socket) > 0)) {
+		debug("cchelper_socket: %s", options->cchelper_socket);
+	}
+
+	/* private option */
+	options->cchelper_in_process = option_b(argc, argv,
+						ctx, &defaults,
+						service, NULL, NULL,
+						"cchelper_in_process", 0);
+	if (options->debug && options->cchelper_in_process) {
+		debug("flag: cchelper_in_process");
+	}
+
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_CANONICALIZE
 	options->canonicalize = option_b(argc, argv,
-					 ctx, options->realm,
+					 ctx, &defaults,
 					 service, NULL, NULL,
 					 "canonicalize", -1);
 	if (options->debug && (options->canonicalize == 1)) {
@@ -486,7 +786,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 #ifdef HAVE_KRB5_ANAME_TO_LOCALNAME
 	/* private option */
 	options->always_allow_localname = option_b(argc, argv,
-						   ctx, options->realm,
+						   ctx, &defaults,
 						   service, NULL, NULL,
 						   "always_allow_localname",
 						   0);
@@ -500,7 +800,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 #ifdef HAVE_AFS
 	/* private option */
 	options->ignore_afs = option_b(argc, argv,
-				       ctx, options->realm,
+				       ctx, &defaults,
 				       service, NULL, NULL, "ignore_afs", 0);
 	if (options->debug && (options->ignore_afs == 1)) {
 		debug("flag: ignore_afs");
@@ -511,11 +811,11 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 
 	/* private option */
 	options->null_afs_first = option_b(argc, argv,
-					   ctx, options->realm,
+					   ctx, &defaults,
 					   service, NULL, NULL, "null_afs", -1);
 	if (options->null_afs_first == -1) {
 		options->null_afs_first = option_b(argc, argv,
-						   ctx, options->realm,
+						   ctx, &defaults,
 						   service, NULL, NULL,
 						   "nullafs", 0);
 	}
@@ -527,19 +827,47 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	}
 
 	/* private option */
-	options->tokens = option_b(argc, argv, ctx, options->realm,
+	options->tokens = option_b(argc, argv, ctx, &defaults,
 				   service, NULL, NULL, "tokens", 0);
 	if (options->debug && options->tokens) {
 		debug("flag: tokens");
 	}
+
+	options->afs_parallel = option_b(argc, argv, ctx, &defaults,
+					 service, NULL, NULL,
+					 "afs_parallel", 1);
+	if (options->debug && (options->afs_parallel == 0)) {
+		debug("flag: no afs_parallel");
+	}
+
+	options->afs_token_margin = option_i(argc, argv, ctx, &defaults,
+					     "afs_token_margin");
+	if (options->afs_token_margin < 0) {
+		options->afs_token_margin = DEFAULT_AFS_TOKEN_MARGIN;
+	}
+	if (options->debug) {
+		debug("afs_token_margin: %d", options->afs_token_margin);
+	}
+
+	options->afs_realm_ttl = option_i(argc, argv,
+					  ctx, &defaults, "afs_realm_ttl");
+	if (options->afs_realm_ttl < 0) {
+		options->afs_realm_ttl = DEFAULT_AFS_REALM_TTL;
+	}
+	if (options->debug) {
+		debug("afs_realm_ttl: %d", options->afs_realm_ttl);
+	}
 #else
 	options->ignore_afs = 1;
 	options->tokens = 0;
+	options->afs_parallel = 0;
+	options->afs_realm_ttl = 0;
+	options->afs_token_margin = 0;
 #endif
 
 	/* private option */
 	options->cred_session = option_b(argc, argv,
-					 ctx, options->realm,
+					 ctx, &defaults,
 					 service, NULL, DEFAULT_NO_CRED_SESSION,
 					 "cred_session", 1);
 	if (options->debug && (options->cred_session == 1)) {
@@ -551,7 +879,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 
 	/* private option */
 	options->ignore_k5login = option_b(argc, argv,
-					   ctx, options->realm,
+					   ctx, &defaults,
 					   service, NULL, NULL,
 					   "ignore_k5login", 0);
 	if (options->debug && (options->ignore_k5login == 1)) {
@@ -561,17 +889,28 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 		debug("flag: no ignore_k5login");
 	}
 
+	/* private option */
+	options->kuserok_in_process = option_b(argc, argv,
+					       ctx, &defaults,
+					       service, NULL, NULL,
+					       "kuserok_in_process", 0);
+	if (options->debug && options->kuserok_in_process) {
+		debug("flag: kuserok_in_process");
+	}
+
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PKINIT
 	/* option specific to the Heimdal implementation */
-	options->pkinit_identity = option_s(argc, argv, ctx, options->realm,
+	options->pkinit_identity = option_s(argc, argv, ctx, &defaults,
 					    "pkinit_identity",
 					    DEFAULT_PKINIT_IDENTITY);
 	if (options->debug && options->pkinit_identity) {
 		debug("pkinit_identity(template): %s",
 		      options->pkinit_identity);
 	}
+	options->pkinit_identity_template =
+		v5_user_info_template_parse(options->pkinit_identity);
 	options->pkinit_flags = option_i(argc, argv,
-					 ctx, options->realm, "pkinit_flags");
+					 ctx, &defaults, "pkinit_flags");
 	if (options->pkinit_flags == -1) {
 		options->pkinit_flags = 0;
 	}
@@ -581,21 +920,37 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 #endif
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PA
 	/* option specific to the MIT implementation */
-	options->preauth_options = option_l(argc, argv, ctx, options->realm,
+	options->preauth_options = option_l(argc, argv, ctx, &defaults,
 					    "preauth_options",
 					    DEFAULT_PREAUTH_OPTIONS);
-	if (options->debug && options->preauth_options) {
+	if (options->preauth_options != NULL) {
+		struct _pam_krb5_template **templates;
+		char **preauth = options->preauth_options;
 		int i;
 		for (i = 0; options->preauth_options[i] != NULL; i++) {
-			debug("preauth_options(template): %s",
-			      options->preauth_options[i]);
+			if (options->debug) {
+				debug("preauth_options(template): %s",
+				      options->preauth_options[i]);
+			}
+		}
+		templates = malloc(sizeof(struct _pam_krb5_template *) *
+				   (i + 1));
+		options->preauth_options_templates = templates;
+		if (templates != NULL) {
+			for (i = 0; preauth[i] != NULL; i++) {
+				templates[i] =
+					v5_user_info_template_parse(preauth[i]);
+			}
+			templates[i] = NULL;
+		} else {
+			warn("error parsing preauth_options");
 		}
 	}
 #endif
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_CHANGE_PASSWORD_PROMPT
 	/* library option */
 	options->chpw_prompt = option_b(argc, argv,
-				        ctx, options->realm,
+				        ctx, &defaults,
 				        service,
 					DEFAULT_CHPW_PROMPT, "",
 					"chpw_prompt", 0);
@@ -606,7 +961,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 
 	/* private option */
 	options->user_check = option_b(argc, argv,
-				       ctx, options->realm,
+				       ctx, &defaults,
 				       service, NULL, NULL, "user_check", 1);
 	if (options->debug && options->user_check) {
 		debug("flag: user_check");
@@ -614,7 +969,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 
 	/* private option */
 	options->use_authtok = option_b(argc, argv,
-					ctx, options->realm,
+					ctx, &defaults,
 					service, NULL, NULL, "use_authtok", 0);
 	if (options->debug && options->use_authtok) {
 		debug("flag: use_authtok");
@@ -626,16 +981,16 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	options->use_third_pass = (role != _pam_krb5_option_role_chauthtok);
 	options->permit_password_callback = 0;
 	use_first_pass = option_b(argc, argv,
-				  ctx, options->realm,
+				  ctx, &defaults,
 				  service, NULL, NULL, "use_first_pass", -1);
 	try_first_pass = option_b(argc, argv,
-				  ctx, options->realm,
+				  ctx, &defaults,
 				  service, NULL, NULL, "try_first_pass", -1);
 	initial_prompt = option_b(argc, argv,
-				  ctx, options->realm,
+				  ctx, &defaults,
 				  service, NULL, NULL, "initial_prompt", -1);
 	subsequent_prompt = option_b(argc, argv,
-				     ctx, options->realm,
+				     ctx, &defaults,
 				     service, NULL, NULL,
 				     "subsequent_prompt", -1);
 	if (initial_prompt != -1) {
@@ -671,7 +1026,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 
 	/* private option */
 	options->use_shmem = option_b(argc, argv,
-				      ctx, options->realm,
+				      ctx, &defaults,
 				      service, DEFAULT_USE_SHMEM, NULL,
 				      "use_shmem", 0);
 	if (options->debug && (options->use_shmem == 1)) {
@@ -680,10 +1035,25 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	if (options->debug && (options->use_shmem == 0)) {
 		debug("flag: no use_shmem");
 	}
+	/* "memfd" in the list picks the backend, and by itself means "all". */
+	options->use_shmem_memfd = 0;
+	list = option_l(argc, argv, ctx, &defaults, "use_shmem", "");
+	for (i = 0; (list != NULL) && (list[i] != NULL); i++) {
+		if (strcmp(list[i], "memfd") == 0) {
+			options->use_shmem_memfd = 1;
+			if ((i == 0) && (list[i + 1] == NULL)) {
+				options->use_shmem = 1;
+			}
+		}
+	}
+	free_l(list);
+	if (options->debug && options->use_shmem_memfd) {
+		debug("flag: use_shmem using memfd");
+	}
 
 	/* private option */
 	options->external = option_b(argc, argv,
-				     ctx, options->realm,
+				     ctx, &defaults,
 				     service, DEFAULT_EXTERNAL, "",
 				     "external", 0);
 	if (options->debug && (options->external == 1)) {
@@ -695,7 +1065,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 
 	/* private option */
 	options->multiple_ccaches = option_b(argc, argv,
-					     ctx, options->realm,
+					     ctx, &defaults,
 					     service,
 					     DEFAULT_MULTIPLE_CCACHES, "",
 					     "multiple_ccaches", 0);
@@ -708,14 +1078,14 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 
 	/* private option */
 	options->validate = option_b(argc, argv,
-				     ctx, options->realm,
+				     ctx, &defaults,
 				     service, NULL, NULL,
 				     "validate", 1);
 	if (options->debug && (options->validate == 1)) {
 		debug("flag: validate");
 	}
 	options->validate_user_user = option_b(argc, argv,
-					       ctx, options->realm,
+					       ctx, &defaults,
 					       service, NULL, NULL,
 					       "validate_user_user", 0);
 	if (options->debug && (options->validate_user_user == 1)) {
@@ -723,7 +1093,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	}
 
 	options->warn = option_b(argc, argv,
-				 ctx, options->realm,
+				 ctx, &defaults,
 				 service, NULL, NULL, "warn", 1);
 	if (options->debug && (options->warn == 1)) {
 		debug("flag: warn");
@@ -731,20 +1101,20 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 
 	/* private option */
 	options->minimum_uid = option_i(argc, argv,
-					ctx, options->realm, "minimum_uid");
+					ctx, &defaults, "minimum_uid");
 	if (options->debug && (options->minimum_uid != (uid_t) -1)) {
 		debug("minimum uid: %d", options->minimum_uid);
 	}
 
 	/* private options */
 	options->banner = option_s(argc, argv,
-				   ctx, options->realm, "banner",
+				   ctx, &defaults, "banner",
 				   "Kerberos 5");
 	if (options->debug && options->banner) {
 		debug("banner: %s", options->banner);
 	}
 	options->ccache_dir = option_s(argc, argv,
-				       ctx, options->realm, "ccache_dir",
+				       ctx, &defaults, "ccache_dir",
 				       DEFAULT_CCACHE_DIR);
 	if (strlen(options->ccache_dir) == 0) {
 		xstrfree(options->ccache_dir);
@@ -778,7 +1148,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	}
 #endif
 	options->ccname_template = option_s(argc, argv,
-					    ctx, options->realm,
+					    ctx, &defaults,
 					    "ccname_template",
 					    default_ccname ?
 					    default_ccname :
@@ -791,9 +1161,11 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	if (options->debug && options->ccname_template) {
 		debug("ccname template: %s", options->ccname_template);
 	}
+	options->ccname_template_template =
+		v5_user_info_template_parse(options->ccname_template);
 
 	if (service != NULL) {
-		list = option_l(argc, argv, ctx, options->realm,
+		list = option_l(argc, argv, ctx, &defaults,
 				"keytab", DEFAULT_KEYTAB_LOCATION);
 		for (i = 0; (list != NULL) && (list[i] != NULL); i++) {
 			if ((strncmp(list[i], service, strlen(service)) == 0) &&
@@ -822,7 +1194,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	}
 
 	options->pwhelp = option_s(argc, argv,
-				   ctx, options->realm, "pwhelp",
+				   ctx, &defaults, "pwhelp",
 				   "");
 	if (strlen(options->pwhelp) == 0) {
 		xstrfree(options->pwhelp);
@@ -833,7 +1205,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	}
 
 	options->token_strategy = option_s(argc, argv,
-					   ctx, options->realm,
+					   ctx, &defaults,
 					   "token_strategy", "");
 	if (strlen(options->token_strategy) == 0) {
 		xstrfree(options->token_strategy);
@@ -844,12 +1216,12 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	}
 
 	options->ignore_unknown_principals = option_b(argc, argv, ctx,
-						      options->realm,
+						      &defaults,
 						      service, NULL, NULL,
 						      "ignore_unknown_principals", -1);
 	if (options->ignore_unknown_principals == -1) {
 		options->ignore_unknown_principals = option_b(argc, argv, ctx,
-							      options->realm,
+							      &defaults,
 							      service,
 							      NULL, NULL,
 							      "ignore_unknown_spn",
@@ -857,7 +1229,7 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	}
 	if (options->ignore_unknown_principals == -1) {
 		options->ignore_unknown_principals = option_b(argc, argv, ctx,
-							      options->realm,
+							      &defaults,
 							      service,
 							      NULL, NULL,
 							      "ignore_unknown_upn",
@@ -867,11 +1239,21 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 		options->ignore_unknown_principals = 0;
 	}
 
+	options->unknown_principal_ttl = option_i(argc, argv, ctx, &defaults,
+						  "unknown_principal_ttl");
+	if (options->unknown_principal_ttl < 0) {
+		options->unknown_principal_ttl = 0;
+	}
+	if (options->debug && options->unknown_principal_ttl) {
+		debug("unknown_principal_ttl: %d",
+		      options->unknown_principal_ttl);
+	}
+
 	/* If /afs is on a different device from /, this suggests that AFS is
 	 * running.  Set up to get tokens for the local cell and attempt to
 	 * get that cell's name if we're not ignoring AFS altogether. */
 	if (!options->ignore_afs) {
-		list = option_l(argc, argv, ctx, options->realm, "afs_cells",
+		list = option_l(argc, argv, ctx, &defaults, "afs_cells",
 				"");
 		if ((list != NULL) && (list[0] != NULL)) {
 			int i;
@@ -919,8 +1301,8 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 	}
 
 	options->mappings_s = option_s(argc, argv,
-				       ctx, options->realm, "mappings", "");
-	list = option_l(argc, argv, ctx, options->realm, "mappings", "");
+				       ctx, &defaults, "mappings", "");
+	list = option_l(argc, argv, ctx, &defaults, "mappings", "");
 	for (i = 0; (list != NULL) && (list[i] != NULL); i++) {
 		/* nothing */
 	}
@@ -938,27 +1320,49 @@ _pam_krb5_options_init(pam_handle_t *pamh, int argc,
 			options->mappings[i].pattern = xstrdup(list[i * 2]);
 			options->mappings[i].replacement =
 				xstrdup(list[i * 2 + 1]);
+			options->mappings[i].compiled = NULL;
 			if (options->debug) {
 				debug("mapping: \"%s\" to \"%s\"",
 				      options->mappings[i].pattern,
 				      options->mappings[i].replacement);
 			}
+			if ((options->mappings[i].pattern == NULL) ||
+			    (options->mappings[i].replacement == NULL) ||
+			    (map_compile(&options->mappings[i]) != 0)) {
+				warn("error compiling mapping \"%s\"",
+				     options->mappings[i].pattern ?
+				     options->mappings[i].pattern : "");
+			}
 		}
 	}
 	free_l(list);
 
+	appdefaults_free(&defaults);
+
 	return options;
 }
-void
-_pam_krb5_options_free(pam_handle_t *pamh, krb5_context ctx,
-		       struct _pam_krb5_options *options)
+
+static void
+options_free(struct _pam_krb5_options *options)
 {
 	int i;
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PKINIT
 	free_s(options->pkinit_identity);
 	options->pkinit_identity = NULL;
+	v5_user_info_template_free(options->pkinit_identity_template);
+	options->pkinit_identity_template = NULL;
 #endif
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PA
+	for (i = 0;
+	     (options->preauth_options != NULL) &&
+	     (options->preauth_options_templates != NULL) &&
+	     (options->preauth_options[i] != NULL);
+	     i++) {
+		v5_user_info_template_free(
+			options->preauth_options_templates[i]);
+	}
+	free(options->preauth_options_templates);
+	options->preauth_options_templates = NULL;
 	free_l(options->preauth_options);
 	options->preauth_options = NULL;
 #endif
@@ -968,6 +1372,8 @@ _pam_krb5_options_free(pam_handle_t *pamh, krb5_context ctx,
 	options->ccache_dir = NULL;
 	free_s(options->ccname_template);
 	options->ccname_template = NULL;
+	v5_user_info_template_free(options->ccname_template_template);
+	options->ccname_template_template = NULL;
 	free_s(options->keytab);
 	options->keytab = NULL;
 	free_s(options->pwhelp);
@@ -981,6 +1387,8 @@ _pam_krb5_options_free(pam_handle_t *pamh, krb5_context ctx,
 #endif
 	free_s(options->cchelper_path);
 	options->cchelper_path = NULL;
+	free_s(options->cchelper_socket);
+	options->cchelper_socket = NULL;
 	free_s(options->realm);
 	options->realm = NULL;
 	free_l(options->hosts);
@@ -992,6 +1400,7 @@ _pam_krb5_options_free(pam_handle_t *pamh, krb5_context ctx,
 	free(options->afs_cells);
 	options->afs_cells = NULL;
 	for (i = 0; i < options->n_mappings; i++) {
+		map_free(&options->mappings[i]);
 		xstrfree(options->mappings[i].pattern);
 		xstrfree(options->mappings[i].replacement);
 	}
@@ -1000,4 +1409,214 @@ _pam_krb5_options_free(pam_handle_t *pamh, krb5_context ctx,
 	free(options->mappings_s);
 	options->mappings_s = NULL;
 	free(options);
-};
+}
+
+static void
+options_cache_entry_free(struct _pam_krb5_options_cache_entry *entry)
+{
+	int i;
+	for (i = 0; (entry->argv != NULL) && (i < entry->argc); i++) {
+		xstrfree(entry->argv[i]);
+	}
+	free(entry->argv);
+	xstrfree(entry->service);
+	if (entry->options != NULL) {
+		options_free(entry->options);
+	}
+	free(entry);
+}
+
+static void
+options_cache_cleanup(pam_handle_t *pamh, void *data, int error)
+{
+	struct _pam_krb5_options_cache *cache = data;
+	struct _pam_krb5_options_cache_entry *next;
+	while (cache->head != NULL) {
+		next = cache->head->next;
+		options_cache_entry_free(cache->head);
+		cache->head = next;
+	}
+	free(cache);
+}
+
+static struct _pam_krb5_options_cache *
+options_cache_get(pam_handle_t *pamh)
+{
+	struct _pam_krb5_options_cache *cache;
+	cache = NULL;
+	if ((pam_get_data(pamh, OPTIONS_CACHE_DATA,
+			  (PAM_KRB5_MAYBE_CONST void **) &cache) == PAM_SUCCESS) &&
+	    (cache != NULL)) {
+		return cache;
+	}
+	cache = malloc(sizeof(*cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+	cache->head = NULL;
+	if (pam_set_data(pamh, OPTIONS_CACHE_DATA, cache,
+			 options_cache_cleanup) != PAM_SUCCESS) {
+		free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+static int
+options_cache_entry_matches(struct _pam_krb5_options_cache_entry *entry,
+			    int argc, PAM_KRB5_MAYBE_CONST char **argv,
+			    const char *service,
+			    enum _pam_krb5_option_role role)
+{
+	int i;
+	if ((entry->argc != argc) || (entry->role != role)) {
+		return 0;
+	}
+	if ((entry->service == NULL) != (service == NULL)) {
+		return 0;
+	}
+	if ((service != NULL) && (strcmp(entry->service, service) != 0)) {
+		return 0;
+	}
+	for (i = 0; i < argc; i++) {
+		if (strcmp(entry->argv[i], argv[i]) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Remember a newly-parsed set of options, forgetting any which were parsed
+ * using an older configuration. */
+static void
+options_cache_add(struct _pam_krb5_options_cache *cache,
+		  int argc, PAM_KRB5_MAYBE_CONST char **argv,
+		  const char *service, enum _pam_krb5_option_role role,
+		  unsigned long generation,
+		  struct _pam_krb5_options *options)
+{
+	struct _pam_krb5_options_cache_entry *entry, **prev;
+	int i;
+
+	prev = &cache->head;
+	while (*prev != NULL) {
+		entry = *prev;
+		if ((entry->generation != generation) &&
+		    !entry->options->in_use) {
+			*prev = entry->next;
+			options_cache_entry_free(entry);
+		} else {
+			prev = &entry->next;
+		}
+	}
+
+	entry = malloc(sizeof(*entry));
+	if (entry == NULL) {
+		return;
+	}
+	memset(entry, 0, sizeof(*entry));
+	entry->argv = malloc(sizeof(char *) * (argc + 1));
+	if (entry->argv == NULL) {
+		free(entry);
+		return;
+	}
+	memset(entry->argv, 0, sizeof(char *) * (argc + 1));
+	entry->argc = argc;
+	for (i = 0; i < argc; i++) {
+		entry->argv[i] = xstrdup(argv[i]);
+		if (entry->argv[i] == NULL) {
+			options_cache_entry_free(entry);
+			return;
+		}
+	}
+	if (service != NULL) {
+		entry->service = xstrdup(service);
+		if (entry->service == NULL) {
+			options_cache_entry_free(entry);
+			return;
+		}
+	}
+	entry->role = role;
+	entry->generation = generation;
+	entry->options = options;
+	options->cached = 1;
+	entry->next = cache->head;
+	cache->head = entry;
+}
+
+/* Parse our options, or, if an earlier call using this PAM handle already
+ * parsed the same arguments for the same service and role using the same
+ * configuration, hand back what it got. */
+struct _pam_krb5_options *
+_pam_krb5_options_init(pam_handle_t *pamh, int argc,
+		       PAM_KRB5_MAYBE_CONST char **argv,
+		       krb5_context ctx,
+		       enum _pam_krb5_option_role role)
+{
+	struct _pam_krb5_options_cache *cache;
+	struct _pam_krb5_options_cache_entry *entry;
+	struct _pam_krb5_options *options;
+	unsigned long generation;
+	char *service;
+
+	cache = NULL;
+	service = NULL;
+	generation = 0;
+	if (pamh != NULL) {
+		generation = _pam_krb5_shared_ctx_generation(pamh, ctx);
+	}
+	if (generation != 0) {
+		cache = options_cache_get(pamh);
+		_pam_krb5_get_item_text(pamh, PAM_SERVICE, &service);
+	}
+	for (entry = (cache != NULL) ? cache->head : NULL;
+	     entry != NULL;
+	     entry = entry->next) {
+		if ((entry->generation != generation) ||
+		    entry->options->in_use ||
+		    !options_cache_entry_matches(entry, argc, argv,
+						 service, role)) {
+			continue;
+		}
+		/* Reapply the parts which change the library context. */
+		options = entry->options;
+		if (strlen(options->realm) > 0) {
+			krb5_set_default_realm(ctx, options->realm);
+		}
+#ifdef HAVE_KRB5_SET_TRACE_CALLBACK
+		if (options->trace) {
+			krb5_set_trace_callback(ctx, &trace, NULL);
+		}
+#endif
+		options->argc = argc;
+		options->argv = argv;
+		options->timings = NULL;
+		options->in_use = 1;
+		if (options->debug) {
+			debug("using previously-parsed options");
+		}
+		return options;
+	}
+
+	options = options_parse(pamh, argc, argv, ctx, role);
+	if (options == NULL) {
+		return NULL;
+	}
+	options->in_use = 1;
+	if (cache != NULL) {
+		options_cache_add(cache, argc, argv, service, role,
+				  generation, options);
+	}
+	return options;
+}
+
+void
+_pam_krb5_options_free(pam_handle_t *pamh, krb5_context ctx,
+		       struct _pam_krb5_options *options)
+{
+	options->in_use = 0;
+	options->timings = NULL;
+	if (!options->cached) {
+		options_free(options);
+	}
+}
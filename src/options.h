@@ -33,6 +33,9 @@
 #ifndef pam_krb5_options_h
 #define pam_krb5_options_h
 
+struct _pam_krb5_template;
+struct _pam_krb5_timing;
+
 struct _pam_krb5_options {
 	int debug;
 	int argc;
@@ -41,14 +44,19 @@ struct _pam_krb5_options {
 #ifdef HAVE_KRB5_ANAME_TO_LOCALNAME
 	int always_allow_localname;
 #endif
+	int afs_parallel;
+	int afs_realm_ttl;
+	int afs_token_margin;
 #if defined(HAVE_KRB5_GET_INIT_CREDS_OPT_SET_FAST_CCACHE) && \
     defined(HAVE_KRB5_GET_INIT_CREDS_OPT_SET_FAST_FLAGS)
 	int armor;
+	int armor_refresh;
 	char *armor_strategy;
 #endif
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_CANONICALIZE
 	int canonicalize;
 #endif
+	int cchelper_in_process;
 	int chpw_prompt;
 	int cred_session;
 	int debug_sensitive;
@@ -56,20 +64,25 @@ struct _pam_krb5_options {
 	int ignore_afs;
 	int ignore_k5login;
 	int ignore_unknown_principals;
+	int kdc_race;
+	int kuserok_in_process;
 	int multiple_ccaches;
 	int null_afs_first;
 	int permit_password_callback;
 	int test_environment;
+	int timing;
 	int tokens;
 #ifdef HAVE_KRB5_SET_TRACE_CALLBACK
 	int trace;
 #endif
+	int unknown_principal_ttl;
 	int user_check;
 	int use_authtok;
 	int use_first_pass;
 	int use_second_pass;
 	int use_third_pass;
 	int use_shmem;
+	int use_shmem_memfd;
 	int validate;
 	int validate_user_user;
 	int warn;
@@ -79,6 +92,7 @@ struct _pam_krb5_options {
 	char *banner;
 	char *ccache_dir;
 	char *cchelper_path;
+	char *cchelper_socket;
 	char *ccname_template;
 	char *keytab;
 	char *pwhelp;
@@ -94,6 +108,16 @@ struct _pam_krb5_options {
 	char **preauth_options;
 #endif
 
+	/* Not options: the templates above, parsed by
+	 * v5_user_info_template_parse() when we read the options. */
+	struct _pam_krb5_template *ccname_template_template;
+#ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PKINIT
+	struct _pam_krb5_template *pkinit_identity_template;
+#endif
+#ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PA
+	struct _pam_krb5_template **preauth_options_templates;
+#endif
+
 	struct afs_cell {
 		char *cell, *principal_name;
 	} *afs_cells;
@@ -102,8 +126,18 @@ struct _pam_krb5_options {
 	char *mappings_s;
 	struct name_mapping {
 		char *pattern, *replacement;
+		/* Set up by map_compile(). */
+		struct name_mapping_compiled *compiled;
 	} *mappings;
 	int n_mappings;
+
+	/* Not an option: where the current call is collecting timings, if the
+	 * "timing" option is set. */
+	struct _pam_krb5_timing *timings;
+
+	/* Not options: set if this structure is being kept in the PAM
+	 * handle's cache of parsed options, and while a call is using it. */
+	int cached, in_use;
 };
 
 enum _pam_krb5_option_role {
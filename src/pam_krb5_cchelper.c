@@ -33,13 +33,18 @@
 #include "../config.h"
 
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
 #include <limits.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -51,88 +56,10 @@
 #include <keyutils.h>
 #endif
 
+#include "cchelper.h"
+#include "ccinit.h"
 #include "xstr.h"
 
-krb5_error_code
-cc_resolve_and_initialize(krb5_context ctx, const char *ccname,
-			  krb5_principal client, krb5_ccache *ccout)
-{
-	krb5_ccache ccache;
-	krb5_error_code err;
-#if defined(HAVE_KRB5_CC_SUPPORT_SWITCH) && \
-    defined(HAVE_KRB5_CC_CACHE_MATCH) && \
-    defined(HAVE_KRB5_CC_NEW_UNIQUE)
-	krb5_cccol_cursor cursor;
-	krb5_boolean make_primary;
-	char *cctype, *hint, *defcc;
-	const char *cdefcc;
-
-	/* Set the default name to the already-not-a-template location that
-	 * we're planning to use, in case we end up calling
-	 * krb5_cc_new_unique() below. */
-	cdefcc = krb5_cc_default_name(ctx);
-	defcc = (cdefcc != NULL) ? strdup(cdefcc) : NULL;
-	err = krb5_cc_set_default_name(ctx, ccname);
-
-	/* Isolate the cctype. */
-	cctype = strdup(ccname);
-	hint = strchr(cctype, ':');
-	if (hint != NULL) {
-		*hint++ = '\0';
-	}
-
-	/* If the type supports switching... */
-	if (krb5_cc_support_switch(ctx, cctype)) {
-		/* check if there are any ccaches in there yet */
-		make_primary = FALSE;
-		if (krb5_cccol_cursor_new(ctx, &cursor) == 0) {
-			ccache = NULL;
-			if ((krb5_cccol_cursor_next(ctx, cursor,
-						    &ccache) == 0) &&
-			    (ccache != NULL)) {
-				make_primary = FALSE;
-			} else {
-				make_primary = TRUE;
-			}
-			krb5_cccol_cursor_free(ctx, &cursor);
-		}
-		/* check if we already have a ccache for this client. */
-		ccache = NULL;
-		err = krb5_cc_cache_match(ctx, client, &ccache);
-		if (err != 0) {
-			if (err == KRB5_CC_NOTFOUND) {
-				/* We don't have one -> create a new one. */
-				err = krb5_cc_new_unique(ctx, cctype, hint,
-							 &ccache);
-			} else {
-				/* Some other error -> just start over. */
-				err = krb5_cc_resolve(ctx, ccname, &ccache);
-			}
-		}
-		/* make this the primary ccache if there wasn't already one */
-		if ((ccache != NULL) && make_primary) {
-			krb5_cc_switch(ctx, ccache);
-		}
-	} else {
-		/* Just resolve the name for overwriting later. */
-		err = krb5_cc_resolve(ctx, ccname, &ccache);
-	}
-	krb5_cc_set_default_name(ctx, defcc);
-#else
-	err = krb5_cc_resolve(ctx, ccname, &ccache);
-#endif
-	*ccout = NULL;
-	if (err == 0) {
-		err = krb5_cc_initialize(ctx, ccache, client);
-		if (err == 0) {
-			*ccout = ccache;
-			return 0;
-		}
-		krb5_cc_close(ctx, ccache);
-	}
-	return err;
-}
-
 #ifdef HAVE_KEYUTILS_H
 static int
 is_original_keyring(const char *residual)
@@ -149,101 +76,14 @@ is_original_keyring(const char *residual)
 }
 #endif
 
-/* A simple (hopefully) helper which creates a file using mkstemp() and a
- * supplied pattern, attempts to set the ownership of that file, stores
- * whatever it reads from stdin in that file, and then prints the file's name
- * on stdout.
- *
- * While all of this can be done directly by pam_krb5, we need to do it after
- * an exec() to have the file created with the proper context if we're running
- * in an SELinux environment, so the helper is used.  To simplify debugging and
- * maintenance, use of this helper is not conditionalized. */
-int
-main(int argc, const char **argv)
+
+/* Attempt to drop supplemental groups and become the given user.  Note that
+ * this may all fail if we're unprivileged, and that is expressly allowed. */
+static int
+become(long long uid, long long gid)
 {
-	krb5_context ctx = NULL;
-	krb5_ccache ccache = NULL, tmp_ccache = NULL;
-	krb5_principal client = NULL;
-	char *ccname, *workccname, *p, input[128 * 1024], pattern[PATH_MAX];
-	struct dirent **dents = NULL;
-	struct stat st, st2;
-	long long uid, gid;
 	gid_t current_gid;
-	long id;
-	int fd, i, j, c_flag = 0, d_flag = 0, u_flag = 0;
-	size_t n_input, n_output;
-
-	/* Get this out of the way. */
-	umask(S_IRGRP | S_IWGRP | S_IXGRP | S_IROTH | S_IWOTH | S_IXOTH);
-
-	/* We're not intended to be set*id! */
-	if ((getuid() != geteuid()) || (getgid() != getegid())) {
-		return 1;
-	}
-
-	/* Two or four arguments.  No more, no less, else we bail. */
-	if ((argc != 3) && (argc != 5)) {
-		return 2;
-	}
-
-	/* Check what mode we're in. */
-	if (strcmp(argv[1], "-c") == 0) {
-		c_flag++;
-	} else
-	if (strcmp(argv[1], "-d") == 0) {
-		d_flag++;
-	} else
-	if (strcmp(argv[1], "-u") == 0) {
-		u_flag++;
-	} else {
-		return 3;
-	}
-
-	/* We'll need a writable string for use as the template. */
-	ccname = xstrdup(argv[2]);
-	if (ccname == NULL) {
-		return 4;
-	}
-	if (strchr(ccname, ':') == NULL) {
-		p = malloc(strlen(ccname) + 6);
-		if (p != NULL) {
-			snprintf(p, strlen(ccname) + 6, "FILE:%s", ccname);
-			ccname = p;
-		}
-	}
-	workccname = NULL;
-
-	/* Parse the UID, if given. */
-	if (argc > 3) {
-#ifdef HAVE_STRTOLL
-		uid = strtoll(argv[3], &p, 0);
-#else
-		uid = strtol(argv[3], &p, 0);
-#endif
-		if ((p == NULL) || (*p != '\0')) {
-			return 5;
-		}
-	} else {
-		uid = getuid();
-	}
 
-	/* Parse the GID, if given. */
-	if (argc > 4) {
-#ifdef HAVE_STRTOLL
-		gid = strtoll(argv[4], &p, 0);
-#else
-		gid = strtol(argv[4], &p, 0);
-#endif
-		if ((p == NULL) || (*p != '\0')) {
-			return 5;
-		}
-	} else {
-		gid = getgid();
-	}
-
-	/* Attempt to drop supplemental groups and become the given user (if
-	 * one was given).  Note that this may all fail if we're unprivileged,
-	 * and that is expressly allowed. */
 	current_gid = getgid();
 	if (getuid() == 0) {
 		if (setgroups(0, &current_gid) == -1) {
@@ -266,24 +106,39 @@ main(int argc, const char **argv)
 			}
 		}
 	}
+	return 0;
+}
 
-	/* Read stdin. */
-	n_input = 0;
-	while (n_input < sizeof(input)) {
-		i = read(STDIN_FILENO, input + n_input,
-			 sizeof(input) - n_input);
-		if (i < 0) {
-			return 7;
-		}
-		n_input += i;
-		if (i == 0) {
-			close(STDIN_FILENO);
-			break;
-		}
+/* Create, update, or destroy the named ccache, storing the name of the
+ * result, followed by a newline, in "output". */
+static int
+cchelper(int c_flag, int d_flag, int u_flag, const char *template,
+	 long long uid, long long gid, const char *input, size_t n_input,
+	 char *output, size_t output_size)
+{
+	krb5_context ctx = NULL;
+	krb5_ccache ccache = NULL, tmp_ccache = NULL;
+	krb5_principal client = NULL;
+	char *ccname, *workccname, *p, pattern[PATH_MAX];
+	struct dirent **dents = NULL;
+	struct stat st, st2;
+	long id;
+	int fd, i, j;
+	size_t n_output;
+
+	/* We'll need a writable string for use as the template. */
+	ccname = xstrdup(template);
+	if (ccname == NULL) {
+		return 4;
 	}
-	if (n_input == sizeof(input)) {
-		return 8;
+	if (strchr(ccname, ':') == NULL) {
+		p = malloc(strlen(ccname) + 6);
+		if (p != NULL) {
+			snprintf(p, strlen(ccname) + 6, "FILE:%s", ccname);
+			ccname = p;
+		}
 	}
+	workccname = NULL;
 
 	i = krb5_init_context(&ctx);
 	if (i != 0) {
@@ -415,7 +270,7 @@ main(int argc, const char **argv)
 			n_output += i;
 		}
 		close(fd);
-		printf("%s\n", ccname);
+		snprintf(output, output_size, "%s\n", ccname);
 		return 0;
 	}
 
@@ -466,7 +321,7 @@ main(int argc, const char **argv)
 			}
 			do {
 				/* Try to create a unique directory. */
-				strcpy(ccname, argv[2]);
+				strcpy(ccname, template);
 				mktemp(ccname + 4);
 				if (strlen(ccname + 4) == 0) {
 					i = EINVAL;
@@ -537,7 +392,7 @@ main(int argc, const char **argv)
 			}
 			do {
 				/* Try to create a unique keyring name. */
-				strcpy(ccname, argv[2]);
+				strcpy(ccname, template);
 				mktemp(ccname + 8);
 				if (strlen(ccname + 8) == 0) {
 					i = EINVAL;
@@ -599,8 +454,9 @@ main(int argc, const char **argv)
 	/* Copy the credentials from the temporary ccache to the
 	 * ready-to-receive-them destination. */
 	ccache = NULL;
-	i = cc_resolve_and_initialize(ctx, workccname ? workccname : ccname,
-				      client, &ccache);
+	i = _pam_krb5_cc_resolve_and_initialize(ctx,
+						workccname ? workccname : ccname,
+						client, &ccache);
 	krb5_free_principal(ctx, client);
 	if (i != 0) {
 		if (ccache != NULL) {
@@ -640,6 +496,440 @@ main(int argc, const char **argv)
 	krb5_cc_close(ctx, ccache);
 	krb5_cc_destroy(ctx, tmp_ccache);
 	krb5_free_context(ctx);
-	printf("%s\n", ccname);
+	snprintf(output, output_size, "%s\n", ccname);
 	return 0;
 }
+
+#ifdef SO_PEERCRED
+static ssize_t
+read_all(int fd, void *buffer, size_t len)
+{
+	size_t n;
+	ssize_t i;
+
+	n = 0;
+	while (n < len) {
+		i = read(fd, (char *) buffer + n, len - n);
+		if ((i == -1) && (errno == EINTR)) {
+			continue;
+		}
+		if (i <= 0) {
+			break;
+		}
+		n += i;
+	}
+	return n;
+}
+
+static ssize_t
+write_all(int fd, const void *buffer, size_t len)
+{
+	size_t n;
+	ssize_t i;
+
+	n = 0;
+	while (n < len) {
+		i = write(fd, (const char *) buffer + n, len - n);
+		if ((i == -1) && (errno == EINTR)) {
+			continue;
+		}
+		if (i <= 0) {
+			break;
+		}
+		n += i;
+	}
+	return n;
+}
+
+/* Read one request from a client, carry it out as the requested user, and
+ * send back the result.  Called in a child process. */
+static int
+serve_one(int s, const struct ucred *peer)
+{
+	struct _pam_krb5_cchelper_request request;
+	struct _pam_krb5_cchelper_reply reply;
+	char ccname[PATH_MAX], input[128 * 1024], output[PATH_MAX + 2];
+	long long uid, gid;
+
+	if ((read_all(s, &request, sizeof(request)) != sizeof(request)) ||
+	    (request.magic != PAM_KRB5_CCHELPER_MAGIC) ||
+	    (request.ccname_len == 0) ||
+	    (request.ccname_len >= sizeof(ccname)) ||
+	    (request.data_len >= sizeof(input))) {
+		return 2;
+	}
+	if ((read_all(s, ccname, request.ccname_len) != request.ccname_len) ||
+	    (read_all(s, input, request.data_len) != request.data_len)) {
+		return 7;
+	}
+	ccname[request.ccname_len] = '\0';
+	if (strlen(ccname) != request.ccname_len) {
+		return 2;
+	}
+
+	/* Only root gets to pick whom we act as.  Anyone else who got this
+	 * far is running as the same user we are, and gets treated the way
+	 * the helper would treat them if they'd run it, which is to say, as
+	 * themselves. */
+	if (peer->uid == 0) {
+		uid = (uid_t) request.uid;
+		gid = (gid_t) request.gid;
+	} else {
+		uid = peer->uid;
+		gid = peer->gid;
+	}
+
+	memset(&reply, 0, sizeof(reply));
+	reply.magic = PAM_KRB5_CCHELPER_MAGIC;
+	memset(output, '\0', sizeof(output));
+	reply.status = become(uid, gid);
+	if (reply.status == 0) {
+		reply.status = cchelper(request.flag == 'c',
+					request.flag == 'd',
+					request.flag == 'u',
+					ccname, uid, gid,
+					input, request.data_len,
+					output, sizeof(output));
+	}
+	memset(input, '\0', sizeof(input));
+	reply.output_len = strlen(output);
+	if ((write_all(s, &reply, sizeof(reply)) != sizeof(reply)) ||
+	    (write_all(s, output, reply.output_len) != reply.output_len)) {
+		return 10;
+	}
+	return 0;
+}
+
+static volatile sig_atomic_t report_requested;
+
+static void
+request_report(int signum)
+{
+	report_requested = 1;
+}
+
+/* Check that a client is one that we're willing to spend a child process on,
+ * which is to say that it's root or that it's running as the same user that
+ * we are, and don't let it keep us waiting for too long. */
+static int
+authorize(int c, struct ucred *peer)
+{
+	struct timeval timeout;
+	socklen_t len;
+
+	len = sizeof(*peer);
+	if ((getsockopt(c, SOL_SOCKET, SO_PEERCRED, peer, &len) != 0) ||
+	    ((peer->uid != 0) && (peer->uid != geteuid()))) {
+		return -1;
+	}
+	memset(&timeout, 0, sizeof(timeout));
+	timeout.tv_sec = PAM_KRB5_CCHELPER_TIMEOUT;
+	if ((setsockopt(c, SOL_SOCKET, SO_RCVTIMEO,
+			&timeout, sizeof(timeout)) != 0) ||
+	    (setsockopt(c, SOL_SOCKET, SO_SNDTIMEO,
+			&timeout, sizeof(timeout)) != 0)) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Listen for requests on a local socket, handling each one in a child process
+ * so that changing IDs in one doesn't affect the others, and so that callers
+ * needn't run a new copy of the helper for each request.  At most
+ * "max_children" requests from authorized clients are handled at a time, and
+ * others are turned away without being given a child.  Sending us a SIGUSR1
+ * gets a count of what we've done written to stderr. */
+static int
+serve(const char *path, int max_children)
+{
+	struct sockaddr_un address;
+	struct sigaction sa;
+	struct ucred peer;
+	struct stat st;
+	unsigned long served, rejected, failed, waited;
+	int s, c, status, active, peak;
+	pid_t child;
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if ((max_children < 1) || (strlen(path) == 0) ||
+	    (strlen(path) >= sizeof(address.sun_path))) {
+		return 2;
+	}
+	strcpy(address.sun_path, path);
+
+	/* Clear out a socket left behind by a previous instance, but don't
+	 * remove anything else which might be there. */
+	if ((lstat(path, &st) == 0) && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+	s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s == -1) {
+		return 14;
+	}
+	if ((bind(s, (struct sockaddr *) &address, sizeof(address)) != 0) ||
+	    (chmod(path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |
+			 S_IROTH | S_IWOTH) != 0) ||
+	    (listen(s, SOMAXCONN) != 0)) {
+		close(s);
+		return 14;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+	sa.sa_handler = request_report;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	served = rejected = failed = waited = 0;
+	active = peak = 0;
+	for (;;) {
+		/* Reap any children which have finished. */
+		while ((child = waitpid(-1, &status, WNOHANG)) > 0) {
+			active--;
+			if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+				failed++;
+			}
+		}
+		/* If we're at the limit, wait for one to finish. */
+		while (active >= max_children) {
+			child = waitpid(-1, &status, 0);
+			if (child > 0) {
+				active--;
+				waited++;
+				if (!WIFEXITED(status) ||
+				    (WEXITSTATUS(status) != 0)) {
+					failed++;
+				}
+			} else if (errno != EINTR) {
+				active = 0;
+			}
+		}
+		if (report_requested) {
+			report_requested = 0;
+			fprintf(stderr, "served %lu, rejected %lu, failed %lu, "
+				"active %d, peak %d, waited for a slot %lu\n",
+				served, rejected, failed, active, peak,
+				waited);
+		}
+		c = accept(s, NULL, NULL);
+		if (c == -1) {
+			continue;
+		}
+		if (authorize(c, &peer) != 0) {
+			rejected++;
+			close(c);
+			continue;
+		}
+		switch (child = fork()) {
+		case -1:
+			failed++;
+			close(c);
+			break;
+		case 0:
+			close(s);
+			sa.sa_handler = SIG_DFL;
+			sigaction(SIGUSR1, &sa, NULL);
+			_exit(serve_one(c, &peer));
+			break;
+		default:
+			close(c);
+			served++;
+			active++;
+			if (active > peak) {
+				peak = active;
+			}
+			break;
+		}
+	}
+	abort(); /* not reached */
+}
+#endif
+
+/* Hold on to the memfd which we were given as our standard input, at a known
+ * descriptor, until we're told to stop, or until "lifetime" seconds have
+ * passed.  We do that in a child which nobody has to wait for, after telling
+ * whoever started us its PID. */
+static int
+keep_memfd(unsigned int lifetime)
+{
+	sigset_t mask;
+	pid_t child;
+	long i, max;
+	int null;
+#if defined(F_GET_SEALS) && defined(F_SEAL_WRITE)
+	int seals;
+#endif
+
+#if defined(F_GET_SEALS) && defined(F_SEAL_WRITE)
+	/* Only hold on to things which nobody can change.  Anything which
+	 * isn't a memfd can't be sealed at all. */
+	seals = fcntl(STDIN_FILENO, F_GET_SEALS);
+	if ((seals == -1) || ((seals & F_SEAL_WRITE) == 0)) {
+		return 6;
+	}
+#else
+	return 6;
+#endif
+	switch (child = fork()) {
+	case -1:
+		return 7;
+	case 0:
+		break;
+	default:
+		printf("%ld\n", (long) child);
+		return (fflush(stdout) == 0) ? 0 : 7;
+	}
+	setsid();
+	if (dup2(STDIN_FILENO, PAM_KRB5_CCHELPER_MEMFD_FD) == -1) {
+		_exit(1);
+	}
+	null = open("/dev/null", O_RDWR);
+	if (null != -1) {
+		dup2(null, STDIN_FILENO);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+	}
+#ifdef HAVE_CLOSE_RANGE
+	if (close_range(PAM_KRB5_CCHELPER_MEMFD_FD + 1, ~0U, 0) != 0)
+#endif
+	{
+		max = sysconf(_SC_OPEN_MAX);
+		for (i = PAM_KRB5_CCHELPER_MEMFD_FD + 1; i < max; i++) {
+			close(i);
+		}
+	}
+	signal(SIGHUP, SIG_IGN);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGALRM, SIG_DFL);
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+	alarm(lifetime);
+	for (;;) {
+		pause();
+	}
+}
+
+/* A simple (hopefully) helper which creates a file using mkstemp() and a
+ * supplied pattern, attempts to set the ownership of that file, stores
+ * whatever it reads from stdin in that file, and then prints the file's name
+ * on stdout.
+ *
+ * While all of this can be done directly by pam_krb5, we need to do it after
+ * an exec() to have the file created with the proper context if we're running
+ * in an SELinux environment, so the helper is used.  To simplify debugging and
+ * maintenance, use of this helper is not conditionalized.
+ *
+ * When started with "--serve", the helper instead waits for the same requests
+ * to be sent to it over a local socket. */
+int
+main(int argc, const char **argv)
+{
+	char *p, input[128 * 1024], output[PATH_MAX + 2];
+	long long uid, gid;
+	int i, c_flag = 0, d_flag = 0, u_flag = 0;
+	size_t n_input;
+
+	/* Get this out of the way. */
+	umask(S_IRGRP | S_IWGRP | S_IXGRP | S_IROTH | S_IWOTH | S_IXOTH);
+
+	/* We're not intended to be set*id! */
+	if ((getuid() != geteuid()) || (getgid() != getegid())) {
+		return 1;
+	}
+
+	/* Server mode takes a socket location and an optional limit. */
+	if ((argc > 1) && (strcmp(argv[1], "--serve") == 0)) {
+		if ((argc < 3) || (argc > 4)) {
+			return 2;
+		}
+#ifdef SO_PEERCRED
+		return serve(argv[2], (argc > 3) ? atoi(argv[3]) : 16);
+#else
+		return 2;
+#endif
+	}
+
+	/* Keeping a memfd takes a lifetime, and the memfd itself. */
+	if ((argc > 1) && (strcmp(argv[1], "--keep-memfd") == 0)) {
+		if (argc != 3) {
+			return 2;
+		}
+		return keep_memfd(strtoul(argv[2], NULL, 10));
+	}
+
+	/* Two or four arguments.  No more, no less, else we bail. */
+	if ((argc != 3) && (argc != 5)) {
+		return 2;
+	}
+
+	/* Check what mode we're in. */
+	if (strcmp(argv[1], "-c") == 0) {
+		c_flag++;
+	} else
+	if (strcmp(argv[1], "-d") == 0) {
+		d_flag++;
+	} else
+	if (strcmp(argv[1], "-u") == 0) {
+		u_flag++;
+	} else {
+		return 3;
+	}
+
+	/* Parse the UID, if given. */
+	if (argc > 3) {
+#ifdef HAVE_STRTOLL
+		uid = strtoll(argv[3], &p, 0);
+#else
+		uid = strtol(argv[3], &p, 0);
+#endif
+		if ((p == NULL) || (*p != '\0')) {
+			return 5;
+		}
+	} else {
+		uid = getuid();
+	}
+
+	/* Parse the GID, if given. */
+	if (argc > 4) {
+#ifdef HAVE_STRTOLL
+		gid = strtoll(argv[4], &p, 0);
+#else
+		gid = strtol(argv[4], &p, 0);
+#endif
+		if ((p == NULL) || (*p != '\0')) {
+			return 5;
+		}
+	} else {
+		gid = getgid();
+	}
+
+	i = become(uid, gid);
+	if (i != 0) {
+		return i;
+	}
+
+	/* Read stdin. */
+	n_input = 0;
+	while (n_input < sizeof(input)) {
+		i = read(STDIN_FILENO, input + n_input,
+			 sizeof(input) - n_input);
+		if (i < 0) {
+			return 7;
+		}
+		n_input += i;
+		if (i == 0) {
+			close(STDIN_FILENO);
+			break;
+		}
+	}
+	if (n_input == sizeof(input)) {
+		return 8;
+	}
+
+	memset(output, '\0', sizeof(output));
+	i = cchelper(c_flag, d_flag, u_flag, argv[2], uid, gid,
+		     input, n_input, output, sizeof(output));
+	fputs(output, stdout);
+	return i;
+}
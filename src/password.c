@@ -83,7 +83,7 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 	struct pam_message message;
 
 	/* Initialize Kerberos. */
-	if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+	if (_pam_krb5_init_ctx_for_handle(pamh, &ctx, argc, argv) != 0) {
 		warn("error initializing Kerberos");
 		return PAM_SERVICE_ERR;
 	}
@@ -92,7 +92,7 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 	i = pam_get_user(pamh, &user, NULL);
 	if ((i != PAM_SUCCESS) || (user == NULL)) {
 		warn("could not identify user name");
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return i;
 	}
 
@@ -100,7 +100,7 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 	i = v5_alloc_get_init_creds_opt(ctx, &gic_options);
 	if (i != 0) {
 		warn("error initializing options (shouldn't happen)");
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 	options = _pam_krb5_options_init(pamh, argc, argv, ctx,
@@ -108,13 +108,13 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 	if (options == NULL) {
 		warn("error parsing options (shouldn't happen)");
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 	_pam_krb5_set_init_opts(ctx, gic_options, options);
 
 	/* Get information about the user and the user's principal name. */
-	userinfo = _pam_krb5_user_info_init(ctx, user, options);
+	userinfo = _pam_krb5_user_info_init(pamh, ctx, user, options);
 	if (userinfo == NULL) {
 		if (options->ignore_unknown_principals) {
 			retval = PAM_IGNORE;
@@ -124,7 +124,7 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 		}
 		_pam_krb5_options_free(pamh, ctx, options);
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return retval;
 	}
 
@@ -139,7 +139,7 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 		_pam_krb5_user_info_free(ctx, userinfo);
 		_pam_krb5_options_free(pamh, ctx, options);
 		v5_free_get_init_creds_opt(ctx, gic_options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_IGNORE;
 	}
 
@@ -551,6 +551,6 @@ pam_sm_chauthtok(pam_handle_t *pamh, int flags,
 	_pam_krb5_user_info_free(ctx, userinfo);
 	_pam_krb5_options_free(pamh, ctx, options);
 	v5_free_get_init_creds_opt(ctx, gic_options);
-	_pam_krb5_free_ctx(ctx);
+	_pam_krb5_free_ctx_for_handle(pamh, ctx);
 	return retval;
 }
@@ -33,8 +33,19 @@
 #include "../config.h"
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_FSUID_H
+#include <sys/fsuid.h>
+#endif
+#include <errno.h>
+#include <grp.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+
+#include KRB5_H
+
+#include "log.h"
 #include "perms.h"
 
 struct _pam_krb5_perms {
@@ -89,3 +100,56 @@ _pam_krb5_restore_perms(struct _pam_krb5_perms *saved)
 	}
 	return ret;
 }
+
+#ifdef PAM_KRB5_FS_PERMS
+/* Start accessing files as the user, the way a helper would after dropping
+ * privileges, and with a umask which keeps anything we create private.  If
+ * we're not root, we just keep being ourselves, as a helper would. */
+int
+_pam_krb5_switch_fs_perms(uid_t uid, gid_t gid,
+			  struct _pam_krb5_fs_perms *saved)
+{
+	memset(saved, 0, sizeof(*saved));
+	saved->umask = umask(S_IRWXG | S_IRWXO);
+	if (geteuid() != 0) {
+		return 0;
+	}
+	saved->n_groups = getgroups(0, NULL);
+	if (saved->n_groups > 0) {
+		saved->groups = malloc(sizeof(gid_t) * saved->n_groups);
+		if ((saved->groups == NULL) ||
+		    (getgroups(saved->n_groups, saved->groups) == -1)) {
+			free(saved->groups);
+			saved->groups = NULL;
+			return -1;
+		}
+	} else if (saved->n_groups < 0) {
+		return -1;
+	}
+	saved->switched = 1;
+	if ((setgroups(0, NULL) != 0) ||
+	    ((gid_t) setfsgid(gid) == (gid_t) -1) ||
+	    ((gid_t) setfsgid(-1) != gid) ||
+	    ((uid_t) setfsuid(uid) == (uid_t) -1) ||
+	    ((uid_t) setfsuid(-1) != uid)) {
+		return -1;
+	}
+	return 0;
+}
+
+void
+_pam_krb5_restore_fs_perms(struct _pam_krb5_fs_perms *saved)
+{
+	if (saved->switched) {
+		setfsuid(geteuid());
+		setfsgid(getegid());
+		if (setgroups(saved->n_groups, saved->groups) != 0) {
+			warn("error restoring supplemental groups: %s",
+			     strerror(errno));
+		}
+		free(saved->groups);
+	}
+	umask(saved->umask);
+	memset(saved, 0, sizeof(*saved));
+}
+#endif
@@ -37,4 +37,20 @@ struct _pam_krb5_perms;
 struct _pam_krb5_perms *_pam_krb5_switch_perms(void);
 int _pam_krb5_restore_perms(struct _pam_krb5_perms *saved);
 
+#if defined(HAVE_SYS_FSUID_H) && defined(HAVE_SETFSUID) && defined(HAVE_SETFSGID)
+#define PAM_KRB5_FS_PERMS 1
+
+/* Our filesystem identity and related settings, saved while we're acting as
+ * another user. */
+struct _pam_krb5_fs_perms {
+	mode_t umask;
+	int switched, n_groups;
+	gid_t *groups;
+};
+
+int _pam_krb5_switch_fs_perms(uid_t uid, gid_t gid,
+			      struct _pam_krb5_fs_perms *saved);
+void _pam_krb5_restore_fs_perms(struct _pam_krb5_fs_perms *saved);
+#endif
+
 #endif
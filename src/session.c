@@ -56,6 +56,7 @@
 #include "session.h"
 #include "shmem.h"
 #include "stash.h"
+#include "timing.h"
 #include "tokens.h"
 #include "userinfo.h"
 #include "v5.h"
@@ -74,41 +75,52 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 	struct _pam_krb5_options *options;
 	struct _pam_krb5_user_info *userinfo;
 	struct _pam_krb5_stash *stash;
+	struct _pam_krb5_timing timing;
 	int i, retval;
 
 	/* Initialize Kerberos. */
-	if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+	_pam_krb5_timing_init(&timing);
+	_pam_krb5_timing_start(&timing, _pam_krb5_timing_init_ctx);
+	if (_pam_krb5_init_ctx_for_handle(pamh, &ctx, argc, argv) != 0) {
 		warn("error initializing Kerberos");
 		return PAM_SERVICE_ERR;
 	}
+	_pam_krb5_timing_stop(&timing, _pam_krb5_timing_init_ctx);
 
 	/* Get the user's name. */
 	i = pam_get_user(pamh, &user, NULL);
 	if ((i != PAM_SUCCESS) || (user == NULL)) {
 		warn("could not identify user name");
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return i;
 	}
 
 	/* Read our options. */
+	_pam_krb5_timing_start(&timing, _pam_krb5_timing_options_init);
 	options = _pam_krb5_options_init(pamh, argc, argv, ctx,
 					 _pam_krb5_option_role_general);
 	if (options == NULL) {
 		warn("error parsing options (shouldn't happen)");
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
+	_pam_krb5_timing_stop(&timing, _pam_krb5_timing_options_init);
+	options->timings = options->timing ? &timing : NULL;
 
 	/* If we're in a no-cred-session situation, return. */
 	if ((!options->cred_session) &&
 	    (caller_type == _pam_krb5_session_caller_setcred)) {
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SUCCESS;
 	}
 
 	/* Get information about the user and the user's principal name. */
-	userinfo = _pam_krb5_user_info_init(ctx, user, options);
+	_pam_krb5_timing_start(options->timings,
+			       _pam_krb5_timing_user_info_init);
+	userinfo = _pam_krb5_user_info_init(pamh, ctx, user, options);
+	_pam_krb5_timing_stop(options->timings,
+			      _pam_krb5_timing_user_info_init);
 	if (userinfo == NULL) {
 		if (options->debug) {
 			debug("no user info for '%s'", user);
@@ -118,13 +130,15 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 		} else {
 			retval = PAM_USER_UNKNOWN;
 		}
+		_pam_krb5_timing_report(options->timings, caller,
+					user, retval);
 		if (options->debug) {
 			debug("%s returning %d (%s)", caller,
 			      retval,
 			      pam_strerror(pamh, retval));
 		}
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return retval;
 	}
 	if ((options->user_check) &&
@@ -140,12 +154,14 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 			      pam_strerror(pamh, PAM_IGNORE));
 		}
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_IGNORE;
 	}
 
 	/* Get the stash for this user. */
+	_pam_krb5_timing_start(options->timings, _pam_krb5_timing_stash_get);
 	stash = _pam_krb5_stash_get(pamh, user, userinfo, options);
+	_pam_krb5_timing_stop(options->timings, _pam_krb5_timing_stash_get);
 	if (stash == NULL) {
 		warn("no stash for '%s' (shouldn't happen)", user);
 		_pam_krb5_user_info_free(ctx, userinfo);
@@ -155,7 +171,7 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 			      pam_strerror(pamh, PAM_SERVICE_ERR));
 		}
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
@@ -164,14 +180,28 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 	 * to do it later.) */
 	if (options->use_shmem) {
 		if ((stash->v5shm != -1) && (stash->v5shm_owner != -1)) {
-			if (options->debug) {
-				debug("removing shared memory segment %d"
-				      " creator pid %ld",
-				      stash->v5shm, (long) stash->v5shm_owner);
+			if (stash->v5shm_memfd) {
+				if (options->debug) {
+					debug("removing memfd %d held by "
+					      "pid %ld", stash->v5shm,
+					      (long) stash->v5shm_owner);
+				}
+				_pam_krb5_memfd_remove(stash->v5shm_owner,
+						       stash->v5shm,
+						       options->debug);
+			} else {
+				if (options->debug) {
+					debug("removing shared memory segment "
+					      "%d creator pid %ld",
+					      stash->v5shm,
+					      (long) stash->v5shm_owner);
+				}
+				_pam_krb5_shm_remove(stash->v5shm_owner,
+						     stash->v5shm,
+						     options->debug);
 			}
-			_pam_krb5_shm_remove(stash->v5shm_owner, stash->v5shm,
-					     options->debug);
 			stash->v5shm = -1;
+			stash->v5shm_memfd = 0;
 			_pam_krb5_stash_shm_var_name(options, user, &segname);
 			if (segname != NULL) {
 				pam_putenv(pamh, segname);
@@ -192,7 +222,7 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 			      pam_strerror(pamh, PAM_SUCCESS));
 		}
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SUCCESS;
 	}
 
@@ -200,7 +230,11 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 	if ((i == PAM_SUCCESS) &&
 	    (options->ignore_afs == 0) &&
 	    tokens_useful()) {
+		_pam_krb5_timing_start(options->timings,
+				       _pam_krb5_timing_tokens_obtain);
 		tokens_obtain(ctx, stash, options, userinfo, 1);
+		_pam_krb5_timing_stop(options->timings,
+				      _pam_krb5_timing_tokens_obtain);
 	}
 
 	/* Create the user's credential cache, but only if we didn't pick them
@@ -253,11 +287,12 @@ _pam_krb5_open_session(pam_handle_t *pamh, int flags,
 		debug("%s returning %d (%s)", caller, i,
 		      pam_strerror(pamh, i));
 	}
+	_pam_krb5_timing_report(options->timings, caller, user, i);
 	_pam_krb5_options_free(pamh, ctx, options);
 	_pam_krb5_user_info_free(ctx, userinfo);
 
 
-	_pam_krb5_free_ctx(ctx);
+	_pam_krb5_free_ctx_for_handle(pamh, ctx);
 	return i;
 }
 
@@ -275,7 +310,7 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 	int i, retval;
 
 	/* Initialize Kerberos. */
-	if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+	if (_pam_krb5_init_ctx_for_handle(pamh, &ctx, argc, argv) != 0) {
 		warn("error initializing Kerberos");
 		return PAM_SERVICE_ERR;
 	}
@@ -284,7 +319,7 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 	i = pam_get_user(pamh, &user, NULL);
 	if (i != PAM_SUCCESS) {
 		warn("could not determine user name");
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return i;
 	}
 
@@ -292,7 +327,7 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 	options = _pam_krb5_options_init(pamh, argc, argv, ctx,
 					 _pam_krb5_option_role_general);
 	if (options == NULL) {
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
@@ -300,12 +335,12 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 	if ((!options->cred_session) &&
 	    (caller_type == _pam_krb5_session_caller_setcred)) {
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SUCCESS;
 	}
 
 	/* Get information about the user and the user's principal name. */
-	userinfo = _pam_krb5_user_info_init(ctx, user, options);
+	userinfo = _pam_krb5_user_info_init(pamh, ctx, user, options);
 	if (userinfo == NULL) {
 		if (options->ignore_unknown_principals) {
 			retval = PAM_IGNORE;
@@ -319,7 +354,7 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 			      pam_strerror(pamh, retval));
 		}
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return retval;
 	}
 
@@ -336,7 +371,7 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 			      pam_strerror(pamh, PAM_IGNORE));
 		}
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_IGNORE;
 	}
 
@@ -351,7 +386,7 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 			      pam_strerror(pamh, PAM_SERVICE_ERR));
 		}
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
@@ -369,7 +404,7 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 			      pam_strerror(pamh, PAM_SUCCESS));
 		}
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SUCCESS;
 	}
 
@@ -398,7 +433,7 @@ _pam_krb5_close_session(pam_handle_t *pamh, int flags,
 		      pam_strerror(pamh, PAM_SUCCESS));
 	}
 	_pam_krb5_options_free(pamh, ctx, options);
-	_pam_krb5_free_ctx(ctx);
+	_pam_krb5_free_ctx_for_handle(pamh, ctx);
 	return PAM_SUCCESS;
 }
 
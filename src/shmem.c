@@ -34,10 +34,15 @@
 
 #include <sys/types.h>
 #include <sys/ipc.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #include <sys/shm.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -54,6 +59,7 @@
 #include KRB5_H
 
 #include "cchelper.h"
+#include "child.h"
 #include "log.h"
 #include "shmem.h"
 #include "stash.h"
@@ -69,6 +75,15 @@ struct _pam_krb5_shm_rec {
 	int debug;
 };
 
+#if defined(HAVE_MEMFD_CREATE) && defined(MFD_ALLOW_SEALING) && \
+    defined(F_ADD_SEALS) && defined(F_GET_SEALS)
+#define USE_MEMFD
+/* Once these are set, nobody can change the contents of a memfd. */
+#define MEMFD_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+/* The name we give our memfds, which shows up in /proc. */
+#define MEMFD_NAME "pam_krb5_stash"
+#endif
+
 /* Release a shared memory segment. */
 void
 _pam_krb5_shm_remove(pid_t pid, int key, int log_debug)
@@ -333,3 +348,241 @@ _pam_krb5_blob_from_shm(int key, void **block, size_t *block_size)
 		address = _pam_krb5_shm_detach(address);
 	}
 }
+
+#ifdef USE_MEMFD
+/* Open the memfd which process "pid" has open as descriptor "fd", checking
+ * that it's one of ours: sealed, created by our user, and with our name. */
+static int
+_pam_krb5_memfd_open(pid_t pid, int fd, struct stat *st)
+{
+	char path[64], link[PATH_MAX];
+	ssize_t len;
+	int ofd, seals;
+
+	snprintf(path, sizeof(path), "/proc/%ld/fd/%d", (long) pid, fd);
+	len = readlink(path, link, sizeof(link) - 1);
+	if (len == -1) {
+		return -1;
+	}
+	link[len] = '\0';
+	if (strncmp(link, "/memfd:" MEMFD_NAME " ",
+		    strlen("/memfd:" MEMFD_NAME " ")) != 0) {
+		return -1;
+	}
+	ofd = open(path, O_RDONLY | O_CLOEXEC);
+	if (ofd == -1) {
+		return -1;
+	}
+	seals = fcntl(ofd, F_GET_SEALS);
+	if ((seals == -1) || ((seals & MEMFD_SEALS) != MEMFD_SEALS) ||
+	    (fstat(ofd, st) == -1) ||
+	    (!S_ISREG(st->st_mode)) ||
+	    (st->st_uid != getuid()) ||
+	    (st->st_uid != geteuid())) {
+		close(ofd);
+		return -1;
+	}
+	return ofd;
+}
+#endif
+
+/* Check if we can use memfds. */
+int
+_pam_krb5_memfd_available(void)
+{
+#ifdef USE_MEMFD
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Stop the process which is holding a memfd open for us, if it's still
+ * holding one of ours. */
+void
+_pam_krb5_memfd_remove(pid_t pid, int fd, int log_debug)
+{
+#ifdef USE_MEMFD
+	struct stat st;
+	int ofd;
+
+	ofd = _pam_krb5_memfd_open(pid, fd, &st);
+	if (ofd == -1) {
+		if (log_debug) {
+			debug("process %ld is not holding memfd %d, not "
+			      "stopping it", (long) pid, fd);
+		}
+		return;
+	}
+	close(ofd);
+	if (log_debug) {
+		debug("cleanup function stopping process %ld, which holds "
+		      "memfd %d", (long) pid, fd);
+	}
+	kill(pid, SIGTERM);
+#endif
+}
+
+/* Clean up a memfd and its record. */
+static void
+_pam_krb5_memfd_cleanup(pam_handle_t *pamh, void *data, int status)
+{
+	struct _pam_krb5_shm_rec *rec;
+	rec = data;
+	_pam_krb5_memfd_remove(rec->pid, rec->key, rec->debug);
+	free(rec->name);
+	free(rec);
+}
+
+/* Create a sealed memfd containing "data", and have "helper" start a process
+ * which holds it open, so that it outlives us, until it's removed or until
+ * "lifetime" seconds have passed.  Returns the number of the descriptor in
+ * that process, and stores the process's PID in "pid", or returns -1. */
+int
+_pam_krb5_memfd_new(pam_handle_t *pamh, const char *helper,
+		    const void *data, size_t size,
+		    unsigned int lifetime, pid_t *pid, int debug)
+{
+#ifdef USE_MEMFD
+	struct _pam_krb5_shm_rec *rec;
+	struct _pam_krb5_child child;
+	char lifetimestr[32], pidstr[32], *argv[4], *p;
+	ssize_t n;
+	long keeper;
+	int fd, fds[2], dummy[3], i;
+
+	*pid = -1;
+	/* Make sure that neither the memfd nor the pipe ends up as
+	 * descriptors 0 through 2. */
+	for (i = 0; i < 3; i++) {
+		dummy[i] = open("/dev/null", O_RDONLY);
+	}
+	fd = memfd_create(MEMFD_NAME, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1) {
+		warn("error creating memfd: %s", strerror(errno));
+		for (i = 0; i < 3; i++) {
+			close(dummy[i]);
+		}
+		return -1;
+	}
+	if ((_pam_krb5_write_with_retry(fd, data, size) != (ssize_t) size) ||
+	    (fcntl(fd, F_ADD_SEALS, MEMFD_SEALS) == -1) ||
+	    (pipe(fds) == -1)) {
+		warn("error filling memfd: %s", strerror(errno));
+		close(fd);
+		for (i = 0; i < 3; i++) {
+			close(dummy[i]);
+		}
+		return -1;
+	}
+
+	/* Hand the memfd to a fresh copy of the helper, instead of keeping a
+	 * copy of the whole calling process around for as long as the
+	 * credentials last.  It tells us the PID of the process which ends up
+	 * holding it. */
+	snprintf(lifetimestr, sizeof(lifetimestr), "%u", lifetime);
+	argv[0] = (char *) helper;
+	argv[1] = "--keep-memfd";
+	argv[2] = lifetimestr;
+	argv[3] = NULL;
+	if (_pam_krb5_child_exec(&child, helper, argv, geteuid(), getegid(),
+				 fd, fds[1]) == -1) {
+		warn("error running helper \"%s\": %s", helper,
+		     strerror(errno));
+	}
+	for (i = 0; i < 3; i++) {
+		close(dummy[i]);
+	}
+	close(fds[1]);
+	close(fd);
+	keeper = -1;
+	if (child.pid != -1) {
+		memset(pidstr, '\0', sizeof(pidstr));
+		n = _pam_krb5_read_with_retry(fds[0],
+					      (unsigned char *) pidstr,
+					      sizeof(pidstr) - 1);
+		if ((_pam_krb5_child_wait(&child) == 0) && (n > 0)) {
+			keeper = strtol(pidstr, &p, 10);
+			if ((p == pidstr) || (*p != '\n') || (keeper <= 0)) {
+				keeper = -1;
+			}
+		}
+	}
+	close(fds[0]);
+	if (keeper == -1) {
+		warn("error starting process to hold memfd");
+		return -1;
+	}
+
+	/* Save the record. */
+	rec = malloc(sizeof(struct _pam_krb5_shm_rec));
+	if (rec != NULL) {
+		rec->name = malloc(strlen("_pam_krb5_memfd_") +
+				   sizeof(keeper) * 8);
+		if (rec->name == NULL) {
+			free(rec);
+			rec = NULL;
+		}
+	}
+	if (rec == NULL) {
+		_pam_krb5_memfd_remove(keeper, PAM_KRB5_CCHELPER_MEMFD_FD,
+				       debug);
+		return -1;
+	}
+	sprintf(rec->name, "_pam_krb5_memfd_%ld", keeper);
+	rec->pid = keeper;
+	rec->key = PAM_KRB5_CCHELPER_MEMFD_FD;
+	rec->debug = debug;
+	pam_set_data(pamh, rec->name, rec, _pam_krb5_memfd_cleanup);
+	*pid = keeper;
+	return PAM_KRB5_CCHELPER_MEMFD_FD;
+#else
+	*pid = -1;
+	return -1;
+#endif
+}
+
+/* Map the memfd which process "pid" holds as descriptor "fd", returning the
+ * address where it was mapped, and its size.  The caller will need to detach
+ * it. */
+void *
+_pam_krb5_memfd_attach(pid_t pid, int fd, size_t *size)
+{
+#ifdef USE_MEMFD
+	struct stat st;
+	void *address;
+	int ofd;
+
+	*size = 0;
+	ofd = _pam_krb5_memfd_open(pid, fd, &st);
+	if (ofd == -1) {
+		return NULL;
+	}
+	if (st.st_size <= 0) {
+		close(ofd);
+		return NULL;
+	}
+	address = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, ofd, 0);
+	close(ofd);
+	if (address == MAP_FAILED) {
+		return NULL;
+	}
+	*size = st.st_size;
+	return address;
+#else
+	*size = 0;
+	return NULL;
+#endif
+}
+
+/* Unmap a memfd, returning NULL. */
+void *
+_pam_krb5_memfd_detach(void *address, size_t size)
+{
+#ifdef USE_MEMFD
+	if (address != NULL) {
+		munmap(address, size);
+	}
+#endif
+	return NULL;
+}
@@ -46,4 +46,12 @@ int _pam_krb5_shm_new_from_blob(pam_handle_t *pamh, size_t lead,
 				int debug);
 void _pam_krb5_blob_from_shm(int key, void **block, size_t *block_size);
 
+int _pam_krb5_memfd_available(void);
+int _pam_krb5_memfd_new(pam_handle_t *pamh, const char *helper,
+			const void *data, size_t size,
+			unsigned int lifetime, pid_t *pid, int debug);
+void *_pam_krb5_memfd_attach(pid_t pid, int fd, size_t *size);
+void *_pam_krb5_memfd_detach(void *address, size_t size);
+void _pam_krb5_memfd_remove(pid_t pid, int fd, int debug);
+
 #endif
@@ -133,7 +133,7 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags, const char *why,
 	}
 
 	/* Initialize Kerberos. */
-	if (_pam_krb5_init_ctx(&ctx, argc, argv) != 0) {
+	if (_pam_krb5_init_ctx_for_handle(pamh, &ctx, argc, argv) != 0) {
 		warn("error initializing Kerberos");
 		return PAM_SERVICE_ERR;
 	}
@@ -142,7 +142,7 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags, const char *why,
 	i = pam_get_user(pamh, &user, NULL);
 	if ((i != PAM_SUCCESS) || (user == NULL)) {
 		warn("could not identify user name");
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return i;
 	}
 
@@ -151,7 +151,7 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags, const char *why,
 					 _pam_krb5_option_role_general);
 	if (options == NULL) {
 		warn("error parsing options (shouldn't happen)");
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 	if (options->debug) {
@@ -159,7 +159,7 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags, const char *why,
 	}
 
 	/* Get information about the user and the user's principal name. */
-	userinfo = _pam_krb5_user_info_init(ctx, user, options);
+	userinfo = _pam_krb5_user_info_init(pamh, ctx, user, options);
 	if (userinfo == NULL) {
 		if (options->ignore_unknown_principals) {
 			retval = PAM_IGNORE;
@@ -169,7 +169,7 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags, const char *why,
 			retval = PAM_USER_UNKNOWN;
 		}
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return retval;
 	}
 
@@ -181,7 +181,7 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags, const char *why,
 		}
 		_pam_krb5_user_info_free(ctx, userinfo);
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_IGNORE;
 	}
 
@@ -192,7 +192,7 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags, const char *why,
 		     user);
 		_pam_krb5_user_info_free(ctx, userinfo);
 		_pam_krb5_options_free(pamh, ctx, options);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return PAM_SERVICE_ERR;
 	}
 
@@ -318,7 +318,7 @@ _pam_krb5_sly_maybe_refresh(pam_handle_t *pamh, int flags, const char *why,
 
 	_pam_krb5_user_info_free(ctx, userinfo);
 	_pam_krb5_options_free(pamh, ctx, options);
-	_pam_krb5_free_ctx(ctx);
+	_pam_krb5_free_ctx_for_handle(pamh, ctx);
 
 	return retval;
 }
@@ -37,6 +37,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_SECURITY_PAM_APPL_H
@@ -49,6 +50,7 @@
 
 #include KRB5_H
 
+#include "ccfile.h"
 #include "cchelper.h"
 #include "init.h"
 #include "log.h"
@@ -60,6 +62,12 @@
 
 #define PAM_KRB5_STASH_TEMPLATE			"_pam_krb5_stash_%s_%s_%s_%d"
 #define PAM_KRB5_STASH_TEMPLATE_SHM_SUFFIX	"_shm"
+#define PAM_KRB5_STASH_MEMFD_PREFIX		"memfd:"
+#define PAM_KRB5_STASH_V2_MAGIC			"\377pk\002"
+#define PAM_KRB5_STASH_V2_MAGIC_LENGTH		4
+#define PAM_KRB5_STASH_V2_TAG_STATE		1
+#define PAM_KRB5_STASH_V2_TAG_TGT		2
+#define PAM_KRB5_STASH_V2_TAG_PWC		3
 
 static void
 _pam_krb5_stash_name_with_suffix(struct _pam_krb5_options *options,
@@ -132,11 +140,314 @@ _pam_krb5_stash_cleanup(pam_handle_t *pamh, void *data, int error)
 		stash->v5ccnames = node->next;
 		free(node);
 	}
-	krb5_free_context(stash->v5ctx);
+	if (stash->v5shared != NULL) {
+		_pam_krb5_shared_ctx_unref(stash->v5shared);
+	} else {
+		krb5_free_context(stash->v5ctx);
+	}
 	memset(stash, 0, sizeof(struct _pam_krb5_stash));
 	free(stash);
 }
 
+/* Version 2 of the blob which we pass between processes starts with a magic
+ * number which can't be mistaken for the size at the start of the original
+ * layout, and then holds entries, each a 16-bit tag and a 32-bit length, both
+ * big-endian, followed by the value.  The state entry holds v5attempted,
+ * v5result and v5external as 32-bit values, and the credential entries hold
+ * one credential each, encoded as in a FILE: ccache.  We skip entries which
+ * we don't recognize. */
+static int
+_pam_krb5_stash_v2_blob(const void *blob, size_t blob_size)
+{
+	return (blob_size >= PAM_KRB5_STASH_V2_MAGIC_LENGTH) &&
+	       (memcmp(blob, PAM_KRB5_STASH_V2_MAGIC,
+		       PAM_KRB5_STASH_V2_MAGIC_LENGTH) == 0);
+}
+
+static unsigned char *
+_pam_krb5_stash_v2_put(unsigned char *p, unsigned int tag,
+		       const void *data, size_t length)
+{
+	p[0] = (tag >> 8) & 0xff;
+	p[1] = tag & 0xff;
+	p[2] = (length >> 24) & 0xff;
+	p[3] = (length >> 16) & 0xff;
+	p[4] = (length >> 8) & 0xff;
+	p[5] = length & 0xff;
+	memcpy(p + 6, data, length);
+	return p + 6 + length;
+}
+
+/* Build a version 2 blob holding the TGT, any password-changing ticket, and
+ * our state, and note when the TGT expires. */
+static int
+_pam_krb5_stash_v2_encode(struct _pam_krb5_stash *stash,
+			  struct _pam_krb5_options *options,
+			  unsigned char **blob, size_t *blob_size,
+			  krb5_timestamp *endtime)
+{
+	krb5_creds tgt, pwc;
+	unsigned char *tgt_blob, *pwc_blob, state[12], *p;
+	size_t tgt_size, pwc_size, size;
+	int i, values[3];
+
+	*blob = NULL;
+	*blob_size = 0;
+	*endtime = 0;
+	if ((stash->v5ccache == NULL) || !_pam_krb5_ccfile_available()) {
+		return -1;
+	}
+	memset(&tgt, 0, sizeof(tgt));
+	if (v5_ccache_has_tgt(stash->v5ctx, stash->v5ccache,
+			      options->realm, &tgt) != 0) {
+		return -1;
+	}
+	*endtime = tgt.times.endtime;
+	i = _pam_krb5_ccfile_serialize_cred(stash->v5ctx, &tgt,
+					    &tgt_blob, &tgt_size);
+	krb5_free_cred_contents(stash->v5ctx, &tgt);
+	if (i != 0) {
+		return -1;
+	}
+	pwc_blob = NULL;
+	pwc_size = 0;
+	memset(&pwc, 0, sizeof(pwc));
+	if (v5_ccache_has_pwc(stash->v5ctx, stash->v5ccache, &pwc) == 0) {
+		if (_pam_krb5_ccfile_serialize_cred(stash->v5ctx, &pwc,
+						    &pwc_blob,
+						    &pwc_size) != 0) {
+			pwc_blob = NULL;
+			pwc_size = 0;
+		}
+		krb5_free_cred_contents(stash->v5ctx, &pwc);
+	}
+
+	values[0] = stash->v5attempted;
+	values[1] = stash->v5result;
+	values[2] = stash->v5external;
+	for (i = 0; i < 3; i++) {
+		state[i * 4] = (values[i] >> 24) & 0xff;
+		state[i * 4 + 1] = (values[i] >> 16) & 0xff;
+		state[i * 4 + 2] = (values[i] >> 8) & 0xff;
+		state[i * 4 + 3] = values[i] & 0xff;
+	}
+	size = PAM_KRB5_STASH_V2_MAGIC_LENGTH + 6 + sizeof(state) +
+	       6 + tgt_size + (pwc_blob ? 6 + pwc_size : 0);
+	*blob = malloc(size);
+	if (*blob != NULL) {
+		memcpy(*blob, PAM_KRB5_STASH_V2_MAGIC,
+		       PAM_KRB5_STASH_V2_MAGIC_LENGTH);
+		p = *blob + PAM_KRB5_STASH_V2_MAGIC_LENGTH;
+		p = _pam_krb5_stash_v2_put(p, PAM_KRB5_STASH_V2_TAG_STATE,
+					   state, sizeof(state));
+		p = _pam_krb5_stash_v2_put(p, PAM_KRB5_STASH_V2_TAG_TGT,
+					   tgt_blob, tgt_size);
+		if (pwc_blob != NULL) {
+			p = _pam_krb5_stash_v2_put(p,
+						   PAM_KRB5_STASH_V2_TAG_PWC,
+						   pwc_blob, pwc_size);
+		}
+		*blob_size = size;
+	}
+	memset(tgt_blob, 0, tgt_size);
+	free(tgt_blob);
+	if (pwc_blob != NULL) {
+		memset(pwc_blob, 0, pwc_size);
+		free(pwc_blob);
+	}
+	return (*blob != NULL) ? 0 : -1;
+}
+
+/* Make sure the stash has a MEMORY: ccache to load credentials in to. */
+static krb5_error_code
+_pam_krb5_stash_memory_ccache(struct _pam_krb5_stash *stash, int *created)
+{
+	char ccname[LINE_MAX];
+	krb5_error_code err;
+
+	*created = 0;
+	if (stash->v5ccache != NULL) {
+		return 0;
+	}
+	snprintf(ccname, sizeof(ccname), "MEMORY:%p", &stash->v5ccache);
+	err = krb5_cc_resolve(stash->v5ctx, ccname, &stash->v5ccache);
+	if (err != 0) {
+		stash->v5ccache = NULL;
+		return err;
+	}
+	*created = 1;
+	return 0;
+}
+
+/* Decode a version 2 blob in to the stash.  The credentials are stored in the
+ * stash's ccache straight from the blob. */
+static krb5_error_code
+_pam_krb5_stash_v2_decode(struct _pam_krb5_stash *stash,
+			  const unsigned char *blob, size_t blob_size)
+{
+	const unsigned char *p, *end;
+	unsigned long length, value;
+	unsigned int tag;
+	int i, values[3], have_state, n_creds;
+	krb5_error_code err;
+
+	p = blob + PAM_KRB5_STASH_V2_MAGIC_LENGTH;
+	end = blob + blob_size;
+	have_state = 0;
+	n_creds = 0;
+	err = 0;
+	while ((err == 0) && (p < end)) {
+		if (end - p < 6) {
+			err = KRB5_CC_FORMAT;
+			break;
+		}
+		tag = (p[0] << 8) | p[1];
+		length = ((unsigned long) p[2] << 24) | (p[3] << 16) |
+			 (p[4] << 8) | p[5];
+		p += 6;
+		if (length > (unsigned long) (end - p)) {
+			err = KRB5_CC_FORMAT;
+			break;
+		}
+		switch (tag) {
+		case PAM_KRB5_STASH_V2_TAG_STATE:
+			if (length < 12) {
+				err = KRB5_CC_FORMAT;
+				break;
+			}
+			for (i = 0; i < 3; i++) {
+				value = ((unsigned long) p[i * 4] << 24) |
+					(p[i * 4 + 1] << 16) |
+					(p[i * 4 + 2] << 8) |
+					p[i * 4 + 3];
+				values[i] = (value & 0x80000000UL) ?
+					    -(int) (0xffffffffUL - value) - 1 :
+					    (int) value;
+			}
+			have_state = 1;
+			break;
+		case PAM_KRB5_STASH_V2_TAG_TGT:
+		case PAM_KRB5_STASH_V2_TAG_PWC:
+			/* The first credential tells us the client. */
+			err = _pam_krb5_ccfile_store_cred(stash->v5ctx,
+							  p, length,
+							  stash->v5ccache,
+							  n_creds == 0);
+			n_creds++;
+			break;
+		default:
+			break;
+		}
+		p += length;
+	}
+	if ((err == 0) && (!have_state || (n_creds == 0))) {
+		err = KRB5_CC_FORMAT;
+	}
+	if (err == 0) {
+		stash->v5attempted = values[0];
+		stash->v5result = values[1];
+		stash->v5external = values[2];
+	}
+	return err;
+}
+
+/* Decode a blob in to the stash, if it's in version 2 format, or if it's in
+ * the original format and we can parse the ccache in it ourselves. */
+static krb5_error_code
+_pam_krb5_stash_blob_decode(struct _pam_krb5_stash *stash,
+			    const void *blob, size_t blob_size)
+{
+	const unsigned char *blob_creds;
+	int lead[4], created;
+	krb5_error_code err;
+
+	if (!_pam_krb5_stash_v2_blob(blob, blob_size)) {
+		if (!_pam_krb5_ccfile_available()) {
+			return KRB5_CC_NOSUPP;
+		}
+		if (blob_size < sizeof(lead)) {
+			return KRB5_CC_FORMAT;
+		}
+		memcpy(lead, blob, sizeof(lead));
+		if ((lead[0] < 0) ||
+		    ((size_t) lead[0] > blob_size - sizeof(lead))) {
+			return KRB5_CC_FORMAT;
+		}
+	}
+	err = _pam_krb5_stash_memory_ccache(stash, &created);
+	if (err != 0) {
+		return err;
+	}
+	if (_pam_krb5_stash_v2_blob(blob, blob_size)) {
+		err = _pam_krb5_stash_v2_decode(stash, blob, blob_size);
+	} else {
+		blob_creds = blob;
+		blob_creds += sizeof(lead);
+		err = _pam_krb5_ccfile_deserialize(stash->v5ctx,
+						   blob_creds, lead[0],
+						   stash->v5ccache);
+		if (err == 0) {
+			stash->v5attempted = lead[1];
+			stash->v5result = lead[2];
+			stash->v5external = lead[3];
+		}
+	}
+	if ((err != 0) && created) {
+		krb5_cc_destroy(stash->v5ctx, stash->v5ccache);
+		stash->v5ccache = NULL;
+	}
+	return err;
+}
+
+/* Note where we got credentials from, for the self-tests. */
+static void
+_pam_krb5_stash_shm_note_read(pam_handle_t *pamh,
+			      struct _pam_krb5_options *options,
+			      const char *location)
+{
+	char envstr[PATH_MAX];
+
+	if (options->test_environment) {
+		snprintf(envstr, sizeof(envstr),
+			 PACKAGE "_read_shm_segment=%s", location);
+		pam_putenv(pamh, envstr);
+	}
+}
+
+/* Set the PAM environment variable which tells the next process where to
+ * find the credentials, and remember it so that we can clean up. */
+static void
+_pam_krb5_stash_shm_set_var(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
+			    struct _pam_krb5_options *options,
+			    const char *user, int memfd, int key, pid_t owner)
+{
+	char variable[PATH_MAX + 6], *segname, envstr[PATH_MAX];
+
+	segname = NULL;
+	_pam_krb5_stash_shm_var_name(options, user, &segname);
+	if (segname == NULL) {
+		return;
+	}
+	snprintf(variable, sizeof(variable), "%s=%s%d/%ld", segname,
+		 memfd ? PAM_KRB5_STASH_MEMFD_PREFIX : "", key, (long) owner);
+	free(segname);
+	pam_putenv(pamh, variable);
+	if (options->debug) {
+		debug("set '%s' in environment", variable);
+	}
+	if (options->test_environment) {
+		/* Store this here so that we can check for it in a
+		 * self-test. */
+		snprintf(envstr, sizeof(envstr),
+			 PACKAGE "_write_shm_segment%s",
+			 variable + strcspn(variable, "="));
+		pam_putenv(pamh, envstr);
+	}
+	stash->v5shm = key;
+	stash->v5shm_owner = owner;
+	stash->v5shm_memfd = memfd;
+}
+
 /* Read state from the shared memory blob. */
 static void
 _pam_krb5_stash_shm_read_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
@@ -144,7 +455,7 @@ _pam_krb5_stash_shm_read_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 			    const char *location, int key,
 			    void *blob, size_t blob_size)
 {
-	char tktfile[PATH_MAX + 6], envstr[PATH_MAX];
+	char tktfile[PATH_MAX + 6];
 	unsigned char *blob_creds;
 	ssize_t blob_creds_size;
 	int fd;
@@ -207,13 +518,7 @@ _pam_krb5_stash_shm_read_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 			debug("recovered credentials from shared memory "
 			      "segment %d", key);
 		}
-		if (options->test_environment) {
-			/* Store this here so that we can check for it
-			 * in a self-test. */
-			snprintf(envstr, sizeof(envstr),
-				 PACKAGE "_read_shm_segment=%s", location);
-			pam_putenv(pamh, envstr);
-		}
+		_pam_krb5_stash_shm_note_read(pamh, options, location);
 	}
 
 	/* Clean up. */
@@ -228,7 +533,7 @@ _pam_krb5_stash_shm_write_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 			     const char *user,
 			     struct _pam_krb5_user_info *userinfo)
 {
-	char variable[PATH_MAX + 6], *segname, envstr[PATH_MAX];
+	char variable[PATH_MAX + 6];
 	void *blob;
 	int *intblob;
 	size_t blob_size;
@@ -288,37 +593,136 @@ _pam_krb5_stash_shm_write_v5(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 	close(fd);
 
 	if (key != -1) {
-		segname = NULL;
-		_pam_krb5_stash_shm_var_name(options, user, &segname);
-		if (segname != NULL) {
-			snprintf(variable, sizeof(variable),
-				 "%s=%d/%ld",
-				 segname, key, (long) getpid());
-			free(segname);
-			pam_putenv(pamh, variable);
-			if (options->debug) {
-				debug("saved credentials to shared memory "
-				      "segment %d (creator pid %ld)", key,
-				      (long) getpid());
-				debug("set '%s' in environment", variable);
-			}
-			if (options->test_environment) {
-				/* Store this here so that we can check for it
-				 * in a self-test. */
-				snprintf(envstr, sizeof(envstr),
-					 PACKAGE "_write_shm_segment%s",
-					 variable + strcspn(variable, "="));
-				pam_putenv(pamh, envstr);
-			}
-			stash->v5shm = key;
-			stash->v5shm_owner = getpid();
+		if (options->debug) {
+			debug("saved credentials to shared memory "
+			      "segment %d (creator pid %ld)", key,
+			      (long) getpid());
 		}
+		_pam_krb5_stash_shm_set_var(pamh, stash, options, user, 0,
+					    key, getpid());
 	} else {
 		warn("error saving credential state to shared "
 		     "memory segment");
 	}
 }
 
+/* Save state to a shared memory segment, in the version 2 format.  Returns 0
+ * if we saved it, or didn't need to, or -1 if the caller should fall back to
+ * the original format. */
+static int
+_pam_krb5_stash_shm_write_v2(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
+			     struct _pam_krb5_options *options,
+			     const char *user)
+{
+	unsigned char *blob;
+	size_t blob_size;
+	krb5_timestamp endtime;
+	int key;
+
+	/* Sanity check. */
+	if ((stash->v5attempted == 0) || (stash->v5result != 0)) {
+		return 0;
+	}
+	if (_pam_krb5_stash_v2_encode(stash, options, &blob, &blob_size,
+				      &endtime) != 0) {
+		return -1;
+	}
+	key = _pam_krb5_shm_new_from_blob(pamh, 0, blob, blob_size, NULL,
+					  options->debug);
+	memset(blob, 0, blob_size);
+	free(blob);
+	if (key == -1) {
+		warn("error saving credential state to shared "
+		     "memory segment");
+		return 0;
+	}
+	if (options->debug) {
+		debug("saved %lu bytes of credentials to shared memory "
+		      "segment %d (creator pid %ld)", (unsigned long) blob_size,
+		      key, (long) getpid());
+	}
+	_pam_krb5_stash_shm_set_var(pamh, stash, options, user, 0,
+				    key, getpid());
+	return 0;
+}
+
+/* Read state from a sealed memfd, decoding the credentials straight from it in
+ * to our ccache. */
+static void
+_pam_krb5_stash_memfd_read(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
+			   struct _pam_krb5_options *options,
+			   const char *location, int fd, pid_t owner)
+{
+	void *address;
+	size_t size;
+	krb5_error_code err;
+
+	address = _pam_krb5_memfd_attach(owner, fd, &size);
+	if (address == NULL) {
+		warn("no memfd %d held by process %ld", fd, (long) owner);
+		return;
+	}
+	err = _pam_krb5_stash_blob_decode(stash, address, size);
+	_pam_krb5_memfd_detach(address, size);
+	if (err != 0) {
+		warn("error reading credentials from memfd %d: %s", fd,
+		     v5_error_message(err));
+		return;
+	}
+	if (options->debug) {
+		debug("recovered credentials from memfd %d held by process "
+		      "%ld", fd, (long) owner);
+	}
+	_pam_krb5_stash_shm_note_read(pamh, options, location);
+}
+
+/* Save state to a sealed memfd.  Returns 0 if we saved it, or didn't need
+ * to, or -1 if the caller should fall back to a shared memory segment. */
+static int
+_pam_krb5_stash_memfd_write(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
+			    struct _pam_krb5_options *options,
+			    const char *user)
+{
+	unsigned char *blob;
+	size_t blob_size;
+	krb5_timestamp endtime;
+	unsigned int lifetime;
+	time_t now;
+	pid_t keeper;
+	int fd;
+
+	/* Sanity check. */
+	if ((stash->v5attempted == 0) || (stash->v5result != 0)) {
+		return 0;
+	}
+
+	/* Serialize the credentials, and note how long they'll be useful. */
+	if (_pam_krb5_stash_v2_encode(stash, options, &blob, &blob_size,
+				      &endtime) != 0) {
+		return -1;
+	}
+	now = time(NULL);
+	lifetime = (endtime > now) ? (unsigned int) (endtime - now) : 1;
+
+	/* Put them in a memfd. */
+	fd = _pam_krb5_memfd_new(pamh, options->cchelper_path,
+				 blob, blob_size, lifetime, &keeper,
+				 options->debug);
+	memset(blob, 0, blob_size);
+	free(blob);
+	if (fd == -1) {
+		warn("error saving credential state to memfd");
+		return -1;
+	}
+	if (options->debug) {
+		debug("saved credentials to memfd %d held by process %ld",
+		      fd, (long) keeper);
+	}
+	_pam_krb5_stash_shm_set_var(pamh, stash, options, user, 1,
+				    fd, keeper);
+	return 0;
+}
+
 /* Retrieve credentials from the shared memory segments named by the PAM
  * environment variables which begin with partial_key. */
 void
@@ -328,13 +732,14 @@ _pam_krb5_stash_shm_read(pam_handle_t *pamh, const char *partial_key,
 			 const char *user,
 			 struct _pam_krb5_user_info *userinfo)
 {
-	int key;
+	int key, memfd;
 	pid_t owner;
 	long l;
 	char *variable, *p, *q;
 	const char *value;
 	void *blob;
 	size_t blob_size;
+	krb5_error_code err;
 
 	/* Construct the name of a variable. */
 	_pam_krb5_stash_shm_var_name(options, user, &variable);
@@ -346,6 +751,13 @@ _pam_krb5_stash_shm_read(pam_handle_t *pamh, const char *partial_key,
 	value = pam_getenv(pamh, variable);
 	key = -1;
 	owner = -1;
+	memfd = 0;
+	if ((value != NULL) &&
+	    (strncmp(value, PAM_KRB5_STASH_MEMFD_PREFIX,
+		     strlen(PAM_KRB5_STASH_MEMFD_PREFIX)) == 0)) {
+		memfd = 1;
+		value += strlen(PAM_KRB5_STASH_MEMFD_PREFIX);
+	}
 	if (value != NULL) {
 		l = strtol(value, &p, 0);
 		if ((p != NULL) && (*p == '/')) {
@@ -359,7 +771,11 @@ _pam_krb5_stash_shm_read(pam_handle_t *pamh, const char *partial_key,
 			}
 		}
 		if ((key != -1) && (owner != -1)) {
-			if (options->debug) {
+			if (options->debug && memfd) {
+				debug("found memfd %d held by pid %ld",
+				      key, (long) owner);
+			}
+			if (options->debug && !memfd) {
 				debug("found shm segment %d owned by UID %lu",
 				      key, (unsigned long) owner);
 			}
@@ -378,11 +794,35 @@ _pam_krb5_stash_shm_read(pam_handle_t *pamh, const char *partial_key,
 	if ((stash->v5shm == -1) && (owner != -1)) {
 		stash->v5shm = key;
 		stash->v5shm_owner = owner;
+		stash->v5shm_memfd = memfd;
 	}
-	if (key != -1) {
+	if ((key != -1) && (owner != -1) && memfd) {
+		/* Decode the credentials without copying them anywhere. */
+		_pam_krb5_stash_memfd_read(pamh, stash, options, value,
+					   key, owner);
+	} else if (key != -1) {
 		_pam_krb5_blob_from_shm(key, &blob, &blob_size);
 		if ((blob == NULL) || (blob_size == 0)) {
 			warn("no segment with specified identifier %d", key);
+		} else if (_pam_krb5_stash_v2_blob(blob, blob_size) ||
+			   _pam_krb5_ccfile_available()) {
+			/* Decode the credentials directly. */
+			err = _pam_krb5_stash_blob_decode(stash, blob,
+							  blob_size);
+			if (err == 0) {
+				if (options->debug) {
+					debug("recovered credentials from "
+					      "shared memory segment %d", key);
+				}
+				_pam_krb5_stash_shm_note_read(pamh, options,
+							      value);
+			} else {
+				warn("error reading credentials from shared "
+				     "memory segment %d: %s", key,
+				     v5_error_message(err));
+			}
+			memset(blob, 0, blob_size);
+			free(blob);
 		} else {
 			/* Pull credentials from the blob, which contains a
 			 * ccache file.  Cross our fingers and hope it's
@@ -405,6 +845,23 @@ _pam_krb5_stash_shm_write(pam_handle_t *pamh, struct _pam_krb5_stash *stash,
 			  const char *user,
 			  struct _pam_krb5_user_info *userinfo)
 {
+	if (options->use_shmem_memfd) {
+		if (_pam_krb5_memfd_available() &&
+		    _pam_krb5_ccfile_available()) {
+			if (_pam_krb5_stash_memfd_write(pamh, stash, options,
+							user) == 0) {
+				return;
+			}
+		} else {
+			if (options->debug) {
+				debug("memfd stash not available, using a "
+				      "shared memory segment");
+			}
+		}
+	}
+	if (_pam_krb5_stash_shm_write_v2(pamh, stash, options, user) == 0) {
+		return;
+	}
 	_pam_krb5_stash_shm_write_v5(pamh, stash, options, user, userinfo);
 }
 
@@ -558,8 +1015,10 @@ _pam_krb5_stash_get(pam_handle_t *pamh, const char *user,
 	}
 
 	/* Build a new one. */
-	if (_pam_krb5_init_ctx(&ctx, options->argc,
-			       options->argv) != PAM_SUCCESS) {
+	/* Share the handle's context, if it has one, instead of reading the
+	 * configuration files yet again. */
+	if (_pam_krb5_init_ctx_for_handle(pamh, &ctx, options->argc,
+					  options->argv) != PAM_SUCCESS) {
 		warn("error initializing kerberos");
 		return NULL;
 	}
@@ -572,13 +1031,14 @@ _pam_krb5_stash_get(pam_handle_t *pamh, const char *user,
 	stash = malloc(sizeof(struct _pam_krb5_stash));
 	if (stash == NULL) {
 		free(key);
-		_pam_krb5_free_ctx(ctx);
+		_pam_krb5_free_ctx_for_handle(pamh, ctx);
 		return NULL;
 	}
 	memset(stash, 0, sizeof(struct _pam_krb5_stash));
 
 	stash->key = key;
 	stash->v5ctx = ctx;
+	stash->v5shared = _pam_krb5_shared_ctx_find(pamh, ctx);
 	stash->v5attempted = 0;
 	stash->v5result = KRB5KRB_ERR_GENERIC;
 	stash->v5expired = 0;
@@ -586,6 +1046,7 @@ _pam_krb5_stash_get(pam_handle_t *pamh, const char *user,
 	stash->v5ccnames = NULL;
 	stash->v5setenv = 0;
 	stash->v5shm = -1;
+	stash->v5shm_memfd = 0;
 	stash->v5shm_owner = -1;
 	stash->v5ccache = NULL;
 	stash->v5armorccache = NULL;
@@ -607,7 +1068,7 @@ void
 _pam_krb5_stash_push(krb5_context ctx,
 		     struct _pam_krb5_stash *stash,
 		     struct _pam_krb5_options *options,
-		     const char *ccname_template,
+		     const struct _pam_krb5_template *ccname_template,
 		     int preserve_existing_ccaches,
 		     const char *user,
 		     struct _pam_krb5_user_info *userinfo,
@@ -644,7 +1105,7 @@ _pam_krb5_stash_push(krb5_context ctx,
 		node->name = newname;
 		node->next = stash->v5ccnames;
 		node->session_specific =
-			(strstr(ccname_template, "XXXXXX") != NULL);
+			(strstr(ccname_template->source, "XXXXXX") != NULL);
 		stash->v5ccnames = node;
 	} else {
 		/* Log an error. */
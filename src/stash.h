@@ -44,11 +44,12 @@ struct _pam_krb5_ccname_list {
 struct _pam_krb5_stash {
 	char *key;
 	krb5_context v5ctx;
+	struct _pam_krb5_shared_ctx *v5shared;
 	int v5attempted, v5result, v5expired, v5external;
 	struct _pam_krb5_ccname_list *v5ccnames;
 	krb5_ccache v5ccache, v5armorccache;
 	int v5setenv;
-	int v5shm;
+	int v5shm, v5shm_memfd;
 	pid_t v5shm_owner;
 	int afspag;
 };
@@ -59,7 +60,7 @@ struct _pam_krb5_stash *_pam_krb5_stash_get(pam_handle_t *pamh,
 					    struct _pam_krb5_options *options);
 void _pam_krb5_stash_push(krb5_context ctx, struct _pam_krb5_stash *stash,
 			  struct _pam_krb5_options *options,
-			  const char *ccname_template,
+			  const struct _pam_krb5_template *ccname_template,
 			  int preserve_existing_ccaches,
 			  const char *user,
 			  struct _pam_krb5_user_info *userinfo,
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include KRB5_H
+
+#include "log.h"
+#include "timing.h"
+
+static const char *timing_phase_names[_pam_krb5_timing_n_phases] = {
+	"init_ctx",
+	"options_init",
+	"user_info_init",
+	"stash_get",
+	"get_init_creds",
+	"validate",
+	"cchelper",
+	"kuserok",
+	"tokens_obtain",
+};
+
+static long
+timing_elapsed(const struct timeval *start, const struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000L +
+	       (end->tv_usec - start->tv_usec);
+}
+
+void
+_pam_krb5_timing_init(struct _pam_krb5_timing *timing)
+{
+	if (timing == NULL) {
+		return;
+	}
+	memset(timing, 0, sizeof(*timing));
+	gettimeofday(&timing->start, NULL);
+}
+
+void
+_pam_krb5_timing_start(struct _pam_krb5_timing *timing,
+		       enum _pam_krb5_timing_phase phase)
+{
+	if (timing == NULL) {
+		return;
+	}
+	gettimeofday(&timing->phase_start[phase], NULL);
+}
+
+void
+_pam_krb5_timing_stop(struct _pam_krb5_timing *timing,
+		      enum _pam_krb5_timing_phase phase)
+{
+	struct timeval now;
+
+	if (timing == NULL) {
+		return;
+	}
+	gettimeofday(&now, NULL);
+	timing->usec[phase] += timing_elapsed(&timing->phase_start[phase],
+					      &now);
+	timing->count[phase]++;
+}
+
+/* Log everything we measured as a single line of "name=value" pairs.  Phases
+ * which ran more than once get their call count appended. */
+void
+_pam_krb5_timing_report(struct _pam_krb5_timing *timing,
+			const char *caller, const char *user, int result)
+{
+	char buf[LINE_MAX], *p;
+	struct timeval now;
+	size_t left;
+	int i, n;
+
+	if (timing == NULL) {
+		return;
+	}
+	gettimeofday(&now, NULL);
+	p = buf;
+	left = sizeof(buf);
+	n = snprintf(p, left, "timing: call=%s user=%s result=%d total=%ld",
+		     caller, user ? user : "(unknown)", result,
+		     timing_elapsed(&timing->start, &now));
+	for (i = 0; (i < _pam_krb5_timing_n_phases) &&
+		    (n > 0) && ((size_t) n < left); i++) {
+		p += n;
+		left -= n;
+		if (timing->count[i] == 0) {
+			n = 0;
+			continue;
+		}
+		if (timing->count[i] > 1) {
+			n = snprintf(p, left, " %s=%ld/%d",
+				     timing_phase_names[i], timing->usec[i],
+				     timing->count[i]);
+		} else {
+			n = snprintf(p, left, " %s=%ld",
+				     timing_phase_names[i], timing->usec[i]);
+		}
+	}
+	notice("%s", buf);
+}
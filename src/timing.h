@@ -0,0 +1,69 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef pam_krb5_timing_h
+#define pam_krb5_timing_h
+
+#include <sys/time.h>
+
+/* The phases of an entry point which we know how to time. */
+enum _pam_krb5_timing_phase {
+	_pam_krb5_timing_init_ctx,
+	_pam_krb5_timing_options_init,
+	_pam_krb5_timing_user_info_init,
+	_pam_krb5_timing_stash_get,
+	_pam_krb5_timing_get_init_creds,
+	_pam_krb5_timing_validate,
+	_pam_krb5_timing_cchelper,
+	_pam_krb5_timing_kuserok,
+	_pam_krb5_timing_tokens_obtain,
+	_pam_krb5_timing_n_phases
+};
+
+/* Accumulated wall-clock time spent in each phase during one call. */
+struct _pam_krb5_timing {
+	struct timeval start;
+	struct timeval phase_start[_pam_krb5_timing_n_phases];
+	long usec[_pam_krb5_timing_n_phases];
+	int count[_pam_krb5_timing_n_phases];
+};
+
+/* All of these are no-ops if "timing" is NULL. */
+void _pam_krb5_timing_init(struct _pam_krb5_timing *timing);
+void _pam_krb5_timing_start(struct _pam_krb5_timing *timing,
+			    enum _pam_krb5_timing_phase phase);
+void _pam_krb5_timing_stop(struct _pam_krb5_timing *timing,
+			   enum _pam_krb5_timing_phase phase);
+void _pam_krb5_timing_report(struct _pam_krb5_timing *timing,
+			     const char *caller, const char *user, int result);
+
+#endif
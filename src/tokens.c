@@ -33,6 +33,7 @@
 #include "../config.h"
 
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <limits.h>
 #include <stdio.h>
@@ -80,13 +81,70 @@ cell_is_in_option_list(struct _pam_krb5_options *options, const char *cell)
 	return 0;
 }
 
+/* Check if we've already got a token for the cell which will be good for a
+ * while yet, in which case there's no point in getting a new one. */
+static int
+tokens_fresh(krb5_context context, struct _pam_krb5_stash *stash,
+	     struct _pam_krb5_options *options, const char *cell, uid_t uid)
+{
+	if (options->afs_token_margin <= 0) {
+		return 0;
+	}
+	if (minikafs_has_token(context, stash->v5ccache, options, cell, uid,
+			       options->afs_token_margin)) {
+		if (options->debug) {
+			debug("keeping tokens for '%s'", cell);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/* Get tokens for one cell, and note how long that took if we're keeping
+ * track, along with how long it took to get its tickets ahead of time, if we
+ * did that. */
+static void
+tokens_obtain_cell(krb5_context context, struct _pam_krb5_stash *stash,
+		   struct _pam_krb5_options *options,
+		   const char *cell, const char *hint_principal, uid_t uid,
+		   const int *methods, int n_methods, long prefetch_usec)
+{
+	struct timeval start, now;
+	int ret;
+
+	gettimeofday(&start, NULL);
+	ret = minikafs_log(context, stash->v5ccache, options,
+			   cell, hint_principal, uid,
+			   methods, n_methods);
+	if (ret != 0) {
+		if (stash->v5attempted != 0) {
+			warn("got error %d (%s) while obtaining "
+			     "tokens for %s",
+			     ret, v5_error_message(ret), cell);
+		} else {
+			if (options->debug) {
+				debug("got error %d (%s) while "
+				      "obtaining tokens for %s",
+				      ret, v5_error_message(ret), cell);
+			}
+		}
+	}
+	if (options->timings != NULL) {
+		gettimeofday(&now, NULL);
+		notice("timing: cell=%s prefetch=%ld tokens=%ld result=%d",
+		       cell, prefetch_usec,
+		       (now.tv_sec - start.tv_sec) * 1000000L +
+		       (now.tv_usec - start.tv_usec), ret);
+	}
+}
+
 int
 tokens_obtain(krb5_context context,
 	      struct _pam_krb5_stash *stash,
 	      struct _pam_krb5_options *options,
 	      struct _pam_krb5_user_info *info, int newpag)
 {
-	int i, ret;
+	int i;
 	unsigned int n;
 	char localcell[LINE_MAX], homecell[LINE_MAX], homedir[LINE_MAX],
 	     lnk[LINE_MAX];
@@ -98,8 +156,9 @@ tokens_obtain(krb5_context context,
 		{"2b", MINIKAFS_METHOD_V5_2B},
 		{"rxk5", MINIKAFS_METHOD_RXK5}
 	};
-	int *methods, n_methods;
-	const char *p, *q;
+	int *methods, n_methods, n_cells, n_stale, homecell_known, fresh;
+	const char *p, *q, **cells, **hints;
+	long *usec, prefetch_usec;
 
 	if (options->debug) {
 		debug("obtaining afs tokens");
@@ -154,30 +213,10 @@ tokens_obtain(krb5_context context,
 	 * to determine which cell is considered the local cell.  Avoid getting
 	 * tripped up by dynamic root support in clients. */
 	memset(localcell, '\0', sizeof(localcell));
-	if ((minikafs_ws_cell(localcell, sizeof(localcell) - 1) == 0) &&
-	    (strcmp(localcell, "dynroot") != 0) &&
-	    (!cell_is_in_option_list(options, localcell))) {
-		if (options->debug) {
-			debug("obtaining tokens for local cell '%s'",
-			      localcell);
-		}
-		ret = minikafs_log(context, stash->v5ccache, options,
-				   localcell, NULL, uid,
-				   methods, n_methods);
-		if (ret != 0) {
-			if (stash->v5attempted != 0) {
-				warn("got error %d (%s) while obtaining "
-				     "tokens for %s",
-				     ret, v5_error_message(ret), localcell);
-			} else {
-				if (options->debug) {
-					debug("got error %d (%s) while "
-					      "obtaining tokens for %s",
-					      ret, v5_error_message(ret),
-					      localcell);
-				}
-			}
-		}
+	if ((minikafs_ws_cell(localcell, sizeof(localcell) - 1) != 0) ||
+	    (strcmp(localcell, "dynroot") == 0) ||
+	    (cell_is_in_option_list(options, localcell))) {
+		localcell[0] = '\0';
 	}
 	/* Get the name of the cell which houses the user's home directory.  In
 	 * case intervening directories aren't readable by system:anyuser
@@ -202,44 +241,118 @@ tokens_obtain(krb5_context context,
 			}
 		}
 	}
+	memset(homecell, '\0', sizeof(homecell));
 	i = minikafs_cell_of_file_walk_up(homedir, homecell,
 					  sizeof(homecell) - 1);
-	if ((i == 0) &&
-	    (strcmp(homecell, "dynroot") != 0) &&
-	    (strcmp(homecell, localcell) != 0) &&
-	    (!cell_is_in_option_list(options, homecell))) {
-		if (options->debug) {
-			debug("obtaining tokens for home cell '%s'", homecell);
+	homecell_known = (i == 0);
+	if (!homecell_known ||
+	    (strcmp(homecell, "dynroot") == 0) ||
+	    (strcmp(homecell, localcell) == 0) ||
+	    (cell_is_in_option_list(options, homecell))) {
+		homecell[0] = '\0';
+	}
+
+	/* If there's more than one cell to get tokens for, get the tickets
+	 * we'll need for all of them at once, so that we only have to wait
+	 * for the slowest KDC instead of for each of them in turn.  The tokens
+	 * themselves still get set in the same order as always. */
+	cells = malloc((options->n_afs_cells + 2) * sizeof(cells[0]));
+	hints = malloc((options->n_afs_cells + 2) * sizeof(hints[0]));
+	usec = malloc((options->n_afs_cells + 2) * sizeof(usec[0]));
+	if ((cells == NULL) || (hints == NULL) || (usec == NULL)) {
+		free(cells);
+		free(hints);
+		free(usec);
+		free(methods);
+		return PAM_BUF_ERR;
+	}
+	n_cells = 0;
+	if (strlen(localcell) > 0) {
+		hints[n_cells] = NULL;
+		cells[n_cells++] = localcell;
+	}
+	if (strlen(homecell) > 0) {
+		hints[n_cells] = NULL;
+		cells[n_cells++] = homecell;
+	}
+	for (i = 0; i < options->n_afs_cells; i++) {
+		hints[n_cells] = options->afs_cells[i].principal_name;
+		cells[n_cells++] = options->afs_cells[i].cell;
+	}
+	/* Leave out any cells for which we've still got good tokens.  A new
+	 * PAG won't have any tokens in it yet. */
+	n_stale = 0;
+	for (i = 0; i < n_cells; i++) {
+		usec[i] = -1;
+		if (!newpag &&
+		    tokens_fresh(context, stash, options, cells[i], uid)) {
+			cells[i] = NULL;
+		} else {
+			n_stale++;
 		}
-		ret = minikafs_log(context, stash->v5ccache, options,
-				   homecell, NULL, uid,
-				   methods, n_methods);
-		if (ret != 0) {
-			if (stash->v5attempted != 0) {
-				warn("got error %d (%s) while obtaining "
-				     "tokens for %s",
-				     ret, v5_error_message(ret), homecell);
-			} else {
-				if (options->debug) {
-					debug("got error %d (%s) while "
-					      "obtaining tokens for %s",
-					      ret, v5_error_message(ret),
-					      homecell);
-				}
+	}
+	if ((n_stale > 1) && options->afs_parallel) {
+		minikafs_prefetch(context, stash->v5ccache, options,
+				  cells, hints, n_cells, uid,
+				  methods, n_methods, usec);
+	}
+	n = 0;
+
+	if (strlen(localcell) > 0) {
+		if (cells[n] != NULL) {
+			if (options->debug) {
+				debug("obtaining tokens for local cell '%s'",
+				      localcell);
 			}
+			tokens_obtain_cell(context, stash, options, localcell,
+					   NULL, uid, methods, n_methods,
+					   usec[n]);
 		}
+		n++;
 	}
-
-	/* If there are no additional cells configured, stop here. */
-	if (options->afs_cells == NULL) {
-		if (options->debug) {
-			debug("no additional afs cells configured");
+	/* If we couldn't tell where the home directory is before, maybe we
+	 * can now that we have tokens for the local cell. */
+	if (!homecell_known && (strlen(localcell) > 0)) {
+		i = minikafs_cell_of_file_walk_up(homedir, homecell,
+						  sizeof(homecell) - 1);
+		if ((i != 0) ||
+		    (strcmp(homecell, "dynroot") == 0) ||
+		    (strcmp(homecell, localcell) == 0) ||
+		    (cell_is_in_option_list(options, homecell))) {
+			homecell[0] = '\0';
 		}
-		return PAM_SUCCESS;
+	}
+	if (strlen(homecell) > 0) {
+		if (homecell_known) {
+			fresh = (cells[n] == NULL);
+			prefetch_usec = usec[n++];
+		} else {
+			fresh = !newpag &&
+				tokens_fresh(context, stash, options,
+					     homecell, uid);
+			prefetch_usec = -1;
+		}
+		if (!fresh) {
+			if (options->debug) {
+				debug("obtaining tokens for home cell '%s'",
+				      homecell);
+			}
+			tokens_obtain_cell(context, stash, options, homecell,
+					   NULL, uid, methods, n_methods,
+					   prefetch_usec);
+		}
+	}
+
+	/* Note if there are no additional cells configured. */
+	if ((options->afs_cells == NULL) && options->debug) {
+		debug("no additional afs cells configured");
 	}
 
 	/* Iterate through the list of other cells. */
-	for (i = 0; i < options->n_afs_cells; i++) {
+	for (i = 0; i < options->n_afs_cells; i++, n++) {
+		if (cells[n] == NULL) {
+			continue;
+		}
 		if (options->debug) {
 			if (options->afs_cells[i].principal_name != NULL) {
 				debug("obtaining tokens for '%s' ('%s')",
@@ -250,25 +363,19 @@ tokens_obtain(krb5_context context,
 				      options->afs_cells[i].cell);
 			}
 		}
-		ret = minikafs_log(context, stash->v5ccache, options,
+		tokens_obtain_cell(context, stash, options,
 				   options->afs_cells[i].cell,
-				   options->afs_cells[i].principal_name, uid,
-				   methods, n_methods);
-		if (ret != 0) {
-			if (stash->v5attempted != 0) {
-				warn("got error %d (%s) while obtaining "
-				     "tokens for %s",
-				     ret, v5_error_message(ret),
-				     options->afs_cells[i].cell);
-			} else {
-				if (options->debug) {
-					debug("got error %d (%s) while "
-					      "obtaining tokens for %s",
-					      ret, v5_error_message(ret),
-					      options->afs_cells[i].cell);
-				}
-			}
-		}
+				   options->afs_cells[i].principal_name,
+				   uid, methods, n_methods, usec[n]);
+	}
+	free(cells);
+	free(hints);
+	free(usec);
+	free(methods);
+
+	if (options->timings != NULL) {
+		notice("timing: afs syscalls saved=%lu",
+		       minikafs_syscalls_saved());
 	}
 
 	/* Suppress all errors. */
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../config.h"
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#ifdef HAVE_SECURITY_PAM_MODULES_H
+#include <security/pam_modules.h>
+#endif
+
+#include KRB5_H
+
+#include "log.h"
+#include "mapfile.h"
+#include "options.h"
+#include "unknown.h"
+
+static struct _pam_krb5_mapfile *
+_pam_krb5_unknown_open(const struct _pam_krb5_options *options)
+{
+	if (options->unknown_principal_ttl <= 0) {
+		return NULL;
+	}
+	return _pam_krb5_mapfile_open(options->ccache_dir,
+				      PAM_KRB5_UNKNOWN_FILE,
+				      sizeof(struct _pam_krb5_unknown_table),
+				      PAM_KRB5_UNKNOWN_MAGIC,
+				      PAM_KRB5_UNKNOWN_VERSION);
+}
+
+static struct _pam_krb5_unknown_entry *
+_pam_krb5_unknown_find(struct _pam_krb5_unknown_table *table,
+		       const char *principal)
+{
+	unsigned int i;
+
+	for (i = 0; i < PAM_KRB5_UNKNOWN_ENTRIES; i++) {
+		if (strncmp(table->entries[i].name, principal,
+			    sizeof(table->entries[i].name)) == 0) {
+			return &table->entries[i];
+		}
+	}
+	return NULL;
+}
+
+/* Check if the KDC told us that it didn't know about this principal recently
+ * enough that we shouldn't bother asking it again.  Returns 1 if so. */
+int
+_pam_krb5_unknown_check(const struct _pam_krb5_options *options,
+			const char *principal)
+{
+	struct _pam_krb5_mapfile *file;
+	struct _pam_krb5_unknown_table *table;
+	struct _pam_krb5_unknown_entry *entry;
+	unsigned long long hits, misses;
+	int ret;
+
+	if ((principal == NULL) || (principal[0] == '\0') ||
+	    (strlen(principal) >= sizeof(entry->name))) {
+		return 0;
+	}
+	file = _pam_krb5_unknown_open(options);
+	if (file == NULL) {
+		return 0;
+	}
+	if (_pam_krb5_mapfile_lock(file, F_WRLCK) != 0) {
+		_pam_krb5_mapfile_close(file);
+		return 0;
+	}
+	table = file->data;
+	entry = _pam_krb5_unknown_find(table, principal);
+	if ((entry != NULL) && (entry->expires > (int64_t) time(NULL))) {
+		table->hits++;
+		ret = 1;
+	} else {
+		table->misses++;
+		ret = 0;
+	}
+	hits = table->hits;
+	misses = table->misses;
+	_pam_krb5_mapfile_unlock(file);
+	_pam_krb5_mapfile_close(file);
+	if (options->debug) {
+		debug("'%s' %s in the unknown principal cache "
+		      "(%llu hits, %llu misses)", principal,
+		      ret ? "found" : "not found", hits, misses);
+	}
+	return ret;
+}
+
+/* Note that the KDC just told us that it doesn't know about this principal.
+ * If there's no room, take over the slot which will expire soonest. */
+void
+_pam_krb5_unknown_add(const struct _pam_krb5_options *options,
+		      const char *principal)
+{
+	struct _pam_krb5_mapfile *file;
+	struct _pam_krb5_unknown_table *table;
+	struct _pam_krb5_unknown_entry *entry;
+	unsigned int i;
+
+	if ((principal == NULL) || (principal[0] == '\0') ||
+	    (strlen(principal) >= sizeof(entry->name))) {
+		return;
+	}
+	file = _pam_krb5_unknown_open(options);
+	if (file == NULL) {
+		return;
+	}
+	if (_pam_krb5_mapfile_lock(file, F_WRLCK) != 0) {
+		_pam_krb5_mapfile_close(file);
+		return;
+	}
+	table = file->data;
+	entry = _pam_krb5_unknown_find(table, principal);
+	if (entry == NULL) {
+		entry = &table->entries[0];
+		for (i = 0; i < PAM_KRB5_UNKNOWN_ENTRIES; i++) {
+			if (table->entries[i].expires < entry->expires) {
+				entry = &table->entries[i];
+			}
+		}
+		memset(entry, 0, sizeof(*entry));
+		strcpy(entry->name, principal);
+	}
+	entry->expires = (int64_t) time(NULL) + options->unknown_principal_ttl;
+	_pam_krb5_mapfile_unlock(file);
+	_pam_krb5_mapfile_close(file);
+	if (options->debug) {
+		debug("caching '%s' as unknown for %d seconds", principal,
+		      options->unknown_principal_ttl);
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef pam_krb5_unknown_h
+#define pam_krb5_unknown_h
+
+#define PAM_KRB5_UNKNOWN_FILE "pam_krb5_unknown_principals"
+#define PAM_KRB5_UNKNOWN_MAGIC 0x6b756e6b
+#define PAM_KRB5_UNKNOWN_VERSION 1
+#define PAM_KRB5_UNKNOWN_ENTRIES 128
+#define PAM_KRB5_UNKNOWN_NAME_LENGTH 256
+
+/* A principal name which the KDC recently told us it didn't know.  A slot
+ * with an empty name is unused. */
+struct _pam_krb5_unknown_entry {
+	int64_t expires;
+	char name[PAM_KRB5_UNKNOWN_NAME_LENGTH];
+};
+
+/* The layout of the file which we map, and which all of a user's processes
+ * share.  The counters note how often we've been able to skip asking. */
+struct _pam_krb5_unknown_table {
+	uint32_t magic, version;
+	uint64_t hits, misses;
+	struct _pam_krb5_unknown_entry entries[PAM_KRB5_UNKNOWN_ENTRIES];
+};
+
+struct _pam_krb5_options;
+
+int _pam_krb5_unknown_check(const struct _pam_krb5_options *options,
+			    const char *principal);
+void _pam_krb5_unknown_add(const struct _pam_krb5_options *options,
+			   const char *principal);
+
+#endif
@@ -59,8 +59,8 @@
 #include "xstr.h"
 
 struct _pam_krb5_user_info *
-_pam_krb5_user_info_init(krb5_context ctx, const char *name,
-			 struct _pam_krb5_options *options)
+_pam_krb5_user_info_init(pam_handle_t *pamh, krb5_context ctx,
+			 const char *name, struct _pam_krb5_options *options)
 {
 	struct _pam_krb5_user_info *ret = NULL;
 	char local_name[LINE_MAX];
@@ -151,10 +151,14 @@ _pam_krb5_user_info_init(krb5_context ctx, const char *name,
 	local_name[sizeof(local_name) - 1] = '\0';
 
 	if (options->user_check) {
-		/* Look up the user's UID/GID. */
-		if (_pam_krb5_get_pw_info(local_name, -1,
-					  &ret->uid, &ret->gid,
-					  &ret->homedir) != 0) {
+		/* Look up the user's UID/GID, if we haven't already. */
+		if (((pamh != NULL) ?
+		     _pam_krb5_get_pw_info_for_handle(pamh, local_name,
+						      &ret->uid, &ret->gid,
+						      &ret->homedir) :
+		     _pam_krb5_get_pw_info(local_name, -1,
+					   &ret->uid, &ret->gid,
+					   &ret->homedir)) != 0) {
 			warn("error resolving user name '%s' to uid/gid pair",
 			     local_name);
 			v5_free_unparsed_name(ctx, ret->unparsed_name);
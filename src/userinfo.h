@@ -43,7 +43,8 @@ struct _pam_krb5_user_info {
 	char *unparsed_name, *realm;
 };
 
-struct _pam_krb5_user_info *_pam_krb5_user_info_init(krb5_context ctx,
+struct _pam_krb5_user_info *_pam_krb5_user_info_init(pam_handle_t *pamh,
+						     krb5_context ctx,
 						     const char *name,
 						     struct _pam_krb5_options *options);
 
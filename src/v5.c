@@ -32,11 +32,16 @@
 
 #include "../config.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_SECURITY_PAM_APPL_H
@@ -59,11 +64,14 @@
 
 #include "conv.h"
 #include "initopts.h"
+#include "kdcrace.h"
 #include "log.h"
 #include "perms.h"
 #include "prompter.h"
 #include "sly.h"
 #include "stash.h"
+#include "timing.h"
+#include "unknown.h"
 #include "userinfo.h"
 #include "v5.h"
 #include "xstr.h"
@@ -167,229 +175,259 @@ v5_parse_name(krb5_context ctx, struct _pam_krb5_options *options,
 #endif
 }
 
-char *
-v5_user_info_subst(krb5_context ctx,
-		   const char *user,
-		   struct _pam_krb5_user_info *userinfo,
-		   struct _pam_krb5_options *options,
-		   const char *template_value)
+/* Substitutions which we recognize in templates.  Single-letter names are
+ * case-sensitive, and the longer ones aren't. */
+static const struct {
+	const char *name;
+	enum _pam_krb5_template_item item;
+} v5_template_names[] = {
+	{"p", _pam_krb5_template_principal},
+	{"u", _pam_krb5_template_user},
+	{"U", _pam_krb5_template_uid},
+	{"P", _pam_krb5_template_pid},
+	{"r", _pam_krb5_template_realm},
+	{"h", _pam_krb5_template_homedir},
+	{"d", _pam_krb5_template_ccache_dir},
+	{"{uid}", _pam_krb5_template_uid},
+	{"{euid}", _pam_krb5_template_euid},
+	{"{userid}", _pam_krb5_template_uid},
+	{"{username}", _pam_krb5_template_user},
+};
+
+static void
+v5_template_add(struct _pam_krb5_template *tmpl,
+		enum _pam_krb5_template_item item,
+		const char *text, size_t length)
+{
+	struct _pam_krb5_template_token *token;
+
+	if (item == _pam_krb5_template_text) {
+		/* Literal text: append it to the text of the previous token if
+		 * it's also literal text, since they're contiguous. */
+		memcpy(tmpl->text + tmpl->text_length, text, length);
+		if ((tmpl->n_tokens > 0) &&
+		    (tmpl->tokens[tmpl->n_tokens - 1].item == item)) {
+			tmpl->tokens[tmpl->n_tokens - 1].length += length;
+			tmpl->text_length += length;
+			return;
+		}
+	}
+	token = &tmpl->tokens[tmpl->n_tokens++];
+	token->item = item;
+	token->offset = tmpl->text_length;
+	token->length = (item == _pam_krb5_template_text) ? length : 0;
+	tmpl->text_length += token->length;
+	tmpl->counts[item]++;
+}
+
+struct _pam_krb5_template *
+v5_user_info_template_parse(const char *template_value)
 {
-	char *ret;
-	int i, j, len;
-
-	ret = NULL;
-	len = strlen(template_value);
-	for (i = 0; template_value[i] != '\0'; i++) {
-		switch (template_value[i]) {
-		case '%':
-			switch (template_value[i + 1]) {
-			case 'p':
-				len += strlen(userinfo->unparsed_name);
-				i++;
-				break;
-			case 'u':
-				len += strlen(user);
-				i++;
-				break;
-			case 'U':
-#ifdef HAVE_LONG_LONG
-				len += sizeof(unsigned long long) * 4;
-#else
-				len += sizeof(unsigned long) * 4;
-#endif
-				i++;
-				break;
-			case 'P':
-				len += sizeof(pid_t) * 4;
-				i++;
-				break;
-			case 'r':
-				len += strlen(userinfo->realm);
-				i++;
-				break;
-			case 'h':
-				len += strlen(userinfo->homedir ?
-					      userinfo->homedir :
-					      "/");
-				i++;
-			case 'd':
-				len += strlen(options->ccache_dir);
-				i++;
+	struct _pam_krb5_template *tmpl;
+	const char *p;
+	size_t length, n;
+	unsigned int i;
+
+	if (template_value == NULL) {
+		return NULL;
+	}
+	tmpl = malloc(sizeof(*tmpl));
+	if (tmpl == NULL) {
+		return NULL;
+	}
+	memset(tmpl, 0, sizeof(*tmpl));
+	/* We never have more tokens, or more text, than the template has
+	 * characters. */
+	length = strlen(template_value);
+	tmpl->source = xstrdup(template_value);
+	tmpl->text = malloc(length + 1);
+	tmpl->tokens = malloc(sizeof(tmpl->tokens[0]) * (length + 1));
+	if ((tmpl->source == NULL) ||
+	    (tmpl->text == NULL) ||
+	    (tmpl->tokens == NULL)) {
+		v5_user_info_template_free(tmpl);
+		return NULL;
+	}
+
+	for (p = template_value; *p != '\0'; p++) {
+		if (*p != '%') {
+			n = strcspn(p, "%");
+			v5_template_add(tmpl, _pam_krb5_template_text, p, n);
+			p += n - 1;
+			continue;
+		}
+		for (i = 0;
+		     i < sizeof(v5_template_names) /
+			 sizeof(v5_template_names[0]);
+		     i++) {
+			n = strlen(v5_template_names[i].name);
+			if ((v5_template_names[i].name[0] == '{') ?
+			    (strncasecmp(p + 1, v5_template_names[i].name,
+					 n) == 0) :
+			    (strncmp(p + 1, v5_template_names[i].name,
+				     n) == 0)) {
 				break;
-			case '{':
-				if (strncasecmp(template_value + i + 1,
-						"{uid}", 5) == 0) {
+			}
+		}
+		if (i < sizeof(v5_template_names) /
+			sizeof(v5_template_names[0])) {
+			v5_template_add(tmpl, v5_template_names[i].item,
+					NULL, 0);
+			p += n;
+		} else
+		if (p[1] == '%') {
+			v5_template_add(tmpl, _pam_krb5_template_text, p, 1);
+			p++;
+		} else
+		if (p[1] != '{') {
+			/* Not a substitution, so keep the '%' and go on to
+			 * treat the next character normally. */
+			v5_template_add(tmpl, _pam_krb5_template_text, p, 1);
+		}
+		/* An unrecognized "%{" has always lost its '%'. */
+	}
+	tmpl->text[tmpl->text_length] = '\0';
+	return tmpl;
+}
+
+void
+v5_user_info_template_free(struct _pam_krb5_template *tmpl)
+{
+	if (tmpl == NULL) {
+		return;
+	}
+	xstrfree(tmpl->source);
+	free(tmpl->text);
+	free(tmpl->tokens);
+	free(tmpl);
+}
+
+char *
+v5_user_info_template_subst(krb5_context ctx,
+			    const char *user,
+			    struct _pam_krb5_user_info *userinfo,
+			    struct _pam_krb5_options *options,
+			    const struct _pam_krb5_template *tmpl)
+{
+	const char *values[_pam_krb5_template_n_items];
+	size_t lengths[_pam_krb5_template_n_items], len, j;
 #ifdef HAVE_LONG_LONG
-					len += sizeof(unsigned long long) * 4;
+	char uid[sizeof(unsigned long long) * 4];
+	char euid[sizeof(unsigned long long) * 4];
 #else
-					len += sizeof(unsigned long) * 4;
+	char uid[sizeof(unsigned long) * 4];
+	char euid[sizeof(unsigned long) * 4];
 #endif
-					i += 5;
-				} else
-				if (strncasecmp(template_value + i + 1,
-						"{euid}", 6) == 0) {
+	char pid[sizeof(long) * 4];
+	const struct _pam_krb5_template_token *token;
+	char *ret;
+	int i;
+
+	if (tmpl == NULL) {
+		return NULL;
+	}
+
+	/* Look up the values of only the substitutions we'll be making. */
+	memset(values, 0, sizeof(values));
+	if (tmpl->counts[_pam_krb5_template_principal] > 0) {
+		values[_pam_krb5_template_principal] = userinfo->unparsed_name;
+	}
+	if (tmpl->counts[_pam_krb5_template_user] > 0) {
+		values[_pam_krb5_template_user] = user;
+	}
+	if (tmpl->counts[_pam_krb5_template_uid] > 0) {
 #ifdef HAVE_LONG_LONG
-					len += sizeof(unsigned long long) * 4;
+		snprintf(uid, sizeof(uid), "%llu",
+			 options->user_check ?
+			 (unsigned long long) userinfo->uid :
+			 (unsigned long long) getuid());
 #else
-					len += sizeof(unsigned long) * 4;
+		snprintf(uid, sizeof(uid), "%lu",
+			 options->user_check ?
+			 (unsigned long) userinfo->uid :
+			 (unsigned long) getuid());
 #endif
-					i += 6;
-				} else
-				if (strncasecmp(template_value + i + 1,
-						"{userid}", 8) == 0) {
+		values[_pam_krb5_template_uid] = uid;
+	}
+	if (tmpl->counts[_pam_krb5_template_euid] > 0) {
 #ifdef HAVE_LONG_LONG
-					len += sizeof(unsigned long long) * 4;
+		snprintf(euid, sizeof(euid), "%llu",
+			 options->user_check ?
+			 (unsigned long long) userinfo->uid :
+			 (unsigned long long) geteuid());
 #else
-					len += sizeof(unsigned long) * 4;
+		snprintf(euid, sizeof(euid), "%lu",
+			 options->user_check ?
+			 (unsigned long) userinfo->uid :
+			 (unsigned long) geteuid());
 #endif
-					i += 8;
-				} else
-				if (strncasecmp(template_value + i + 1,
-						"{username}", 10) == 0) {
-					len += strlen(user);
-					i += 10;
-				}
-				break;
-			default:
-			case '%':
-				break;
-			}
-		default:
-			break;
+		values[_pam_krb5_template_euid] = euid;
+	}
+	if (tmpl->counts[_pam_krb5_template_pid] > 0) {
+		snprintf(pid, sizeof(pid), "%ld", (long) getpid());
+		values[_pam_krb5_template_pid] = pid;
+	}
+	if (tmpl->counts[_pam_krb5_template_realm] > 0) {
+		values[_pam_krb5_template_realm] = userinfo->realm;
+	}
+	if (tmpl->counts[_pam_krb5_template_homedir] > 0) {
+		values[_pam_krb5_template_homedir] = userinfo->homedir ?
+						     userinfo->homedir : "/";
+	}
+	if (tmpl->counts[_pam_krb5_template_ccache_dir] > 0) {
+		values[_pam_krb5_template_ccache_dir] = options->ccache_dir;
+	}
+
+	/* Size the result exactly. */
+	len = tmpl->text_length;
+	for (i = 0; i < _pam_krb5_template_n_items; i++) {
+		lengths[i] = 0;
+		if ((i != _pam_krb5_template_text) && (values[i] != NULL)) {
+			lengths[i] = strlen(values[i]);
+			len += lengths[i] * tmpl->counts[i];
 		}
 	}
 	ret = malloc(len + 1);
 	if (ret == NULL) {
 		return NULL;
 	}
-	memset(ret, '\0', len + 1);
-	for (i = 0, j = 0; template_value[i] != '\0'; i++) {
-		switch (template_value[i]) {
-		case '%':
-			switch (template_value[i + 1]) {
-			case 'p':
-				strcat(ret, userinfo->unparsed_name);
-				i++;
-				j = strlen(ret);
-				break;
-			case 'u':
-				strcat(ret, user);
-				i++;
-				j = strlen(ret);
-				break;
-			case 'U':
-#ifdef HAVE_LONG_LONG
-				sprintf(ret + j, "%llu",
-					options->user_check ?
-					(unsigned long long) userinfo->uid :
-					(unsigned long long) getuid());
-#else
-				sprintf(ret + j, "%lu",
-					options->user_check ?
-					(unsigned long) userinfo->uid :
-					(unsigned long) getuid());
-#endif
-				i++;
-				j = strlen(ret);
-				break;
-			case 'P':
-				sprintf(ret + j, "%ld", (long) getpid());
-				i++;
-				j = strlen(ret);
-				break;
-			case 'r':
-				strcat(ret, userinfo->realm);
-				i++;
-				j = strlen(ret);
-				break;
-			case 'h':
-				strcat(ret,
-				       userinfo->homedir ?
-				       userinfo->homedir : "/");
-				i++;
-				j = strlen(ret);
-				break;
-			case 'd':
-				strcat(ret, options->ccache_dir);
-				i++;
-				j = strlen(ret);
-				break;
-			case '{':
-				if (strncasecmp(template_value + i + 1,
-						"{uid}", 5) == 0) {
-#ifdef HAVE_LONG_LONG
-				sprintf(ret + j, "%llu",
-					options->user_check ?
-					(unsigned long long) userinfo->uid :
-					(unsigned long long) getuid());
-#else
-				sprintf(ret + j, "%lu",
-					options->user_check ?
-					(unsigned long) userinfo->uid :
-					(unsigned long) getuid());
-#endif
-					i += 5;
-					j = strlen(ret);
-				} else
-				if (strncasecmp(template_value + i + 1,
-						"{euid}", 6) == 0) {
-#ifdef HAVE_LONG_LONG
-				sprintf(ret + j, "%llu",
-					options->user_check ?
-					(unsigned long long) userinfo->uid :
-					(unsigned long long) geteuid());
-#else
-				sprintf(ret + j, "%lu",
-					options->user_check ?
-					(unsigned long) userinfo->uid :
-					(unsigned long) geteuid());
-#endif
-					i += 6;
-					j = strlen(ret);
-				} else
-				if (strncasecmp(template_value + i + 1,
-						"{userid}", 8) == 0) {
-#ifdef HAVE_LONG_LONG
-				sprintf(ret + j, "%llu",
-					options->user_check ?
-					(unsigned long long) userinfo->uid :
-					(unsigned long long) getuid());
-#else
-				sprintf(ret + j, "%lu",
-					options->user_check ?
-					(unsigned long) userinfo->uid :
-					(unsigned long) getuid());
-#endif
-					i += 8;
-					j = strlen(ret);
-				} else
-				if (strncasecmp(template_value + i + 1,
-						"{username}", 10) == 0) {
-					strcat(ret, user);
-					i += 10;
-					j = strlen(ret);
-				}
-				break;
-			case '%':
-				strcat(ret, "%");
-				i++;
-				j = strlen(ret);
-				break;
-			default:
-				strcat(ret, "%");
-				j = strlen(ret);
-				break;
-			}
-			break;
-		default:
-			ret[j++] = template_value[i];
-			break;
+
+	/* Fill it in. */
+	for (i = 0, j = 0; i < tmpl->n_tokens; i++) {
+		token = &tmpl->tokens[i];
+		if (token->item == _pam_krb5_template_text) {
+			memcpy(ret + j, tmpl->text + token->offset,
+			       token->length);
+			j += token->length;
+		} else if (values[token->item] != NULL) {
+			memcpy(ret + j, values[token->item],
+			       lengths[token->item]);
+			j += lengths[token->item];
 		}
 	}
 	ret[j] = '\0';
 	return ret;
 }
 
+char *
+v5_user_info_subst(krb5_context ctx,
+		   const char *user,
+		   struct _pam_krb5_user_info *userinfo,
+		   struct _pam_krb5_options *options,
+		   const char *template_value)
+{
+	struct _pam_krb5_template *tmpl;
+	char *ret;
+
+	tmpl = v5_user_info_template_parse(template_value);
+	if (tmpl == NULL) {
+		return NULL;
+	}
+	ret = v5_user_info_template_subst(ctx, user, userinfo, options, tmpl);
+	v5_user_info_template_free(tmpl);
+	return ret;
+}
+
 #ifdef HAVE_KRB5_XFREE
 void
 v5_free_unparsed_name(krb5_context ctx, char *name)
@@ -1167,9 +1205,9 @@ v5_free_keytab_entry_contents(krb5_context ctx, krb5_keytab_entry *entry)
 /* Select the principal name of the service to use when validating the creds in
  * question. */
 static int
-v5_select_keytab_service(krb5_context ctx, krb5_principal client,
-			 const char *ktname,
-			 krb5_principal *service)
+v5_select_keytab_service_scan(krb5_context ctx, krb5_principal client,
+			      const char *ktname,
+			      krb5_principal *service)
 {
 	krb5_principal host, princ;
 	krb5_keytab keytab;
@@ -1364,6 +1402,247 @@ v5_select_keytab_service(krb5_context ctx, krb5_principal client,
 	return PAM_SUCCESS;
 }
 
+#define KEYTAB_SERVICE_CACHE "pam_krb5_keytab_services"
+#define KEYTAB_SERVICE_CACHE_ENTRIES 16
+#ifndef HOST_NAME_MAX
+#define HOST_NAME_MAX 255
+#endif
+
+/* Describe the things which v5_select_keytab_service_scan()'s answer depends
+ * on: which keytab it read and what state it was in (which file it is, when
+ * it was last modified, and its size), the local host's name, and the
+ * client's realm.  If the keytab isn't a file, we don't try. */
+static char *
+v5_keytab_service_cache_key(krb5_context ctx, krb5_principal client,
+			    const char *ktname)
+{
+	char name[PATH_MAX], host[HOST_NAME_MAX + 1], *key;
+	const char *path;
+	struct stat st;
+	int realm_length;
+	size_t length;
+	long mtime_nsec;
+
+	if (ktname == NULL) {
+		if (krb5_kt_default_name(ctx, name, sizeof(name)) != 0) {
+			return NULL;
+		}
+	} else {
+		if (strlen(ktname) >= sizeof(name)) {
+			return NULL;
+		}
+		strcpy(name, ktname);
+	}
+	if (strncmp(name, "FILE:", 5) == 0) {
+		path = name + 5;
+	} else
+	if (strncmp(name, "WRFILE:", 7) == 0) {
+		path = name + 7;
+	} else
+	if ((strchr(name, ':') == NULL) && (name[0] == '/')) {
+		path = name;
+	} else {
+		return NULL;
+	}
+	if ((stat(path, &st) != 0) || !S_ISREG(st.st_mode)) {
+		return NULL;
+	}
+	memset(host, '\0', sizeof(host));
+	if (gethostname(host, sizeof(host) - 1) != 0) {
+		return NULL;
+	}
+	realm_length = v5_princ_realm_length(client);
+	length = strlen(path) + strlen(host) + realm_length + 128;
+	key = malloc(length);
+	if (key == NULL) {
+		return NULL;
+	}
+	/* A keytab which is replaced by a new one with the same size in the
+	 * same second, as happens when it's rekeyed, is still a new file. */
+	mtime_nsec = 0;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+	snprintf(key, length, "%s\t%lu\t%lu\t%ld.%09ld\t%ld\t%s\t%.*s",
+		 path,
+		 (unsigned long) st.st_dev,
+		 (unsigned long) st.st_ino,
+		 (long) st.st_mtime, mtime_nsec,
+		 (long) st.st_size, host,
+		 realm_length, v5_princ_realm_contents(client));
+	if (strchr(key, '\n') != NULL) {
+		free(key);
+		return NULL;
+	}
+	return key;
+}
+
+/* Read our list of previously-selected services.  Only trust it if it's a
+ * plain file which only root can have written. */
+static char *
+v5_keytab_service_cache_load(const struct _pam_krb5_options *options)
+{
+	char path[PATH_MAX], *contents;
+	struct stat st;
+	ssize_t n;
+	int fd;
+
+	if ((geteuid() != 0) ||
+	    (snprintf(path, sizeof(path), "%s/%s", options->ccache_dir,
+		      KEYTAB_SERVICE_CACHE) >= (int) sizeof(path))) {
+		return NULL;
+	}
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+	if (fd == -1) {
+		return NULL;
+	}
+	if ((fstat(fd, &st) != 0) ||
+	    !S_ISREG(st.st_mode) ||
+	    (st.st_uid != 0) ||
+	    ((st.st_mode & (S_IRWXG | S_IRWXO)) != 0) ||
+	    (st.st_size > 64 * 1024)) {
+		close(fd);
+		return NULL;
+	}
+	contents = malloc(st.st_size + 1);
+	if (contents == NULL) {
+		close(fd);
+		return NULL;
+	}
+	n = read(fd, contents, st.st_size);
+	close(fd);
+	if (n != st.st_size) {
+		free(contents);
+		return NULL;
+	}
+	contents[n] = '\0';
+	return contents;
+}
+
+/* Find the line for "key" in the list, and return the start of the principal
+ * name which follows it. */
+static char *
+v5_keytab_service_cache_find(char *contents, const char *key)
+{
+	char *line, *next;
+	size_t length;
+
+	length = strlen(key);
+	for (line = contents; (line != NULL) && (*line != '\0'); line = next) {
+		next = strchr(line, '\n');
+		if (next != NULL) {
+			*next++ = '\0';
+		}
+		if ((strncmp(line, key, length) == 0) &&
+		    (line[length] == '\t')) {
+			return line + length + 1;
+		}
+		if (next != NULL) {
+			next[-1] = '\n';
+		}
+	}
+	return NULL;
+}
+
+/* Add a line for "key" to the list, dropping any old one for it, and the
+ * oldest ones if the list gets long.  Write it to a new file and rename it
+ * into place, so that readers never see a partial list. */
+static void
+v5_keytab_service_cache_save(const struct _pam_krb5_options *options,
+			     const char *key, const char *principal)
+{
+	char path[PATH_MAX], tmp[PATH_MAX], *contents, *line, *next;
+	size_t length;
+	FILE *fp;
+	int fd, i;
+
+	if ((geteuid() != 0) ||
+	    (strchr(principal, '\n') != NULL) ||
+	    (snprintf(path, sizeof(path), "%s/%s", options->ccache_dir,
+		      KEYTAB_SERVICE_CACHE) >= (int) sizeof(path)) ||
+	    (snprintf(tmp, sizeof(tmp), "%s/%s.XXXXXX", options->ccache_dir,
+		      KEYTAB_SERVICE_CACHE) >= (int) sizeof(tmp))) {
+		return;
+	}
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		return;
+	}
+	fp = fdopen(fd, "w");
+	if ((fp == NULL) || (fchmod(fd, S_IRUSR | S_IWUSR) != 0)) {
+		if (fp != NULL) {
+			fclose(fp);
+		} else {
+			close(fd);
+		}
+		unlink(tmp);
+		return;
+	}
+	fprintf(fp, "%s\t%s\n", key, principal);
+	contents = v5_keytab_service_cache_load(options);
+	length = strlen(key);
+	for (line = contents, i = 1;
+	     (line != NULL) && (*line != '\0') &&
+	     (i < KEYTAB_SERVICE_CACHE_ENTRIES);
+	     line = next) {
+		next = strchr(line, '\n');
+		if (next != NULL) {
+			*next++ = '\0';
+		}
+		if ((strncmp(line, key, length) != 0) ||
+		    (line[length] != '\t')) {
+			fprintf(fp, "%s\n", line);
+			i++;
+		}
+	}
+	free(contents);
+	if ((fclose(fp) != 0) || (rename(tmp, path) != 0)) {
+		unlink(tmp);
+	}
+}
+
+/* Select the service, reusing the answer we came up with the last time we
+ * looked at this version of the keytab, if we can, since finding it can mean
+ * DNS lookups and reading every entry in a large keytab. */
+static int
+v5_select_keytab_service(krb5_context ctx, krb5_principal client,
+			 const struct _pam_krb5_options *options,
+			 krb5_principal *service)
+{
+	char *key, *contents, *cached, *unparsed;
+	int i;
+
+	*service = NULL;
+	key = v5_keytab_service_cache_key(ctx, client, options->keytab);
+	if (key != NULL) {
+		contents = v5_keytab_service_cache_load(options);
+		cached = (contents != NULL) ?
+			 v5_keytab_service_cache_find(contents, key) :
+			 NULL;
+		if ((cached != NULL) &&
+		    (krb5_parse_name(ctx, cached, service) == 0)) {
+			if (options->debug) {
+				debug("using previously-selected keytab "
+				      "service \"%s\"", cached);
+			}
+			free(contents);
+			free(key);
+			return PAM_SUCCESS;
+		}
+		free(contents);
+	}
+
+	i = v5_select_keytab_service_scan(ctx, client, options->keytab,
+					  service);
+	if ((i == PAM_SUCCESS) && (key != NULL) && (*service != NULL) &&
+	    (krb5_unparse_name(ctx, *service, &unparsed) == 0)) {
+		v5_keytab_service_cache_save(options, key, unparsed);
+		v5_free_unparsed_name(ctx, unparsed);
+	}
+	free(key);
+	return i;
+}
+
 static int
 v5_validate_using_keytab(krb5_context ctx,
 			 krb5_creds *creds, krb5_ccache ccache,
@@ -1377,7 +1656,7 @@ v5_validate_using_keytab(krb5_context ctx,
 
 	/* Try to figure out the name of a suitable service. */
 	princ = NULL;
-	v5_select_keytab_service(ctx, creds->client, options->keytab, &princ);
+	v5_select_keytab_service(ctx, creds->client, options, &princ);
 
 	/* Try to get a text representation of the principal to which the key
 	 * belongs, for logging purposes. */
@@ -1544,7 +1823,7 @@ v5_setup_armor_ccache_keytab(krb5_context ctx,
 		krb5_free_principal(ctx, creds->client);
 		creds->client = NULL;
 	}
-	i = v5_select_keytab_service(ctx, guess_client, options->keytab,
+	i = v5_select_keytab_service(ctx, guess_client, options,
 				     &creds->client);
 	krb5_free_principal(ctx, guess_client);
 	if (creds->client == NULL) {
@@ -1697,6 +1976,217 @@ v5_setup_armor_ccache_pkinit(krb5_context ctx,
 	v5_free_get_init_creds_opt(ctx, gicopts);
 }
 
+#define ARMOR_CCACHE_PREFIX "pam_krb5_armor_"
+#define ARMOR_CCACHE_LOCK_TRIES 100
+
+/* Append "_" and "value" to "name", escaping anything other than letters,
+ * digits, dots, and hyphens as "%XX" so that different values never give us
+ * the same name, and so that none of them can add a "/". */
+static int
+v5_armor_ccache_shared_name_append(char *name, size_t length,
+				   const char *value)
+{
+	size_t n;
+
+	n = strlen(name);
+	if (n + 1 >= length) {
+		return -1;
+	}
+	name[n++] = '_';
+	for (; (value != NULL) && (*value != '\0'); value++) {
+		if (isalnum((unsigned char) *value) ||
+		    (*value == '.') || (*value == '-')) {
+			if (n + 1 >= length) {
+				return -1;
+			}
+			name[n++] = *value;
+		} else {
+			if (n + 3 >= length) {
+				return -1;
+			}
+			snprintf(name + n, 4, "%%%02X",
+				 (unsigned char) *value);
+			n += 3;
+		}
+	}
+	name[n] = '\0';
+	return 0;
+}
+
+/* Build the name of the file in which we share armor for "realm" with other
+ * logins which get it the same way, using the same armor_strategy and keytab.
+ * Only root gets to do that, since the keytab and any PKINIT configuration
+ * are only expected to be usable by root. */
+static int
+v5_armor_ccache_shared_path(const struct _pam_krb5_options *options,
+			    const char *realm, char *path, size_t length)
+{
+	char name[NAME_MAX - 4];
+
+	if ((geteuid() != 0) ||
+	    (realm == NULL) ||
+	    (realm[0] == '\0') ||
+	    (realm[0] == '.') ||
+	    (strchr(realm, '/') != NULL)) {
+		return -1;
+	}
+	/* Leave room for the lock file's ".lock" suffix. */
+	if ((snprintf(name, sizeof(name), "%s%s", ARMOR_CCACHE_PREFIX,
+		      realm) >= (int) sizeof(name)) ||
+	    (v5_armor_ccache_shared_name_append(name, sizeof(name),
+						options->armor_strategy) != 0) ||
+	    (v5_armor_ccache_shared_name_append(name, sizeof(name),
+						options->keytab) != 0)) {
+		return -1;
+	}
+	if (snprintf(path, length, "%s/%s", options->ccache_dir,
+		     name) >= (int) length - 5) {
+		return -1;
+	}
+	return 0;
+}
+
+/* If the shared file is one which only root could have written, and it
+ * holds a TGT which isn't going to expire within the next "armor_refresh"
+ * seconds, copy that TGT into "armor_ccache". */
+static int
+v5_armor_ccache_shared_load(krb5_context ctx,
+			    const struct _pam_krb5_options *options,
+			    const char *realm, const char *path,
+			    krb5_ccache armor_ccache)
+{
+	char ccname[PATH_MAX + 6];
+	krb5_ccache shared;
+	krb5_creds tgt;
+	struct stat st;
+	int fd, i;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+	if (fd == -1) {
+		return -1;
+	}
+	if ((fstat(fd, &st) != 0) ||
+	    !S_ISREG(st.st_mode) ||
+	    (st.st_uid != 0) ||
+	    ((st.st_mode & (S_IRWXG | S_IRWXO)) != 0)) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	snprintf(ccname, sizeof(ccname), "FILE:%s", path);
+	if (krb5_cc_resolve(ctx, ccname, &shared) != 0) {
+		return -1;
+	}
+	memset(&tgt, 0, sizeof(tgt));
+	if (v5_ccache_has_tgt(ctx, shared, realm, &tgt) != 0) {
+		krb5_cc_close(ctx, shared);
+		return -1;
+	}
+	krb5_cc_close(ctx, shared);
+	if ((long) tgt.times.endtime - (long) time(NULL) <=
+	    options->armor_refresh) {
+		if (options->debug) {
+			debug("shared armor ticket in \"%s\" is due to be "
+			      "refreshed", path);
+		}
+		krb5_free_cred_contents(ctx, &tgt);
+		return -1;
+	}
+	i = krb5_cc_initialize(ctx, armor_ccache, tgt.client);
+	if (i == 0) {
+		i = krb5_cc_store_cred(ctx, armor_ccache, &tgt);
+	}
+	krb5_free_cred_contents(ctx, &tgt);
+	if ((i == 0) && options->debug) {
+		debug("reusing shared armor ticket from \"%s\"", path);
+	}
+	return i;
+}
+
+/* Lock the shared file against other logins which want to refresh it, so
+ * that only one of them contacts the KDC.  If we can't get the lock in a
+ * reasonable amount of time, the caller goes ahead without it. */
+static int
+v5_armor_ccache_shared_lock(const char *path)
+{
+	char lock[PATH_MAX];
+	struct flock fl;
+	struct stat st;
+	int fd, i;
+
+	snprintf(lock, sizeof(lock), "%s.lock", path);
+	fd = open(lock, O_RDWR | O_CREAT | O_NOFOLLOW | O_NONBLOCK,
+		  S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		return -1;
+	}
+	if ((fstat(fd, &st) != 0) ||
+	    !S_ISREG(st.st_mode) ||
+	    (st.st_uid != 0) ||
+	    ((st.st_mode & (S_IRWXG | S_IRWXO)) != 0)) {
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	for (i = 0; i < ARMOR_CCACHE_LOCK_TRIES; i++) {
+		memset(&fl, 0, sizeof(fl));
+		fl.l_type = F_WRLCK;
+		fl.l_whence = SEEK_SET;
+		if (fcntl(fd, F_SETLK, &fl) == 0) {
+			return fd;
+		}
+		if ((errno != EAGAIN) && (errno != EACCES)) {
+			break;
+		}
+		usleep(100000);
+	}
+	close(fd);
+	return -1;
+}
+
+/* Write the armor we just obtained to a new file and rename it into place,
+ * so that other logins never see a partially-written ccache. */
+static void
+v5_armor_ccache_shared_save(krb5_context ctx,
+			    const struct _pam_krb5_options *options,
+			    const char *realm, const char *path,
+			    krb5_ccache armor_ccache)
+{
+	char tmp[PATH_MAX], ccname[PATH_MAX + 6];
+	krb5_ccache shared;
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		return;
+	}
+	if (fchmod(fd, S_IRUSR | S_IWUSR) != 0) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	close(fd);
+	snprintf(ccname, sizeof(ccname), "FILE:%s", tmp);
+	if (krb5_cc_resolve(ctx, ccname, &shared) != 0) {
+		unlink(tmp);
+		return;
+	}
+	if (v5_cc_copy(ctx, realm, armor_ccache, &shared) != 0) {
+		krb5_cc_destroy(ctx, shared);
+		unlink(tmp);
+		return;
+	}
+	krb5_cc_close(ctx, shared);
+	if (rename(tmp, path) != 0) {
+		unlink(tmp);
+		return;
+	}
+	if (options->debug) {
+		debug("saved armor ticket to \"%s\" for sharing", path);
+	}
+}
+
 static void
 v5_setup_armor_ccache(krb5_context ctx,
 		      struct _pam_krb5_options *options,
@@ -1704,9 +2194,9 @@ v5_setup_armor_ccache(krb5_context ctx,
 		      krb5_ccache *armor_ccache)
 {
 	krb5_creds creds;
-	char ccname[LINE_MAX];
+	char ccname[LINE_MAX], sharedpath[PATH_MAX];
 	const char *p;
-	int i;
+	int i, shared, lockfd;
 	unsigned int u, len;
 	struct {
 		const char *name;
@@ -1739,6 +2229,30 @@ v5_setup_armor_ccache(krb5_context ctx,
 		krb5_free_principal(ctx, creds.server);
 		return;
 	}
+	/* If another login has already gotten armor which is still good, use
+	 * that instead of asking the KDC for more.  If it needs to be
+	 * refreshed, make sure only one of us does that, and check again once
+	 * we have the lock, in case someone else just finished doing it. */
+	lockfd = -1;
+	shared = (v5_armor_ccache_shared_path(options, realm, sharedpath,
+					      sizeof(sharedpath)) == 0);
+	if (shared) {
+		if (v5_armor_ccache_shared_load(ctx, options, realm,
+						sharedpath,
+						*armor_ccache) == 0) {
+			krb5_free_principal(ctx, creds.server);
+			return;
+		}
+		lockfd = v5_armor_ccache_shared_lock(sharedpath);
+		if ((lockfd != -1) &&
+		    (v5_armor_ccache_shared_load(ctx, options, realm,
+						 sharedpath,
+						 *armor_ccache) == 0)) {
+			close(lockfd);
+			krb5_free_principal(ctx, creds.server);
+			return;
+		}
+	}
 	/* Use the methods in the configured order. */
 	p = options->armor_strategy;
 	while (*p != '\0') {
@@ -1763,22 +2277,16 @@ v5_setup_armor_ccache(krb5_context ctx,
 	if (v5_creds_check_initialized(ctx, &creds) == 0) {
 		if (v5_ccache_has_tgt(ctx, *armor_ccache,
 				      realm, NULL) != 0) {
-			if (krb5_cc_initialize(ctx, *armor_ccache,
-					       creds.client) != 0) {
-				krb5_free_cred_contents(ctx, &creds);
+			if ((krb5_cc_initialize(ctx, *armor_ccache,
+						creds.client) != 0) ||
+			    (krb5_cc_store_cred(ctx, *armor_ccache,
+						&creds) != 0)) {
 				krb5_cc_destroy(ctx, *armor_ccache);
 				*armor_ccache = NULL;
-				return;
-			}
-			if (krb5_cc_store_cred(ctx, *armor_ccache, &creds) != 0) {
-				krb5_free_cred_contents(ctx, &creds);
-				krb5_cc_destroy(ctx, *armor_ccache);
-				*armor_ccache = NULL;
-				return;
 			}
 		}
-		krb5_free_cred_contents(ctx, &creds);
 	}
+	krb5_free_cred_contents(ctx, &creds);
 	/* Now if we still haven't got suitable creds, abandon this. */
 	if ((*armor_ccache != NULL) &&
 	    (v5_ccache_has_tgt(ctx, *armor_ccache,
@@ -1786,6 +2294,14 @@ v5_setup_armor_ccache(krb5_context ctx,
 		krb5_cc_destroy(ctx, *armor_ccache);
 		*armor_ccache = NULL;
 	}
+	/* Let other logins use what we got. */
+	if (shared && (*armor_ccache != NULL)) {
+		v5_armor_ccache_shared_save(ctx, options, realm, sharedpath,
+					    *armor_ccache);
+	}
+	if (lockfd != -1) {
+		close(lockfd);
+	}
 }
 #endif
 
@@ -1855,6 +2371,19 @@ v5_get_creds(krb5_context ctx,
 		debug("authenticating '%s' to '%s'",
 		      userinfo->unparsed_name, realm_service);
 	}
+	/* If the KDC told us recently that it's never heard of this user,
+	 * don't bother asking it again. */
+	if ((options->unknown_principal_ttl > 0) &&
+	    _pam_krb5_unknown_check(options, userinfo->unparsed_name)) {
+		if (result != NULL) {
+			*result = KRB5KDC_ERR_C_PRINCIPAL_UNKNOWN;
+		}
+		if (options->ignore_unknown_principals) {
+			return PAM_IGNORE;
+		} else {
+			return PAM_USER_UNKNOWN;
+		}
+	}
 	/* Get creds. */
 	prompter_data.ctx = ctx;
 	prompter_data.pamh = pamh;
@@ -1868,8 +2397,8 @@ v5_get_creds(krb5_context ctx,
 		      password ? "\"" : "");
 	}
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PKINIT
-	opt = v5_user_info_subst(ctx, user, userinfo, options,
-				 options->pkinit_identity);
+	opt = v5_user_info_template_subst(ctx, user, userinfo, options,
+					  options->pkinit_identity_template);
 	if (opt != NULL) {
 		if (strlen(opt) > 0) {
 			if (options->debug) {
@@ -1904,10 +2433,11 @@ v5_get_creds(krb5_context ctx,
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_PA
 	for (i = 0;
 	     (options->preauth_options != NULL) &&
+	     (options->preauth_options_templates != NULL) &&
 	     (options->preauth_options[i] != NULL);
 	     i++) {
-		opt = v5_user_info_subst(ctx, user, userinfo, options,
-					 options->preauth_options[i]);
+		opt = v5_user_info_template_subst(ctx, user, userinfo, options,
+						  options->preauth_options_templates[i]);
 		if (opt != NULL) {
 			char *val;
 			val = strchr(opt, '=');
@@ -1964,15 +2494,29 @@ v5_get_creds(krb5_context ctx,
 #ifdef HAVE_KRB5_GET_INIT_CREDS_OPT_SET_OUT_CCACHE
 	krb5_get_init_creds_opt_set_out_ccache(ctx, gic_options, *ccache);
 #endif
-	i = krb5_get_init_creds_password(ctx,
-					 &creds,
-					 userinfo->principal_name,
-					 password,
-					 prompter,
-					 &prompter_data,
-					 0,
-					 realm_service,
-					 gic_options);
+	_pam_krb5_timing_start(options->timings,
+			       _pam_krb5_timing_get_init_creds);
+	/* If we've been asked to, try several KDCs at once, and if that
+	 * doesn't work out, let the library go through them one by one.  The
+	 * library picks KDCs for itself, so the record of how they've been
+	 * doing is only kept and used when we're racing them. */
+	if ((options->kdc_race < 2) ||
+	    (_pam_krb5_kdc_race(ctx, &creds, userinfo->principal_name,
+				password, prompter, &prompter_data,
+				realm_service, gic_options, options,
+				&i) != 0)) {
+		i = krb5_get_init_creds_password(ctx,
+						 &creds,
+						 userinfo->principal_name,
+						 password,
+						 prompter,
+						 &prompter_data,
+						 0,
+						 realm_service,
+						 gic_options);
+	}
+	_pam_krb5_timing_stop(options->timings,
+			      _pam_krb5_timing_get_init_creds);
 	/* Let the caller see the krb5 result code. */
 	if (options->debug) {
 		debug("krb5_get_init_creds_password(%s) returned %d (%s)",
@@ -1998,8 +2542,13 @@ v5_get_creds(krb5_context ctx,
 			if (options->debug) {
 				debug("validating credentials");
 			}
-			switch (v5_validate(ctx, &creds, *ccache,
-					    userinfo, options)) {
+			_pam_krb5_timing_start(options->timings,
+					       _pam_krb5_timing_validate);
+			i = v5_validate(ctx, &creds, *ccache,
+					userinfo, options);
+			_pam_krb5_timing_stop(options->timings,
+					      _pam_krb5_timing_validate);
+			switch (i) {
 			case PAM_AUTH_ERR:
 				return PAM_AUTH_ERR;
 				break;
@@ -2021,7 +2570,17 @@ v5_get_creds(krb5_context ctx,
 		/* fall through */
 	case KRB5KDC_ERR_C_PRINCIPAL_UNKNOWN:
 	case KRB5KDC_ERR_NAME_EXP:
-		/* The user is unknown or a principal has expired. */
+		/* The user is unknown or a principal has expired.  Remember
+		 * that for a while, unless it's just a locked account, or the
+		 * KDC was asked for something other than a TGT, such as a
+		 * password-changing ticket, since a problem with that doesn't
+		 * mean that the user can't log in. */
+		if ((i != KRB5KDC_ERR_CLIENT_REVOKED) &&
+		    (strcmp(service, KRB5_TGS_NAME) == 0) &&
+		    (options->unknown_principal_ttl > 0)) {
+			_pam_krb5_unknown_add(options,
+					      userinfo->unparsed_name);
+		}
 		if (options->ignore_unknown_principals) {
 			return PAM_IGNORE;
 		} else {
@@ -2062,6 +2621,8 @@ v5_get_creds(krb5_context ctx,
 			/* Try library defaults. */
 			tmp_gicopts = NULL;
 		}
+		_pam_krb5_timing_start(options->timings,
+				       _pam_krb5_timing_get_init_creds);
 		i = krb5_get_init_creds_password(ctx,
 						 &creds,
 						 userinfo->principal_name,
@@ -2071,6 +2632,8 @@ v5_get_creds(krb5_context ctx,
 						 0,
 						 realm_service,
 						 tmp_gicopts);
+		_pam_krb5_timing_stop(options->timings,
+				      _pam_krb5_timing_get_init_creds);
 		v5_free_get_init_creds_opt(ctx, tmp_gicopts);
 		krb5_free_cred_contents(ctx, &creds);
 		switch (i) {
@@ -2113,7 +2676,7 @@ v5_get_creds(krb5_context ctx,
 static int
 v5_save(krb5_context ctx,
 	struct _pam_krb5_stash *stash,
-	const char *ccname_template,
+	const struct _pam_krb5_template *ccname_template,
 	int preserve_existing_ccaches,
 	const char *user,
 	struct _pam_krb5_user_info *userinfo,
@@ -2157,7 +2720,7 @@ v5_save_for_user(krb5_context ctx,
 		 struct _pam_krb5_options *options,
 		 const char **ccname)
 {
-	return v5_save(ctx, stash, options->ccname_template, FALSE,
+	return v5_save(ctx, stash, options->ccname_template_template, FALSE,
 		       user, userinfo, options, ccname);
 }
 
@@ -2169,8 +2732,15 @@ v5_save_for_kuserok(krb5_context ctx,
 		    struct _pam_krb5_options *options,
 		    const char **ccname)
 {
-	return v5_save(ctx, stash, "FILE:%d/krb5cc_%U_XXXXXX", TRUE,
-		       user, userinfo, options, ccname);
+	struct _pam_krb5_template *ccname_template;
+	int ret;
+
+	ccname_template = v5_user_info_template_parse("FILE:%d/"
+						      "krb5cc_%U_XXXXXX");
+	ret = v5_save(ctx, stash, ccname_template, TRUE,
+		      user, userinfo, options, ccname);
+	v5_user_info_template_free(ccname_template);
+	return ret;
 }
 
 void
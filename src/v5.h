@@ -142,6 +142,42 @@ krb5_error_code v5_alloc_get_init_creds_opt(krb5_context ctx,
 					    krb5_get_init_creds_opt **opt);
 void v5_free_get_init_creds_opt(krb5_context ctx,
 				krb5_get_init_creds_opt *opt);
+
+/* The things which can appear in a template. */
+enum _pam_krb5_template_item {
+	_pam_krb5_template_text,
+	_pam_krb5_template_principal,
+	_pam_krb5_template_user,
+	_pam_krb5_template_uid,
+	_pam_krb5_template_euid,
+	_pam_krb5_template_pid,
+	_pam_krb5_template_realm,
+	_pam_krb5_template_homedir,
+	_pam_krb5_template_ccache_dir,
+	_pam_krb5_template_n_items,
+};
+
+struct _pam_krb5_template_token {
+	enum _pam_krb5_template_item item;
+	size_t offset, length;
+};
+
+/* A template, broken up into a list of literal text and substitutions. */
+struct _pam_krb5_template {
+	char *source, *text;
+	size_t text_length;
+	struct _pam_krb5_template_token *tokens;
+	int n_tokens;
+	int counts[_pam_krb5_template_n_items];
+};
+
+struct _pam_krb5_template *v5_user_info_template_parse(const char *template_value);
+void v5_user_info_template_free(struct _pam_krb5_template *tmpl);
+char *v5_user_info_template_subst(krb5_context ctx,
+				  const char *user,
+				  struct _pam_krb5_user_info *userinfo,
+				  struct _pam_krb5_options *options,
+				  const struct _pam_krb5_template *tmpl);
 char *v5_user_info_subst(krb5_context ctx,
 			 const char *user,
 			 struct _pam_krb5_user_info *userinfo,
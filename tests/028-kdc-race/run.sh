@@ -0,0 +1,58 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+test_flags="$test_flags ignore_afs ccache_dir=$testdir/kdc"
+health=$testdir/kdc/pam_krb5_kdc_health_`id -u`
+
+setpw $test_principal foo
+pwexpire $test_principal never
+
+# Ahead of the real KDC, list one which is down, and one which answers, but
+# only after taking longer than we're willing to wait.  The real KDC is the
+# master, so we don't need to check anything it tells us with anyone else.
+sed -r -e 's|^( *)kdc = (.*):8801$|\1kdc = \2:8806\n\1kdc = \2:8805\n\1kdc = \2:8801\n\1master_kdc = \2:8801|' \
+	$KRB5_CONFIG > $testdir/kdc/krb5.conf.race
+KRB5_CONFIG=$testdir/kdc/krb5.conf.race ; export KRB5_CONFIG
+rm -f $health
+kdc_delay 8805 $test_host 8801 10 > /dev/null 2> /dev/null &
+delayer=$!
+test_settle
+
+echo ""; echo Succeed: race all three KDCs.
+start=`date +%s`
+test_run -auth $test_principal $pam_krb5 $test_flags kdc_race=8 -- foo
+if test `expr \`date +%s\` - $start` -lt 5 ; then
+	echo Did not wait for the slow KDC.
+else
+	echo Waited for the slow KDC.
+fi
+
+echo ""; echo Fail: race all three KDCs, incorrect password.
+start=`date +%s`
+test_run -auth $test_principal $pam_krb5 $test_flags kdc_race=8 -- bar
+if test `expr \`date +%s\` - $start` -lt 5 ; then
+	echo Did not wait for the slow KDC.
+else
+	echo Waited for the slow KDC.
+fi
+
+kill $delayer
+
+# List only a replica which hasn't heard of the user yet, and the real KDC as
+# the master.
+sed -r -e 's|^( *)kdc = (.*):8801$|\1kdc = \2:8807\n\1master_kdc = \2:8801|' \
+	$KRB5_CONFIG > $testdir/kdc/krb5.conf.race
+rm -f $health
+kdc_unknown 8807 EXAMPLE.COM > /dev/null 2> /dev/null &
+replica=$!
+test_settle
+
+echo ""; echo Succeed: the replica does not know the user, but the master does.
+test_run -auth $test_principal $pam_krb5 $test_flags kdc_race=8 -- foo
+
+echo ""; echo Fail: the master agrees that the password is wrong.
+test_run -auth $test_principal $pam_krb5 $test_flags kdc_race=8 -- bar
+
+kill $replica
+rm -f $health $testdir/kdc/krb5.conf.race
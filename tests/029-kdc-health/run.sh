@@ -0,0 +1,34 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+test_flags="$test_flags ignore_afs ccache_dir=$testdir/kdc"
+health=$testdir/kdc/pam_krb5_kdc_health_`id -u`
+
+setpw $test_principal foo
+pwexpire $test_principal never
+
+# Ahead of the real KDC, list one which is down.
+sed -r -e 's|^( *)kdc = (.*):8801$|\1kdc = \2:8806\n\1kdc = \2:8801|' \
+	$KRB5_CONFIG > $testdir/kdc/krb5.conf.health
+KRB5_CONFIG=$testdir/kdc/krb5.conf.health ; export KRB5_CONFIG
+rm -f $health
+
+echo ""; echo Succeed: both KDCs are tried.
+test_run -auth $test_principal $pam_krb5 $test_flags kdc_race=4 -- foo
+kdc_health $health | sort -u
+
+echo ""; echo Succeed: the KDC which is down is skipped after failing again.
+test_run -auth $test_principal $pam_krb5 $test_flags kdc_race=4 -- foo
+kdc_health $health | sort -u
+
+echo ""; echo Succeed: do not race, or keep a record, with just one KDC.
+rm -f $health
+test_run -auth $test_principal $pam_krb5 $test_flags kdc_race=1 -- foo
+if test -f $health ; then
+	echo Kept a record.
+else
+	echo Did not keep a record.
+fi
+
+rm -f $health $testdir/kdc/krb5.conf.health
@@ -0,0 +1,20 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+test_flags="$test_flags ignore_afs ccache_dir=$testdir/kdc"
+unknown=$testdir/kdc/pam_krb5_unknown_principals_`id -u`
+rm -f $unknown
+
+echo ""; echo Fail: the principal does not exist yet.
+test_run -auth $test_principal $pam_krb5 $test_flags mappings="$test_principal ${test_principal}new" unknown_principal_ttl=60 -- foo
+
+addprinc ${test_principal}new foo
+
+echo ""; echo Fail: the KDC is not asked about it again.
+test_run -auth $test_principal $pam_krb5 $test_flags mappings="$test_principal ${test_principal}new" unknown_principal_ttl=60 -- foo
+
+echo ""; echo Succeed: the KDC is asked.
+test_run -auth $test_principal $pam_krb5 $test_flags mappings="$test_principal ${test_principal}new" -- foo
+
+rm -f $unknown
@@ -0,0 +1,36 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+test_flags="$test_flags ccache_dir=$testdir/kdc"
+
+# Without AFS support, there's no stand-in, and nothing for it to do.
+if ! test -f $afs_standin ; then
+	exit 77
+fi
+
+setpw $test_principal foo
+pwexpire $test_principal never
+addprinc afs/example.com bar
+addprinc afs/two.example.com bar
+addprinc afs/three.example.com bar
+
+AFS_STANDIN_CELL=example.com ; export AFS_STANDIN_CELL
+AFS_STANDIN_LOG=$testdir/kdc/afs_standin.log ; export AFS_STANDIN_LOG
+rm -f $AFS_STANDIN_LOG
+
+echo ""; echo Succeed: get tokens for the local cell in a new PAG, then drop them.
+test_run_afs -auth -setcred $test_principal $pam_krb5 $test_flags -- foo
+test_afs_log
+rm -f $AFS_STANDIN_LOG
+
+echo ""; echo Succeed: get tokens while authenticating, but not for an unknown cell.
+test_run_afs -auth $test_principal $pam_krb5 $test_flags tokens afs_cells=other.example.org no_afs_parallel -- foo
+test_afs_log
+rm -f $AFS_STANDIN_LOG
+
+echo ""; echo Succeed: fetch tickets for several cells at once, but set tokens in order.
+test_run_afs -auth $test_principal $pam_krb5 $test_flags tokens afs_cells=three.example.com,two.example.com -- foo
+# The children which fetch the tickets log their own calls as they go.
+test_afs_log | grep '^settoken'
+rm -f $AFS_STANDIN_LOG
@@ -0,0 +1,36 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+test_flags="$test_flags ccache_dir=$testdir/kdc"
+
+# Without AFS support, there's no stand-in, and nothing for it to do.
+if ! test -f $afs_standin ; then
+	exit 77
+fi
+
+setpw $test_principal foo
+pwexpire $test_principal never
+addprinc afs/example.com bar
+
+AFS_STANDIN_CELL=example.com ; export AFS_STANDIN_CELL
+AFS_STANDIN_LOG=$testdir/kdc/afs_standin.log ; export AFS_STANDIN_LOG
+rm -f $AFS_STANDIN_LOG
+
+# Refreshing won't find a ccache to update, but it'll still look at tokens.
+ccname=FILE:$testdir/kdc/krb5cc_afs_missing
+
+echo ""; echo Keep: the tokens from authenticating are still good when refreshing.
+test_run_afs -auth -refreshcred -setenv KRB5CCNAME=$ccname $test_principal $pam_krb5 $test_flags tokens -- foo
+test_afs_log
+rm -f $AFS_STANDIN_LOG
+
+echo ""; echo Replace: do not check for tokens before getting new ones.
+test_run_afs -auth -refreshcred -setenv KRB5CCNAME=$ccname $test_principal $pam_krb5 $test_flags tokens afs_token_margin=0 -- foo
+test_afs_log
+rm -f $AFS_STANDIN_LOG
+
+echo ""; echo Replace: the tokens from authenticating will not last long enough.
+test_run_afs -auth -refreshcred -setenv KRB5CCNAME=$ccname $test_principal $pam_krb5 $test_flags tokens afs_token_margin=31536000 -- foo
+test_afs_log
+rm -f $AFS_STANDIN_LOG
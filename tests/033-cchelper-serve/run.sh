@@ -0,0 +1,39 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+cchelper=$testdir/../src/pam_krb5_cchelper
+socket=$testdir/kdc/cchelper.socket
+
+rm -f $socket $testdir/kdc/krb5cc_serve_*
+$cchelper --serve $socket 2 &
+server=$!
+while ! test -S $socket ; do
+	sleep 1
+done
+
+echo ""; echo Succeed: create a file.
+echo "not really a ccache" | cchelper_client $socket -c FILE:$testdir/kdc/krb5cc_serve_XXXXXX | test_cleanmsg
+cat $testdir/kdc/krb5cc_serve_*
+
+echo ""; echo Succeed: update the file.
+echo "still not a ccache" | cchelper_client $socket -u `ls $testdir/kdc/krb5cc_serve_*` | test_cleanmsg
+cat $testdir/kdc/krb5cc_serve_*
+
+echo ""; echo Succeed: remove the file.
+cchelper_client $socket -d FILE:`ls $testdir/kdc/krb5cc_serve_*` < /dev/null
+ls $testdir/kdc/krb5cc_serve_* 2> /dev/null
+
+echo ""; echo Fail: an unknown request.
+echo "not a ccache" | cchelper_client $socket -x FILE:$testdir/kdc/krb5cc_serve_XXXXXX
+
+echo ""; echo Succeed: idle clients only hold slots until they time out.
+cchelper_client -w 15 $socket &
+cchelper_client -w 15 $socket &
+sleep 1
+echo "not really a ccache" | cchelper_client $socket -c FILE:$testdir/kdc/krb5cc_serve_XXXXXX | test_cleanmsg
+rm -f $testdir/kdc/krb5cc_serve_*
+
+kill $server
+wait 2> /dev/null
+rm -f $socket
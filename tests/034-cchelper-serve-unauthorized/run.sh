@@ -0,0 +1,34 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+# We need to be able to connect as some other user.
+if test `id -u` -ne 0 ; then
+	exit 77
+fi
+
+cchelper=$testdir/../src/pam_krb5_cchelper
+socket=$testdir/kdc/cchelper.socket
+nobody=`id -u nobody`
+
+rm -f $socket $testdir/kdc/krb5cc_serve_*
+$cchelper --serve $socket 1 &
+server=$!
+while ! test -S $socket ; do
+	sleep 1
+done
+
+echo ""; echo Fail: a client running as another user is turned away.
+echo "not really a ccache" | cchelper_client -u $nobody $socket -c FILE:$testdir/kdc/krb5cc_serve_XXXXXX
+ls $testdir/kdc/krb5cc_serve_* 2> /dev/null
+
+echo ""; echo Succeed: clients which were turned away never held the only slot.
+cchelper_client -u $nobody -w 15 $socket &
+cchelper_client -u $nobody -w 15 $socket &
+sleep 1
+echo "not really a ccache" | timeout 5 cchelper_client $socket -c FILE:$testdir/kdc/krb5cc_serve_XXXXXX | test_cleanmsg
+rm -f $testdir/kdc/krb5cc_serve_*
+
+kill $server
+wait 2> /dev/null
+rm -f $socket
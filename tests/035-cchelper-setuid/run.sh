@@ -0,0 +1,15 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+# We need to be able to give ourselves a different real UID.
+if test `id -u` -ne 0 ; then
+	exit 77
+fi
+
+setpw $test_principal foo
+pwexpire $test_principal never
+
+echo ""; echo Succeed: the helper runs when our real UID is not our effective UID.
+test_run -ruid `id -u nobody` -auth -setcred -session $test_principal -run klist_c $pam_krb5 $test_flags ccname_template=FILE:${testdir}/kdc/krb5cc_%U_XXXXXX -- foo
+find ${testdir}/kdc -name "krb5cc*" -ls
@@ -0,0 +1,35 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+# Armor is only shared between logins when we're running as root.
+if test `id -u` -ne 0 ; then
+	exit 77
+fi
+
+test_flags="$test_flags ccache_dir=$testdir/kdc use_first_pass test_environment armor"
+
+setpw $test_principal foo
+pwexpire $test_principal never
+rm -f $testdir/kdc/pam_krb5_armor_*
+cp $testdir/kdc/krb5.keytab $testdir/kdc/krb5.keytab.copy
+
+# Show the names of the files in which armor is shared, leaving out the
+# location of the test directory, which shows up in the keytab's part.
+function armor_files() {
+	ls $testdir/kdc | grep '^pam_krb5_armor_' | grep -v '\.lock$' | sed -r 's|_[^_]*%2Fkdc%2F([^_]*)$|_...%2Fkdc%2F\1|'
+}
+
+echo ""; echo Succeed: share armor obtained using the keytab.
+test_run -auth -session -run grepenvc.sh -authtok foo $test_principal $pam_krb5 $test_flags keytab=$testdir/kdc/krb5.keytab armor_strategy=keytab
+armor_files
+
+echo ""; echo Succeed: do not share it with logins which use another keytab.
+test_run -auth -session -run grepenvc.sh -authtok foo $test_principal $pam_krb5 $test_flags keytab=$testdir/kdc/krb5.keytab.copy armor_strategy=keytab
+armor_files
+
+echo ""; echo Succeed: or with logins which get armor some other way.
+test_run -auth -session -run grepenvc.sh -authtok foo $test_principal $pam_krb5 $test_flags preauth_options=X509_anchors=FILE:$testdir/kdc/ca.crt armor_strategy=pkinit
+armor_files
+
+rm -f $testdir/kdc/pam_krb5_armor_* $testdir/kdc/krb5.keytab.copy
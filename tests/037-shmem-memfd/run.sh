@@ -0,0 +1,11 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+setpw $test_principal foo
+pwexpire $test_principal never
+
+echo ""; echo "Forking, with use_shmem=memfd:"
+test_run -fork -auth -setcred -session $test_principal -run grepmemfd.sh $pam_krb5 $test_flags ccname_template=FILE:${testdir}/kdc/krb5cc_%U_XXXXXX use_shmem=memfd test_environment -- foo
+
+find ${testdir}/kdc -name "krb5cc*" -ls
@@ -0,0 +1,28 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+# We can only do this with libkrb5s whose structures we know.
+if ! ccfile_load -c ; then
+	exit 77
+fi
+
+setpw $test_principal foo
+pwexpire $test_principal never
+
+echo ""; echo "Obtaining creds:"
+CCSAVE=${testdir}/kdc/krb5cc_save; export CCSAVE
+test_run -auth -session $test_principal -run save_cc_file.sh $pam_krb5 $test_flags ccname_template=FILE:${testdir}/kdc/krb5cc_%U_XXXXXX -- foo
+
+echo ""; echo "Loading them:"
+ccfile_load $CCSAVE | sed "s|^Client: $test_principal@|"'Client: ${test_principal}@|'
+
+echo ""; echo "Loading part of them:"
+head -c 100 $CCSAVE > $CCSAVE.short
+ccfile_load $CCSAVE.short
+
+echo ""; echo "Loading something which is not a ccache:"
+ccfile_load $testdir/kdc/krb5.keytab
+
+rm -f $CCSAVE $CCSAVE.short
+find ${testdir}/kdc -name "krb5cc*" -print
@@ -0,0 +1,55 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+test_flags="$test_flags kuserok_in_process"
+
+# The user's home directory is a new one in $testdir, so that we never touch
+# a real .k5login file.
+rm -rf $test_home
+mkdir $test_home
+k5login=$test_home/.k5login
+
+setpw $test_principal foo
+pwexpire $test_principal never
+
+# Two names of the same length, only one of which is ours.
+listed="$test_principal@EXAMPLE.COM"
+unlisted=`echo "$listed" | sed 's,^.,_,'`
+
+echo ""; echo Succeed: the principal is listed.
+echo "$listed" > "$k5login"
+test_home test_run -auth -account $test_principal $pam_krb5 $test_flags -- foo
+
+echo ""; echo Fail: the principal is not listed.
+echo "$unlisted" > "$k5login"
+test_home test_run -auth -account $test_principal $pam_krb5 $test_flags -- foo
+
+echo ""; echo Succeed: there is no file, so our own name is enough.
+rm -f "$k5login"
+test_home test_run -auth -account $test_principal $pam_krb5 $test_flags -- foo
+
+# Change the file between two checks made by the same process, keeping its
+# size, so that only a new modification time or inode can tell them apart.
+cat > $testdir/kdc/k5login_rewrite <<-EOF2
+	#!/bin/sh
+	echo "$unlisted" > "$k5login"
+	EOF2
+cat > $testdir/kdc/k5login_replace <<-EOF2
+	#!/bin/sh
+	echo "$unlisted" > "$k5login".new
+	touch -r "$k5login" "$k5login".new
+	mv -f "$k5login".new "$k5login"
+	EOF2
+chmod +x $testdir/kdc/k5login_rewrite $testdir/kdc/k5login_replace
+
+echo ""; echo Succeed, then fail: the file is rewritten after it was read.
+echo "$listed" > "$k5login"
+test_home test_run -auth -account -account -run $testdir/kdc/k5login_rewrite $test_principal $pam_krb5 $test_flags -- foo
+
+echo ""; echo Succeed, then fail: the file is replaced with one with the same timestamp.
+echo "$listed" > "$k5login"
+test_home test_run -auth -account -account -run $testdir/kdc/k5login_replace $test_principal $pam_krb5 $test_flags -- foo
+
+rm -f $testdir/kdc/k5login_rewrite $testdir/kdc/k5login_replace
+rm -rf $test_home
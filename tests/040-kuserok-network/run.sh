@@ -0,0 +1,57 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+# Without AFS support, there's no stand-in to say that the home directory is
+# on a network filesystem.
+if ! test -f $afs_standin ; then
+	exit 77
+fi
+
+# The user's home directory is a new one in $testdir, so that we never touch
+# a real .k5login file.
+rm -rf $test_home
+mkdir $test_home
+k5login=$test_home/.k5login
+
+setpw $test_principal foo
+pwexpire $test_principal never
+addprinc afs/example.com bar
+
+AFS_STANDIN_CELL=example.com ; export AFS_STANDIN_CELL
+AFS_STANDIN_LOG=$testdir/kdc/afs_standin.log ; export AFS_STANDIN_LOG
+
+listed="$test_principal@EXAMPLE.COM"
+unlisted=`echo "$listed" | sed 's,^.,_,'`
+
+# Only the helper gets tokens before reading the file, so count how many times
+# that happened.
+echo ""; echo Succeed: a local file is read without a helper.
+echo "$listed" > "$k5login"
+rm -f $AFS_STANDIN_LOG ; touch $AFS_STANDIN_LOG
+test_home test_run_afs -auth -account $test_principal $pam_krb5 $test_flags kuserok_in_process -- foo
+grep -c '^settoken' $AFS_STANDIN_LOG
+
+AFS_STANDIN_HOME=`cd $test_home; /bin/pwd` ; export AFS_STANDIN_HOME
+
+echo ""; echo Succeed: a file in AFS is read by a helper.
+rm -f $AFS_STANDIN_LOG ; touch $AFS_STANDIN_LOG
+test_home test_run_afs -auth -account $test_principal $pam_krb5 $test_flags kuserok_in_process -- foo
+grep -c '^settoken' $AFS_STANDIN_LOG
+
+echo ""; echo Fail: a file in AFS which does not list us is read by a helper.
+echo "$unlisted" > "$k5login"
+rm -f $AFS_STANDIN_LOG ; touch $AFS_STANDIN_LOG
+test_home test_run_afs -auth -account $test_principal $pam_krb5 $test_flags kuserok_in_process -- foo
+grep -c '^settoken' $AFS_STANDIN_LOG
+
+unset AFS_STANDIN_HOME
+
+echo ""; echo Succeed: without kuserok_in_process, a local file is read by a helper.
+echo "$listed" > "$k5login"
+rm -f $AFS_STANDIN_LOG ; touch $AFS_STANDIN_LOG
+test_home test_run_afs -auth -account $test_principal $pam_krb5 $test_flags -- foo
+grep -c '^settoken' $AFS_STANDIN_LOG
+
+rm -f $AFS_STANDIN_LOG
+rm -rf $test_home
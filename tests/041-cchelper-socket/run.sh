@@ -0,0 +1,36 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+# The helper only serves root, and the module only trusts a helper which is
+# running as root.
+if test `id -u` -ne 0 ; then
+	exit 77
+fi
+# With SELinux enabled, the module always runs the helper itself.
+if selinuxenabled 2> /dev/null ; then
+	exit 77
+fi
+
+cchelper=$testdir/../src/pam_krb5_cchelper
+socket=$testdir/kdc/cchelper.socket
+
+setpw $test_principal foo
+pwexpire $test_principal never
+
+rm -f $socket
+$cchelper --serve $socket 2 &
+server=$!
+while ! test -S $socket ; do
+	sleep 1
+done
+
+# Point cchelper_path at something which doesn't exist, so that the only way
+# for the ccache to be written is by the helper which is already running.
+echo ""; echo Succeed: the running helper creates and removes the ccache.
+test_run -auth -setcred -session $test_principal -run klist_c $pam_krb5 $test_flags cchelper_socket=$socket cchelper_path=$testdir/kdc/no-such-cchelper ccname_template=FILE:${testdir}/kdc/krb5cc_%U_XXXXXX -- foo
+find ${testdir}/kdc -name "krb5cc*" -ls
+
+kill $server
+wait 2> /dev/null
+rm -f $socket
@@ -0,0 +1,53 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+# Map each name using a pattern which can be matched without the regex
+# library, using one which means the same thing but which can't, and using
+# sed, and show the results, which should all be the same.
+map_sed() {
+	pattern="$1"
+	replacement=$(echo "$2" | sed -e 's,\$\$,%,g' -e 's,\$0,\&,g' -e 's,\$\([1-9]\),\\\1,g' -e 's,%,$,g')
+	shift 2
+	for name in "$@" ; do
+		mapped=`echo "$name" | sed -n -E "s|$pattern|$replacement|p"`
+		if test -n "$mapped" ; then
+			echo "Match: \"$name\" -> \"$mapped\""
+		else
+			echo "No match: \"$name\""
+		fi
+	done
+}
+
+map_all() {
+	fast="$1"
+	slow="$2"
+	replacement="$3"
+	shift 3
+	fast_result=`map_test "$fast" "$replacement" "$@"`
+	slow_result=`map_test "$slow" "$replacement" "$@"`
+	sed_result=`map_sed "$fast" "$replacement" "$@"`
+	echo "$fast_result"
+	if test "$fast_result" != "$slow_result" ; then
+		echo "\"$slow\" gave different results:"
+		echo "$slow_result"
+	fi
+	if test "$fast_result" != "$sed_result" ; then
+		echo "sed gave different results:"
+		echo "$sed_result"
+	fi
+}
+
+long=a.very.long.local.user.name.which.goes.on.well.past.fifty.characters
+
+echo ""; echo A prefix.
+map_all '^dept-(.*)$' '^[d]ept-(.*)$' '$1@EXAMPLE.COM' dept-alice dept-$long dept- alice
+
+echo ""; echo A suffix.
+map_all '^(.*)\.admin$' '^(.*)\.admi[n]$' '$1/admin@EXAMPLE.COM' alice.admin $long.admin .admin alice
+
+echo ""; echo Several groups, used more than once, in a different order.
+map_all '^([^.]*)\.([^.]*)\.(.*)$' '^([^.]*)[.]([^.]*)[.](.*)$' '$3/$2.$1-$1$$$0@EXAMPLE.COM' a.b.c $long alice
+
+echo ""; echo Everything.
+map_all '^(.*)$' '^(.*)$()' '$1@EXAMPLE.COM' alice $long
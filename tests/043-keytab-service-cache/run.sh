@@ -0,0 +1,43 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+# The module only remembers which key it chose when it's running as root.
+if test `id -u` -ne 0 ; then
+	exit 77
+fi
+
+keytab=$testdir/kdc/services.keytab
+services=$testdir/kdc/pam_krb5_keytab_services
+test_flags="$test_flags validate keytab=FILE:$keytab ccache_dir=$testdir/kdc"
+rm -f $keytab $keytab.new $services
+
+setpw $test_principal foo
+pwexpire $test_principal never
+addprinc nfsa/$test_host bar
+addprinc nfsb/$test_host bar
+
+# Show which key the module chose the last time, which is listed first.
+chosen() {
+	head -n 1 $services | cut -f8 | sed "s|$test_host|"'$test_host|g'
+}
+
+echo ""; echo Succeed: validate using the only key in the keytab.
+ktadd $keytab nfsa/$test_host
+test_run -auth $test_principal $pam_krb5 $test_flags -- foo
+chosen
+
+# Replace the keytab with one holding a different key, of the same size, with
+# the same modification time, as if it had been rekeyed.
+ktadd $keytab.new nfsb/$test_host
+touch -r $keytab $keytab.new
+if test "`stat -c '%s %y' $keytab`" = "`stat -c '%s %y' $keytab.new`" ; then
+	echo ""; echo The new keytab has the same size and modification time.
+fi
+mv -f $keytab.new $keytab
+
+echo ""; echo Succeed: the keytab was replaced, so the new key is chosen.
+test_run -auth $test_principal $pam_krb5 $test_flags -- foo
+chosen
+
+rm -f $keytab $keytab.new $services
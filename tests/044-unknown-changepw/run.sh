@@ -0,0 +1,32 @@
+#!/bin/sh
+
+. $testdir/testenv.sh
+
+test_flags="$test_flags ignore_afs ccache_dir=$testdir/kdc unknown_principal_ttl=60"
+unknown=$testdir/kdc/pam_krb5_unknown_principals_`id -u`
+rm -f $unknown
+
+setpw $test_principal foo
+pwexpire $test_principal never
+
+# Put a KDC in front of the real one which says that it has never heard of the
+# user when asked for a password-changing ticket, and passes on everything
+# else.
+sed -r -e 's|^( *)kdc = (.*):8801$|\1kdc = \2:8808|' \
+	$KRB5_CONFIG > $testdir/kdc/krb5.conf.changepw
+KRB5_CONFIG=$testdir/kdc/krb5.conf.changepw ; export KRB5_CONFIG
+kdc_unknown 8808 EXAMPLE.COM changepw $test_host 8801 > /dev/null 2> /dev/null &
+proxy=$!
+test_settle
+
+echo ""; echo Fail: the password-changing service says the user is unknown.
+test_run -chauthtok $test_principal $pam_krb5 $test_flags -- foo bar bar | grep '^CHAUTHTOK1'
+if test -s $unknown ; then
+	echo The user is remembered as unknown.
+fi
+
+echo ""; echo Succeed: logging in still asks the KDC.
+test_run -auth $test_principal $pam_krb5 $test_flags -- foo
+
+kill $proxy
+rm -f $unknown $testdir/kdc/krb5.conf.changepw
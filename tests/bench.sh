@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# Drive the module through repeated logins against the test KDC and report
+# per-call latencies.  Usage:
+#   bench.sh [principals [concurrency [iterations [module options ...]]]]
+# If AFS_STANDIN_CELL is set, tokens are also obtained for that cell, with
+# tools/afs_standin answering in place of the AFS kernel module.  Set
+# AFS_STANDIN_DELAY to the number of microseconds each call should take.
+
+testdir=`dirname "$0"`
+testdir=`cd "$testdir" ; pwd`
+export testdir
+
+. $testdir/testenv.sh
+
+principals=${1:-100}
+concurrency=${2:-8}
+iterations=${3:-1}
+if test $# -ge 3 ; then
+	shift 3
+else
+	shift $#
+fi
+if test -n "$AFS_STANDIN_CELL" && test -f $afs_standin ; then
+	bench_flags="$test_flags tokens no_user_check ${*}"
+	bench_preload="LD_PRELOAD=$afs_standin"
+else
+	bench_flags="$test_flags ignore_afs no_user_check ${*}"
+	bench_preload=
+fi
+
+test_kdcinitdb
+test_kdcprep
+i=1
+while test $i -le $principals ; do
+	addprinc bench$i foo
+	i=`expr $i + 1`
+done
+if test -n "$bench_preload" ; then
+	addprinc afs/$AFS_STANDIN_CELL foo
+fi
+
+if test $principals -gt 1 ; then
+	bench_user=bench
+else
+	bench_user=bench1
+fi
+meanwhile "$run_kdc" -w "waitforkdc.sh $testdir/kdc/krb5kdc.log" \
+	"$bench_preload $testdir/tools/pam_bench -principals $principals -concurrency $concurrency -iterations $iterations $bench_user $pam_krb5 $bench_flags ccname_template=FILE:$testdir/kdc/krb5cc_%u_XXXXXX -- foo"
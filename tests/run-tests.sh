@@ -28,9 +28,15 @@ for test in ${@:-"$testdir"/0*} ; do
 	test_kdcprep
 	echo -n ." "
 	meanwhile "$run_kdc" -w "waitforkdc.sh $test/../kdc/krb5kdc.log" "$run_kadmind" -w "waitforkpasswdd.sh $test/../kdc/kadmind.log" "$test/run.sh" > $test/stdout 2> $test/stderr
+	result=$?
 	kdcport=`expr $kdcport + 3`
 	kadminport=`expr $kdcport + 1`
 	kpasswdport=`expr $kadminport + 1`
+	# A test which can't run here exits with status 77, as with automake.
+	if test $result -eq 77 ; then
+		echo SKIPPED
+		continue
+	fi
 	if test -s $test/stdout.expected ; then
 		if ! cmp -s $test/stdout.expected $test/stdout ; then
 			if ! test -s $test/stdout.expected.2 || ! cmp -s $test/stdout.expected.2 $test/stdout ; then
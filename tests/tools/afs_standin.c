@@ -0,0 +1,648 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA
+ *
+ */
+
+/* A stand-in for the OpenAFS kernel module, for loading using LD_PRELOAD:
+ * when the file in /proc which minikafs uses to talk to AFS is opened, hand
+ * back a descriptor for /dev/null instead, and answer the ioctl() calls made
+ * using it ourselves.  Tokens are kept in memory, so each process gets a copy
+ * of its parent's tokens when it starts, which is close enough to having a
+ * PAG for our purposes.
+ *
+ * It's controlled using these environment variables:
+ *   AFS_STANDIN_CELL	the name of the local cell (default "example.com")
+ *   AFS_STANDIN_SERVER	the IPv4 address of every cell's file server (if
+ *			not set, we pretend not to know where they are)
+ *   AFS_STANDIN_DELAY	microseconds to wait before answering each call
+ *   AFS_STANDIN_LOG	a file to which we append a line for each call
+ *   AFS_STANDIN_HOME	a directory which fstatfs() says is in AFS, along
+ *			with everything in it */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/vfs.h>
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STANDIN_FILE "/proc/fs/openafs/afs_ioctl"
+#define STANDIN_MAX_CELLS 32
+#define STANDIN_MAX_TOKENS 8192
+#define STANDIN_AFS_MAGIC 0x5346414f
+
+/* These have to match minikafs.c. */
+#define VIOCTL_SYSCALL ((unsigned int) _IOW('C', 1, void *))
+#define VIOCTL_FN(id)  ((unsigned int) _IOW('V', (id), struct standin_ioblock))
+#define CIOCTL_FN(id)  ((unsigned int) _IOW('C', (id), struct standin_ioblock))
+
+struct standin_procdata {
+	long param4;
+	long param3;
+	long param2;
+	long param1;
+	long function;
+};
+
+struct standin_ioblock {
+	char *in, *out;
+	uint16_t insize, outsize;
+};
+
+struct standin_plain_token {
+	uint32_t kvno;
+	char key[8];
+	uint32_t uid;
+	uint32_t start, end;
+};
+
+#define STANDIN_SUBSYS_PIOCTL 20
+#define STANDIN_SUBSYS_SETPAG 21
+
+#define STANDIN_TOKEN_RXKAD 2
+#define STANDIN_TOKEN_RXK5 5
+
+/* The tokens we're holding for each cell, XDR-encoded the way the gettoken2
+ * call returns them: a count, followed by that many opaque token unions. */
+static struct standin_cell {
+	char name[256];
+	uint32_t n_tokens;
+	size_t length;
+	unsigned char tokens[STANDIN_MAX_TOKENS];
+} standin_cells[STANDIN_MAX_CELLS];
+
+static int standin_fd = -1;
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_open64)(const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static int (*real_fstatfs)(int, struct statfs *);
+static int (*real_fstatfs64)(int, struct statfs64 *);
+
+static void
+standin_log(const char *fmt, ...)
+{
+	char line[1024];
+	const char *path;
+	va_list args;
+	int fd;
+
+	path = getenv("AFS_STANDIN_LOG");
+	if ((path == NULL) || (strlen(path) == 0)) {
+		return;
+	}
+	va_start(args, fmt);
+	vsnprintf(line, sizeof(line) - 1, fmt, args);
+	va_end(args);
+	strcat(line, "\n");
+	/* A single write() to a file opened for appending, so that lines from
+	 * different processes don't get mixed together. */
+	fd = real_open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+	if (fd != -1) {
+		if (write(fd, line, strlen(line)) != (ssize_t) strlen(line)) {
+			/* Nothing to be done about it. */
+		}
+		real_close(fd);
+	}
+}
+
+static void
+standin_init(void)
+{
+	if (real_open == NULL) {
+		real_open = dlsym(RTLD_NEXT, "open");
+		real_open64 = dlsym(RTLD_NEXT, "open64");
+		real_close = dlsym(RTLD_NEXT, "close");
+		real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+		real_fstatfs = dlsym(RTLD_NEXT, "fstatfs");
+		real_fstatfs64 = dlsym(RTLD_NEXT, "fstatfs64");
+	}
+}
+
+static const char *
+standin_ws_cell(void)
+{
+	const char *cell;
+
+	cell = getenv("AFS_STANDIN_CELL");
+	if ((cell == NULL) || (strlen(cell) == 0)) {
+		cell = "example.com";
+	}
+	return cell;
+}
+
+static struct standin_cell *
+standin_find_cell(const char *name, int create)
+{
+	int i;
+
+	for (i = 0; i < STANDIN_MAX_CELLS; i++) {
+		if ((standin_cells[i].n_tokens > 0) &&
+		    (strcmp(standin_cells[i].name, name) == 0)) {
+			return &standin_cells[i];
+		}
+	}
+	if (!create || (strlen(name) >= sizeof(standin_cells[0].name))) {
+		return NULL;
+	}
+	for (i = 0; i < STANDIN_MAX_CELLS; i++) {
+		if (standin_cells[i].n_tokens == 0) {
+			strcpy(standin_cells[i].name, name);
+			standin_cells[i].length = 0;
+			return &standin_cells[i];
+		}
+	}
+	return NULL;
+}
+
+/* Copy a string to an ioblock's output buffer. */
+static int
+standin_out_string(struct standin_ioblock *iob, const char *s)
+{
+	if ((iob->out == NULL) || (strlen(s) + 1 > iob->outsize)) {
+		errno = E2BIG;
+		return -1;
+	}
+	strcpy(iob->out, s);
+	return 0;
+}
+
+/* XDR helpers. */
+static size_t
+standin_put_uint32(unsigned char *p, uint32_t u)
+{
+	p[0] = (u >> 24) & 0xff;
+	p[1] = (u >> 16) & 0xff;
+	p[2] = (u >> 8) & 0xff;
+	p[3] = u & 0xff;
+	return 4;
+}
+
+static size_t
+standin_put_opaque(unsigned char *p, const void *data, uint32_t length)
+{
+	size_t padded;
+
+	padded = (length + 3) & ~3;
+	standin_put_uint32(p, length);
+	memset(p + 4, 0, padded);
+	memcpy(p + 4, data, length);
+	return 4 + padded;
+}
+
+static int
+standin_get_uint32(const unsigned char **p, size_t *left, uint32_t *u)
+{
+	if (*left < 4) {
+		return -1;
+	}
+	*u = ((*p)[0] << 24) | ((*p)[1] << 16) | ((*p)[2] << 8) | (*p)[3];
+	*p += 4;
+	*left -= 4;
+	return 0;
+}
+
+static int
+standin_get_opaque(const unsigned char **p, size_t *left,
+		   const unsigned char **data, uint32_t *length)
+{
+	size_t padded;
+
+	if (standin_get_uint32(p, left, length) != 0) {
+		return -1;
+	}
+	padded = ((size_t) *length + 3) & ~3;
+	if (*left < padded) {
+		return -1;
+	}
+	*data = *p;
+	*p += padded;
+	*left -= padded;
+	return 0;
+}
+
+/* The old-style settoken call: a ticket, our half of the token, a flag
+ * word, and the name of the cell, in host byte order.  Keep it as an rxkad
+ * token, which is what gettoken2 would turn it into. */
+static int
+standin_settoken(struct standin_ioblock *iob)
+{
+	struct standin_plain_token plain;
+	struct standin_cell *cell;
+	unsigned char *p;
+	uint32_t ticket_size, size, flags;
+	const char *ticket, *name;
+
+	if ((iob->in == NULL) || (iob->insize < 4)) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(&ticket_size, iob->in, 4);
+	if ((ticket_size > iob->insize) ||
+	    (4 + ticket_size + 4 + sizeof(plain) + 4 + 1 > iob->insize)) {
+		errno = EINVAL;
+		return -1;
+	}
+	ticket = iob->in + 4;
+	memcpy(&size, ticket + ticket_size, 4);
+	if (size != sizeof(plain)) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(&plain, ticket + ticket_size + 4, sizeof(plain));
+	memcpy(&flags, ticket + ticket_size + 4 + sizeof(plain), 4);
+	name = ticket + ticket_size + 4 + sizeof(plain) + 4;
+	if (memchr(name, '\0', iob->in + iob->insize - name) == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	standin_log("settoken %s rxkad viceid=%lu", name,
+		    (unsigned long) plain.uid);
+
+	cell = standin_find_cell(name, 1);
+	if ((cell == NULL) ||
+	    (4 + 7 * 4 + 8 + 4 + ticket_size + 3 > sizeof(cell->tokens))) {
+		errno = ENOMEM;
+		return -1;
+	}
+	/* Length of the token, then the union's tag and contents. */
+	p = cell->tokens + 4;
+	p += standin_put_uint32(p, STANDIN_TOKEN_RXKAD);
+	p += standin_put_uint32(p, plain.uid);
+	p += standin_put_uint32(p, plain.kvno);
+	memcpy(p, plain.key, 8);
+	p += 8;
+	p += standin_put_uint32(p, plain.start);
+	p += standin_put_uint32(p, plain.end);
+	p += standin_put_uint32(p, flags);
+	p += standin_put_opaque(p, ticket, ticket_size);
+	standin_put_uint32(cell->tokens, p - (cell->tokens + 4));
+	cell->length = p - cell->tokens;
+	cell->n_tokens = 1;
+	return 0;
+}
+
+/* The settoken2 call: flags, a cell name, and a list of tokens, all
+ * XDR-encoded.  Keep the tokens as they are. */
+static int
+standin_settoken2(struct standin_ioblock *iob)
+{
+	struct standin_cell *cell;
+	const unsigned char *p, *name, *token, *tokens;
+	size_t left;
+	uint32_t flags, name_length, n, i, length, type;
+	char cellname[256];
+
+	p = (const unsigned char *) iob->in;
+	left = iob->in ? iob->insize : 0;
+	if ((standin_get_uint32(&p, &left, &flags) != 0) ||
+	    (standin_get_opaque(&p, &left, &name, &name_length) != 0) ||
+	    (name_length >= sizeof(cellname)) ||
+	    (standin_get_uint32(&p, &left, &n) != 0) ||
+	    (n == 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(cellname, name, name_length);
+	cellname[name_length] = '\0';
+	tokens = p;
+	for (i = 0; i < n; i++) {
+		if ((standin_get_opaque(&p, &left, &token, &length) != 0) ||
+		    (length < 4)) {
+			errno = EINVAL;
+			return -1;
+		}
+		type = (token[0] << 24) | (token[1] << 16) |
+		       (token[2] << 8) | token[3];
+		standin_log("settoken2 %s %s", cellname,
+			    (type == STANDIN_TOKEN_RXK5) ? "rxk5" :
+			    (type == STANDIN_TOKEN_RXKAD) ? "rxkad" : "other");
+	}
+
+	cell = standin_find_cell(cellname, 1);
+	if ((cell == NULL) || ((size_t) (p - tokens) > sizeof(cell->tokens))) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(cell->tokens, tokens, p - tokens);
+	cell->length = p - tokens;
+	cell->n_tokens = n;
+	return 0;
+}
+
+/* The gettoken2 call: given a cell name, hand back what we have for it. */
+static int
+standin_gettoken2(struct standin_ioblock *iob)
+{
+	struct standin_cell *cell;
+	unsigned char *p;
+	char cellname[256];
+
+	if ((iob->in == NULL) || (iob->insize == 0) ||
+	    (iob->insize > sizeof(cellname))) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(cellname, iob->in, iob->insize);
+	cellname[iob->insize - 1] = '\0';
+	cell = standin_find_cell(cellname, 0);
+	standin_log("gettoken2 %s %lu", cellname,
+		    cell ? (unsigned long) cell->n_tokens : 0UL);
+	if (cell == NULL) {
+		errno = EDOM;
+		return -1;
+	}
+	if ((iob->out == NULL) ||
+	    (4 + 4 + ((strlen(cellname) + 3) & ~3) + 4 + cell->length >
+	     iob->outsize)) {
+		errno = E2BIG;
+		return -1;
+	}
+	p = (unsigned char *) iob->out;
+	p += standin_put_uint32(p, 0);
+	p += standin_put_opaque(p, cellname, strlen(cellname));
+	p += standin_put_uint32(p, cell->n_tokens);
+	memcpy(p, cell->tokens, cell->length);
+	return 0;
+}
+
+/* The whereis call: the addresses of the servers for a path, as a list of
+ * IPv4 addresses terminated by a zero. */
+static int
+standin_whereis(const char *path, struct standin_ioblock *iob)
+{
+	const char *server;
+	struct in_addr addr;
+
+	standin_log("whereis %s", path);
+	server = getenv("AFS_STANDIN_SERVER");
+	if ((server == NULL) || (inet_pton(AF_INET, server, &addr) != 1)) {
+		errno = ENOENT;
+		return -1;
+	}
+	if ((iob->out == NULL) || (iob->outsize < 2 * sizeof(addr))) {
+		errno = E2BIG;
+		return -1;
+	}
+	memset(iob->out, 0, 2 * sizeof(addr));
+	memcpy(iob->out, &addr, sizeof(addr));
+	return 0;
+}
+
+/* The getcelloffile call: "/afs" is in the local cell, and "/afs/cell/..."
+ * is in "cell".  Nothing else is in AFS at all. */
+static int
+standin_getcelloffile(const char *path, struct standin_ioblock *iob)
+{
+	char cell[256];
+	size_t length;
+
+	standin_log("getcelloffile %s", path);
+	if (strcmp(path, "/afs") == 0) {
+		return standin_out_string(iob, standin_ws_cell());
+	}
+	if ((strncmp(path, "/afs/", 5) != 0) || (strlen(path) == 5)) {
+		errno = EINVAL;
+		return -1;
+	}
+	length = strcspn(path + 5, "/");
+	if (length >= sizeof(cell)) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(cell, path + 5, length);
+	cell[length] = '\0';
+	return standin_out_string(iob, cell);
+}
+
+static int
+standin_pioctl(const char *path, unsigned int subfunction,
+	       struct standin_ioblock *iob)
+{
+	struct standin_ioblock empty;
+	int i;
+
+	if (iob == NULL) {
+		memset(&empty, 0, sizeof(empty));
+		iob = &empty;
+	}
+	if (path == NULL) {
+		path = "";
+	}
+	switch (subfunction) {
+	case VIOCTL_FN(3):
+		return standin_settoken(iob);
+	case CIOCTL_FN(8):
+		return standin_settoken2(iob);
+	case CIOCTL_FN(7):
+		return standin_gettoken2(iob);
+	case VIOCTL_FN(9):
+		standin_log("unlog");
+		for (i = 0; i < STANDIN_MAX_CELLS; i++) {
+			standin_cells[i].n_tokens = 0;
+		}
+		return 0;
+	case VIOCTL_FN(14):
+		return standin_whereis(path, iob);
+	case VIOCTL_FN(30):
+		return standin_getcelloffile(path, iob);
+	case VIOCTL_FN(31):
+		standin_log("getwscell");
+		return standin_out_string(iob, standin_ws_cell());
+	default:
+		standin_log("pioctl 0x%x", subfunction);
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+static int
+standin_call(struct standin_procdata *data)
+{
+	const char *delay;
+	int i;
+
+	delay = getenv("AFS_STANDIN_DELAY");
+	if ((delay != NULL) && (atol(delay) > 0)) {
+		usleep(atol(delay));
+	}
+	switch (data->function) {
+	case STANDIN_SUBSYS_SETPAG:
+		standin_log("setpag");
+		for (i = 0; i < STANDIN_MAX_CELLS; i++) {
+			standin_cells[i].n_tokens = 0;
+		}
+		return 0;
+	case STANDIN_SUBSYS_PIOCTL:
+		return standin_pioctl((const char *) data->param1,
+				      (unsigned int) data->param2,
+				      (struct standin_ioblock *) data->param3);
+	default:
+		standin_log("syscall %ld", data->function);
+		errno = ENOSYS;
+		return -1;
+	}
+}
+
+static int
+standin_open(int (*fn)(const char *, int, ...),
+	     const char *path, int flags, mode_t mode)
+{
+	int fd;
+
+	if ((path != NULL) && (strcmp(path, STANDIN_FILE) == 0)) {
+		fd = fn("/dev/null", flags & ~(O_CREAT | O_TRUNC));
+		if (fd != -1) {
+			standin_fd = fd;
+		}
+		return fd;
+	}
+	return fn(path, flags, mode);
+}
+
+int
+open(const char *path, int flags, ...)
+{
+	va_list args;
+	mode_t mode;
+
+	standin_init();
+	va_start(args, flags);
+	mode = (flags & O_CREAT) ? va_arg(args, int) : 0;
+	va_end(args);
+	return standin_open(real_open, path, flags, mode);
+}
+
+int
+open64(const char *path, int flags, ...)
+{
+	va_list args;
+	mode_t mode;
+
+	standin_init();
+	va_start(args, flags);
+	mode = (flags & O_CREAT) ? va_arg(args, int) : 0;
+	va_end(args);
+	return standin_open(real_open64 ? real_open64 : real_open,
+			    path, flags, mode);
+}
+
+int
+__open_2(const char *path, int flags)
+{
+	standin_init();
+	return standin_open(real_open, path, flags, 0);
+}
+
+int
+__open64_2(const char *path, int flags)
+{
+	standin_init();
+	return standin_open(real_open64 ? real_open64 : real_open,
+			    path, flags, 0);
+}
+
+int
+close(int fd)
+{
+	standin_init();
+	if (fd == standin_fd) {
+		standin_fd = -1;
+	}
+	return real_close(fd);
+}
+
+int
+ioctl(int fd, unsigned long request, ...)
+{
+	va_list args;
+	void *arg;
+
+	standin_init();
+	va_start(args, request);
+	arg = va_arg(args, void *);
+	va_end(args);
+	if ((fd != -1) && (fd == standin_fd) && (request == VIOCTL_SYSCALL)) {
+		return standin_call(arg);
+	}
+	return real_ioctl(fd, request, arg);
+}
+
+/* Check if the descriptor refers to something under AFS_STANDIN_HOME. */
+static int
+standin_in_home(int fd)
+{
+	char link[64], path[PATH_MAX];
+	const char *home;
+	ssize_t n;
+	size_t length;
+
+	home = getenv("AFS_STANDIN_HOME");
+	if ((home == NULL) || (strlen(home) == 0)) {
+		return 0;
+	}
+	snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+	n = readlink(link, path, sizeof(path) - 1);
+	if (n < 0) {
+		return 0;
+	}
+	path[n] = '\0';
+	length = strlen(home);
+	while ((length > 1) && (home[length - 1] == '/')) {
+		length--;
+	}
+	return (strncmp(path, home, length) == 0) &&
+	       ((path[length] == '\0') || (path[length] == '/'));
+}
+
+int
+fstatfs(int fd, struct statfs *buf)
+{
+	int ret;
+
+	standin_init();
+	ret = real_fstatfs(fd, buf);
+	if ((ret == 0) && standin_in_home(fd)) {
+		buf->f_type = STANDIN_AFS_MAGIC;
+	}
+	return ret;
+}
+
+int
+fstatfs64(int fd, struct statfs64 *buf)
+{
+	int ret;
+
+	standin_init();
+	ret = real_fstatfs64(fd, buf);
+	if ((ret == 0) && standin_in_home(fd)) {
+		buf->f_type = STANDIN_AFS_MAGIC;
+	}
+	return ret;
+}
@@ -0,0 +1,84 @@
+#include "../../config.h"
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <krb5.h>
+#include "../../src/ccfile.h"
+
+/* Load the contents of a FILE: ccache in to a MEMORY: ccache using
+ * _pam_krb5_ccfile_deserialize(), and list what we got.  With "-c", just
+ * check whether or not we can do that here. */
+int
+main(int argc, char **argv)
+{
+	static unsigned char blob[128 * 1024];
+	krb5_context ctx;
+	krb5_ccache ccache;
+	krb5_principal client;
+	krb5_cc_cursor cursor;
+	krb5_creds creds;
+	krb5_error_code ret;
+	char *name;
+	size_t n;
+	FILE *fp;
+
+	if (argc != 2) {
+		printf("Usage: ccfile_load [-c|filename]\n");
+		return 1;
+	}
+	if (strcmp(argv[1], "-c") == 0) {
+		return _pam_krb5_ccfile_available() ? 0 : 1;
+	}
+	fp = fopen(argv[1], "r");
+	if (fp == NULL) {
+		printf("Error opening \"%s\".\n", argv[1]);
+		return 1;
+	}
+	n = fread(blob, 1, sizeof(blob), fp);
+	fclose(fp);
+
+	ctx = NULL;
+	ret = krb5_init_context(&ctx);
+	if (ret != 0) {
+		printf("Error initializing Kerberos.\n");
+		return ret;
+	}
+	ret = krb5_cc_resolve(ctx, "MEMORY:ccfile_load", &ccache);
+	if (ret != 0) {
+		printf("Error creating ccache.\n");
+		krb5_free_context(ctx);
+		return 1;
+	}
+	ret = _pam_krb5_ccfile_deserialize(ctx, blob, n, ccache);
+	if (ret != 0) {
+		printf("Error loading credentials.\n");
+		krb5_cc_destroy(ctx, ccache);
+		krb5_free_context(ctx);
+		return 1;
+	}
+	if ((krb5_cc_get_principal(ctx, ccache, &client) == 0) &&
+	    (krb5_unparse_name(ctx, client, &name) == 0)) {
+		printf("Client: %s\n", name);
+		krb5_free_unparsed_name(ctx, name);
+		krb5_free_principal(ctx, client);
+	}
+	if (krb5_cc_start_seq_get(ctx, ccache, &cursor) == 0) {
+		memset(&creds, 0, sizeof(creds));
+		while (krb5_cc_next_cred(ctx, ccache, &cursor, &creds) == 0) {
+			/* Skip libkrb5's configuration entries. */
+			if (krb5_unparse_name(ctx, creds.server, &name) == 0) {
+				if (strncmp(name, "X-CACHECONF:", 12) != 0) {
+					printf("Server: %s\n", name);
+				}
+				krb5_free_unparsed_name(ctx, name);
+			}
+			krb5_free_cred_contents(ctx, &creds);
+			memset(&creds, 0, sizeof(creds));
+		}
+		krb5_cc_end_seq_get(ctx, ccache, &cursor);
+	}
+	krb5_cc_destroy(ctx, ccache);
+	krb5_free_context(ctx);
+	return 0;
+}
@@ -0,0 +1,114 @@
+#include "../../config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <krb5.h>
+#include "../../src/cchelper.h"
+
+/* Send one request to "pam_krb5_cchelper --serve", with whatever we read from
+ * stdin as the credentials, and print what comes back.  When started as root,
+ * "-u uid" switches to another user before connecting.  With "-w seconds", we
+ * just connect and then wait, sending nothing. */
+int
+main(int argc, char **argv)
+{
+	struct _pam_krb5_cchelper_request request;
+	struct _pam_krb5_cchelper_reply reply;
+	struct sockaddr_un address;
+	char input[128 * 1024], output[PATH_MAX + 2];
+	size_t n_input;
+	ssize_t i;
+	int s, wait;
+
+	if ((argc > 2) && (strcmp(argv[1], "-u") == 0)) {
+		if (setuid(atoi(argv[2])) != 0) {
+			printf("Error switching users.\n");
+			return 1;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+	if ((argc == 4) && (strcmp(argv[1], "-w") == 0)) {
+		wait = atoi(argv[2]);
+		argc -= 2;
+		argv += 2;
+	} else {
+		wait = 0;
+	}
+	if ((wait > 0) ? (argc != 2) : ((argc != 4) && (argc != 6))) {
+		printf("Usage: cchelper_client [-u uid] socket [-c|-u|-d] "
+		       "ccname [uid gid]\n"
+		       "       cchelper_client -w seconds socket\n");
+		return 1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(argv[1]) >= sizeof(address.sun_path)) {
+		printf("Socket path too long.\n");
+		return 1;
+	}
+	strcpy(address.sun_path, argv[1]);
+
+	if (wait > 0) {
+		s = socket(AF_UNIX, SOCK_STREAM, 0);
+		if ((s == -1) ||
+		    (connect(s, (struct sockaddr *) &address,
+			     sizeof(address)) != 0)) {
+			printf("Error connecting.\n");
+			return 1;
+		}
+		sleep(wait);
+		close(s);
+		return 0;
+	}
+
+	n_input = 0;
+	while ((n_input < sizeof(input)) &&
+	       ((i = read(STDIN_FILENO, input + n_input,
+			  sizeof(input) - n_input)) > 0)) {
+		n_input += i;
+	}
+
+	memset(&request, 0, sizeof(request));
+	request.magic = PAM_KRB5_CCHELPER_MAGIC;
+	request.flag = argv[2][1];
+	request.uid = (argc > 4) ? atoll(argv[4]) : getuid();
+	request.gid = (argc > 5) ? atoll(argv[5]) : getgid();
+	request.ccname_len = strlen(argv[3]);
+	request.data_len = n_input;
+
+	s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((s == -1) ||
+	    (connect(s, (struct sockaddr *) &address, sizeof(address)) != 0)) {
+		printf("Error connecting.\n");
+		return 1;
+	}
+	/* A helper which turns us away may hang up before we finish. */
+	signal(SIGPIPE, SIG_IGN);
+	if ((write(s, &request, sizeof(request)) != sizeof(request)) ||
+	    (write(s, argv[3], request.ccname_len) != request.ccname_len) ||
+	    ((n_input > 0) && (write(s, input, n_input) != n_input)) ||
+	    (read(s, &reply, sizeof(reply)) != sizeof(reply)) ||
+	    (reply.magic != PAM_KRB5_CCHELPER_MAGIC) ||
+	    (reply.output_len >= sizeof(output))) {
+		printf("No reply.\n");
+		close(s);
+		return 1;
+	}
+	memset(output, '\0', sizeof(output));
+	i = 0;
+	while ((i < reply.output_len) &&
+	       (read(s, output + i, 1) == 1)) {
+		i++;
+	}
+	close(s);
+	printf("Status %d.\n", reply.status);
+	printf("%s", output);
+	return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../../config.h"
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../src/child.h"
+
+/* Time starting a trivial helper the way we used to, by closing every
+ * possible descriptor in the child before exec(), and using
+ * _pam_krb5_child_exec(), as the limit on the number of open descriptors
+ * grows. */
+
+static long
+elapsed(const struct timeval *start, const struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000L +
+	       (end->tv_usec - start->tv_usec);
+}
+
+static int
+run_closing_all(const char *path, char * const *argv, int fd)
+{
+	pid_t child;
+	int i, status;
+
+	switch (child = fork()) {
+	case -1:
+		return -1;
+		break;
+	case 0:
+		dup2(fd, STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		for (i = STDERR_FILENO + 1; i < sysconf(_SC_OPEN_MAX); i++) {
+			close(i);
+		}
+		execv(path, argv);
+		_exit(-1);
+		break;
+	default:
+		break;
+	}
+	waitpid(child, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int
+run_child(const char *path, char * const *argv, int fd)
+{
+	struct _pam_krb5_child child;
+
+	if (_pam_krb5_child_exec(&child, path, argv, getuid(), getgid(),
+				 fd, fd) == -1) {
+		return -1;
+	}
+	return _pam_krb5_child_wait(&child);
+}
+
+static long
+run(int (*fn)(const char *, char * const *, int),
+    const char *path, char * const *argv, int fd, int iterations)
+{
+	struct timeval start, end;
+	int i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		if (fn(path, argv, fd) != 0) {
+			printf("Error running \"%s\".\n", path);
+			exit(1);
+		}
+	}
+	gettimeofday(&end, NULL);
+	return elapsed(&start, &end);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct rlimit limit, saved;
+	const rlim_t limits[] = {1024, 16384, 65536, 262144, 1048576};
+	char *helper_argv[] = {"/bin/true", NULL};
+	long old_usec, new_usec;
+	unsigned int i;
+	int iterations, fd, j;
+
+	iterations = 100;
+	for (j = 1; j < argc; j++) {
+		if ((strcmp(argv[j], "-iterations") == 0) && (j + 1 < argc)) {
+			iterations = atoi(argv[++j]);
+			continue;
+		}
+		if ((strcmp(argv[j], "-helper") == 0) && (j + 1 < argc)) {
+			helper_argv[0] = argv[++j];
+			continue;
+		}
+		printf("Usage: %s [-iterations N] [-helper path]\n",
+		       strchr(argv[0], '/') ?
+		       strrchr(argv[0], '/') + 1 :
+		       argv[0]);
+		return 255;
+	}
+	if (iterations < 1) {
+		printf("Counts must be positive.\n");
+		return 255;
+	}
+
+	fd = open("/dev/null", O_RDWR);
+	if (fd == -1) {
+		printf("Error opening /dev/null: %s.\n", strerror(errno));
+		return 255;
+	}
+	if (getrlimit(RLIMIT_NOFILE, &saved) != 0) {
+		printf("Error reading descriptor limit: %s.\n",
+		       strerror(errno));
+		return 255;
+	}
+	printf("%-10s %14s %14s\n", "nofile", "close-all(us)", "child(us)");
+	for (i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+		limit = saved;
+		limit.rlim_cur = limits[i];
+		if ((saved.rlim_max != RLIM_INFINITY) &&
+		    (limit.rlim_cur > saved.rlim_max)) {
+			break;
+		}
+		if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+			break;
+		}
+		old_usec = run(run_closing_all, helper_argv[0], helper_argv,
+			       fd, iterations);
+		new_usec = run(run_child, helper_argv[0], helper_argv,
+			       fd, iterations);
+		printf("%-10lu %14ld %14ld\n", (unsigned long) limits[i],
+		       old_usec / iterations, new_usec / iterations);
+	}
+	setrlimit(RLIMIT_NOFILE, &saved);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,8 @@
+#!/bin/sh
+env | grep ^pam_krb5_ | sort
+# Show which program is holding the memfd which we read credentials from.
+pid=`env | sed -rn 's|^pam_krb5_read_shm_segment=[0-9]+/([0-9]+)$|\1|p'`
+if test -n "$pid" ; then
+	basename `readlink /proc/$pid/exe`
+fi
+klist_c
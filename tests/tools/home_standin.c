@@ -0,0 +1,125 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA
+ *
+ */
+
+/* A stand-in for the user's passwd entry, for loading using LD_PRELOAD: give
+ * one user a different home directory, so that tests can put files like
+ * .k5login there without touching the real one.  Both the module and libkrb5
+ * look the user up with getpwnam_r(), so they both see the same directory.
+ *
+ * It's controlled using these environment variables:
+ *   HOME_STANDIN_USER	the user whose home directory we replace
+ *   HOME_STANDIN_DIR	the directory to report instead */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int (*real_getpwnam_r)(const char *, struct passwd *, char *, size_t,
+			      struct passwd **);
+static int (*real_getpwuid_r)(uid_t, struct passwd *, char *, size_t,
+			      struct passwd **);
+static struct passwd *(*real_getpwnam)(const char *);
+static struct passwd *(*real_getpwuid)(uid_t);
+
+static char standin_dir[PATH_MAX];
+
+static void
+standin_init(void)
+{
+	if (real_getpwnam_r == NULL) {
+		real_getpwnam_r = dlsym(RTLD_NEXT, "getpwnam_r");
+		real_getpwuid_r = dlsym(RTLD_NEXT, "getpwuid_r");
+		real_getpwnam = dlsym(RTLD_NEXT, "getpwnam");
+		real_getpwuid = dlsym(RTLD_NEXT, "getpwuid");
+	}
+}
+
+static void
+standin_fix(struct passwd *pwd)
+{
+	const char *user, *dir;
+
+	user = getenv("HOME_STANDIN_USER");
+	dir = getenv("HOME_STANDIN_DIR");
+	if ((pwd == NULL) || (pwd->pw_name == NULL) ||
+	    (user == NULL) || (strcmp(pwd->pw_name, user) != 0) ||
+	    (dir == NULL) || (strlen(dir) == 0) ||
+	    (strlen(dir) >= sizeof(standin_dir))) {
+		return;
+	}
+	strcpy(standin_dir, dir);
+	pwd->pw_dir = standin_dir;
+}
+
+int
+getpwnam_r(const char *name, struct passwd *pwd, char *buf, size_t buflen,
+	   struct passwd **result)
+{
+	int ret;
+
+	standin_init();
+	ret = real_getpwnam_r(name, pwd, buf, buflen, result);
+	if (ret == 0) {
+		standin_fix(*result);
+	}
+	return ret;
+}
+
+int
+getpwuid_r(uid_t uid, struct passwd *pwd, char *buf, size_t buflen,
+	   struct passwd **result)
+{
+	int ret;
+
+	standin_init();
+	ret = real_getpwuid_r(uid, pwd, buf, buflen, result);
+	if (ret == 0) {
+		standin_fix(*result);
+	}
+	return ret;
+}
+
+struct passwd *
+getpwnam(const char *name)
+{
+	struct passwd *pwd;
+
+	standin_init();
+	pwd = real_getpwnam(name);
+	standin_fix(pwd);
+	return pwd;
+}
+
+struct passwd *
+getpwuid(uid_t uid)
+{
+	struct passwd *pwd;
+
+	standin_init();
+	pwd = real_getpwuid(uid);
+	standin_fix(pwd);
+	return pwd;
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA
+ *
+ */
+
+/* A stand-in for a KDC which is up, but slow: forward requests which arrive
+ * on a local port, over UDP or TCP, to a real KDC, but only after waiting for
+ * a while. */
+
+#include <sys/types.h>
+#include <sys/signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static struct addrinfo *kdc_udp, *kdc_tcp;
+static unsigned int delay;
+
+static void
+relay_udp(int fd, const unsigned char *request, ssize_t length,
+	  const struct sockaddr *client, socklen_t client_length)
+{
+	unsigned char reply[65536];
+	struct pollfd pfd;
+	ssize_t n;
+	int kdc;
+
+	sleep(delay);
+	kdc = socket(kdc_udp->ai_family, SOCK_DGRAM, 0);
+	if ((kdc == -1) ||
+	    (connect(kdc, kdc_udp->ai_addr, kdc_udp->ai_addrlen) != 0) ||
+	    (send(kdc, request, length, 0) != length)) {
+		_exit(1);
+	}
+	pfd.fd = kdc;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 10000) != 1) {
+		_exit(1);
+	}
+	n = recv(kdc, reply, sizeof(reply), 0);
+	if (n > 0) {
+		sendto(fd, reply, n, 0, client, client_length);
+	}
+	_exit(0);
+}
+
+static ssize_t
+read_all(int fd, unsigned char *buf, size_t length)
+{
+	size_t done;
+	ssize_t n;
+
+	for (done = 0; done < length; done += n) {
+		n = read(fd, buf + done, length - done);
+		if (n <= 0) {
+			return -1;
+		}
+	}
+	return done;
+}
+
+static void
+relay_tcp(int client)
+{
+	unsigned char buf[65536 + 4];
+	size_t length;
+	int kdc;
+
+	if (read_all(client, buf, 4) != 4) {
+		_exit(1);
+	}
+	length = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+	if ((length > sizeof(buf) - 4) ||
+	    (read_all(client, buf + 4, length) != (ssize_t) length)) {
+		_exit(1);
+	}
+	sleep(delay);
+	kdc = socket(kdc_tcp->ai_family, SOCK_STREAM, 0);
+	if ((kdc == -1) ||
+	    (connect(kdc, kdc_tcp->ai_addr, kdc_tcp->ai_addrlen) != 0) ||
+	    (write(kdc, buf, length + 4) != (ssize_t) (length + 4)) ||
+	    (read_all(kdc, buf, 4) != 4)) {
+		_exit(1);
+	}
+	length = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+	if ((length > sizeof(buf) - 4) ||
+	    (read_all(kdc, buf + 4, length) != (ssize_t) length)) {
+		_exit(1);
+	}
+	if (write(client, buf, length + 4) != (ssize_t) (length + 4)) {
+		_exit(1);
+	}
+	_exit(0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct addrinfo hints, *local_udp, *local_tcp;
+	struct sockaddr_storage client;
+	socklen_t client_length;
+	unsigned char request[65536];
+	struct pollfd fds[2];
+	ssize_t n;
+	int one = 1, fd;
+
+	if (argc != 5) {
+		fprintf(stderr, "Usage: %s port kdchost kdcport seconds\n",
+			argv[0]);
+		return 1;
+	}
+	delay = atoi(argv[4]);
+	signal(SIGCHLD, SIG_IGN);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_PASSIVE;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(NULL, argv[1], &hints, &local_udp) != 0) {
+		return 1;
+	}
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(NULL, argv[1], &hints, &local_tcp) != 0) {
+		return 1;
+	}
+	hints.ai_flags = 0;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(argv[2], argv[3], &hints, &kdc_udp) != 0) {
+		return 1;
+	}
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(argv[2], argv[3], &hints, &kdc_tcp) != 0) {
+		return 1;
+	}
+
+	fds[0].fd = socket(local_udp->ai_family, SOCK_DGRAM, 0);
+	fds[1].fd = socket(local_tcp->ai_family, SOCK_STREAM, 0);
+	if ((fds[0].fd == -1) || (fds[1].fd == -1)) {
+		perror("socket");
+		return 1;
+	}
+	setsockopt(fds[1].fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if ((bind(fds[0].fd, local_udp->ai_addr,
+		  local_udp->ai_addrlen) != 0) ||
+	    (bind(fds[1].fd, local_tcp->ai_addr,
+		  local_tcp->ai_addrlen) != 0) ||
+	    (listen(fds[1].fd, 16) != 0)) {
+		perror("bind");
+		return 1;
+	}
+	fds[0].events = POLLIN;
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return 1;
+		}
+		if (fds[0].revents & POLLIN) {
+			client_length = sizeof(client);
+			n = recvfrom(fds[0].fd, request, sizeof(request), 0,
+				     (struct sockaddr *) &client,
+				     &client_length);
+			if ((n > 0) && (fork() == 0)) {
+				relay_udp(fds[0].fd, request, n,
+					  (struct sockaddr *) &client,
+					  client_length);
+			}
+		}
+		if (fds[1].revents & POLLIN) {
+			fd = accept(fds[1].fd, NULL, NULL);
+			if (fd != -1) {
+				if (fork() == 0) {
+					close(fds[0].fd);
+					close(fds[1].fd);
+					relay_tcp(fd);
+				}
+				close(fd);
+			}
+		}
+	}
+}
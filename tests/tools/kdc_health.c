@@ -0,0 +1,77 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA
+ *
+ */
+
+/* Print what a KDC health table says about each KDC, by port number. */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../../src/kdchealth.h"
+
+int
+main(int argc, char **argv)
+{
+	struct _pam_krb5_kdc_health_table table;
+	struct _pam_krb5_kdc_health_entry *entry;
+	unsigned int i, port;
+	FILE *fp;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s file\n", argv[0]);
+		return 1;
+	}
+	fp = fopen(argv[1], "r");
+	if ((fp == NULL) ||
+	    (fread(&table, sizeof(table), 1, fp) != 1) ||
+	    (table.magic != PAM_KRB5_KDC_HEALTH_MAGIC) ||
+	    (table.version != PAM_KRB5_KDC_HEALTH_VERSION)) {
+		fprintf(stderr, "Error reading \"%s\".\n", argv[1]);
+		return 1;
+	}
+	fclose(fp);
+	for (i = 0; i < PAM_KRB5_KDC_HEALTH_ENTRIES; i++) {
+		entry = &table.entries[i];
+		switch (entry->address.ss_family) {
+		case AF_INET:
+			port = ntohs(((struct sockaddr_in *)
+				      &entry->address)->sin_port);
+			break;
+		case AF_INET6:
+			port = ntohs(((struct sockaddr_in6 *)
+				      &entry->address)->sin6_port);
+			break;
+		default:
+			continue;
+		}
+		if (entry->address_length == 0) {
+			continue;
+		}
+		printf("%u: %s\n", port,
+		       (entry->open_until > (int64_t) time(NULL)) ?
+		       "skipped" :
+		       (entry->failures > 0) ? "failing" : "answering");
+	}
+	return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA
+ *
+ */
+
+/* A stand-in for a replica KDC which hasn't caught up with the master: answer
+ * every request which arrives on a local port over UDP with a KRB-ERROR
+ * saying that the client principal doesn't exist.  If given a service name
+ * and a real KDC, only answer that way for requests which name that service,
+ * and pass everything else on to the real KDC. */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KDC_ERR_C_PRINCIPAL_UNKNOWN 6
+
+/* Append a DER tag, length, and "content" to "out", returning the new length
+ * of "out".  Nothing we build here is ever 64k long. */
+static size_t
+der(unsigned char *out, size_t used, unsigned char tag,
+    const unsigned char *content, size_t length)
+{
+	out[used++] = tag;
+	if (length < 0x80) {
+		out[used++] = length;
+	} else
+	if (length < 0x100) {
+		out[used++] = 0x81;
+		out[used++] = length;
+	} else {
+		out[used++] = 0x82;
+		out[used++] = length >> 8;
+		out[used++] = length & 0xff;
+	}
+	memmove(out + used, content, length);
+	return used + length;
+}
+
+static size_t
+der_int(unsigned char *out, size_t used, unsigned char tag, unsigned char i)
+{
+	unsigned char integer[3];
+
+	integer[0] = 0x02;
+	integer[1] = 1;
+	integer[2] = i;
+	return der(out, used, tag, integer, sizeof(integer));
+}
+
+static size_t
+der_string(unsigned char *out, size_t used, unsigned char tag,
+	   unsigned char type, const char *string)
+{
+	unsigned char buf[1024];
+	size_t n;
+
+	n = der(buf, 0, type, (const unsigned char *) string, strlen(string));
+	return der(out, used, tag, buf, n);
+}
+
+/* Build a KRB-ERROR from "realm"'s TGS, saying that the client is unknown. */
+static size_t
+krb_error(unsigned char *out, const char *realm)
+{
+	unsigned char fields[2048], strings[1024], name[1024], seq[2048];
+	char stime[16];
+	time_t now;
+	size_t n, k;
+
+	now = time(NULL);
+	strftime(stime, sizeof(stime), "%Y%m%d%H%M%SZ", gmtime(&now));
+
+	/* The server's name is krbtgt/REALM, an NT-SRV-INST name. */
+	k = der(strings, 0, 0x1b, (const unsigned char *) "krbtgt", 6);
+	k = der(strings, k, 0x1b, (const unsigned char *) realm,
+		strlen(realm));
+	n = der(seq, 0, 0x30, strings, k);
+	k = der_int(name, 0, 0xa0, 2);
+	k = der(name, k, 0xa1, seq, n);
+	n = der(seq, 0, 0x30, name, k);
+
+	/* pvno, msg-type, stime, susec, error-code, realm, sname. */
+	k = der_int(fields, 0, 0xa0, 5);
+	k = der_int(fields, k, 0xa1, 30);
+	k = der_string(fields, k, 0xa4, 0x18, stime);
+	k = der_int(fields, k, 0xa5, 0);
+	k = der_int(fields, k, 0xa6, KDC_ERR_C_PRINCIPAL_UNKNOWN);
+	k = der_string(fields, k, 0xa9, 0x1b, realm);
+	k = der(fields, k, 0xaa, seq, n);
+
+	n = der(seq, 0, 0x30, fields, k);
+	return der(out, 0, 0x7e, seq, n);
+}
+
+/* Pass a request on to the real KDC, and its answer back to the client. */
+static void
+relay(int fd, struct addrinfo *kdc_addr,
+      const unsigned char *request, ssize_t length,
+      const struct sockaddr *client, socklen_t client_length)
+{
+	unsigned char reply[65536];
+	struct pollfd pfd;
+	ssize_t n;
+	int kdc;
+
+	kdc = socket(kdc_addr->ai_family, SOCK_DGRAM, 0);
+	if (kdc == -1) {
+		return;
+	}
+	if ((connect(kdc, kdc_addr->ai_addr, kdc_addr->ai_addrlen) == 0) &&
+	    (send(kdc, request, length, 0) == length)) {
+		pfd.fd = kdc;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 10000) == 1) {
+			n = recv(kdc, reply, sizeof(reply), 0);
+			if (n > 0) {
+				sendto(fd, reply, n, 0, client, client_length);
+			}
+		}
+	}
+	close(kdc);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct addrinfo hints, *local, *kdc_addr;
+	struct sockaddr_storage client;
+	socklen_t client_length;
+	unsigned char request[65536], reply[4096];
+	size_t length;
+	ssize_t n;
+	int fd;
+
+	if ((argc != 3) && (argc != 6)) {
+		fprintf(stderr, "Usage: %s port realm "
+			"[service kdchost kdcport]\n", argv[0]);
+		return 1;
+	}
+	if (strlen(argv[2]) > 256) {
+		fprintf(stderr, "Realm name too long.\n");
+		return 1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_PASSIVE;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(NULL, argv[1], &hints, &local) != 0) {
+		return 1;
+	}
+	kdc_addr = NULL;
+	if ((argc == 6) &&
+	    (getaddrinfo(argv[4], argv[5], &hints, &kdc_addr) != 0)) {
+		return 1;
+	}
+	fd = socket(local->ai_family, SOCK_DGRAM, 0);
+	if ((fd == -1) ||
+	    (bind(fd, local->ai_addr, local->ai_addrlen) != 0)) {
+		perror("bind");
+		return 1;
+	}
+
+	for (;;) {
+		client_length = sizeof(client);
+		n = recvfrom(fd, request, sizeof(request), 0,
+			     (struct sockaddr *) &client, &client_length);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return 1;
+		}
+		/* Pass on anything which doesn't name the service. */
+		if ((n > 0) && (kdc_addr != NULL) &&
+		    (memmem(request, n, argv[3], strlen(argv[3])) == NULL)) {
+			relay(fd, kdc_addr, request, n,
+			      (struct sockaddr *) &client, client_length);
+			continue;
+		}
+		/* Only answer things which look like an AS-REQ. */
+		if ((n > 0) && (request[0] == 0x6a)) {
+			length = krb_error(reply, argv[2]);
+			sendto(fd, reply, length, 0,
+			       (struct sockaddr *) &client, client_length);
+		}
+	}
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../../config.h"
+
+#include <sys/types.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#ifdef HAVE_SECURITY_PAM_MODULES_H
+#include <security/pam_modules.h>
+#endif
+
+#include KRB5_H
+
+#include "../../src/map.h"
+#include "../../src/options.h"
+
+/* Map each "data" argument using "pattern" and "replacement", the way the
+ * "mappings" option does, and print the results. */
+int
+main(int argc, char **argv)
+{
+	struct name_mapping mapping;
+	char output[LINE_MAX];
+	int i;
+
+	if (argc < 4) {
+		printf("Usage: %s pattern replacement data [...]\n", argv[0]);
+		return 1;
+	}
+	memset(&mapping, 0, sizeof(mapping));
+	mapping.pattern = argv[1];
+	mapping.replacement = argv[2];
+	mapping.compiled = NULL;
+	if (map_compile(&mapping) != 0) {
+		printf("Error compiling \"%s\".\n", argv[1]);
+		map_free(&mapping);
+		return 1;
+	}
+	for (i = 3; i < argc; i++) {
+		if (map_lname_aname(&mapping, 1, argv[i],
+				    output, sizeof(output)) == 0) {
+			printf("Match: \"%s\" -> \"%s\"\n", argv[i], output);
+		} else {
+			printf("No match: \"%s\"\n", argv[i]);
+		}
+	}
+	map_free(&mapping);
+	return 0;
+}
@@ -170,5 +170,9 @@ main(int argc, char **argv)
 			       (long) children[i], cmds[i]);
 		}
 	}
-	return ret;
+	/* Pass the foreground command's exit status along. */
+	if ((ret != -1) && WIFEXITED(ret)) {
+		return WEXITSTATUS(ret);
+	}
+	return -1;
 }
@@ -0,0 +1,265 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../../config.h"
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#ifdef HAVE_SECURITY_PAM_MODULES_H
+#include <security/pam_modules.h>
+#endif
+
+#include KRB5_H
+
+#include "../../src/options.h"
+
+/* Time _pam_krb5_options_init() with and without the single-pass appdefaults
+ * table, using a generated krb5.conf with lots of realms and per-service
+ * lists, like the ones which sites with many realms use. */
+
+static int
+converse(int num_msgs, const struct pam_message **msg,
+	 struct pam_response **resp, void *appdata_ptr)
+{
+	return PAM_CONV_ERR;
+}
+
+static long
+elapsed(const struct timeval *start, const struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000L +
+	       (end->tv_usec - start->tv_usec);
+}
+
+static void
+write_services(FILE *fp, const char *option, int first, int n, int step)
+{
+	int i;
+	fprintf(fp, "\t\t\t%s =", option);
+	for (i = first; i < n; i += step) {
+		fprintf(fp, " svc%d", i);
+	}
+	fprintf(fp, "\n");
+}
+
+static int
+write_config(const char *path, int realms, int services)
+{
+	FILE *fp;
+	const char *booleans[] = {
+		"validate", "tokens", "external", "use_shmem",
+		"multiple_ccaches", "cred_session", "ignore_k5login",
+		"user_check", "debug", "always_allow_localname",
+	};
+	char name[64];
+	unsigned int j;
+	int i;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		return -1;
+	}
+	fprintf(fp, "[libdefaults]\n\tdefault_realm = REALM%d.EXAMPLE.COM\n",
+		realms);
+	fprintf(fp, "[realms]\n");
+	for (i = 1; i <= realms; i++) {
+		fprintf(fp, "\tREALM%d.EXAMPLE.COM = {\n"
+			"\t\tkdc = kdc%d.example.com\n\t}\n", i, i);
+	}
+	fprintf(fp, "[appdefaults]\n\tforwardable = true\n\tpam = {\n");
+	fprintf(fp, "\t\tbanner = Kerberos\n\t\tminimum_uid = 1000\n");
+	for (i = 1; i <= realms; i++) {
+		fprintf(fp, "\t\tREALM%d.EXAMPLE.COM = {\n", i);
+		for (j = 0; j < sizeof(booleans) / sizeof(booleans[0]); j++) {
+			snprintf(name, sizeof(name), "%s", booleans[j]);
+			write_services(fp, name, j % 3, services, 3);
+			snprintf(name, sizeof(name), "no_%s", booleans[j]);
+			write_services(fp, name, (j + 1) % 3, services, 3);
+		}
+		fprintf(fp, "\t\t\tccache_dir = /var/tmp/realm%d\n", i);
+		fprintf(fp, "\t\t\tafs_cells = realm%d.example.com\n", i);
+		fprintf(fp, "\t\t\tmappings = ^(.*)$ $1@REALM%d.EXAMPLE.COM\n",
+			i);
+		fprintf(fp, "\t\t}\n");
+	}
+	fprintf(fp, "\t}\n");
+	for (i = 1; i <= realms; i++) {
+		fprintf(fp, "\tREALM%d.EXAMPLE.COM = {\n"
+			"\t\tforwardable = false\n\t}\n", i);
+	}
+	return fclose(fp);
+}
+
+/* Check that both methods came up with the same answers. */
+static int
+compare(struct _pam_krb5_options *a, struct _pam_krb5_options *b)
+{
+	return (a->validate == b->validate) &&
+	       (a->tokens == b->tokens) &&
+	       (a->external == b->external) &&
+	       (a->use_shmem == b->use_shmem) &&
+	       (a->multiple_ccaches == b->multiple_ccaches) &&
+	       (a->cred_session == b->cred_session) &&
+	       (a->ignore_k5login == b->ignore_k5login) &&
+	       (a->user_check == b->user_check) &&
+	       (a->minimum_uid == b->minimum_uid) &&
+	       (a->n_afs_cells == b->n_afs_cells) &&
+	       (a->n_mappings == b->n_mappings) &&
+	       (strcmp(a->banner, b->banner) == 0) &&
+	       (strcmp(a->ccache_dir, b->ccache_dir) == 0) &&
+	       (strcmp(a->ccname_template, b->ccname_template) == 0) &&
+	       (strcmp(a->keytab, b->keytab) == 0);
+}
+
+static long
+run(pam_handle_t *pamh, krb5_context ctx, int argc, const char **argv,
+    int iterations, struct _pam_krb5_options **last)
+{
+	struct _pam_krb5_options *options;
+	struct timeval start, end;
+	int i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		options = _pam_krb5_options_init(pamh, argc,
+						 (PAM_KRB5_MAYBE_CONST char **) argv,
+						 ctx,
+						 _pam_krb5_option_role_general);
+		if (options == NULL) {
+			printf("Error parsing options.\n");
+			exit(1);
+		}
+		if (i == iterations - 1) {
+			*last = options;
+		} else {
+			_pam_krb5_options_free(pamh, ctx, options);
+		}
+	}
+	gettimeofday(&end, NULL);
+	return elapsed(&start, &end);
+}
+
+int
+main(int argc, char **argv)
+{
+	pam_handle_t *pamh;
+	struct pam_conv conv;
+	krb5_context ctx;
+	struct _pam_krb5_options *old, *new;
+	const char *old_argv[] = {"no_appdefaults_table"};
+	char path[] = "/tmp/pam_krb5_options_bench.XXXXXX", service[32];
+	int realms, services, iterations, i, fd;
+	long old_usec, new_usec;
+
+	realms = 50;
+	services = 30;
+	iterations = 200;
+	for (i = 1; i < argc; i++) {
+		if ((strcmp(argv[i], "-realms") == 0) && (i + 1 < argc)) {
+			realms = atoi(argv[++i]);
+			continue;
+		}
+		if ((strcmp(argv[i], "-services") == 0) && (i + 1 < argc)) {
+			services = atoi(argv[++i]);
+			continue;
+		}
+		if ((strcmp(argv[i], "-iterations") == 0) && (i + 1 < argc)) {
+			iterations = atoi(argv[++i]);
+			continue;
+		}
+		printf("Usage: %s [-realms N] [-services N] [-iterations N]\n",
+		       strchr(argv[0], '/') ?
+		       strrchr(argv[0], '/') + 1 :
+		       argv[0]);
+		return 255;
+	}
+	if ((realms < 1) || (services < 1) || (iterations < 1)) {
+		printf("Counts must be positive.\n");
+		return 255;
+	}
+
+	fd = mkstemp(path);
+	if (fd == -1) {
+		printf("Error creating temporary file: %s.\n", strerror(errno));
+		return 255;
+	}
+	close(fd);
+	if (write_config(path, realms, services) != 0) {
+		printf("Error writing \"%s\".\n", path);
+		unlink(path);
+		return 255;
+	}
+	setenv("KRB5_CONFIG", path, 1);
+	if (krb5_init_context(&ctx) != 0) {
+		printf("Error initializing Kerberos.\n");
+		unlink(path);
+		return 255;
+	}
+
+	/* Use a service name which appears in the lists. */
+	snprintf(service, sizeof(service), "svc%d", services / 2);
+	memset(&conv, 0, sizeof(conv));
+	conv.conv = converse;
+	if (pam_start(service, "user", &conv, &pamh) != PAM_SUCCESS) {
+		printf("Error starting PAM.\n");
+		unlink(path);
+		return 255;
+	}
+
+	old_usec = run(pamh, ctx, 1, old_argv, iterations, &old);
+	new_usec = run(pamh, ctx, 0, NULL, iterations, &new);
+	printf("realms\t%d\tservices\t%d\titerations\t%d\n",
+	       realms, services, iterations);
+	printf("per-option\t%ld us/call\n", old_usec / iterations);
+	printf("table\t\t%ld us/call\n", new_usec / iterations);
+	i = compare(old, new);
+	if (!i) {
+		printf("Results differ!\n");
+	}
+
+	_pam_krb5_options_free(pamh, ctx, old);
+	_pam_krb5_options_free(pamh, ctx, new);
+	pam_end(pamh, PAM_SUCCESS);
+	krb5_free_context(ctx);
+	unlink(path);
+	return i ? 0 : 1;
+}
@@ -0,0 +1,367 @@
+/*
+ * Copyright 2001,2002,2003,2012 Red Hat, Inc.
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA
+ *
+ */
+
+#ifndef HAVE_CONFIG_H
+#include "../../config.h"
+#endif
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <security/pam_appl.h>
+#include <security/pam_modules.h>
+
+/* The entry points we drive, in the order in which we call them. */
+enum bench_phase {
+	bench_phase_auth,
+	bench_phase_setcred,
+	bench_phase_open,
+	bench_phase_close,
+	bench_phase_login,
+	bench_phase_count
+};
+
+static const struct {
+	const char *tag, *symbol;
+} phases[bench_phase_count] = {
+	{"AUTH", "pam_sm_authenticate"},
+	{"SETCRED", "pam_sm_setcred"},
+	{"OPEN", "pam_sm_open_session"},
+	{"CLOSE", "pam_sm_close_session"},
+	{"LOGIN", NULL},
+};
+
+/* One timing sample, passed from a worker back to the parent. */
+struct bench_sample {
+	int phase;
+	int result;
+	long usec;
+};
+
+typedef int (*bench_fn)(pam_handle_t *pamh, int flags,
+			int argc, const char **argv);
+
+/* A conversation function which answers every prompt with the password. */
+static int
+converse(int num_msgs,
+	 const struct pam_message **msg,
+	 struct pam_response **resp,
+	 void *appdata_ptr)
+{
+	const char *password = appdata_ptr;
+	int i;
+	*resp = malloc(sizeof(struct pam_response) * num_msgs);
+	if (*resp == NULL) {
+		return PAM_BUF_ERR;
+	}
+	for (i = 0; i < num_msgs; i++) {
+		memset(&((*resp)[i]), 0, sizeof(struct pam_response));
+		switch (msg[i]->msg_style) {
+		case PAM_PROMPT_ECHO_ON:
+		case PAM_PROMPT_ECHO_OFF:
+			(*resp)[i].resp = strdup(password ? password : "");
+			break;
+		default:
+			break;
+		}
+		(*resp)[i].resp_retcode = PAM_SUCCESS;
+	}
+	return PAM_SUCCESS;
+}
+
+static long
+elapsed(const struct timeval *start, const struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000L +
+	       (end->tv_usec - start->tv_usec);
+}
+
+static int
+write_sample(int fd, int phase, int result, long usec)
+{
+	struct bench_sample sample;
+	ssize_t i;
+	memset(&sample, 0, sizeof(sample));
+	sample.phase = phase;
+	sample.result = result;
+	sample.usec = usec;
+	do {
+		i = write(fd, &sample, sizeof(sample));
+	} while ((i == -1) && (errno == EINTR));
+	return (i == sizeof(sample)) ? 0 : -1;
+}
+
+/* Run one login for one user, timing each call. */
+static void
+bench_one(const char *service, const char *user, const char *password,
+	  bench_fn *fns, int argc, const char **argv, int fd)
+{
+	pam_handle_t *pamh;
+	struct pam_conv conv;
+	struct timeval login_start, start, end;
+	int i, ret, flags;
+
+	memset(&conv, 0, sizeof(conv));
+	conv.conv = converse;
+	conv.appdata_ptr = (void *) password;
+	if (pam_start(service, user, &conv, &pamh) != PAM_SUCCESS) {
+		write_sample(fd, bench_phase_login, PAM_SYSTEM_ERR, 0);
+		return;
+	}
+	gettimeofday(&login_start, NULL);
+	ret = PAM_SUCCESS;
+	for (i = 0; i < bench_phase_login; i++) {
+		flags = (i == bench_phase_setcred) ? PAM_ESTABLISH_CRED : 0;
+		gettimeofday(&start, NULL);
+		ret = fns[i](pamh, flags, argc, argv);
+		gettimeofday(&end, NULL);
+		write_sample(fd, i, ret, elapsed(&start, &end));
+		if (ret != PAM_SUCCESS) {
+			break;
+		}
+	}
+	gettimeofday(&end, NULL);
+	write_sample(fd, bench_phase_login, ret, elapsed(&login_start, &end));
+	pam_end(pamh, ret);
+}
+
+static int
+compare_longs(const void *a, const void *b)
+{
+	long l = *(const long *) a, r = *(const long *) b;
+	return (l < r) ? -1 : ((l > r) ? 1 : 0);
+}
+
+/* Nearest-rank percentile of a sorted list. */
+static long
+percentile(const long *sorted, int n, int pct)
+{
+	int rank;
+	if (n == 0) {
+		return 0;
+	}
+	rank = (n * pct + 99) / 100;
+	if (rank < 1) {
+		rank = 1;
+	}
+	return sorted[rank - 1];
+}
+
+int
+main(int argc, char **argv)
+{
+	void *dlhandle;
+	bench_fn fns[bench_phase_login];
+	const char *service, *prefix, *module, *password, **margv;
+	char user[LINE_MAX];
+	int principals, concurrency, iterations, margc;
+	int i, j, n, status, fds[2];
+	pid_t *children;
+	struct bench_sample sample;
+	long *latencies[bench_phase_count];
+	int n_latencies[bench_phase_count], n_failures[bench_phase_count];
+	struct timeval start, end;
+	double seconds;
+	ssize_t len;
+
+	service = "login";
+	prefix = NULL;
+	module = NULL;
+	password = NULL;
+	principals = 1;
+	concurrency = 1;
+	iterations = 1;
+	margc = 0;
+	margv = NULL;
+	for (i = 1; i < argc; i++) {
+		if ((strcmp(argv[i], "-principals") == 0) && (i + 1 < argc)) {
+			principals = atoi(argv[++i]);
+			continue;
+		}
+		if ((strcmp(argv[i], "-concurrency") == 0) && (i + 1 < argc)) {
+			concurrency = atoi(argv[++i]);
+			continue;
+		}
+		if ((strcmp(argv[i], "-iterations") == 0) && (i + 1 < argc)) {
+			iterations = atoi(argv[++i]);
+			continue;
+		}
+		if ((strcmp(argv[i], "-service") == 0) && (i + 1 < argc)) {
+			service = argv[++i];
+			continue;
+		}
+		if (prefix == NULL) {
+			prefix = argv[i];
+			continue;
+		}
+		if (module == NULL) {
+			module = argv[i];
+			margv = (const char **) &argv[i + 1];
+			for (j = i + 1; j < argc; j++) {
+				if (strcmp(argv[j], "--") == 0) {
+					break;
+				}
+			}
+			margc = j - (i + 1);
+			if (j + 1 < argc) {
+				password = argv[j + 1];
+			}
+			break;
+		}
+	}
+	if ((prefix == NULL) || (module == NULL) ||
+	    (principals < 1) || (concurrency < 1) || (iterations < 1)) {
+		printf("Usage: %s\n"
+		       "       [-principals N] [-concurrency N] "
+		       "[-iterations N] [-service name]\n"
+		       "       user-or-prefix module [arg ...] "
+		       "[-- password]\n",
+		       strchr(argv[0], '/') ?
+		       strrchr(argv[0], '/') + 1 :
+		       argv[0]);
+		return 255;
+	}
+	if (concurrency > principals * iterations) {
+		concurrency = principals * iterations;
+	}
+
+	/* Load the module once, so that every worker inherits it. */
+	dlhandle = dlopen(module, RTLD_NOW);
+	if (dlhandle == NULL) {
+		printf("Error loading `%s': %s.\n", module, dlerror());
+		return 255;
+	}
+	for (i = 0; i < bench_phase_login; i++) {
+		fns[i] = (bench_fn) dlsym(dlhandle, phases[i].symbol);
+		if (fns[i] == NULL) {
+			printf("Error locating symbol `%s': %s.\n",
+			       phases[i].symbol, dlerror());
+			return 255;
+		}
+	}
+
+	if (pipe(fds) == -1) {
+		printf("Error creating pipe: %s\n", strerror(errno));
+		return 255;
+	}
+	children = malloc(sizeof(pid_t) * concurrency);
+	if (children == NULL) {
+		printf("Out of memory.\n");
+		return 255;
+	}
+
+	/* Each worker takes every concurrency'th login from the list of
+	 * (iteration, principal) pairs.  The module isn't expected to be
+	 * thread-safe, so workers are processes, as they'd be under sshd. */
+	fflush(NULL);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < concurrency; i++) {
+		switch (children[i] = fork()) {
+		case -1:
+			printf("Error forking: %s\n", strerror(errno));
+			return 255;
+		case 0:
+			close(fds[0]);
+			for (n = i; n < principals * iterations;
+			     n += concurrency) {
+				if (principals > 1) {
+					snprintf(user, sizeof(user), "%s%d",
+						 prefix, (n % principals) + 1);
+				} else {
+					snprintf(user, sizeof(user), "%s",
+						 prefix);
+				}
+				bench_one(service, user, password, fns,
+					  margc, margv, fds[1]);
+			}
+			close(fds[1]);
+			_exit(0);
+			break;
+		default:
+			break;
+		}
+	}
+	close(fds[1]);
+
+	/* Collect samples until every worker has closed its end. */
+	memset(n_latencies, 0, sizeof(n_latencies));
+	memset(n_failures, 0, sizeof(n_failures));
+	for (i = 0; i < bench_phase_count; i++) {
+		latencies[i] = malloc(sizeof(long) * principals * iterations);
+		if (latencies[i] == NULL) {
+			printf("Out of memory.\n");
+			return 255;
+		}
+	}
+	for (;;) {
+		len = read(fds[0], &sample, sizeof(sample));
+		if ((len == -1) && (errno == EINTR)) {
+			continue;
+		}
+		if (len != sizeof(sample)) {
+			break;
+		}
+		if ((sample.phase < 0) || (sample.phase >= bench_phase_count) ||
+		    (n_latencies[sample.phase] >= principals * iterations)) {
+			continue;
+		}
+		latencies[sample.phase][n_latencies[sample.phase]++] =
+			sample.usec;
+		if (sample.result != PAM_SUCCESS) {
+			n_failures[sample.phase]++;
+		}
+	}
+	close(fds[0]);
+	for (i = 0; i < concurrency; i++) {
+		waitpid(children[i], &status, 0);
+	}
+	gettimeofday(&end, NULL);
+	free(children);
+
+	/* Report. */
+	seconds = elapsed(&start, &end) / 1000000.0;
+	printf("logins\t%d\tconcurrency\t%d\telapsed\t%.3fs\t"
+	       "throughput\t%.1f/s\n",
+	       n_latencies[bench_phase_login], concurrency, seconds,
+	       seconds > 0 ? n_latencies[bench_phase_login] / seconds : 0.0);
+	printf("%-8s %8s %8s %10s %10s %10s %10s\n",
+	       "call", "count", "failed", "p50(us)", "p95(us)", "p99(us)",
+	       "max(us)");
+	for (i = 0; i < bench_phase_count; i++) {
+		n = n_latencies[i];
+		qsort(latencies[i], n, sizeof(long), compare_longs);
+		printf("%-8s %8d %8d %10ld %10ld %10ld %10ld\n",
+		       phases[i].tag, n, n_failures[i],
+		       percentile(latencies[i], n, 50),
+		       percentile(latencies[i], n, 95),
+		       percentile(latencies[i], n, 99),
+		       n > 0 ? latencies[i][n - 1] : 0);
+		free(latencies[i]);
+	}
+	return n_failures[bench_phase_login] ? 1 : 0;
+}
@@ -121,7 +121,7 @@ main(int argc, char **argv)
 	int dofork, dorefresh;
 	int noreentrancy;
 	int i, ret, responses, args, argcount;
-	const char *user, *module, *envvar;
+	const char *user, *module, *envvar, *ruid;
 	pam_handle_t *pamh;
 	struct pam_partial_handle {
 		char *authtok;
@@ -141,7 +141,7 @@ main(int argc, char **argv)
 		       "-chauthtok | -refreshcred ]\n"
 		       "       [-tty tty] [-ruser ruser] [-rhost rhost] "
 		       "[-authtok tok] [-oldauthtok tok]\n"
-		       "       [-setenv VAR=VAL]\n"
+		       "       [-setenv VAR=VAL] [-ruid uid]\n"
 		       "       [-prompt string] [-showprompt] [-run command] "
 		       "[-noreentrancy] [-fork]\n"
 		       "       user [module [arg ...]| stack] "
@@ -158,7 +158,7 @@ main(int argc, char **argv)
 	noreentrancy = 0;
 	args = argcount = responses = 0;
 	tty = ruser = rhost = authtok = oldauthtok = run = prompt = NULL;
-	envvar = NULL;
+	envvar = ruid = NULL;
 	for (i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-auth") == 0) {
 			doauth++;
@@ -228,6 +228,10 @@ main(int argc, char **argv)
 			envvar = argv[++i];
 			continue;
 		}
+		if (strcmp(argv[i], "-ruid") == 0) {
+			ruid = argv[++i];
+			continue;
+		}
 		if (user == NULL) {
 			user = argv[i];
 			continue;
@@ -268,6 +272,14 @@ main(int argc, char **argv)
 		return 255;
 	}
 
+	/* Act like a set-user-ID program, if asked to. */
+	if (ruid != NULL) {
+		if (setreuid(atoi(ruid), -1) != 0) {
+			printf("Error setting real UID to %s.\n", ruid);
+			return 255;
+		}
+	}
+
 	/* Set up the conversation structure to point to our conversation
 	 * function and the list of responses we've gotten. */
 	memset(&conv, 0, sizeof(conv));
@@ -482,6 +494,11 @@ main(int argc, char **argv)
 				waitpid(pid, NULL, 0);
 			}
 		}
+		/* Asking for "-account" twice checks again, after
+		 * whatever "-run" did. */
+		if (doaccount > 1) {
+			call_stack(pam_acct_mgmt, "ACCT", 0);
+		}
 		if (dosession) {
 			call_stack(pam_close_session, "CLOSESESS", 0);
 		}
@@ -651,6 +668,11 @@ main(int argc, char **argv)
 				waitpid(pid, NULL, 0);
 			}
 		}
+		/* Asking for "-account" twice checks again, after
+		 * whatever "-run" did. */
+		if (doaccount > 1) {
+			call_fn("pam_sm_acct_mgmt", "ACCT", 0);
+		}
 		if (dosession) {
 			call_fn("pam_sm_close_session", "CLOSESESS", 0);
 		}
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2026 The pam_krb5 contributors.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, and the entire permission notice in its entirety,
+ *    including the disclaimer of warranties.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * ALTERNATIVELY, this product may be distributed under the terms of the
+ * GNU Lesser General Public License, in which case the provisions of the
+ * LGPL are required INSTEAD OF the above restrictions.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../../config.h"
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SECURITY_PAM_APPL_H
+#include <security/pam_appl.h>
+#endif
+
+#ifdef HAVE_SECURITY_PAM_MODULES_H
+#include <security/pam_modules.h>
+#endif
+
+#include KRB5_H
+
+#include "../../src/options.h"
+#include "../../src/userinfo.h"
+#include "../../src/v5.h"
+
+/* Time v5_user_info_subst(), which parses its template on every call, against
+ * rendering a template which was parsed ahead of time, the way we do for
+ * ccname_template, pkinit_identity, and preauth_options. */
+
+static const char *piece = "%d/krb5cc_%U_%{username}_%p_%%_";
+
+static long
+elapsed(const struct timeval *start, const struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000L +
+	       (end->tv_usec - start->tv_usec);
+}
+
+/* Check a few substitutions against known answers. */
+static int
+check(krb5_context ctx, struct _pam_krb5_user_info *userinfo,
+      struct _pam_krb5_options *options)
+{
+	const struct {
+		const char *template_value, *expected;
+	} cases[] = {
+		{"FILE:%d/krb5cc_%U_XXXXXX", "FILE:/tmp/krb5cc_1000_XXXXXX"},
+		{"%h/.k5/%{USERNAME}", "/home/user/.k5/user"},
+		{"%h%d", "/home/user/tmp"},
+		{"%p %r 100%% %x %{x}", "user@EXAMPLE.COM EXAMPLE.COM 100% %x {x}"},
+		{"%{uid}:%{euid}:%{userid}", "1000:1000:1000"},
+		{"%", "%"},
+	};
+	unsigned int i;
+	char *result;
+	int ret;
+
+	ret = 1;
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		result = v5_user_info_subst(ctx, "user", userinfo, options,
+					    cases[i].template_value);
+		if ((result == NULL) ||
+		    (strcmp(result, cases[i].expected) != 0)) {
+			printf("\"%s\" -> \"%s\", expected \"%s\".\n",
+			       cases[i].template_value,
+			       result ? result : "(null)",
+			       cases[i].expected);
+			ret = 0;
+		}
+		free(result);
+	}
+	return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+	krb5_context ctx;
+	struct _pam_krb5_options options;
+	struct _pam_krb5_user_info userinfo;
+	struct _pam_krb5_template *tmpl;
+	struct timeval start, end;
+	char *template_value, *a, *b;
+	int pieces, iterations, i, ok;
+	long old_usec, new_usec;
+
+	pieces = 1;
+	iterations = 100000;
+	for (i = 1; i < argc; i++) {
+		if ((strcmp(argv[i], "-pieces") == 0) && (i + 1 < argc)) {
+			pieces = atoi(argv[++i]);
+			continue;
+		}
+		if ((strcmp(argv[i], "-iterations") == 0) && (i + 1 < argc)) {
+			iterations = atoi(argv[++i]);
+			continue;
+		}
+		printf("Usage: %s [-pieces N] [-iterations N]\n",
+		       strchr(argv[0], '/') ?
+		       strrchr(argv[0], '/') + 1 :
+		       argv[0]);
+		return 255;
+	}
+	if ((pieces < 1) || (iterations < 1)) {
+		printf("Counts must be positive.\n");
+		return 255;
+	}
+	if (krb5_init_context(&ctx) != 0) {
+		printf("Error initializing Kerberos.\n");
+		return 255;
+	}
+
+	memset(&options, 0, sizeof(options));
+	options.user_check = 1;
+	options.ccache_dir = "/tmp";
+	memset(&userinfo, 0, sizeof(userinfo));
+	userinfo.uid = 1000;
+	userinfo.gid = 1000;
+	userinfo.homedir = "/home/user";
+	userinfo.unparsed_name = "user@EXAMPLE.COM";
+	userinfo.realm = "EXAMPLE.COM";
+
+	ok = check(ctx, &userinfo, &options);
+
+	/* Build a template out of repeated copies of a piece. */
+	template_value = malloc(strlen(piece) * pieces + 1);
+	if (template_value == NULL) {
+		printf("Out of memory.\n");
+		return 255;
+	}
+	template_value[0] = '\0';
+	for (i = 0; i < pieces; i++) {
+		strcpy(template_value + strlen(piece) * i, piece);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		free(v5_user_info_subst(ctx, "user", &userinfo, &options,
+					template_value));
+	}
+	gettimeofday(&end, NULL);
+	old_usec = elapsed(&start, &end);
+
+	tmpl = v5_user_info_template_parse(template_value);
+	if (tmpl == NULL) {
+		printf("Error parsing template.\n");
+		return 255;
+	}
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		free(v5_user_info_template_subst(ctx, "user", &userinfo,
+						 &options, tmpl));
+	}
+	gettimeofday(&end, NULL);
+	new_usec = elapsed(&start, &end);
+
+	a = v5_user_info_subst(ctx, "user", &userinfo, &options,
+			       template_value);
+	b = v5_user_info_template_subst(ctx, "user", &userinfo, &options,
+					tmpl);
+	if ((a == NULL) || (b == NULL) || (strcmp(a, b) != 0)) {
+		printf("Results differ!\n");
+		ok = 0;
+	}
+
+	printf("length\t%lu\titerations\t%d\n",
+	       (unsigned long) strlen(template_value), iterations);
+	printf("parse each time\t%ld ns/call\n",
+	       old_usec * 1000 / iterations);
+	printf("parsed once\t%ld ns/call\n",
+	       new_usec * 1000 / iterations);
+
+	free(a);
+	free(b);
+	v5_user_info_template_free(tmpl);
+	free(template_value);
+	krb5_free_context(ctx);
+	return ok ? 0 : 1;
+}